@@ -1,13 +1,22 @@
 ﻿#include "HIERARCHIAL.h"
 #include "shape.h" // Include shape header for derived types in load()
 #include "globals.h"
+#include "mesh.h"
+#include "thread_pool.h"
+#include "static_batch.h"
+#include "simplify.h"
+#include "scene_codec.h"
+#include <chrono>
+#include <cstring>
 #include <fstream>
+#include <random>
 #include <sstream>
 #include <unordered_map>
+#include <unordered_set>
 #include <iostream>
 
 // model_node_t Method Definitions 
-int model_node_t::next_id = 0;   // definition + initializer
+std::atomic<int> model_node_t::next_id{ 0 };   // definition + initializer
 model_node_t::model_node_t(std::shared_ptr<shape_t> s, ShapeType t)
     : id(next_id++), shape(std::move(s)), type(t) {
 }
@@ -18,11 +27,68 @@ void model_node_t::addChild(const std::shared_ptr<model_node_t>& child) {
 }
 
 glm::mat4 model_node_t::getTransform() const {
-    return translation * rotation * scale;
+    // Rotation matrix columns from the (unit) quaternion, each scaled by its axis,
+    // translation in the last column: translation * rotation * scale without a matrix product
+    const glm::quat& q = rotation;
+    float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+    float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+    float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+    return glm::mat4(
+        glm::vec4(1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz), 2.0f * (xz - wy), 0.0f) * scale.x,
+        glm::vec4(2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx), 0.0f) * scale.y,
+        glm::vec4(2.0f * (xz + wy), 2.0f * (yz - wx), 1.0f - 2.0f * (xx + yy), 0.0f) * scale.z,
+        glm::vec4(translation, 1.0f));
 }
 
 //  model_t Method Definitions
 
+namespace {
+
+// Rest of a TRANSLATION/ROTATION/SCALE line. Version 1 files store a full column-major
+// matrix (16 floats) for each, version 2 files store the vec3/quat directly.
+std::vector<float> readFloats(std::istream& in) {
+    std::vector<float> v;
+    float f;
+    while (in >> f) v.push_back(f);
+    return v;
+}
+
+saved_node_t savedNode(const model_node_t& m, int parent_id) {
+    saved_node_t n;
+    n.id = m.id;
+    n.type = m.type;
+    n.parent_id = parent_id;
+    n.color = m.color;
+    n.translation = m.translation;
+    n.rotation = m.rotation;
+    n.scale = m.scale;
+    if (auto mesh = std::dynamic_pointer_cast<mesh_t>(m.shape)) n.meshPath = mesh->path;
+    if (m.shape) n.level = m.shape->getLevel();
+    if (m.shape && m.shape->isErrorBounded()) n.maxError = m.shape->maxError;
+    n.occluder = m.occluder;
+    if (m.prefab) n.prefab = m.prefab->name;
+    return n;
+}
+
+} // namespace
+
+void writeSavedNode(std::ostream& file, const saved_node_t& n) {
+    file << "SHAPE " << n.id << "\n";
+    file << "TYPE " << static_cast<int>(n.type) << "\n";
+    if (n.type == MESH_SHAPE) file << "MESH " << n.meshPath << "\n";
+    if (!n.prefab.empty()) file << "INSTANCE " << n.prefab << "\n";
+    // Files without it load primitives at level 2
+    if (n.type != MESH_SHAPE && n.prefab.empty() && n.level != 2) file << "LEVEL " << n.level << "\n";
+    if (n.maxError > 0.0f) file << "MAX_ERROR " << n.maxError << "\n";
+    // Rotation as x y z w, the same order as animation keys
+    file << "TRANSLATION " << n.translation.x << " " << n.translation.y << " " << n.translation.z << "\n";
+    file << "ROTATION " << n.rotation.x << " " << n.rotation.y << " " << n.rotation.z << " " << n.rotation.w << "\n";
+    file << "SCALE " << n.scale.x << " " << n.scale.y << " " << n.scale.z << "\n";
+    file << "PARENT " << n.parent_id << "\n";
+    file << "COLOR " << n.color.r << " " << n.color.g << " " << n.color.b << " " << n.color.a << "\n";
+    if (n.occluder) file << "OCCLUDER 1\n";
+}
+
 model_t::model_t() {
     // Create a single root node for the scene
     root_node = std::make_shared<model_node_t>(nullptr, SPHERE_SHAPE); 
@@ -39,10 +105,18 @@ std::shared_ptr<model_node_t> model_t::getRoot() {
     return root_node;
 }
 
-const std::vector<std::shared_ptr<model_node_t>>& model_t::getShapes() const { return shapes; }
+const node_list_t& model_t::getShapes() const { return shapes; }
 
 void model_t::addShape(std::unique_ptr<shape_t> shape) {
-    addShapeToParent(currentNode->id, std::move(shape));
+    // The current node if it is in this model, found by walking up to the root rather than by
+    // searching for its id, so building large scenes through here stays linear
+    std::shared_ptr<model_node_t> parent_node = getRoot();
+    for (auto n = currentNode; n; n = n->parent.lock()) {
+        if (n != root_node) continue;
+        parent_node = currentNode;
+        break;
+    }
+    addShapeUnder(*parent_node, std::move(shape));
 }
 
 void model_t::addShapeToParent(int parent_ui_id, std::unique_ptr<shape_t> shape) {
@@ -51,38 +125,125 @@ void model_t::addShapeToParent(int parent_ui_id, std::unique_ptr<shape_t> shape)
         parent_node = getRoot();
         if (!parent_node) return;
     }
+    addShapeUnder(*parent_node, std::move(shape));
+}
 
-    // Convert unique_ptr to shared_ptr and create the node
-    std::shared_ptr<shape_t> shared_shape(std::move(shape));
-    auto new_node = std::make_shared<model_node_t>(shared_shape, shared_shape ? shared_shape->shapetype : SPHERE_SHAPE);
+void model_t::addShapeUnder(model_node_t& parent, std::unique_ptr<shape_t> shape) {
+    auto new_node = attachShape(parent, std::move(shape));
+    std::cout << "Added Shape | ID: " << new_node->id
+          << " | Type: " << shapeTypeToString(new_node->type)
+          << " | Parent ID: " << parent.id << std::endl;
+}
 
-    if (shared_shape && !shared_shape->colors.empty()) {
-        new_node->color = shared_shape->colors[0];
+std::shared_ptr<model_node_t> model_t::attachShape(model_node_t& parent, std::shared_ptr<shape_t> shape) {
+    auto new_node = std::make_shared<model_node_t>(shape, shape ? shape->shapetype : SPHERE_SHAPE);
+
+    if (shape && !shape->colors.empty()) {
+        new_node->color = shape->colors[0];
     }
 
-    parent_node->addChild(new_node);
-    shapes.push_back(new_node);
-    std::cout << "Added Shape | ID: " << new_node->id
-          << " | Type: " << shapeTypeToString(new_node->type)
-          << " | Parent ID: " << parent_node->id << std::endl;
+    attachNode(parent, new_node);
+    return new_node;
+}
 
+void model_t::attachNode(model_node_t& parent, const std::shared_ptr<model_node_t>& node) {
+    parent.addChild(node);
+    shapes.push_back(node);
+    levelsDirty = true;
+    if (!octreeDirty) indexSubtree(*node, modelMatrix(parent));
+    if (editsTracked) edits.push_back({ node->id, node });
+}
+
+std::shared_ptr<model_node_t> model_t::placePrefab(model_node_t& parent, std::shared_ptr<prefab_t> prefab) {
+    auto instance = std::make_shared<model_node_t>();
+    instance->prefab = std::move(prefab);
+    attachNode(parent, instance);
+    return instance;
+}
+
+std::shared_ptr<prefab_t> model_t::findPrefab(const std::string& name) const {
+    for (const auto& p : prefabs) if (p->name == name) return p;
+    return nullptr;
+}
+
+std::shared_ptr<model_node_t> model_t::makePrefab(const std::string& name, model_node_t& node) {
+    auto parent = node.parent.lock();
+    if (!parent || &node == root_node.get()) return nullptr;
+    if (name.empty() || findPrefab(name)) {
+        std::cout << "A prefab named '" << name << "' already exists" << std::endl;
+        return nullptr;
+    }
+    auto keep = node.shared_from_this();
+    auto prefab = std::make_shared<prefab_t>();
+    prefab->name = name;
+    auto instance = placePrefab(*parent, prefab);
+    instance->translation = node.translation;
+    instance->rotation = node.rotation;
+    instance->scale = node.scale;
+    removeNode(node);
+    unfreezeSubtree(node);
+
+    // The root stays shapeless, so a node with a shape goes under a fresh one
+    node.translation = glm::vec3(0.0f);
+    node.rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    node.scale = glm::vec3(1.0f);
+    if (node.shape || node.prefab) {
+        prefab->root = std::make_shared<model_node_t>();
+        prefab->root->addChild(keep);
+    }
+    else {
+        node.parent.reset();
+        prefab->root = keep;
+    }
+    prefab->update();
+    prefabs.push_back(prefab);
+    if (!octreeDirty) indexSubtree(*instance, modelMatrix(*parent));
+    if (editsTracked) editsReset = true;  // definitions only travel in whole snapshots
+    return instance;
+}
+
+void model_t::prefabEdited(prefab_t& prefab) {
+    prefab.update();
+    octreeDirty = true;  // every instance's bounds may have changed
+    if (editsTracked) editsReset = true;
 }
 
 void model_t::removeLastShape() {
     if (shapes.size() <= 1) return; 
+    removeNode(*shapes.back());
+}
 
-    auto last_node = shapes.back();
-    shapes.pop_back();
+void model_t::removeNode(model_node_t& node) {
+    if (&node == root_node.get()) return;
+    auto keep = node.shared_from_this();
+    invalidateBatches(node);
 
-    if (auto parent_node = last_node->parent.lock()) {
+    // Children come after their parents in `shapes`, so a subtree is usually near the end
+    std::vector<model_node_t*> stack{ &node };
+    while (!stack.empty()) {
+        model_node_t* n = stack.back();
+        stack.pop_back();
+        for (const auto& c : n->children) stack.push_back(c.get());
+        for (size_t i = shapes.size(); i-- > 1; ) {
+            if (shapes[i].get() != n) continue;
+            shapes.erase(shapes.begin() + i);
+            break;
+        }
+        octree.remove(n);
+        if (editsTracked) edits.push_back({ n->id, nullptr });
+    }
+
+    if (auto parent_node = node.parent.lock()) {
         auto& children = parent_node->children;
         for (auto it = children.begin(); it != children.end(); ++it) {
-            if ((*it)->id == last_node->id) {
+            if (it->get() == &node) {
                 children.erase(it);
                 break;
             }
         }
     }
+    levelsDirty = true;
+    if (!animation.clips.empty()) animation.bind(shapes);
 }
 
 std::shared_ptr<model_node_t> model_t::getCurrentShape() {
@@ -97,9 +258,13 @@ std::shared_ptr<model_node_t> model_t::getLastNode() {
 
 void model_t::rotateModel(char axis, bool positive) {
     float ang = glm::radians(5.0f) * (positive ? 1.0f : -1.0f);
-    if (axis == 'X') root_node->rotation = glm::rotate(root_node->rotation, ang, glm::vec3(1, 0, 0));
-    else if (axis == 'Y') root_node->rotation = glm::rotate(root_node->rotation, ang, glm::vec3(0, 1, 0));
-    else if (axis == 'Z') root_node->rotation = glm::rotate(root_node->rotation, ang, glm::vec3(0, 0, 1));
+    glm::vec3 axisVec;
+    if (axis == 'X') axisVec = glm::vec3(1, 0, 0);
+    else if (axis == 'Y') axisVec = glm::vec3(0, 1, 0);
+    else if (axis == 'Z') axisVec = glm::vec3(0, 0, 1);
+    else return;
+    root_node->rotation = glm::normalize(root_node->rotation * glm::angleAxis(ang, axisVec));
+    nodeMoved(*root_node);
 }
 
 size_t model_t::getShapeCount() const {
@@ -108,109 +273,622 @@ size_t model_t::getShapeCount() const {
 
 void model_t::clear() {
     shapes.clear();
+    animation.clear();
+    lights.clear();
+    prefabs.clear();
     root_node = std::make_shared<model_node_t>(nullptr, SPHERE_SHAPE);
     root_node->id = next_id++;
     shapes.push_back(root_node);
+    levelsDirty = true;
+    octreeDirty = true;
+    edits.clear();
+    editsReset = true;
+}
+
+void model_t::buildLevels() {
+    levelOrder.clear();
+    levelParent.clear();
+    levelBegin.clear();
+    if (root_node) {
+        levelOrder.push_back(root_node.get());
+        levelParent.push_back(UINT32_MAX);
+    }
+    size_t begin = 0;
+    while (begin < levelOrder.size()) {
+        size_t end = levelOrder.size();
+        levelBegin.push_back(begin);
+        for (size_t i = begin; i < end; ++i) {
+            for (const auto& child : levelOrder[i]->children) {
+                levelOrder.push_back(child.get());
+                levelParent.push_back(uint32_t(i));
+            }
+        }
+        begin = end;
+    }
+    levelBegin.push_back(levelOrder.size());
+    levelsDirty = false;
+}
+
+namespace {
+
+// Box around the node's shape or prefab under `world`, empty at the node's position without either
+void nodeBounds(const model_node_t& node, const glm::mat4& world, glm::vec3& lo, glm::vec3& hi) {
+    glm::vec3 center(world[3]), extent(0.0f);
+    if (node.shape || node.prefab) {
+        glm::vec3 slo, shi;
+        if (node.shape) node.shape->localBounds(slo, shi);
+        else slo = node.prefab->boundsMin, shi = node.prefab->boundsMax;
+        glm::vec3 c = 0.5f * (slo + shi), e = 0.5f * (shi - slo);
+        // Box of the transformed box: centre moves with the matrix, extent by its absolute value
+        center = glm::vec3(world * glm::vec4(c, 1.0f));
+        for (int axis = 0; axis < 3; ++axis)
+            extent += glm::abs(glm::vec3(world[axis])) * e[axis];
+    }
+    lo = center - extent;
+    hi = center + extent;
+}
+
+// World matrix and world-space box of one node; the same arithmetic whichever thread runs it
+void updateNode(model_node_t& node, const glm::mat4& parentWorld) {
+    node.world = parentWorld * node.getTransform();
+    nodeBounds(node, node.world, node.worldMin, node.worldMax);
+}
+
+} // namespace
+
+void prefab_t::update() {
+    if (!root) return;
+    auto forEach = [this](auto fn) {
+        std::vector<model_node_t*> stack{ root.get() };
+        while (!stack.empty()) {
+            model_node_t* n = stack.back();
+            stack.pop_back();
+            fn(*n);
+            for (const auto& c : n->children) stack.push_back(c.get());
+        }
+    };
+    forEach([](model_node_t& n) { n.batch.reset(); });
+    // Instances placed inside the definition have no shape and are drawn on their own
+    root->batch = bakeSubtree(*root, {});
+    std::unordered_set<int> baked;
+    if (root->batch) baked.insert(root->batch->nodeIds.begin(), root->batch->nodeIds.end());
+    forEach([&baked](model_node_t& n) { n.baked = baked.count(n.id) != 0; });
+
+    bool any = false;
+    std::vector<std::pair<const model_node_t*, glm::mat4>> walk{ { root.get(), root->getTransform() } };
+    while (!walk.empty()) {
+        auto [n, m] = walk.back();
+        walk.pop_back();
+        if (n->shape || n->prefab) {
+            glm::vec3 lo, hi;
+            nodeBounds(*n, m, lo, hi);
+            boundsMin = any ? glm::min(boundsMin, lo) : lo;
+            boundsMax = any ? glm::max(boundsMax, hi) : hi;
+            any = true;
+        }
+        for (const auto& c : n->children) walk.emplace_back(c.get(), m * c->getTransform());
+    }
+    if (!any) boundsMin = boundsMax = glm::vec3(0.0f);
+}
+
+void model_t::updateWorldTransforms(const glm::mat4& rootTransform, thread_pool_t* pool) {
+    if (levelsDirty) buildLevels();
+    if (levelOrder.empty()) return;
+    updateNode(*levelOrder[0], rootTransform);
+
+    for (size_t d = 1; d + 1 < levelBegin.size(); ++d) {
+        size_t first = levelBegin[d], count = levelBegin[d + 1] - first;
+        auto run = [&](size_t lo, size_t hi) {
+            for (size_t i = first + lo; i < first + hi; ++i)
+                updateNode(*levelOrder[i], levelOrder[levelParent[i]]->world);
+        };
+        // A level only depends on the one above it, so its nodes can go in any order
+        if (pool && count >= parallelThreshold) pool->parallelFor(count, 1024, run);
+        else run(0, count);
+    }
+}
+
+void model_t::collectNodes(std::shared_ptr<model_node_t> node, std::vector<std::shared_ptr<model_node_t>>& nodeList) {
+    nodeList.push_back(node);
+    for (const auto& child : node->children) collectNodes(child, nodeList);
+}
+
+void model_t::getAllNodes(std::vector<std::shared_ptr<model_node_t>>& nodeList) {
+    nodeList.clear();
+    if (root_node) collectNodes(root_node, nodeList);
+}
+
+glm::mat4 model_t::modelMatrix(const model_node_t& node) const {
+    std::vector<const model_node_t*> path;
+    for (const model_node_t* n = &node; n; ) {
+        path.push_back(n);
+        auto parent = n->parent.lock();
+        n = parent.get();
+    }
+    glm::mat4 m(1.0f);
+    for (auto it = path.rbegin(); it != path.rend(); ++it) m = m * (*it)->getTransform();
+    return m;
+}
+
+void model_t::indexSubtree(model_node_t& node, const glm::mat4& parentModel) {
+    glm::mat4 m = parentModel * node.getTransform();
+    if (&node != root_node.get()) {
+        glm::vec3 lo, hi;
+        nodeBounds(node, m, lo, hi);
+        octree.update(&node, lo, hi);
+    }
+    for (const auto& child : node.children) indexSubtree(*child, m);
+}
+
+void model_t::rebuildOctree() {
+    // Bounds first, to size the root cube
+    struct placed_t { model_node_t* node; glm::vec3 lo, hi; };
+    std::vector<placed_t> placed;
+    std::vector<std::pair<model_node_t*, glm::mat4>> stack{ { root_node.get(), glm::mat4(1.0f) } };
+    while (!stack.empty()) {
+        auto [node, parentModel] = stack.back();
+        stack.pop_back();
+        glm::mat4 m = parentModel * node->getTransform();
+        if (node != root_node.get()) {
+            placed_t p{ node, glm::vec3(0.0f), glm::vec3(0.0f) };
+            nodeBounds(*node, m, p.lo, p.hi);
+            placed.push_back(p);
+        }
+        for (const auto& child : node->children) stack.emplace_back(child.get(), m);
+    }
+    glm::vec3 lo(0.0f), hi(0.0f);
+    if (!placed.empty()) {
+        lo = placed[0].lo;
+        hi = placed[0].hi;
+    }
+    for (const placed_t& p : placed) {
+        lo = glm::min(lo, p.lo);
+        hi = glm::max(hi, p.hi);
+    }
+    octree.reset(lo, hi);
+    for (const placed_t& p : placed) octree.update(p.node, p.lo, p.hi);
+    octreeDirty = false;
+}
+
+void model_t::nodeMoved(model_node_t& node) {
+    if (editsTracked) edits.push_back({ node.id, node.shared_from_this() });
+    if (octreeDirty) return;  // rebuilt on the next query anyway
+    auto parent = node.parent.lock();
+    indexSubtree(node, parent ? modelMatrix(*parent) : glm::mat4(1.0f));
+    // Nodes that left the root cube are scanned by every query; past a point, start over
+    if (octree.needsRebuild()) octreeDirty = true;
+}
+
+void model_t::queryBox(const glm::vec3& lo, const glm::vec3& hi, std::vector<model_node_t*>& out) {
+    if (octreeDirty) rebuildOctree();
+    octree.queryBox(lo, hi, out);
+}
+
+void model_t::querySphere(const glm::vec3& center, float radius, std::vector<model_node_t*>& out) {
+    if (octreeDirty) rebuildOctree();
+    octree.querySphere(center, radius, out);
+}
+
+void model_t::queryNearest(const glm::vec3& point, size_t k, std::vector<model_node_t*>& out) {
+    if (octreeDirty) rebuildOctree();
+    octree.queryNearest(point, k, out);
+}
+
+void model_t::updateAnimation(float dt) {
+    animation.update(dt);
+    if (!animation.playing) return;
+    // Channels of one node are next to each other
+    model_node_t* previous = nullptr;
+    for (model_node_t* n : animation.boundNodes()) {
+        if (n && n != previous) nodeMoved(*n);
+        previous = n;
+    }
+}
+
+void model_t::trackEdits(bool on) {
+    editsTracked = on;
+    edits.clear();
+    editsReset = false;
+}
+
+void model_t::nodeEdited(model_node_t& node) {
+    if (editsTracked) edits.push_back({ node.id, node.shared_from_this() });
+}
+
+bool model_t::takeEdits(std::vector<node_edit_t>& out) {
+    out.clear();
+    out.swap(edits);
+    bool reset = editsReset;
+    editsReset = false;
+    return reset;
+}
+
+bool model_t::freezeSubtree(int id) {
+    std::shared_ptr<model_node_t> node = findMNodeById(id);
+    if (!node || node->baked) return false;
+
+    std::unordered_set<int> dynamicIds;
+    for (const auto& c : animation.clips)
+        dynamicIds.insert(c.nodeIds.begin(), c.nodeIds.end());
+
+    unfreezeSubtree(*node);
+    node->batch = bakeSubtree(*node, dynamicIds);
+    if (!node->batch) return false;
+    for (int bakedId : node->batch->nodeIds)
+        if (auto n = findMNodeById(bakedId)) n->baked = true;
+    buildLodChains({ node->batch.get() }, nullptr);
+    return true;
+}
+
+void model_t::generateLods() {
+    std::vector<shape_t*> candidates;
+    for (const auto& n : shapes) {
+        if (n->shape && n->shape->getType() == MESH_SHAPE) candidates.push_back(n->shape.get());
+        if (n->batch) candidates.push_back(n->batch.get());
+    }
+    for (const auto& p : prefabs)
+        if (p->root->batch) candidates.push_back(p->root->batch.get());
+    buildLodChains(candidates, &sharedThreadPool());
+}
+
+void model_t::unfreezeSubtree(model_node_t& node) {
+    std::vector<model_node_t*> stack{ &node };
+    while (!stack.empty()) {
+        model_node_t* n = stack.back();
+        stack.pop_back();
+        n->batch.reset();
+        n->baked = false;
+        for (const auto& c : n->children) stack.push_back(c.get());
+    }
+}
+
+void model_t::invalidateBatches(model_node_t& node) {
+    bool anyBaked = false;
+    std::vector<model_node_t*> stack{ &node };
+    while (!stack.empty() && !anyBaked) {
+        model_node_t* n = stack.back();
+        stack.pop_back();
+        anyBaked = n->baked;
+        for (const auto& c : n->children) stack.push_back(c.get());
+    }
+    if (!anyBaked) return;
+
+    for (std::shared_ptr<model_node_t> a = node.shared_from_this(); a; a = a->parent.lock()) {
+        if (a->batch) {
+            unfreezeSubtree(*a);
+            std::cout << "Unfroze node " << a->id << " (edited inside)" << std::endl;
+        }
+    }
 }
 
 //save model
-void model_t::save(const std::string& filename) {
-    std::ofstream file(filename);
+void model_t::save(const std::string& filename, const save_options_t& options) {
+    std::ofstream file(filename, options.compressed ? std::ios::binary : std::ios::out);
     if (!file.is_open()) {
         std::cout << "Failed to save model to " << filename << std::endl;
         return;
     }
-    file << "MODEL_FILE_VERSION 1.0\n";
+    // Prefabs, lights, batches and animation: text in both encodings
+    std::ostringstream tail;
+    // A prefab's nodes are saved like the model's, parents first, with -1 for its root
+    for (const auto& p : prefabs) {
+        tail << "PREFAB " << p->name << "\n";
+        std::vector<std::pair<const model_node_t*, int>> stack;
+        for (auto it = p->root->children.rbegin(); it != p->root->children.rend(); ++it) stack.emplace_back(it->get(), -1);
+        while (!stack.empty()) {
+            auto [n, parent_id] = stack.back();
+            stack.pop_back();
+            writeSavedNode(tail, savedNode(*n, parent_id));
+            for (auto it = n->children.rbegin(); it != n->children.rend(); ++it) stack.emplace_back(it->get(), n->id);
+        }
+        tail << "END_PREFAB\n";
+    }
+    for (const auto& l : lights) {
+        tail << "LIGHT " << l.position.x << " " << l.position.y << " " << l.position.z << " "
+             << l.color.r << " " << l.color.g << " " << l.color.b << " " << l.radius << "\n";
+    }
+    // The root is recreated with a fresh id on load, so its batch is saved under -1
+    for (const auto& m : shapes) {
+        if (!m->batch) continue;
+        m->batch->ensureGeometry();  // read back if it was dropped after upload
+        saveBatch(tail, m == root_node ? -1 : m->id, *m->batch);
+    }
+    animation.save(tail);
+
+    if (options.compressed) {
+        std::vector<saved_node_t> nodes;
+        nodes.reserve(shapes.size());
+        for (size_t i = 1; i < shapes.size(); ++i) {
+            auto p = shapes[i]->parent.lock();
+            nodes.push_back(savedNode(*shapes[i], p && p != root_node ? p->id : -1));
+        }
+        writeCompressedScene(file, nodes, tail.str(), options.tolerance);
+        file.close();
+        std::cout << "Model saved to " << filename << " (compressed, tolerance " << options.tolerance << ")" << std::endl;
+        return;
+    }
+
+    file << "MODEL_FILE_VERSION 2.0\n";
     file << "SHAPE_COUNT " << getShapeCount() << "\n";
     for (size_t i = 1; i < shapes.size(); ++i) {
-        const auto& m = shapes[i];
-        file << "SHAPE " << m->id << "\n";
-        file << "TYPE " << static_cast<int>(m->type) << "\n";
-        file << "TRANSLATION ";
-        const float* tptr = glm::value_ptr(m->translation);
-        for (int k = 0; k < 16; ++k) file << tptr[k] << " ";
-        file << "\n";
-        file << "ROTATION ";
-        const float* rptr = glm::value_ptr(m->rotation);
-        for (int k = 0; k < 16; ++k) file << rptr[k] << " ";
-        file << "\n";
-        file << "SCALE ";
-        const float* sptr = glm::value_ptr(m->scale);
-        for (int k = 0; k < 16; ++k) file << sptr[k] << " ";
-        file << "\n";
-        int parent_id = -1;
-        if (auto p = m->parent.lock()) parent_id = p->id;
-        file << "PARENT " << parent_id << "\n";
-        file << "COLOR " << m->color.r << " " << m->color.g << " " << m->color.b << " " << m->color.a << "\n";
+        auto p = shapes[i]->parent.lock();
+        writeSavedNode(file, savedNode(*shapes[i], p && p != root_node ? p->id : -1));
     }
+    file << tail.str();
     file.close();
     std::cout << "Model saved to " << filename << std::endl;
 }
 
 //load model
 bool model_t::load(const std::string& filename) {
-    std::ifstream file(filename);
+    std::ifstream file(filename, std::ios::binary);
     if (!file.is_open()) {
         std::cout << "Failed to load model from " << filename << std::endl;
         return false;
     }
 
-    struct Entry {
-        int id; ShapeType type; glm::mat4 translation, rotation, scale; int parent_id; glm::vec4 color;
-    };
-    std::vector<Entry> entries;
+    std::vector<saved_node_t> entries;
+    std::vector<std::pair<std::string, std::vector<saved_node_t>>> parsedPrefabs;
+    std::vector<saved_node_t>* target = &entries;  // where SHAPE blocks go: a prefab's, between PREFAB and END_PREFAB
+    animation_t parsedAnimation;
+    std::vector<std::pair<int, std::shared_ptr<static_batch_t>>> batches;
+    std::vector<light_t> parsedLights;
+    // Compressed files keep their lights, batches and animation as text after the nodes
+    std::istringstream tail;
+    bool compressed = isCompressedScene(file);
+    if (compressed) {
+        std::string text;
+        if (!readCompressedScene(file, entries, text)) {
+            std::cout << "Failed to load model from " << filename << " (corrupt compressed file)" << std::endl;
+            return false;
+        }
+        tail.str(text);
+    }
+    else {
+        // Reopened as text, for line endings
+        file.close();
+        file.open(filename);
+    }
+    std::istream& in = compressed ? static_cast<std::istream&>(tail) : file;
     std::string line;
-    while (std::getline(file, line)) {
+    while (std::getline(in, line)) {
         std::istringstream iss(line);
         std::string token;
         iss >> token;
         if (token == "SHAPE") {
-            Entry e{};
+            saved_node_t e{};
             iss >> e.id;
             std::streampos lastPos;
             while (true) {
-                lastPos = file.tellg();
-                if (!std::getline(file, line)) break;
+                lastPos = in.tellg();
+                if (!std::getline(in, line)) break;
                 std::istringstream ps(line);
                 std::string prop; ps >> prop;
                 if (prop == "TYPE") { int t; ps >> t; e.type = static_cast<ShapeType>(t); }
-                else if (prop == "TRANSLATION") { float* ptr = glm::value_ptr(e.translation); for (int k = 0; k < 16; ++k) ps >> ptr[k]; }
-                else if (prop == "ROTATION") { float* ptr = glm::value_ptr(e.rotation); for (int k = 0; k < 16; ++k) ps >> ptr[k]; }
-                else if (prop == "SCALE") { float* ptr = glm::value_ptr(e.scale); for (int k = 0; k < 16; ++k) ps >> ptr[k]; }
+                else if (prop == "TRANSLATION") {
+                    std::vector<float> v = readFloats(ps);
+                    if (v.size() == 16) e.translation = glm::vec3(v[12], v[13], v[14]);
+                    else if (v.size() >= 3) e.translation = glm::vec3(v[0], v[1], v[2]);
+                }
+                else if (prop == "ROTATION") {
+                    std::vector<float> v = readFloats(ps);
+                    if (v.size() == 16) e.rotation = glm::quat_cast(glm::mat3(glm::make_mat4(v.data())));
+                    else if (v.size() >= 4) e.rotation = glm::quat(v[3], v[0], v[1], v[2]);
+                }
+                else if (prop == "SCALE") {
+                    std::vector<float> v = readFloats(ps);
+                    if (v.size() == 16) e.scale = glm::vec3(v[0], v[5], v[10]);
+                    else if (v.size() >= 3) e.scale = glm::vec3(v[0], v[1], v[2]);
+                }
+                else if (prop == "MESH") { std::getline(ps >> std::ws, e.meshPath); }
+                else if (prop == "INSTANCE") { std::getline(ps >> std::ws, e.prefab); }
+                else if (prop == "LEVEL") { ps >> e.level; }
+                else if (prop == "MAX_ERROR") { ps >> e.maxError; }
                 else if (prop == "PARENT") { ps >> e.parent_id; }
                 else if (prop == "COLOR") { ps >> e.color.r >> e.color.g >> e.color.b >> e.color.a; }
-                else { file.seekg(lastPos); break; }
+                else if (prop == "OCCLUDER") { ps >> e.occluder; }
+                else { in.seekg(lastPos); break; }
             }
-            entries.push_back(e);
+            target->push_back(e);
+        }
+        else if (token == "PREFAB") {
+            std::string name;
+            std::getline(iss >> std::ws, name);
+            parsedPrefabs.emplace_back(name, std::vector<saved_node_t>());
+            target = &parsedPrefabs.back().second;
         }
+        else if (token == "END_PREFAB") {
+            target = &entries;
+        }
+        else if (token == "LIGHT") {
+            light_t l;
+            iss >> l.position.x >> l.position.y >> l.position.z >> l.color.r >> l.color.g >> l.color.b >> l.radius;
+            parsedLights.push_back(l);
+        }
+        else if (token == "BATCH") {
+            int nodeId = -1;
+            if (auto b = loadBatch(iss, in, nodeId)) batches.emplace_back(nodeId, b);
+            else std::cout << "Skipping malformed batch; freeze again to rebuild it" << std::endl;
+        }
+        else parsedAnimation.parseLine(token, iss);
     }
 
+    // Nodes keep their saved ids; the new root and anything added later get ids above them
+    for (const auto& e : entries) model_node_t::reserveId(e.id);
+    for (const auto& parsed : parsedPrefabs)
+        for (const auto& e : parsed.second) model_node_t::reserveId(e.id);
     clear();
-    std::unordered_map<int, std::shared_ptr<model_node_t>> id_to_node;
-    id_to_node[getRoot()->id] = getRoot();
-
-    for (const auto& e : entries) {
-        std::unique_ptr<shape_t> s;
-        switch (e.type) {
-        case SPHERE_SHAPE: s = std::make_unique<sphere_t>(2); break;
-        case CYLINDER_SHAPE: s = std::make_unique<cylinder_t>(2); break;
-        case BOX_SHAPE: s = std::make_unique<box_t>(2); break;
-        case CONE_SHAPE: s = std::make_unique<cone_t>(2); break;
+    // Instances get the prefab they name, loaded before them; every other node a fresh shape
+    auto makeNode = [this](const saved_node_t& e) {
+        std::shared_ptr<shape_t> s;
+        std::shared_ptr<prefab_t> prefab;
+        if (!e.prefab.empty()) {
+            prefab = findPrefab(e.prefab);
+            if (!prefab) std::cout << "Unknown prefab '" << e.prefab << "'; placing an empty node" << std::endl;
         }
+        else if (e.type == MESH_SHAPE) s = std::make_shared<mesh_t>(e.meshPath);
+        else s = createPrimitive(e.type, e.level);
+        if (s) {
+            if (e.maxError > 0.0f) s->maxError = e.maxError;
+            // Geometry first, otherwise the first draw regenerates it and resets the color
+            s->generateGeometry();
+            s->setColor(e.color);
+        }
+        auto node = std::make_shared<model_node_t>(s, e.type);
+        node->prefab = std::move(prefab);
+        node->color = e.color;
+        node->id = e.id;
+        node->translation = e.translation;
+        node->rotation = glm::normalize(e.rotation);
+        node->scale = e.scale;
+        node->occluder = e.occluder;
+        return node;
+    };
 
-        addShapeToParent(e.parent_id, std::move(s));
-
-        auto new_node = getLastNode();
-        if (new_node->shape) {
-            new_node->shape->setColor(e.color);
+    for (const auto& [name, defEntries] : parsedPrefabs) {
+        auto prefab = std::make_shared<prefab_t>();
+        prefab->name = name;
+        prefab->root = std::make_shared<model_node_t>();
+        std::unordered_map<int, model_node_t*> defNodes{ { -1, prefab->root.get() } };
+        for (const auto& e : defEntries) {
+            auto node = makeNode(e);
+            auto parent = defNodes.find(e.parent_id);
+            (parent != defNodes.end() ? parent->second : prefab->root.get())->addChild(node);
+            defNodes[node->id] = node.get();
         }
-        new_node->id = e.id;
-        new_node->translation = e.translation;
-        new_node->rotation = e.rotation;
-        new_node->scale = e.scale;
+        prefab->update();
+        prefabs.push_back(prefab);
+    }
+
+    std::unordered_map<int, std::shared_ptr<model_node_t>> id_to_node;
+    id_to_node[-1] = getRoot();
+    for (const auto& e : entries) {
+        // Parents are saved before their children; anything else goes under the root
+        auto parent = id_to_node.find(e.parent_id);
+        auto new_node = makeNode(e);
+        attachNode(parent != id_to_node.end() ? *parent->second : *getRoot(), new_node);
         id_to_node[new_node->id] = new_node;
     }
+    for (auto& [nodeId, batch] : batches) {
+        auto it = id_to_node.find(nodeId);
+        bool complete = it != id_to_node.end();
+        for (int bakedId : batch->nodeIds) complete = complete && id_to_node.count(bakedId);
+        if (!complete) continue;
+        it->second->batch = batch;
+        for (int bakedId : batch->nodeIds) id_to_node[bakedId]->baked = true;
+    }
+    lights = std::move(parsedLights);
+    animation = std::move(parsedAnimation);
+    animation.bind(shapes);
     file.close();
+    generateLods();
     std::cout << "Model loaded from " << filename << std::endl;
     return true;
 }
+
+void benchmarkTransforms(size_t nodeCount, int iterations) {
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    std::vector<model_node_t> nodes(nodeCount);
+    // The previous representation: one matrix each for translation, rotation and scale
+    std::vector<glm::mat4> legacy(nodeCount * 3);
+    for (size_t i = 0; i < nodeCount; ++i) {
+        model_node_t& n = nodes[i];
+        n.translation = glm::vec3(dist(rng), dist(rng), dist(rng)) * 10.0f;
+        n.rotation = glm::normalize(glm::quat(dist(rng), dist(rng), dist(rng), dist(rng)));
+        n.scale = glm::vec3(1.0f + 0.5f * dist(rng));
+        legacy[i * 3 + 0] = glm::translate(glm::mat4(1.0f), n.translation);
+        legacy[i * 3 + 1] = glm::mat4_cast(n.rotation);
+        legacy[i * 3 + 2] = glm::scale(glm::mat4(1.0f), n.scale);
+    }
+
+    std::vector<glm::mat4> out(nodeCount);
+    double seconds[2] = {};
+    float checksum = 0.0f;
+    for (int pass = 0; pass < 2; ++pass) {
+        auto start = std::chrono::steady_clock::now();
+        for (int it = 0; it < iterations; ++it) {
+            if (pass == 0)
+                for (size_t i = 0; i < nodeCount; ++i) out[i] = nodes[i].getTransform();
+            else
+                for (size_t i = 0; i < nodeCount; ++i) out[i] = legacy[i * 3] * legacy[i * 3 + 1] * legacy[i * 3 + 2];
+            checksum += out[it % nodeCount][3][0];
+        }
+        seconds[pass] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    size_t trsBytes = sizeof(glm::vec3) * 2 + sizeof(glm::quat);
+    std::cout << "Transform per node: " << trsBytes << " bytes TRS vs " << 3 * sizeof(glm::mat4)
+              << " bytes as three matrices (model_node_t is " << sizeof(model_node_t) << " bytes)" << std::endl;
+    std::cout << "Compose " << nodeCount << " local matrices: TRS " << seconds[0] * 1.0e3 / iterations
+              << " ms, three matrices " << seconds[1] * 1.0e3 / iterations << " ms"
+              << (checksum == checksum ? "" : " (nan)") << std::endl;
+}
+
+void benchmarkWorldTransforms(size_t nodeCount, unsigned int maxThreads, int frames) {
+    // Shallow and wide, like CAD exports: root -> groups -> a few thousand parts each
+    model_t model;
+    std::shared_ptr<shape_t> part(createPrimitive(BOX_SHAPE, 1));
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    auto randomize = [&](model_node_t& n) {
+        n.translation = glm::vec3(dist(rng), dist(rng), dist(rng)) * 20.0f;
+        n.rotation = glm::normalize(glm::quat(dist(rng), dist(rng), dist(rng), dist(rng)));
+        n.scale = glm::vec3(1.0f + 0.5f * dist(rng));
+    };
+    size_t groups = std::max<size_t>(1, nodeCount / 4096);
+    size_t perGroup = std::max<size_t>(1, nodeCount / groups) - 1;
+    size_t total = 1;
+    for (size_t g = 0; g < groups; ++g) {
+        auto group = std::make_shared<model_node_t>();
+        randomize(*group);
+        model.root_node->addChild(group);
+        for (size_t i = 0; i < perGroup; ++i) {
+            auto node = std::make_shared<model_node_t>(part, BOX_SHAPE);
+            randomize(*node);
+            group->addChild(node);
+        }
+        total += 1 + perGroup;
+    }
+
+    std::vector<model_node_t*> nodes;
+    std::vector<std::shared_ptr<model_node_t>> stack{ model.root_node };
+    while (!stack.empty()) {
+        auto n = stack.back();
+        stack.pop_back();
+        nodes.push_back(n.get());
+        for (const auto& c : n->children) stack.push_back(c);
+    }
+
+    // Serial reference: world matrix and bounds of every node
+    const glm::mat4 rootTransform = glm::rotate(glm::mat4(1.0f), 0.3f, glm::vec3(0, 1, 0));
+    const size_t stride = sizeof(glm::mat4) + 2 * sizeof(glm::vec3);
+    auto snapshot = [&](std::vector<unsigned char>& out) {
+        out.resize(nodes.size() * stride);
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            unsigned char* p = out.data() + i * stride;
+            std::memcpy(p, glm::value_ptr(nodes[i]->world), sizeof(glm::mat4));
+            std::memcpy(p + sizeof(glm::mat4), glm::value_ptr(nodes[i]->worldMin), sizeof(glm::vec3));
+            std::memcpy(p + sizeof(glm::mat4) + sizeof(glm::vec3), glm::value_ptr(nodes[i]->worldMax), sizeof(glm::vec3));
+        }
+    };
+    model.updateWorldTransforms(rootTransform);
+    std::vector<unsigned char> reference, result;
+    snapshot(reference);
+
+    std::cout << "World transforms: " << total << " nodes, " << groups << " groups ("
+              << frames << " updates per run)" << std::endl;
+    double serialMs = 0.0;
+    for (unsigned int threads = 1; threads <= maxThreads; threads *= 2) {
+        thread_pool_t pool(threads);
+        for (auto* n : nodes) n->world = glm::mat4(0.0f);
+        auto start = std::chrono::steady_clock::now();
+        for (int f = 0; f < frames; ++f) model.updateWorldTransforms(rootTransform, &pool);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+        if (threads == 1) serialMs = ms;
+        snapshot(result);
+        std::cout << "  threads " << threads << ": " << ms << " ms, speedup "
+                  << (ms > 0.0 ? serialMs / ms : 0.0) << "x"
+                  << (result == reference ? "" : " (MISMATCH with serial)") << std::endl;
+    }
+}
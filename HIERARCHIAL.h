@@ -4,72 +4,223 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/quaternion.hpp>
 #include <GL/glew.h>
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <vector>
 #include <string>
 #include "shape.h"
+#include "animation.h"
+#include "clustered_lights.h"
+#include "octree.h"
+
+class thread_pool_t;
+class static_batch_t;
+struct prefab_t;
 
 // Shader program 
 extern GLuint shaderProgram;
 
 // The single, unified node class for the scene hierarchy
 struct model_node_t : public std::enable_shared_from_this<model_node_t> {
-     static int next_id ;
+     static std::atomic<int> next_id;  // nodes may be created on a loading thread
     int id;
+    // For a node given an id from a file or a peer: ids handed out from now on stay above it,
+    // so no later node shares it
+    static void reserveId(int taken) {
+        int next = next_id.load();
+        while (next <= taken && !next_id.compare_exchange_weak(next, taken + 1)) {}
+    }
     std::shared_ptr<shape_t> shape; // Owns the shape data
     ShapeType type;
 
-    // Transformations
-    glm::mat4 translation{ 1.0f };
-    glm::mat4 rotation{ 1.0f };
-    glm::mat4 scale{ 1.0f };
+    // Transformations, composed as translation * rotation * scale by getTransform()
+    glm::vec3 translation{ 0.0f };
+    glm::quat rotation{ 1.0f, 0.0f, 0.0f, 0.0f };
+    glm::vec3 scale{ 1.0f };
 
     // Hierarchy
     std::weak_ptr<model_node_t> parent;
-    std::vector<std::shared_ptr<model_node_t>> children;
+    node_list_t children;
 
     // Properties
     glm::vec4 color{ 1.0f };
 
+    // Written by model_t::updateWorldTransforms(): parent world * getTransform(), and the
+    // shape's bounds in world space (empty at the world position for nodes without a shape)
+    glm::mat4 world{ 1.0f };
+    glm::vec3 worldMin{ 0.0f }, worldMax{ 0.0f };
+
+    // Static batching: a frozen node draws `batch` (its subtree merged, see static_batch.h);
+    // `baked` nodes are drawn through such a batch instead of on their own
+    std::shared_ptr<static_batch_t> batch;
+    bool baked = false;
+
+    // Box nodes marked here always occlude others in software occlusion culling (occlusion.h);
+    // unmarked boxes only do when they are large on screen
+    bool occluder = false;
+
+    // Prefab instance: draws the prefab's subtree under this node's transform (see prefab_t);
+    // instances have no shape of their own
+    std::shared_ptr<prefab_t> prefab;
+
+    tracked_object_t<MEM_SCENE_GRAPH, model_node_t> tracked;  // counts the node itself
+
     model_node_t(std::shared_ptr<shape_t> s = nullptr, ShapeType t = SPHERE_SHAPE);
     void addChild(const std::shared_ptr<model_node_t>& child);
     glm::mat4 getTransform() const;
 };
 
+// A subtree defined once and placed by reference any number of times (model_node_t::prefab).
+// `root` has no shape, is never in the scene and keeps the identity transform; its descendants
+// are drawn under each instance, so an edit to them shows in every instance at once. The
+// definition is baked into one batch, making each instance a single draw.
+struct prefab_t {
+    std::string name;
+    std::shared_ptr<model_node_t> root;
+    glm::vec3 boundsMin{ 0.0f }, boundsMax{ 0.0f };  // of the whole definition, in root space
+
+    // Rebakes the batch and recomputes the bounds; see model_t::prefabEdited()
+    void update();
+};
+
+// One entry of model_t's edit journal: the node that was added or changed, null once removed
+struct node_edit_t {
+    int id;
+    std::shared_ptr<model_node_t> node;
+};
+
+// How model_t::save() writes the file; load() reads either encoding
+struct save_options_t {
+    bool compressed = false;  // quantized binary encoding, see scene_codec.h
+    float tolerance = 1e-4f;  // compressed: largest error of any translation, rotation, scale or color component
+};
+
 // Main model class containing the scene hierarchy
 class model_t {
 private:
-    std::vector<std::shared_ptr<model_node_t>> shapes; 
+    node_list_t shapes; 
     int next_id = 0;
 
+    // Nodes in breadth-first order, so every level is a contiguous range [levelBegin[d], levelBegin[d + 1])
+    // and parents always come before their children; rebuilt when the hierarchy changes
+    std::vector<model_node_t*> levelOrder;
+    std::vector<uint32_t> levelParent;  // index into levelOrder, UINT32_MAX for the root
+    std::vector<size_t> levelBegin;
+    bool levelsDirty = true;
+    void buildLevels();
+
+    void attachNode(model_node_t& parent, const std::shared_ptr<model_node_t>& node);
+    void addShapeUnder(model_node_t& parent, std::unique_ptr<shape_t> shape);
     void collectNodes(std::shared_ptr<model_node_t> node, std::vector<std::shared_ptr<model_node_t>>& nodeList);
 
+    // Node bounds in model space for the spatial queries; rebuilt from scratch when dirty,
+    // otherwise kept current by the edits that move, add or remove nodes
+    loose_octree_t octree;
+    bool octreeDirty = true;
+    void rebuildOctree();
+    void indexSubtree(model_node_t& node, const glm::mat4& parentModel);
+    glm::mat4 modelMatrix(const model_node_t& node) const;  // root's transform down to the node's
+
+    // Edit journal for scene sync, see trackEdits()
+    bool editsTracked = false;
+    bool editsReset = false;
+    std::vector<node_edit_t> edits;
+
 public:
     std::shared_ptr<model_node_t> findMNodeById(int id);
     std::shared_ptr<model_node_t> root_node; 
+    animation_t animation;  // keyframe clips for this model's nodes, saved with it
+    std::vector<light_t> lights;  // point lights on top of the global light, saved with the model
+    // Prefab definitions, saved with the model; one may place instances of those before it
+    std::vector<std::shared_ptr<prefab_t>> prefabs;
     model_t();
     std::shared_ptr<model_node_t> getRoot();
-    const std::vector<std::shared_ptr<model_node_t>>& getShapes() const;
+    const node_list_t& getShapes() const;
     void addShape(std::unique_ptr<shape_t> shape);
     void addShapeToParent(int parent_ui_id, std::unique_ptr<shape_t> shape);
+    // addShapeToParent() without the id lookup or the console line, for bulk building
+    std::shared_ptr<model_node_t> attachShape(model_node_t& parent, std::shared_ptr<shape_t> shape);
+    // Turns the node and its subtree into a new prefab and puts an instance with the node's
+    // transform in its place. Returns the instance; null if the name is taken or the node is
+    // the root.
+    std::shared_ptr<model_node_t> makePrefab(const std::string& name, model_node_t& node);
+    // Adds an instance of `prefab` under `parent`, at the parent's origin
+    std::shared_ptr<model_node_t> placePrefab(model_node_t& parent, std::shared_ptr<prefab_t> prefab);
+    std::shared_ptr<prefab_t> findPrefab(const std::string& name) const;
+    // Call after changing a prefab's definition: rebakes it and re-indexes its instances.
+    // Prefabs that place this one in their own definition keep their old bounds until they are
+    // updated too.
+    void prefabEdited(prefab_t& prefab);
     void removeLastShape();
+    // Removes the node and its subtree; the root stays
+    void removeNode(model_node_t& node);
     std::shared_ptr<model_node_t> getCurrentShape();
     std::shared_ptr<model_node_t> getLastNode();
     void rotateModel(char axis, bool positive);
     void render(); 
     size_t getShapeCount() const;
     void clear();
-    void save(const std::string& filename);
+    void save(const std::string& filename, const save_options_t& options = save_options_t());
     bool load(const std::string& filename);
     void getAllNodes(std::vector<std::shared_ptr<model_node_t>>& nodeList);
+
+    // Recomputes every node's world matrix and world bounds, one depth level at a time.
+    // Levels of at least parallelThreshold nodes are split across `pool` (when given);
+    // the results are the same as a serial traversal, bit for bit.
+    void updateWorldTransforms(const glm::mat4& rootTransform, thread_pool_t* pool = nullptr);
+    static const size_t parallelThreshold = 8192;
+
+    // Bakes the node and its descendants into one merged draw. Animated nodes and their
+    // subtrees stay separate. False if there is nothing to bake or the node is already baked.
+    bool freezeSubtree(int id);
+    void unfreezeSubtree(model_node_t& node);
+    // Call before editing `node`: drops every batch that has the node or a descendant baked in
+    void invalidateBatches(model_node_t& node);
+
+    // Spatial queries over node bounds in model space (the root's own transform included, the
+    // view rotation passed to updateWorldTransforms() not). Every node but the root is indexed;
+    // nodes without a shape are points.
+    void queryBox(const glm::vec3& lo, const glm::vec3& hi, std::vector<model_node_t*>& out);
+    void querySphere(const glm::vec3& center, float radius, std::vector<model_node_t*>& out);
+    void queryNearest(const glm::vec3& point, size_t k, std::vector<model_node_t*>& out);
+    // Call after changing a node's translation, rotation or scale: re-indexes it and its subtree
+    void nodeMoved(model_node_t& node);
+    // Call after changing nodes without going through the model; the next query rebuilds the index
+    void invalidateSpatialIndex() { octreeDirty = true; }
+    // animation.update(), re-indexing the nodes it moved
+    void updateAnimation(float dt);
+
+    // Edit journal for scene sync (scene_sync.h). While tracked, adding and removing nodes,
+    // nodeMoved() and nodeEdited() record the node; clear(), load(), makePrefab() and
+    // prefabEdited() record a reset instead.
+    void trackEdits(bool on);
+    // Call after changing a node's color, tessellation or occluder flag
+    void nodeEdited(model_node_t& node);
+    // Moves the journal into `out`; true if the whole model was replaced since the last call
+    bool takeEdits(std::vector<node_edit_t>& out);
+
+    // Builds LOD chains (simplify.h) for imported meshes and batches that are large enough and
+    // do not have one yet, in parallel across shapes
+    void generateLods();
 };
+// Prints per-node transform memory and the cost of composing local matrices from TRS
+// against the previous three-matrix product
+void benchmarkTransforms(size_t nodes, int iterations);
+
+// Times updateWorldTransforms() on a wide synthetic hierarchy of `nodes` nodes with 1, 2, 4, ...
+// maxThreads threads and checks every run against the serial result
+void benchmarkWorldTransforms(size_t nodes, unsigned int maxThreads, int frames);
+
 inline std::string shapeTypeToString(ShapeType t) {
     switch (t) {
         case SPHERE_SHAPE: return "Sphere";
         case CYLINDER_SHAPE: return "Cylinder";
         case BOX_SHAPE: return "Box";
         case CONE_SHAPE: return "Cone";
+        case MESH_SHAPE: return "Mesh";
         default: return "Unknown";
     }
 }
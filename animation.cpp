@@ -0,0 +1,494 @@
+#include "animation.h"
+#include "HIERARCHIAL.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <unordered_map>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define ANIMATION_SSE 1
+#endif
+
+namespace {
+
+// Four lanes of floats; SSE when available, plain loops otherwise
+#ifdef ANIMATION_SSE
+struct f4 {
+    __m128 v;
+    static f4 load(const float* p) { return { _mm_loadu_ps(p) }; }
+    static f4 set(float s) { return { _mm_set1_ps(s) }; }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+};
+inline f4 operator+(f4 a, f4 b) { return { _mm_add_ps(a.v, b.v) }; }
+inline f4 operator-(f4 a, f4 b) { return { _mm_sub_ps(a.v, b.v) }; }
+inline f4 operator*(f4 a, f4 b) { return { _mm_mul_ps(a.v, b.v) }; }
+inline f4 invSqrt(f4 a) { return { _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(a.v)) }; }
+inline f4 absolute(f4 a) { return { _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v) }; }
+// x with its sign flipped in the lanes where d < 0
+inline f4 flipWhereNegative(f4 x, f4 d) {
+    return { _mm_xor_ps(x.v, _mm_and_ps(_mm_cmplt_ps(d.v, _mm_setzero_ps()), _mm_set1_ps(-0.0f))) };
+}
+// Four vec4s (one per lane) in, one register per component out; and back
+inline void loadTransposed(const float* const src[4], f4 out[4]) {
+    __m128 r0 = _mm_loadu_ps(src[0]), r1 = _mm_loadu_ps(src[1]), r2 = _mm_loadu_ps(src[2]), r3 = _mm_loadu_ps(src[3]);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    out[0].v = r0; out[1].v = r1; out[2].v = r2; out[3].v = r3;
+}
+inline void storeTransposed(const f4 in[4], float* const dst[4]) {
+    __m128 r0 = in[0].v, r1 = in[1].v, r2 = in[2].v, r3 = in[3].v;
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    _mm_storeu_ps(dst[0], r0); _mm_storeu_ps(dst[1], r1); _mm_storeu_ps(dst[2], r2); _mm_storeu_ps(dst[3], r3);
+}
+#else
+struct f4 {
+    float v[4];
+    static f4 load(const float* p) { return { { p[0], p[1], p[2], p[3] } }; }
+    static f4 set(float s) { return { { s, s, s, s } }; }
+    void store(float* p) const { for (int i = 0; i < 4; ++i) p[i] = v[i]; }
+};
+inline f4 operator+(f4 a, f4 b) { for (int i = 0; i < 4; ++i) a.v[i] += b.v[i]; return a; }
+inline f4 operator-(f4 a, f4 b) { for (int i = 0; i < 4; ++i) a.v[i] -= b.v[i]; return a; }
+inline f4 operator*(f4 a, f4 b) { for (int i = 0; i < 4; ++i) a.v[i] *= b.v[i]; return a; }
+inline f4 invSqrt(f4 a) { for (int i = 0; i < 4; ++i) a.v[i] = 1.0f / std::sqrt(a.v[i]); return a; }
+inline f4 absolute(f4 a) { for (int i = 0; i < 4; ++i) a.v[i] = std::fabs(a.v[i]); return a; }
+inline f4 flipWhereNegative(f4 x, f4 d) { for (int i = 0; i < 4; ++i) if (d.v[i] < 0.0f) x.v[i] = -x.v[i]; return x; }
+inline void loadTransposed(const float* const src[4], f4 out[4]) {
+    for (int comp = 0; comp < 4; ++comp)
+        for (int lane = 0; lane < 4; ++lane) out[comp].v[lane] = src[lane][comp];
+}
+inline void storeTransposed(const f4 in[4], float* const dst[4]) {
+    for (int comp = 0; comp < 4; ++comp)
+        for (int lane = 0; lane < 4; ++lane) dst[lane][comp] = in[comp].v[lane];
+}
+#endif
+
+inline f4 dot4(const f4 a[4], const f4 b[4]) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3]; }
+
+// Catmull-Rom through p1..p2 with p0/p3 as neighbours
+inline f4 catmullRom(f4 p0, f4 p1, f4 p2, f4 p3, f4 t, f4 t2, f4 t3) {
+    f4 a = f4::set(2.0f) * p1;
+    f4 b = p2 - p0;
+    f4 c = f4::set(2.0f) * p0 - f4::set(5.0f) * p1 + f4::set(4.0f) * p2 - p3;
+    f4 d = f4::set(3.0f) * (p1 - p2) + p3 - p0;
+    return f4::set(0.5f) * (a + b * t + c * t2 + d * t3);
+}
+
+const char* targetNames[] = { "POSITION", "ROTATION", "SCALE" };
+const char* interpolationNames[] = { "STEP", "LINEAR", "CUBIC" };
+
+template <size_t N>
+int nameIndex(const char* (&names)[N], const std::string& name) {
+    for (size_t i = 0; i < N; ++i) if (name == names[i]) return int(i);
+    return -1;
+}
+
+// Segment of a key-time track containing `time`: key offsets (previous, start, end, next)
+// and the parameter within it. Playback is usually monotonic, so the search starts at `cursor`.
+inline void sampleTrack(const float* times, uint32_t n, uint32_t& cursor, float time, uint32_t seg[4], float& u) {
+    uint32_t k = cursor < n ? cursor : 0;
+    if (times[k] <= time) {
+        while (k + 1 < n && times[k + 1] <= time) ++k;
+    }
+    else {
+        k = uint32_t(std::upper_bound(times, times + n, time) - times);
+        k = k > 0 ? k - 1 : 0;
+    }
+    cursor = k;
+
+    uint32_t k1 = std::min(k + 1, n - 1);
+    u = 0.0f;
+    if (k1 != k && time > times[k]) u = std::min((time - times[k]) / (times[k1] - times[k]), 1.0f);
+    seg[0] = k > 0 ? k - 1 : 0;
+    seg[1] = k;
+    seg[2] = k1;
+    seg[3] = std::min(k1 + 1, n - 1);
+}
+
+// What the kernels read; slots index the first four arrays, tracks the next two
+struct eval_view_t {
+    const glm::vec4* values;
+    const uint32_t* slotTrack;
+    const uint32_t* slotFirstKey;
+    const float* slotUScale;
+    const uint32_t* trackSegment;
+    const float* trackU;
+    glm::vec4* results;
+};
+
+// Interpolates slots [begin, end) four at a time: the keys of each lane are gathered and
+// transposed into x/y/z/w registers, so every lane runs the same arithmetic
+template <bool rotation, bool cubic>
+void evaluateKind(const eval_view_t& view, size_t begin, size_t end) {
+    for (size_t s = begin; s < end; s += 4) {
+        const float* src[4][4]; // [previous, start, end, next key][lane]
+        float u[4];
+        for (int lane = 0; lane < 4; ++lane) {
+            size_t slot = s + lane;
+            uint32_t track = view.slotTrack[slot];
+            const uint32_t* seg = view.trackSegment + track * 4;
+            const glm::vec4* keys = view.values + view.slotFirstKey[slot];
+            src[1][lane] = &keys[seg[1]].x;
+            src[2][lane] = &keys[seg[2]].x;
+            if (cubic) {
+                src[0][lane] = &keys[seg[0]].x;
+                src[3][lane] = &keys[seg[3]].x;
+            }
+            u[lane] = view.trackU[track] * view.slotUScale[slot];
+        }
+#ifdef ANIMATION_SSE
+        // Keys are the only data not read in order; fetch a few blocks ahead
+        if (s + 64 < end) {
+            for (int lane = 0; lane < 4; ++lane)
+                _mm_prefetch(reinterpret_cast<const char*>(view.values + view.slotFirstKey[s + 64 + lane]), _MM_HINT_T0);
+        }
+#endif
+
+        f4 a[4], b[4], r[4];
+        loadTransposed(src[1], a);
+        loadTransposed(src[2], b);
+        f4 t = f4::load(u);
+
+        if (!cubic) {
+            if (rotation) {
+                // Slerp approximated by nlerp with a corrected parameter (error ~1e-3 rad)
+                f4 d = dot4(a, b);
+                for (int comp = 0; comp < 4; ++comp) b[comp] = flipWhereNegative(b[comp], d);
+                d = absolute(d);
+                f4 A = f4::set(1.0904f) + d * (f4::set(-3.2452f) + d * (f4::set(3.55645f) - d * f4::set(1.43519f)));
+                f4 B = f4::set(0.848013f) + d * (f4::set(-1.06021f) + d * f4::set(0.215638f));
+                f4 h = t - f4::set(0.5f);
+                t = t + t * h * (t - f4::set(1.0f)) * (A * h * h + B);
+            }
+            for (int comp = 0; comp < 4; ++comp) r[comp] = a[comp] + (b[comp] - a[comp]) * t;
+        }
+        else {
+            f4 p0[4], p3[4];
+            loadTransposed(src[0], p0);
+            loadTransposed(src[3], p3);
+            if (rotation) {
+                // Shortest arc: keep the neighbours in the same hemisphere as the segment
+                f4 dab = dot4(a, b);
+                for (int comp = 0; comp < 4; ++comp) b[comp] = flipWhereNegative(b[comp], dab);
+                f4 d0 = dot4(a, p0), d3 = dot4(b, p3);
+                for (int comp = 0; comp < 4; ++comp) {
+                    p0[comp] = flipWhereNegative(p0[comp], d0);
+                    p3[comp] = flipWhereNegative(p3[comp], d3);
+                }
+            }
+            f4 t2 = t * t, t3 = t2 * t;
+            for (int comp = 0; comp < 4; ++comp) r[comp] = catmullRom(p0[comp], a[comp], b[comp], p3[comp], t, t2, t3);
+        }
+
+        if (rotation) {
+            f4 inv = invSqrt(dot4(r, r));
+            for (int comp = 0; comp < 4; ++comp) r[comp] = r[comp] * inv;
+        }
+        float* dst[4] = { &view.results[s].x, &view.results[s + 1].x, &view.results[s + 2].x, &view.results[s + 3].x };
+        storeTransposed(r, dst);
+    }
+}
+
+glm::vec4 restValue(AnimationTarget target) {
+    return target == ANIM_SCALE ? glm::vec4(1.0f)
+        : (target == ANIM_ROTATION ? glm::vec4(0.0f, 0.0f, 0.0f, 1.0f) : glm::vec4(0.0f));
+}
+
+} // namespace
+
+void animation_clip_t::setKey(int nodeId, AnimationTarget target, Interpolation interpolation,
+    float time, const glm::vec4& value) {
+    duration = std::max(duration, time);
+    for (size_t c = 0; c < channelCount(); ++c) {
+        if (nodeIds[c] != nodeId || targets[c] != target) continue;
+        interpolations[c] = interpolation;
+        auto begin = keyTimes.begin() + firstKey[c], end = begin + keyCount[c];
+        auto at = std::lower_bound(begin, end, time);
+        size_t index = size_t(at - keyTimes.begin());
+        if (at != end && std::fabs(*at - time) < 1e-4f) {
+            keyValues[index] = value;
+            return;
+        }
+        keyTimes.insert(at, time);
+        keyValues.insert(keyValues.begin() + index, value);
+        keyCount[c]++;
+        for (size_t o = 0; o < channelCount(); ++o)
+            if (o != c && firstKey[o] >= firstKey[c]) firstKey[o]++;
+        return;
+    }
+    addChannel(nodeId, target, interpolation, { time }, { value });
+}
+
+void animation_clip_t::addChannel(int nodeId, AnimationTarget target, Interpolation interpolation,
+    const std::vector<float>& times, const std::vector<glm::vec4>& values) {
+    nodeIds.push_back(nodeId);
+    targets.push_back(target);
+    interpolations.push_back(interpolation);
+    firstKey.push_back(uint32_t(keyTimes.size()));
+    keyCount.push_back(uint32_t(std::min(times.size(), values.size())));
+    for (size_t k = 0; k < keyCount.back(); ++k) {
+        keyTimes.push_back(times[k]);
+        keyValues.push_back(values[k]);
+        duration = std::max(duration, times[k]);
+    }
+}
+
+animation_clip_t& animation_t::clip(const std::string& name) {
+    for (size_t i = 0; i < clips.size(); ++i)
+        if (clips[i].name == name) return clips[i];
+    clips.emplace_back();
+    clips.back().name = name;
+    if (activeClip < 0) activeClip = int(clips.size()) - 1;
+    return clips.back();
+}
+
+void animation_t::clear() {
+    clips.clear();
+    activeClip = -1;
+    time = 0.0f;
+    playing = false;
+    boundClip = nullptr;
+    nodeById.clear();
+}
+
+void animation_t::bind(const node_list_t& modelNodes) {
+    nodeById.clear();
+    for (const auto& node : modelNodes) nodeById[node->id] = node.get();
+    boundClip = nullptr; // forces prepare() on the next evaluate()
+}
+
+void animation_t::prepare(const animation_clip_t& c) {
+    size_t count = c.channelCount();
+    nodes.assign(count, nullptr);
+    for (size_t i = 0; i < count; ++i) {
+        auto it = nodeById.find(c.nodeIds[i]);
+        if (it != nodeById.end() && c.keyCount[i] > 0) nodes[i] = it->second;
+    }
+
+    // Channels keyed at identical times (position/rotation/scale of one node, usually)
+    // share a track, so the segment search runs once per track instead of once per channel
+    std::vector<uint32_t> channelTrack(count, 0);
+    std::unordered_map<uint64_t, std::vector<uint32_t>> tracksByHash;
+    // Track 0 is empty: padding slots and keyless channels point at it and are never applied
+    trackFirst.assign(1, 0);
+    trackCount.assign(1, 0);
+    for (size_t i = 0; i < count; ++i) {
+        const float* times = c.keyTimes.data() + c.firstKey[i];
+        uint32_t n = c.keyCount[i];
+        if (n == 0) continue;
+        uint64_t hash = 14695981039346656037ull ^ n;
+        for (uint32_t k = 0; k < n; ++k) {
+            uint32_t bits;
+            std::memcpy(&bits, &times[k], sizeof(bits));
+            hash = (hash ^ bits) * 1099511628211ull;
+        }
+        auto& candidates = tracksByHash[hash];
+        uint32_t track = UINT32_MAX;
+        for (uint32_t t : candidates) {
+            if (trackCount[t] == n && std::equal(times, times + n, c.keyTimes.data() + trackFirst[t])) {
+                track = t;
+                break;
+            }
+        }
+        if (track == UINT32_MAX) {
+            track = uint32_t(trackFirst.size());
+            trackFirst.push_back(c.firstKey[i]);
+            trackCount.push_back(n);
+            candidates.push_back(track);
+        }
+        channelTrack[i] = track;
+    }
+    trackCursor.assign(trackFirst.size(), 0);
+    trackSegment.assign(trackFirst.size() * 4, 0);
+    trackU.assign(trackFirst.size(), 0.0f);
+
+    // Group channels by kernel, each group padded to a multiple of 4 slots
+    std::vector<uint32_t> groups[KIND_COUNT];
+    for (size_t i = 0; i < count; ++i) {
+        bool rotation = c.targets[i] == ANIM_ROTATION;
+        bool cubic = c.interpolations[i] == INTERP_CUBIC;
+        groups[cubic ? (rotation ? KIND_QUAT_CUBIC : KIND_VEC_CUBIC)
+                     : (rotation ? KIND_QUAT_LINEAR : KIND_VEC_LINEAR)].push_back(uint32_t(i));
+    }
+    order.clear();
+    for (int k = 0; k < KIND_COUNT; ++k) {
+        kindBegin[k] = order.size();
+        order.insert(order.end(), groups[k].begin(), groups[k].end());
+        while (order.size() % 4) order.push_back(UINT32_MAX);
+    }
+    kindBegin[KIND_COUNT] = order.size();
+
+    slotTrack.assign(order.size(), 0);
+    slotFirstKey.assign(order.size(), 0);
+    slotUScale.assign(order.size(), 0.0f);
+    for (size_t s = 0; s < order.size(); ++s) {
+        uint32_t ch = order[s];
+        if (ch == UINT32_MAX || c.keyCount[ch] == 0) continue;
+        slotTrack[s] = channelTrack[ch];
+        slotFirstKey[s] = c.firstKey[ch];
+        slotUScale[s] = c.interpolations[ch] == INTERP_STEP ? 0.0f : 1.0f;
+    }
+    results.assign(order.size(), glm::vec4(0.0f));
+
+    boundClip = &c;
+    boundChannels = count;
+    boundKeys = c.keyTimes.size();
+}
+
+void animation_t::evaluate(float sampleTime) {
+    animation_clip_t* c = active();
+    if (!c || c->keyValues.empty()) return;
+    if (boundClip != c || boundChannels != c->channelCount() || boundKeys != c->keyTimes.size())
+        prepare(*c);
+
+    if (c->duration > 0.0f) {
+        if (c->loop) {
+            sampleTime = std::fmod(sampleTime, c->duration);
+            if (sampleTime < 0.0f) sampleTime += c->duration;
+        }
+        else sampleTime = std::min(std::max(sampleTime, 0.0f), c->duration);
+    }
+
+    // Pass 1: segment search, once per distinct key-time track
+    for (size_t tr = 0; tr < trackFirst.size(); ++tr) {
+        if (trackCount[tr] == 0) continue;
+        sampleTrack(&c->keyTimes[trackFirst[tr]], trackCount[tr], trackCursor[tr], sampleTime,
+            &trackSegment[tr * 4], trackU[tr]);
+    }
+
+    // Pass 2: four channels at a time, one kernel per kind
+    eval_view_t view{ c->keyValues.data(), slotTrack.data(), slotFirstKey.data(), slotUScale.data(),
+        trackSegment.data(), trackU.data(), results.data() };
+    evaluateKind<false, false>(view, kindBegin[KIND_VEC_LINEAR], kindBegin[KIND_VEC_LINEAR + 1]);
+    evaluateKind<true, false>(view, kindBegin[KIND_QUAT_LINEAR], kindBegin[KIND_QUAT_LINEAR + 1]);
+    evaluateKind<false, true>(view, kindBegin[KIND_VEC_CUBIC], kindBegin[KIND_VEC_CUBIC + 1]);
+    evaluateKind<true, true>(view, kindBegin[KIND_QUAT_CUBIC], kindBegin[KIND_QUAT_CUBIC + 1]);
+}
+
+void animation_t::apply() {
+    const animation_clip_t* c = boundClip;
+    if (!c) return;
+    for (size_t s = 0; s < order.size(); ++s) {
+        uint32_t ch = order[s];
+        if (ch == UINT32_MAX || !nodes[ch]) continue;
+        model_node_t& node = *nodes[ch];
+        const glm::vec4& v = results[s];
+        switch (c->targets[ch]) {
+        case ANIM_POSITION: node.translation = glm::vec3(v); break;
+        case ANIM_ROTATION: node.rotation = glm::quat(v.w, v.x, v.y, v.z); break;
+        case ANIM_SCALE: node.scale = glm::vec3(v); break;
+        }
+    }
+}
+
+void animation_t::update(float dt) {
+    if (!playing || !active()) return;
+    time += dt;
+    evaluate(time);
+    apply();
+}
+
+void animation_t::save(std::ostream& file) const {
+    for (const auto& c : clips) {
+        file << "ANIMATION " << c.name << " " << c.duration << " " << (c.loop ? 1 : 0) << "\n";
+        for (size_t ch = 0; ch < c.channelCount(); ++ch) {
+            file << "CHANNEL " << c.nodeIds[ch] << " " << targetNames[c.targets[ch]] << " "
+                 << interpolationNames[c.interpolations[ch]] << " " << c.keyCount[ch] << "\n";
+            for (uint32_t k = c.firstKey[ch]; k < c.firstKey[ch] + c.keyCount[ch]; ++k) {
+                const glm::vec4& v = c.keyValues[k];
+                file << "KEY " << c.keyTimes[k] << " " << v.x << " " << v.y << " " << v.z << " " << v.w << "\n";
+            }
+        }
+    }
+}
+
+bool animation_t::parseLine(const std::string& token, std::istream& in) {
+    if (token == "ANIMATION") {
+        animation_clip_t c;
+        int loop = 1;
+        in >> c.name >> c.duration >> loop;
+        c.loop = loop != 0;
+        clips.push_back(c);
+        if (activeClip < 0) activeClip = 0;
+        return true;
+    }
+    if (clips.empty()) return false;
+    animation_clip_t& c = clips.back();
+    if (token == "CHANNEL") {
+        int nodeId = -1, count = 0;
+        std::string target, interpolation;
+        in >> nodeId >> target >> interpolation >> count;
+        int ti = nameIndex(targetNames, target), ii = nameIndex(interpolationNames, interpolation);
+        if (ti < 0 || ii < 0) {
+            std::cout << "Skipping animation channel with unknown " << target << "/" << interpolation << std::endl;
+            ti = ANIM_POSITION;
+            ii = INTERP_STEP;
+            nodeId = -1;
+        }
+        c.addChannel(nodeId, AnimationTarget(ti), Interpolation(ii), {}, {});
+        return true;
+    }
+    if (token == "KEY") {
+        if (c.channelCount() == 0) return true;
+        float time = 0.0f;
+        glm::vec4 v = restValue(c.targets.back());
+        in >> time >> v.x >> v.y >> v.z >> v.w;
+        // Keys arrive channel after channel, so they always extend the last channel
+        c.keyTimes.push_back(time);
+        c.keyValues.push_back(v);
+        c.keyCount.back()++;
+        c.duration = std::max(c.duration, time);
+        return true;
+    }
+    return false;
+}
+
+void benchmarkAnimation(size_t nodeCount, int keys, int frames) {
+    node_list_t modelNodes;
+    modelNodes.reserve(nodeCount);
+    for (size_t i = 0; i < nodeCount; ++i) {
+        modelNodes.push_back(std::make_shared<model_node_t>());
+        modelNodes.back()->id = int(i);
+    }
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    animation_t anim;
+    animation_clip_t& c = anim.clip("bench");
+    std::vector<float> times(keys);
+    std::vector<glm::vec4> pos(keys), rot(keys), scl(keys);
+    for (size_t i = 0; i < nodeCount; ++i) {
+        // Every node gets its own key times, shared by its three channels
+        float stretch = 1.0f + 0.25f * dist(rng);
+        for (int k = 0; k < keys; ++k) {
+            times[k] = float(k) * stretch;
+            pos[k] = glm::vec4(dist(rng), dist(rng), dist(rng), 0.0f);
+            rot[k] = glm::normalize(glm::vec4(dist(rng), dist(rng), dist(rng), dist(rng)));
+            scl[k] = glm::vec4(1.0f + 0.5f * dist(rng));
+        }
+        c.addChannel(int(i), ANIM_POSITION, INTERP_LINEAR, times, pos);
+        c.addChannel(int(i), ANIM_ROTATION, i % 4 == 0 ? INTERP_CUBIC : INTERP_LINEAR, times, rot);
+        c.addChannel(int(i), ANIM_SCALE, INTERP_LINEAR, times, scl);
+    }
+    anim.bind(modelNodes);
+    anim.evaluate(0.0f); // prepare outside the timed loop
+
+    double evalMs = 0.0, applyMs = 0.0;
+    for (int f = 0; f < frames; ++f) {
+        auto start = std::chrono::steady_clock::now();
+        anim.evaluate(f * (1.0f / 60.0f));
+        auto mid = std::chrono::steady_clock::now();
+        anim.apply();
+        auto end = std::chrono::steady_clock::now();
+        evalMs += std::chrono::duration<double, std::milli>(mid - start).count();
+        applyMs += std::chrono::duration<double, std::milli>(end - mid).count();
+    }
+    std::cout << "Animation: " << nodeCount << " nodes, " << c.channelCount() << " channels, "
+              << keys << " keys each: evaluate " << evalMs / frames << " ms, apply "
+              << applyMs / frames << " ms per frame" << std::endl;
+}
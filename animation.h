@@ -0,0 +1,111 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "memory_stats.h"
+
+struct model_node_t;
+
+enum AnimationTarget : uint8_t {
+    ANIM_POSITION,
+    ANIM_ROTATION,  // quaternion stored as (x, y, z, w)
+    ANIM_SCALE
+};
+
+enum Interpolation : uint8_t {
+    INTERP_STEP,
+    INTERP_LINEAR,  // lerp for position/scale, slerp for rotation
+    INTERP_CUBIC    // Catmull-Rom through the neighbouring keys
+};
+
+// One named clip. Channels and keys are kept as flat arrays (structure of arrays) so the
+// whole clip can be evaluated in a single pass; each channel animates one property of one node.
+struct animation_clip_t {
+    std::string name;
+    float duration = 0.0f;
+    bool loop = true;
+
+    // Per channel
+    std::vector<int> nodeIds;
+    std::vector<AnimationTarget> targets;
+    std::vector<Interpolation> interpolations;
+    std::vector<uint32_t> firstKey;
+    std::vector<uint32_t> keyCount;
+
+    // All keys of all channels, channel after channel, times ascending within a channel
+    std::vector<float> keyTimes;
+    std::vector<glm::vec4> keyValues;
+
+    size_t channelCount() const { return nodeIds.size(); }
+
+    // Adds a channel, or replaces the key at `time` / inserts a new one if the node already
+    // has a channel for `target`. Rotations are given as (x, y, z, w).
+    void setKey(int nodeId, AnimationTarget target, Interpolation interpolation, float time, const glm::vec4& value);
+    void addChannel(int nodeId, AnimationTarget target, Interpolation interpolation,
+        const std::vector<float>& times, const std::vector<glm::vec4>& values);
+};
+
+// Evaluates the active clip for all animated nodes at once and writes the results into
+// the nodes' transforms, which the renderer then composes into world matrices.
+class animation_t {
+public:
+    std::vector<animation_clip_t> clips;
+    int activeClip = -1;
+    float time = 0.0f;
+    bool playing = false;
+
+    animation_clip_t* active() { return activeClip >= 0 && activeClip < int(clips.size()) ? &clips[activeClip] : nullptr; }
+    animation_clip_t& clip(const std::string& name); // finds or creates
+
+    // Resolves channel node ids against these nodes (model_t::getShapes()); call whenever
+    // nodes are added or removed
+    void bind(const node_list_t& modelNodes);
+    // Advances time when playing and applies the active clip
+    void update(float dt);
+    // Samples the active clip at `t` into the per-channel results (no node writes)
+    void evaluate(float t);
+    // Writes the last evaluate() results into the bound nodes
+    void apply();
+    // Node of each channel of the bound clip, nullptr where the id is gone
+    const std::vector<model_node_t*>& boundNodes() const { return nodes; }
+
+    void save(std::ostream& out) const;
+    // Parses one ANIMATION/CHANNEL/KEY line of a .mod file; false if the token is not ours
+    bool parseLine(const std::string& token, std::istream& in);
+
+    void clear();
+
+private:
+    // Channels in evaluation order: grouped by kind so each kernel runs over a contiguous range,
+    // each group padded to a multiple of 4 with UINT32_MAX
+    enum { KIND_VEC_LINEAR, KIND_QUAT_LINEAR, KIND_VEC_CUBIC, KIND_QUAT_CUBIC, KIND_COUNT };
+    std::vector<uint32_t> order;
+    size_t kindBegin[KIND_COUNT + 1] = {};
+    std::unordered_map<int, model_node_t*> nodeById;
+    std::vector<model_node_t*> nodes;  // per channel, nullptr if the id is gone
+    // Distinct key-time sequences; channels keyed at the same times share one segment search
+    std::vector<uint32_t> trackFirst, trackCount, trackCursor;
+    std::vector<uint32_t> trackSegment;  // 4 per track: previous, start, end, next key
+    std::vector<float> trackU;
+    // Per slot of `order`
+    std::vector<uint32_t> slotTrack, slotFirstKey;
+    std::vector<float> slotUScale;     // 0 for STEP channels, 1 otherwise
+    const animation_clip_t* boundClip = nullptr;
+    size_t boundChannels = 0, boundKeys = 0;
+
+    std::vector<glm::vec4> results;    // per slot of `order`, written by evaluate()
+
+    void prepare(const animation_clip_t& clip);
+};
+
+// Prints evaluation time for `nodes` animated nodes with three channels of `keys` keys each
+void benchmarkAnimation(size_t nodes, int keys, int frames);
+
+#endif
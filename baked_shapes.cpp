@@ -0,0 +1,250 @@
+#include "baked_shapes.h"
+#include "shape.h"
+#include "HIERARCHIAL.h"
+#include <chrono>
+#include <iostream>
+
+namespace {
+
+// constexpr trig: std::sin/std::cos are not usable in constant expressions
+constexpr double BAKE_PI = 3.14159265358979323846;
+
+constexpr double bakeSin(double x) {
+    while (x > BAKE_PI) x -= 2.0 * BAKE_PI;
+    while (x < -BAKE_PI) x += 2.0 * BAKE_PI;
+    double term = x, sum = x;
+    for (int n = 1; n < 20; ++n) {
+        term *= -x * x / ((2.0 * n) * (2.0 * n + 1.0));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double bakeCos(double x) { return bakeSin(x + 0.5 * BAKE_PI); }
+
+template <size_t V, size_t I>
+struct baked_arrays_t {
+    float positions[V * 4];
+    unsigned int indices[I];
+};
+
+template <size_t V, size_t I>
+constexpr void setPosition(baked_arrays_t<V, I>& a, size_t v, double x, double y, double z) {
+    a.positions[v * 4 + 0] = float(x);
+    a.positions[v * 4 + 1] = float(y);
+    a.positions[v * 4 + 2] = float(z);
+    a.positions[v * 4 + 3] = 1.0f;
+}
+
+// The generators below mirror the runtime generateProcedural() of each shape in shape.h,
+// vertex for vertex and index for index.
+
+template <unsigned int L>
+constexpr auto bakeSphere() {
+    constexpr unsigned int stacks = 10 * L, slices = 10 * L;
+    baked_arrays_t<(stacks + 1) * (slices + 1), stacks * slices * 6> a{};
+    size_t v = 0, k = 0;
+    for (unsigned int i = 0; i <= stacks; ++i) {
+        double phi = BAKE_PI * i / stacks;
+        for (unsigned int j = 0; j <= slices; ++j) {
+            double theta = 2.0 * BAKE_PI * j / slices;
+            setPosition(a, v++, bakeSin(phi) * bakeCos(theta), bakeCos(phi), bakeSin(phi) * bakeSin(theta));
+        }
+    }
+    for (unsigned int i = 0; i < stacks; ++i) {
+        for (unsigned int j = 0; j < slices; ++j) {
+            unsigned int first = i * (slices + 1) + j;
+            unsigned int second = first + slices + 1;
+            a.indices[k++] = first;
+            a.indices[k++] = second;
+            a.indices[k++] = first + 1;
+            a.indices[k++] = second;
+            a.indices[k++] = second + 1;
+            a.indices[k++] = first + 1;
+        }
+    }
+    return a;
+}
+
+template <unsigned int L>
+constexpr auto bakeCone() {
+    constexpr unsigned int slices = 20 * L;
+    baked_arrays_t<slices + 3, slices * 9> a{};
+    size_t k = 0;
+    setPosition(a, 0, 0, 1, 0);  // apex
+    setPosition(a, 1, 0, -1, 0); // base center
+    for (unsigned int i = 0; i <= slices; ++i) {
+        double theta = 2.0 * BAKE_PI * i / slices;
+        setPosition(a, 2 + i, bakeCos(theta), -1, bakeSin(theta));
+    }
+    for (unsigned int i = 1; i <= slices; ++i) {
+        a.indices[k++] = 0;
+        a.indices[k++] = i;
+        a.indices[k++] = i + 1;
+    }
+    for (unsigned int i = 0; i < slices; ++i) {
+        a.indices[k++] = 0;
+        a.indices[k++] = 2 + i;
+        a.indices[k++] = 3 + i;
+    }
+    for (unsigned int i = 0; i < slices; ++i) {
+        a.indices[k++] = 1;
+        a.indices[k++] = 3 + i;
+        a.indices[k++] = 2 + i;
+    }
+    return a;
+}
+
+template <unsigned int L>
+constexpr auto bakeBox() {
+    constexpr unsigned int n = L;
+    baked_arrays_t<6 * (n + 1) * (n + 1), 6 * n * n * 6> a{};
+    constexpr double corners[8][3] = {
+        {-1,-1,-1}, {1,-1,-1}, {1,1,-1}, {-1,1,-1},
+        {-1,-1, 1}, {1,-1, 1}, {1,1, 1}, {-1,1, 1}
+    };
+    // back, front, left, right, top, bottom
+    constexpr int faces[6][4] = {
+        {0, 1, 2, 3}, {5, 4, 7, 6}, {4, 0, 3, 7}, {1, 5, 6, 2}, {3, 2, 6, 7}, {4, 5, 1, 0}
+    };
+    size_t v = 0, k = 0;
+    for (const auto& f : faces) {
+        unsigned int startIndex = unsigned(v);
+        for (unsigned int i = 0; i <= n; ++i) {
+            for (unsigned int j = 0; j <= n; ++j) {
+                double u = double(i) / n, t = double(j) / n;
+                double w0 = (1 - u) * (1 - t), w1 = u * (1 - t), w2 = u * t, w3 = (1 - u) * t;
+                double p[3] = {};
+                for (int c = 0; c < 3; ++c)
+                    p[c] = w0 * corners[f[0]][c] + w1 * corners[f[1]][c] + w2 * corners[f[2]][c] + w3 * corners[f[3]][c];
+                setPosition(a, v++, p[0], p[1], p[2]);
+            }
+        }
+        for (unsigned int i = 0; i < n; ++i) {
+            for (unsigned int j = 0; j < n; ++j) {
+                unsigned int row1 = i * (n + 1) + j + startIndex;
+                unsigned int row2 = (i + 1) * (n + 1) + j + startIndex;
+                a.indices[k++] = row1;
+                a.indices[k++] = row2;
+                a.indices[k++] = row1 + 1;
+                a.indices[k++] = row2;
+                a.indices[k++] = row2 + 1;
+                a.indices[k++] = row1 + 1;
+            }
+        }
+    }
+    return a;
+}
+
+template <unsigned int L>
+constexpr auto bakeCylinder() {
+    constexpr unsigned int slices = 20 * L;
+    baked_arrays_t<2 * (slices + 1) + 2, slices * 12> a{};
+    for (unsigned int i = 0; i <= slices; ++i) {
+        double theta = 2.0 * BAKE_PI * i / slices;
+        setPosition(a, 2 * i, bakeCos(theta), 1, bakeSin(theta));
+        setPosition(a, 2 * i + 1, bakeCos(theta), -1, bakeSin(theta));
+    }
+    constexpr unsigned int topCenter = 2 * (slices + 1), bottomCenter = topCenter + 1;
+    setPosition(a, topCenter, 0, 1, 0);
+    setPosition(a, bottomCenter, 0, -1, 0);
+
+    size_t k = 0;
+    for (unsigned int i = 0; i < slices; ++i) {
+        unsigned int curr = i * 2, next = ((i + 1) % slices) * 2;
+        a.indices[k++] = curr;
+        a.indices[k++] = curr + 1;
+        a.indices[k++] = next;
+        a.indices[k++] = curr + 1;
+        a.indices[k++] = next + 1;
+        a.indices[k++] = next;
+    }
+    for (unsigned int i = 0; i < slices; ++i) {
+        a.indices[k++] = topCenter;
+        a.indices[k++] = i * 2;
+        a.indices[k++] = ((i + 1) % slices) * 2;
+    }
+    for (unsigned int i = 0; i < slices; ++i) {
+        a.indices[k++] = bottomCenter;
+        a.indices[k++] = ((i + 1) % slices) * 2 + 1;
+        a.indices[k++] = i * 2 + 1;
+    }
+    return a;
+}
+
+template <size_t V, size_t I>
+constexpr baked_mesh_t describe(const baked_arrays_t<V, I>& a) {
+    return { a.positions, V, a.indices, I };
+}
+
+constexpr auto sphere1 = bakeSphere<1>();
+constexpr auto sphere2 = bakeSphere<2>();
+constexpr auto sphere3 = bakeSphere<3>();
+constexpr auto sphere4 = bakeSphere<4>();
+constexpr auto cone1 = bakeCone<1>();
+constexpr auto cone2 = bakeCone<2>();
+constexpr auto cone3 = bakeCone<3>();
+constexpr auto cone4 = bakeCone<4>();
+constexpr auto box1 = bakeBox<1>();
+constexpr auto box2 = bakeBox<2>();
+constexpr auto box3 = bakeBox<3>();
+constexpr auto box4 = bakeBox<4>();
+constexpr auto cylinder1 = bakeCylinder<1>();
+constexpr auto cylinder2 = bakeCylinder<2>();
+constexpr auto cylinder3 = bakeCylinder<3>();
+constexpr auto cylinder4 = bakeCylinder<4>();
+
+// Indexed by ShapeType, then level - BAKED_MIN_LEVEL
+constexpr baked_mesh_t bakedMeshes[4][BAKED_MAX_LEVEL - BAKED_MIN_LEVEL + 1] = {
+    { describe(sphere1), describe(sphere2), describe(sphere3), describe(sphere4) },
+    { describe(cone1), describe(cone2), describe(cone3), describe(cone4) },
+    { describe(box1), describe(box2), describe(box3), describe(box4) },
+    { describe(cylinder1), describe(cylinder2), describe(cylinder3), describe(cylinder4) },
+};
+
+static_assert(SPHERE_SHAPE == 0 && CONE_SHAPE == 1 && BOX_SHAPE == 2 && CYLINDER_SHAPE == 3,
+    "bakedMeshes rows follow the ShapeType order");
+
+} // namespace
+
+const baked_mesh_t* findBakedMesh(int shapeType, unsigned int level) {
+    if (shapeType < SPHERE_SHAPE || shapeType > CYLINDER_SHAPE) return nullptr;
+    if (level < BAKED_MIN_LEVEL || level > BAKED_MAX_LEVEL) return nullptr;
+    return &bakedMeshes[shapeType][level - BAKED_MIN_LEVEL];
+}
+
+size_t bakedMeshBytes() {
+    size_t bytes = 0;
+    for (const auto& row : bakedMeshes)
+        for (const auto& m : row)
+            bytes += m.vertexCount * 4 * sizeof(float) + m.indexCount * sizeof(unsigned int);
+    return bytes;
+}
+
+void benchmarkShapeCreation(int iterations) {
+    const ShapeType types[] = { SPHERE_SHAPE, CONE_SHAPE, BOX_SHAPE, CYLINDER_SHAPE };
+    std::cout << "Baked primitive data: " << bakedMeshBytes() / 1024.0 << " KiB" << std::endl;
+    std::cout << "Shape creation (" << iterations << " iterations, us per shape)" << std::endl;
+
+    for (ShapeType type : types) {
+        for (unsigned int level = BAKED_MIN_LEVEL; level <= BAKED_MAX_LEVEL; ++level) {
+            double seconds[2] = {};
+            size_t checksum = 0;
+            for (int runtime = 0; runtime < 2; ++runtime) {
+                auto start = std::chrono::steady_clock::now();
+                for (int i = 0; i < iterations; ++i) {
+                    std::unique_ptr<shape_t> shape = createPrimitive(type, level);
+                    if (runtime) shape->generateProcedural();
+                    else shape->generateGeometry();
+                    checksum += shape->indices.size();
+                }
+                seconds[runtime] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            }
+            std::cout << "  " << shapeTypeToString(type) << " level " << level
+                      << ": baked " << seconds[0] * 1.0e6 / iterations
+                      << ", runtime " << seconds[1] * 1.0e6 / iterations
+                      << " (" << (seconds[0] > 0.0 ? seconds[1] / seconds[0] : 0.0) << "x)"
+                      << (checksum ? "" : " (empty)") << std::endl;
+        }
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef BAKED_SHAPES_H
+#define BAKED_SHAPES_H
+
+#include <cstddef>
+
+// Primitive geometry generated at compile time for levels BAKED_MIN_LEVEL..BAKED_MAX_LEVEL.
+// The tables live in read-only data; shapes copy them instead of running trig loops.
+const unsigned int BAKED_MIN_LEVEL = 1;
+const unsigned int BAKED_MAX_LEVEL = 4;
+
+struct baked_mesh_t {
+    const float* positions;      // x, y, z, w per vertex, same layout as glm::vec4
+    size_t vertexCount;
+    const unsigned int* indices;
+    size_t indexCount;
+};
+
+// nullptr when the shape type or level is not baked (meshes, or levels out of range)
+const baked_mesh_t* findBakedMesh(int shapeType, unsigned int level);
+
+// Total bytes of baked vertex and index data compiled into the binary
+size_t bakedMeshBytes();
+
+// Times shape creation from the baked tables against runtime generation, per type and level
+void benchmarkShapeCreation(int iterations);
+
+#endif
@@ -0,0 +1,116 @@
+#include "clustered_lights.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+light_clusters_t::~light_clusters_t() {
+    if (textures[0]) glDeleteTextures(3, textures);
+}
+
+void light_clusters_t::build(const std::vector<light_t>& lights, const glm::mat4& view, const glm::mat4& projection) {
+    auto start = std::chrono::steady_clock::now();
+    // glm::perspective stores -(f+n)/(f-n) in [2][2] and -2fn/(f-n) in [3][2]
+    nearPlane = projection[3][2] / (projection[2][2] - 1.0f);
+    farPlane = projection[3][2] / (projection[2][2] + 1.0f);
+    const float sliceScale = CLUSTER_Z / std::log(farPlane / nearPlane);
+    auto slice = [&](float depth) {
+        return std::clamp(int(std::log(depth / nearPlane) * sliceScale), 0, CLUSTER_Z - 1);
+    };
+    auto tile = [](float ndc, int tiles) {
+        return std::clamp(int(std::floor((ndc * 0.5f + 0.5f) * tiles)), 0, tiles - 1);
+    };
+
+    lightData.clear();
+    cells.clear();
+    clusterRanges.assign(CLUSTER_COUNT * 2, 0);
+    for (const light_t& light : lights) {
+        glm::vec3 c(view * glm::vec4(light.position, 1.0f));
+        float r = light.radius;
+        float nearest = -c.z - r, farthest = -c.z + r;  // distances in front of the eye
+        if (r <= 0.0f || farthest < nearPlane || nearest > farPlane) continue;
+
+        // Screen rectangle of the sphere's view-space box, with the box cut at the near plane
+        // so every corner projects with w > 0; conservative, never misses a covered tile
+        glm::vec2 lo(1e30f), hi(-1e30f);
+        for (int corner = 0; corner < 8; ++corner) {
+            glm::vec3 p = c + r * glm::vec3(corner & 1 ? 1.0f : -1.0f, corner & 2 ? 1.0f : -1.0f, corner & 4 ? 1.0f : -1.0f);
+            p.z = std::min(p.z, -nearPlane);
+            glm::vec4 clip = projection * glm::vec4(p, 1.0f);
+            glm::vec2 ndc = glm::vec2(clip) / clip.w;
+            lo = glm::min(lo, ndc);
+            hi = glm::max(hi, ndc);
+        }
+        if (hi.x < -1.0f || lo.x > 1.0f || hi.y < -1.0f || lo.y > 1.0f) continue;
+
+        light_cells_t cell{ tile(lo.x, CLUSTER_X), tile(hi.x, CLUSTER_X), tile(lo.y, CLUSTER_Y), tile(hi.y, CLUSTER_Y),
+            slice(std::max(nearest, nearPlane)), slice(std::min(farthest, farPlane)) };
+        cells.push_back(cell);
+        lightData.push_back(glm::vec4(light.position, r));
+        lightData.push_back(glm::vec4(light.color, 1.0f));
+        for (int z = cell.z0; z <= cell.z1; ++z)
+            for (int y = cell.y0; y <= cell.y1; ++y)
+                for (int x = cell.x0; x <= cell.x1; ++x)
+                    clusterRanges[((z * CLUSTER_Y + y) * CLUSTER_X + x) * 2 + 1]++;
+    }
+
+    // Counts -> first index per cluster, then scatter the light indices
+    uint32_t total = 0;
+    for (int cl = 0; cl < CLUSTER_COUNT; ++cl) {
+        clusterRanges[cl * 2] = total;
+        total += clusterRanges[cl * 2 + 1];
+    }
+    lightIndices.resize(total);
+    cellLights.assign(CLUSTER_COUNT, 0);
+    for (uint32_t l = 0; l < cells.size(); ++l) {
+        const light_cells_t& cell = cells[l];
+        for (int z = cell.z0; z <= cell.z1; ++z)
+            for (int y = cell.y0; y <= cell.y1; ++y)
+                for (int x = cell.x0; x <= cell.x1; ++x) {
+                    int cl = (z * CLUSTER_Y + y) * CLUSTER_X + x;
+                    lightIndices[clusterRanges[cl * 2] + cellLights[cl]++] = l;
+                }
+    }
+    buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void light_clusters_t::upload() {
+    static const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+    if (!buffers[0]) {
+        glGenTextures(3, textures);
+        for (int b = 0; b < 3; ++b) {
+            buffers[b].upload(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[b]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[b], buffers[b].id());
+        }
+    }
+    const void* data[3] = { lightData.data(), clusterRanges.data(), lightIndices.data() };
+    size_t bytes[3] = { lightData.size() * sizeof(glm::vec4), clusterRanges.size() * sizeof(uint32_t),
+        lightIndices.size() * sizeof(uint32_t) };
+    for (int b = 0; b < 3; ++b) {
+        // Orphan last frame's storage rather than wait for draws still reading it
+        buffers[b].upload(GL_TEXTURE_BUFFER, std::max<size_t>(bytes[b], 16), nullptr, GL_STREAM_DRAW);
+        if (bytes[b]) buffers[b].update(GL_TEXTURE_BUFFER, 0, bytes[b], data[b]);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void light_clusters_t::bind(GLuint program, int viewportWidth, int viewportHeight) const {
+    static const char* samplers[3] = { "lightData", "clusterRanges", "lightIndices" };
+    for (int b = 0; b < 3; ++b) {
+        glActiveTexture(GL_TEXTURE1 + b);
+        glBindTexture(GL_TEXTURE_BUFFER, textures[b]);
+        glUniform1i(glGetUniformLocation(program, samplers[b]), 1 + b);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    glUniform3i(glGetUniformLocation(program, "clusterGrid"), CLUSTER_X, CLUSTER_Y, CLUSTER_Z);
+    glUniform2f(glGetUniformLocation(program, "viewportSize"), float(viewportWidth), float(viewportHeight));
+    glUniform1f(glGetUniformLocation(program, "clusterNear"), nearPlane);
+    glUniform1f(glGetUniformLocation(program, "clusterSliceScale"), CLUSTER_Z / std::log(farPlane / nearPlane));
+}
+
+size_t light_clusters_t::occupiedClusters() const {
+    size_t n = 0;
+    for (int cl = 0; cl < CLUSTER_COUNT; ++cl) n += clusterRanges.size() > size_t(cl * 2 + 1) && clusterRanges[cl * 2 + 1] ? 1 : 0;
+    return n;
+}
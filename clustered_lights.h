@@ -0,0 +1,62 @@
+#ifndef CLUSTERED_LIGHTS_H
+#define CLUSTERED_LIGHTS_H
+
+#include <glm/glm.hpp>
+#include <GL/glew.h>
+#include "gpu_resources.h"
+#include <cstdint>
+#include <vector>
+
+// Point light owned by a model_t and saved with it (LIGHT lines in .mod)
+struct light_t {
+    glm::vec3 position{ 0.0f };
+    glm::vec3 color{ 1.0f };
+    float radius = 5.0f;    // no contribution at or beyond this distance
+};
+
+// Smooth window so a light reaches exactly zero at its radius; the GLSL copy is in fragment_shader.glsl
+inline float lightFalloff(float distance, float radius) {
+    float x = distance / radius;
+    float window = glm::clamp(1.0f - x * x * x * x, 0.0f, 1.0f);
+    return window * window / (1.0f + distance * distance);
+}
+
+// Froxel grid: CLUSTER_X x CLUSTER_Y screen tiles by CLUSTER_Z view-depth slices,
+// the slices spaced exponentially between the projection's near and far planes
+const int CLUSTER_X = 16;
+const int CLUSTER_Y = 9;
+const int CLUSTER_Z = 24;
+const int CLUSTER_COUNT = CLUSTER_X * CLUSTER_Y * CLUSTER_Z;
+
+// Bins the lights of one view into the froxel grid. build() is the CPU pass, upload() moves
+// the result into texture buffers (GL 3.3 has no SSBOs) that the CLUSTERED_LIGHTS shaders
+// read, so each fragment only loops over the lights of its own cluster.
+class light_clusters_t {
+public:
+    ~light_clusters_t();
+
+    void build(const std::vector<light_t>& lights, const glm::mat4& view, const glm::mat4& projection);
+    void upload();
+    // Binds the buffers to texture units 1-3 and sets the cluster uniforms of `program`
+    void bind(GLuint program, int viewportWidth, int viewportHeight) const;
+
+    size_t lightCount() const { return lightData.size() / 2; }
+    size_t indexCount() const { return lightIndices.size(); }
+    size_t occupiedClusters() const;
+    double buildMs = 0.0;
+
+private:
+    float nearPlane = 0.1f, farPlane = 100.0f;
+    std::vector<glm::vec4> lightData;       // 2 per light: position + radius, color
+    std::vector<uint32_t> clusterRanges;    // 2 per cluster: first index, light count
+    std::vector<uint32_t> lightIndices;
+    // Scratch for build(): the cluster box each light covers
+    struct light_cells_t { int x0, x1, y0, y1, z0, z1; };
+    std::vector<light_cells_t> cells;
+    std::vector<uint32_t> cellLights;
+
+    gpu_buffer_t buffers[3] = { gpu_buffer_t(GPU_LIGHTS), gpu_buffer_t(GPU_LIGHTS), gpu_buffer_t(GPU_LIGHTS) };
+    GLuint textures[3] = {};
+};
+
+#endif
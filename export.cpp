@@ -0,0 +1,410 @@
+#include "export.h"
+#include "HIERARCHIAL.h"
+#include "shape.h"
+#include "mesh.h"
+#include <glm/gtc/type_ptr.hpp>
+#include <array>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <utility>
+
+buffered_writer_t::buffered_writer_t(const std::string& filename) {
+    file = std::fopen(filename.c_str(), "wb");
+    buffer.reserve(BUFFER_SIZE);
+}
+
+buffered_writer_t::~buffered_writer_t() {
+    close();
+}
+
+void buffered_writer_t::flush() {
+    if (!file || buffer.empty()) return;
+    if (std::fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size()) failed = true;
+    buffer.clear();
+}
+
+void buffered_writer_t::write(const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    written += size;
+    while (size > 0) {
+        if (buffer.size() == BUFFER_SIZE) flush();
+        size_t n = std::min(size, BUFFER_SIZE - buffer.size());
+        buffer.insert(buffer.end(), bytes, bytes + n);
+        bytes += n;
+        size -= n;
+    }
+}
+
+void buffered_writer_t::text(const char* s) {
+    write(s, std::strlen(s));
+}
+
+void buffered_writer_t::number(float v) {
+    char tmp[32];
+    int n = std::snprintf(tmp, sizeof(tmp), "%.7g", v);
+    write(tmp, size_t(n));
+}
+
+void buffered_writer_t::number(uint64_t v) {
+    char tmp[32];
+    int n = std::snprintf(tmp, sizeof(tmp), "%llu", static_cast<unsigned long long>(v));
+    write(tmp, size_t(n));
+}
+
+void buffered_writer_t::patchU32(uint64_t offset, uint32_t v) {
+    if (!file) return;
+    flush();
+    long end = std::ftell(file);
+    std::fseek(file, long(offset), SEEK_SET);
+    if (std::fwrite(&v, sizeof(v), 1, file) != 1) failed = true;
+    std::fseek(file, end, SEEK_SET);
+}
+
+bool buffered_writer_t::close() {
+    if (!file) return !failed;
+    flush();
+    if (std::fclose(file) != 0) failed = true;
+    file = nullptr;
+    return !failed;
+}
+
+namespace {
+
+// One entry per distinct (shape type, level or max error); the first node using it supplies the vertices
+struct export_geometry_t {
+    std::shared_ptr<shape_t> shape;
+    glm::vec3 minPos{ 0.0f }, maxPos{ 0.0f };
+    uint64_t positionOffset = 0, indexOffset = 0;
+};
+
+typedef std::array<float, 4> color_key_t;
+
+std::string geometryKey(const shape_t& shape) {
+    if (auto mesh = dynamic_cast<const mesh_t*>(&shape)) return "mesh:" + mesh->path;
+    if (shape.isErrorBounded()) return std::to_string(int(shape.shapetype)) + ":e" + std::to_string(shape.maxError);
+    return std::to_string(int(shape.shapetype)) + ":" + std::to_string(shape.level);
+}
+
+color_key_t nodeColor(const model_node_t& node) {
+    glm::vec4 c = (node.shape && !node.shape->colors.empty()) ? node.shape->colors[0] : node.color;
+    return { c.r, c.g, c.b, c.a };
+}
+
+// Geometry table shared by both exporters
+class geometry_table_t {
+public:
+    std::vector<export_geometry_t> entries;
+
+    size_t lookup(const std::shared_ptr<shape_t>& shape) {
+        std::string key = geometryKey(*shape);
+        auto it = index.find(key);
+        if (it != index.end()) return it->second;
+
+        shape->ensureGeometry();
+        export_geometry_t g;
+        g.shape = shape;
+        if (!shape->vertices.empty()) {
+            g.minPos = g.maxPos = glm::vec3(shape->vertices[0]);
+            for (const auto& v : shape->vertices) {
+                g.minPos = glm::min(g.minPos, glm::vec3(v));
+                g.maxPos = glm::max(g.maxPos, glm::vec3(v));
+            }
+        }
+        entries.push_back(std::move(g));
+        index[key] = entries.size() - 1;
+        return entries.size() - 1;
+    }
+
+private:
+    std::map<std::string, size_t> index;
+};
+
+void writeArray(buffered_writer_t& out, const char* name, const float* p, int count) {
+    out.text(",\"");
+    out.text(name);
+    out.text("\":[");
+    for (int k = 0; k < count; ++k) {
+        if (k) out.text(",");
+        out.number(p[k]);
+    }
+    out.text("]");
+}
+
+// glTF nodes take TRS directly; only non-default components are written
+void writeTRS(buffered_writer_t& out, const model_node_t& node) {
+    if (node.translation != glm::vec3(0.0f)) {
+        const float t[3] = { node.translation.x, node.translation.y, node.translation.z };
+        writeArray(out, "translation", t, 3);
+    }
+    if (node.rotation != glm::quat(1.0f, 0.0f, 0.0f, 0.0f)) {
+        const float r[4] = { node.rotation.x, node.rotation.y, node.rotation.z, node.rotation.w };
+        writeArray(out, "rotation", r, 4);
+    }
+    if (node.scale != glm::vec3(1.0f)) {
+        const float s[3] = { node.scale.x, node.scale.y, node.scale.z };
+        writeArray(out, "scale", s, 3);
+    }
+}
+
+} // namespace
+
+bool exportGLB(model_t& model, const std::string& filename) {
+    auto root = model.getRoot();
+    if (!root) return false;
+
+    // Pass 1: distinct geometries, materials and (geometry, material) meshes
+    geometry_table_t geometries;
+    std::map<color_key_t, size_t> materials;
+    std::map<std::pair<size_t, size_t>, size_t> meshes;
+    std::vector<std::pair<size_t, size_t>> meshList;
+    std::vector<color_key_t> materialList;
+    size_t nodeCount = 0;
+    {
+        std::deque<model_node_t*> queue{ root.get() };
+        while (!queue.empty()) {
+            model_node_t* node = queue.front();
+            queue.pop_front();
+            ++nodeCount;
+            if (node->shape) {
+                size_t g = geometries.lookup(node->shape);
+                color_key_t c = nodeColor(*node);
+                auto mat = materials.emplace(c, materialList.size());
+                if (mat.second) materialList.push_back(c);
+                auto mesh = meshes.emplace(std::make_pair(g, mat.first->second), meshList.size());
+                if (mesh.second) meshList.push_back(mesh.first->first);
+            }
+            for (auto& child : node->children) queue.push_back(child.get());
+            if (node->prefab && node->prefab->root) queue.push_back(node->prefab->root.get());
+        }
+    }
+
+    // BIN layout: positions (vec3 float) then indices (uint32) per geometry, 4-byte aligned
+    uint64_t binSize = 0;
+    for (auto& g : geometries.entries) {
+        g.positionOffset = binSize;
+        binSize += g.shape->vertices.size() * 3 * sizeof(float);
+        g.indexOffset = binSize;
+        binSize += g.shape->indices.size() * sizeof(uint32_t);
+    }
+
+    buffered_writer_t out(filename);
+    if (!out.isOpen()) {
+        std::cout << "Failed to export model to " << filename << std::endl;
+        return false;
+    }
+
+    // Header and JSON chunk header; lengths are patched once known
+    out.writeU32(0x46546C67); // "glTF"
+    out.writeU32(2);
+    out.writeU32(0);          // total length
+    out.writeU32(0);          // JSON chunk length
+    out.writeU32(0x4E4F534A); // "JSON"
+    uint64_t jsonStart = out.tell();
+
+    out.text("{\"asset\":{\"version\":\"2.0\",\"generator\":\"modeller\"},\"scene\":0,\"scenes\":[{\"nodes\":[0]}],\"nodes\":[");
+
+    // Pass 2: stream nodes in breadth-first order so each node's children are a contiguous index range
+    {
+        std::deque<model_node_t*> queue{ root.get() };
+        uint64_t index = 0, nextChild = 1;
+        while (!queue.empty()) {
+            model_node_t* node = queue.front();
+            queue.pop_front();
+            if (index++) out.text(",");
+            out.text("{\"name\":\"");
+            out.text(node->shape ? shapeTypeToString(node->type) : node->prefab ? node->prefab->name : std::string("Root"));
+            out.text(" ");
+            out.number(uint64_t(node->id));
+            out.text("\"");
+            if (node->shape) {
+                size_t g = geometries.lookup(node->shape);
+                size_t mat = materials[nodeColor(*node)];
+                out.text(",\"mesh\":");
+                out.number(uint64_t(meshes[std::make_pair(g, mat)]));
+            }
+            writeTRS(out, *node);
+            // glTF nodes have one parent each, so every instance gets its own copy of the prefab
+            std::vector<model_node_t*> children;
+            for (auto& child : node->children) children.push_back(child.get());
+            if (node->prefab && node->prefab->root) children.push_back(node->prefab->root.get());
+            if (!children.empty()) {
+                out.text(",\"children\":[");
+                for (size_t c = 0; c < children.size(); ++c) {
+                    if (c) out.text(",");
+                    out.number(nextChild++);
+                    queue.push_back(children[c]);
+                }
+                out.text("]");
+            }
+            out.text("}");
+        }
+    }
+    out.text("]");
+
+    if (!meshList.empty()) {
+        out.text(",\"meshes\":[");
+        for (size_t m = 0; m < meshList.size(); ++m) {
+            if (m) out.text(",");
+            out.text("{\"primitives\":[{\"attributes\":{\"POSITION\":");
+            out.number(uint64_t(meshList[m].first * 2));
+            out.text("},\"indices\":");
+            out.number(uint64_t(meshList[m].first * 2 + 1));
+            out.text(",\"material\":");
+            out.number(uint64_t(meshList[m].second));
+            out.text("}]}");
+        }
+        out.text("],\"materials\":[");
+        for (size_t m = 0; m < materialList.size(); ++m) {
+            if (m) out.text(",");
+            out.text("{\"pbrMetallicRoughness\":{\"baseColorFactor\":[");
+            for (int k = 0; k < 4; ++k) {
+                if (k) out.text(",");
+                out.number(materialList[m][k]);
+            }
+            out.text("],\"metallicFactor\":0,\"roughnessFactor\":1}}");
+        }
+        out.text("],\"accessors\":[");
+        for (size_t g = 0; g < geometries.entries.size(); ++g) {
+            const auto& geo = geometries.entries[g];
+            if (g) out.text(",");
+            out.text("{\"bufferView\":");
+            out.number(uint64_t(g * 2));
+            out.text(",\"componentType\":5126,\"type\":\"VEC3\",\"count\":");
+            out.number(uint64_t(geo.shape->vertices.size()));
+            out.text(",\"min\":[");
+            out.number(geo.minPos.x); out.text(","); out.number(geo.minPos.y); out.text(","); out.number(geo.minPos.z);
+            out.text("],\"max\":[");
+            out.number(geo.maxPos.x); out.text(","); out.number(geo.maxPos.y); out.text(","); out.number(geo.maxPos.z);
+            out.text("]},{\"bufferView\":");
+            out.number(uint64_t(g * 2 + 1));
+            out.text(",\"componentType\":5125,\"type\":\"SCALAR\",\"count\":");
+            out.number(uint64_t(geo.shape->indices.size()));
+            out.text("}");
+        }
+        out.text("],\"bufferViews\":[");
+        for (size_t g = 0; g < geometries.entries.size(); ++g) {
+            const auto& geo = geometries.entries[g];
+            if (g) out.text(",");
+            out.text("{\"buffer\":0,\"byteOffset\":");
+            out.number(geo.positionOffset);
+            out.text(",\"byteLength\":");
+            out.number(uint64_t(geo.shape->vertices.size() * 3 * sizeof(float)));
+            out.text(",\"target\":34962},{\"buffer\":0,\"byteOffset\":");
+            out.number(geo.indexOffset);
+            out.text(",\"byteLength\":");
+            out.number(uint64_t(geo.shape->indices.size() * sizeof(uint32_t)));
+            out.text(",\"target\":34963}");
+        }
+        out.text("],\"buffers\":[{\"byteLength\":");
+        out.number(binSize);
+        out.text("}]");
+    }
+    out.text("}");
+    while ((out.tell() - jsonStart) % 4) out.text(" ");
+    out.patchU32(12, uint32_t(out.tell() - jsonStart));
+
+    if (binSize > 0) {
+        out.writeU32(uint32_t(binSize));
+        out.writeU32(0x004E4942); // "BIN\0"
+        for (const auto& geo : geometries.entries) {
+            for (const auto& v : geo.shape->vertices) {
+                out.writeF32(v.x);
+                out.writeF32(v.y);
+                out.writeF32(v.z);
+            }
+            out.write(geo.shape->indices.data(), geo.shape->indices.size() * sizeof(uint32_t));
+        }
+    }
+    out.patchU32(8, uint32_t(out.tell()));
+
+    if (!out.close()) {
+        std::cout << "Failed to export model to " << filename << std::endl;
+        return false;
+    }
+    std::cout << "Exported " << nodeCount << " nodes (" << geometries.entries.size()
+              << " shared meshes) to " << filename << std::endl;
+    return true;
+}
+
+bool exportOBJ(model_t& model, const std::string& filename) {
+    auto root = model.getRoot();
+    if (!root) return false;
+
+    std::string base = filename.substr(0, filename.find_last_of('.'));
+    std::string mtlName = base + ".mtl";
+    std::string mtlFile = mtlName.substr(mtlName.find_last_of("/\\") + 1);
+
+    buffered_writer_t out(filename);
+    buffered_writer_t mtl(mtlName);
+    if (!out.isOpen() || !mtl.isOpen()) {
+        std::cout << "Failed to export model to " << filename << std::endl;
+        return false;
+    }
+    out.text("# modeller OBJ export, world transforms baked\nmtllib ");
+    out.text(mtlFile);
+    out.text("\n");
+
+    geometry_table_t geometries;
+    std::map<color_key_t, size_t> materials;
+    uint64_t vertexBase = 1; // OBJ indices are 1-based and global
+    size_t written = 0;
+
+    // Depth-first with an explicit stack carrying the parent's world matrix
+    std::vector<std::pair<model_node_t*, glm::mat4>> stack{ { root.get(), glm::mat4(1.0f) } };
+    while (!stack.empty()) {
+        model_node_t* node = stack.back().first;
+        glm::mat4 world = stack.back().second * node->getTransform();
+        stack.pop_back();
+        for (auto it = node->children.rbegin(); it != node->children.rend(); ++it)
+            stack.emplace_back(it->get(), world);
+        if (node->prefab && node->prefab->root) stack.emplace_back(node->prefab->root.get(), world);
+        if (!node->shape) continue;
+
+        const shape_t& shape = *geometries.entries[geometries.lookup(node->shape)].shape;
+
+        color_key_t color = nodeColor(*node);
+        auto mat = materials.emplace(color, materials.size());
+        if (mat.second) {
+            mtl.text("newmtl mat");
+            mtl.number(uint64_t(mat.first->second));
+            mtl.text("\nKd ");
+            mtl.number(color[0]); mtl.text(" "); mtl.number(color[1]); mtl.text(" "); mtl.number(color[2]);
+            mtl.text("\nd ");
+            mtl.number(color[3]);
+            mtl.text("\n\n");
+        }
+
+        out.text("o ");
+        out.text(shapeTypeToString(node->type));
+        out.text("_");
+        out.number(uint64_t(node->id));
+        out.text("\nusemtl mat");
+        out.number(uint64_t(mat.first->second));
+        out.text("\n");
+        for (const auto& v : shape.vertices) {
+            glm::vec4 p = world * glm::vec4(glm::vec3(v), 1.0f);
+            out.text("v ");
+            out.number(p.x); out.text(" "); out.number(p.y); out.text(" "); out.number(p.z);
+            out.text("\n");
+        }
+        for (size_t i = 0; i + 2 < shape.indices.size(); i += 3) {
+            out.text("f ");
+            out.number(vertexBase + shape.indices[i]); out.text(" ");
+            out.number(vertexBase + shape.indices[i + 1]); out.text(" ");
+            out.number(vertexBase + shape.indices[i + 2]);
+            out.text("\n");
+        }
+        vertexBase += shape.vertices.size();
+        ++written;
+    }
+
+    bool ok = out.close() && mtl.close();
+    if (!ok) {
+        std::cout << "Failed to export model to " << filename << std::endl;
+        return false;
+    }
+    std::cout << "Exported " << written << " shapes to " << filename << std::endl;
+    return true;
+}
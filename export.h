@@ -0,0 +1,49 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "memory_stats.h"
+
+class model_t;
+
+// Fixed-size write buffer over a FILE*, so exporters never hold a whole file in memory.
+// patchU32() rewrites a length field that was only known after streaming the data behind it.
+class buffered_writer_t {
+public:
+    static const size_t BUFFER_SIZE = 1 << 20;
+
+    explicit buffered_writer_t(const std::string& filename);
+    ~buffered_writer_t();
+
+    bool isOpen() const { return file != nullptr; }
+    void write(const void* data, size_t size);
+    void writeU32(uint32_t v) { write(&v, sizeof(v)); }
+    void writeF32(float v) { write(&v, sizeof(v)); }
+    void text(const char* s);
+    void text(const std::string& s) { write(s.data(), s.size()); }
+    void number(float v);
+    void number(uint64_t v);
+    uint64_t tell() const { return written; }
+    void patchU32(uint64_t offset, uint32_t v);
+    bool close();
+
+private:
+    FILE* file = nullptr;
+    io_vector_t<char> buffer;
+    uint64_t written = 0;
+    bool failed = false;
+
+    void flush();
+};
+
+// glTF 2.0 binary: node tree preserved, one mesh per (shape type, level, color),
+// geometry per (shape type, level) written once into the BIN chunk
+bool exportGLB(model_t& model, const std::string& filename);
+
+// Wavefront OBJ + .mtl with world transforms baked into the vertices
+bool exportOBJ(model_t& model, const std::string& filename);
+
+#endif
@@ -1,8 +1,59 @@
 #version 330 core
-out vec4 FragColor;
-in vec4 color;
-outvec4 fag_color;
-void main() {
-    frag_Color = color
+in vec4 fragColor;
+out vec4 color;
 
+#ifdef CLUSTERED_LIGHTS
+// Point lights of the model, binned per froxel on the CPU (clustered_lights.cpp)
+in vec3 worldPos;
+in vec3 worldNormal;
+in vec4 baseColor;
+in float viewDepth;
+
+uniform samplerBuffer lightData;       // per light: position + radius, color
+uniform usamplerBuffer clusterRanges;  // per cluster: first index, light count
+uniform usamplerBuffer lightIndices;
+uniform ivec3 clusterGrid;
+uniform vec2 viewportSize;
+uniform float clusterNear;
+uniform float clusterSliceScale;       // slices per unit of log(depth / near)
+
+uniform vec3 viewPos;
+uniform float diffuseStrength;
+uniform float specularStrength;
+uniform float shininess;
+
+// Same as lightFalloff() in clustered_lights.h
+float lightFalloff(float distance, float radius) {
+    float x = distance / radius;
+    float window = clamp(1.0 - x * x * x * x, 0.0, 1.0);
+    return window * window / (1.0 + distance * distance);
+}
+#endif
+
+void main()
+{
+    color = fragColor;
+#ifdef CLUSTERED_LIGHTS
+    ivec3 cell;
+    cell.xy = clamp(ivec2(gl_FragCoord.xy / viewportSize * vec2(clusterGrid.xy)), ivec2(0), clusterGrid.xy - 1);
+    cell.z = clamp(int(log(viewDepth / clusterNear) * clusterSliceScale), 0, clusterGrid.z - 1);
+    int cluster = (cell.z * clusterGrid.y + cell.y) * clusterGrid.x + cell.x;
+    uvec2 range = texelFetch(clusterRanges, cluster).rg;
+
+    vec3 n = normalize(worldNormal);
+    vec3 viewDir = normalize(viewPos - worldPos);
+    vec3 lit = vec3(0.0);
+    for (uint i = 0u; i < range.y; ++i) {
+        int l = int(texelFetch(lightIndices, int(range.x + i)).r);
+        vec4 light = texelFetch(lightData, 2 * l);
+        vec3 toLight = light.xyz - worldPos;
+        float d = length(toLight);
+        if (d >= light.w) continue;
+        vec3 lightDir = toLight / max(d, 1e-4);
+        float diff = max(dot(n, lightDir), 0.0);
+        float spec = pow(max(dot(viewDir, reflect(-lightDir, n)), 0.0), shininess);
+        lit += lightFalloff(d, light.w) * (diffuseStrength * diff + specularStrength * spec) * texelFetch(lightData, 2 * l + 1).rgb;
+    }
+    color.rgb += lit * baseColor.rgb;
+#endif
 }
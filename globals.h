@@ -1,6 +1,7 @@
 #pragma once
 #include <glm/glm.hpp>
 #include <GL/glew.h>
+#include <memory>
 
 extern int selectedShapeId;       // ID of the currently selected shape
 extern bool transformParentMode;  // whether to transform parent instead of shape
@@ -15,6 +16,12 @@ enum TransformMode { NONE, ROTATE, TRANSLATE, SCALE };
 extern Mode currentMode;
 extern TransformMode transformMode;
 extern char activeAxis;
+extern bool Wireframe;            // W key: polygon mode, honoured by every render backend
+extern bool vertexPulling;        // F2: GL backend draws primitives from gl_VertexID instead of buffers
+extern bool lodEnabled;           // 7: draw simplified levels of large meshes when they are far away
+extern float lodPixelError;       // largest on-screen error, in pixels, a simplified level may show
+extern bool occlusionCulling;     // 8: skip nodes hidden behind large boxes or outside the view (occlusion.h)
+extern bool sortedSubmission;     // F7: draw through the sorted render queue (render_queue.h), not in hierarchy order
 struct model_node_t;
 struct model_t; 
 extern std::shared_ptr<model_t> currentModel;
@@ -23,6 +30,9 @@ extern std::shared_ptr<model_node_t> currentNode;
 extern float cameraDistance, cameraAngleX, cameraAngleY;
 extern glm::mat4 modelRotation;
 
+extern bool screenshotRequested;  // F12: main loop writes screenshot.ppm after the next frame
+extern bool syncCheckRequested;   // F9: a serving instance (--serve) sends clients a digest to check their replica
+
 extern bool lightingEnabled;
 extern glm::vec3 lightPosition;
 extern glm:: vec3 lightColor;
@@ -0,0 +1,248 @@
+#include "gpu_resources.h"
+#include "shape.h"
+#include <iostream>
+#include <utility>
+
+gpu_buffer_t::gpu_buffer_t(gpu_buffer_t&& other) noexcept
+    : name(other.name), size(other.size), category(other.category) {
+    other.name = 0;
+    other.size = 0;
+}
+
+gpu_buffer_t& gpu_buffer_t::operator=(gpu_buffer_t&& other) noexcept {
+    if (this != &other) {
+        reset();
+        name = std::exchange(other.name, 0);
+        size = std::exchange(other.size, 0);
+        category = other.category;
+    }
+    return *this;
+}
+
+void gpu_buffer_t::upload(GLenum target, size_t newSize, const void* data, GLenum usage) {
+    if (!name) name = gpuResources().createBuffer();
+    glBindBuffer(target, name);
+    glBufferData(target, newSize, data, usage);
+    gpuResources().resized(category, size, newSize);
+    size = newSize;
+}
+
+void gpu_buffer_t::allocate(GLenum target, size_t newSize, GLbitfield flags) {
+    reset();
+    name = gpuResources().createBuffer();
+    glBindBuffer(target, name);
+    glBufferStorage(target, newSize, nullptr, flags);
+    gpuResources().resized(category, 0, newSize);
+    size = newSize;
+}
+
+void gpu_buffer_t::update(GLenum target, size_t offset, size_t length, const void* data) {
+    if (!name || offset + length > size) return;
+    glBindBuffer(target, name);
+    glBufferSubData(target, offset, length, data);
+}
+
+void gpu_buffer_t::read(GLenum target, void* data) const {
+    if (!name) return;
+    glBindBuffer(target, name);
+    glGetBufferSubData(target, 0, size, data);
+}
+
+void gpu_buffer_t::reset() {
+    if (!name) return;
+    gpuResources().retireBuffer(name, category, size);
+    name = 0;
+    size = 0;
+}
+
+void* gpu_stream_buffer_t::map(size_t size) {
+    // Some slack, so a scene that grows a little doesn't reallocate every frame
+    size_t wanted = (size + size / 4 + 255) & ~size_t(255);
+    if (GLEW_ARB_buffer_storage) {
+        if (!mapped || size > regionSize) {
+            reset();
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            regionSize = wanted;
+            buffer.allocate(GL_TEXTURE_BUFFER, regionSize * REGIONS, flags);
+            mapped = static_cast<uint8_t*>(glMapBufferRange(GL_TEXTURE_BUFFER, 0, regionSize * REGIONS, flags));
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+            if (!mapped) {
+                reset();
+                return nullptr;
+            }
+        }
+        region = (region + 1) % REGIONS;
+        if (fences[region]) {
+            // Three frames back; normally long done
+            glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+            glDeleteSync(fences[region]);
+            fences[region] = nullptr;
+        }
+        writing = true;
+        return mapped + region * regionSize;
+    }
+
+    if (size > buffer.bytes()) buffer.upload(GL_TEXTURE_BUFFER, wanted, nullptr, GL_STREAM_DRAW);
+    else glBindBuffer(GL_TEXTURE_BUFFER, buffer.id());
+    void* data = glMapBufferRange(GL_TEXTURE_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    writing = data != nullptr;
+    return data;
+}
+
+size_t gpu_stream_buffer_t::unmap() {
+    if (!writing) return 0;
+    writing = false;
+    if (mapped) return region * regionSize;
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer.id());
+    glUnmapBuffer(GL_TEXTURE_BUFFER);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    return 0;
+}
+
+void gpu_stream_buffer_t::fence() {
+    if (!mapped) return;
+    if (fences[region]) glDeleteSync(fences[region]);
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void gpu_stream_buffer_t::reset() {
+    for (GLsync& f : fences) {
+        if (f) glDeleteSync(f);
+        f = nullptr;
+    }
+    if (buffer && (mapped || writing)) {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer.id());
+        glUnmapBuffer(GL_TEXTURE_BUFFER);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+    mapped = nullptr;
+    writing = false;
+    regionSize = 0;
+    buffer.reset();
+}
+
+void gpu_vertex_array_t::bind() {
+    if (!name) name = gpuResources().createVertexArray();
+    glBindVertexArray(name);
+}
+
+void gpu_vertex_array_t::reset() {
+    if (!name) return;
+    gpuResources().retireVertexArray(name);
+    name = 0;
+}
+
+void gpu_mesh_t::release() {
+    gpuResources().unlink(*this);
+    vao.reset();
+    positions.reset();
+    colors.reset();
+    normals.reset();
+    indices.reset();
+}
+
+GLuint gpu_resource_manager_t::createBuffer() {
+    GLuint name = 0;
+    glGenBuffers(1, &name);
+    ++buffers;
+    return name;
+}
+
+GLuint gpu_resource_manager_t::createVertexArray() {
+    GLuint name = 0;
+    glGenVertexArrays(1, &name);
+    ++vertexArrays;
+    return name;
+}
+
+void gpu_resource_manager_t::retireBuffer(GLuint name, GpuCategory category, size_t size) {
+    live[category] -= size;
+    pending += size;
+    retired.push_back({ name, false, size, frame });
+}
+
+void gpu_resource_manager_t::retireVertexArray(GLuint name) {
+    retired.push_back({ name, true, 0, frame });
+}
+
+void gpu_resource_manager_t::resized(GpuCategory category, size_t oldSize, size_t newSize) {
+    live[category] += newSize;
+    live[category] -= oldSize;
+}
+
+void gpu_resource_manager_t::touch(gpu_mesh_t& mesh) {
+    mesh.lastDrawn = frame;
+    if (mostRecent == &mesh) return;
+    unlink(mesh);
+    mesh.next = mostRecent;
+    if (mostRecent) mostRecent->prev = &mesh;
+    mostRecent = &mesh;
+    if (!leastRecent) leastRecent = &mesh;
+    mesh.linked = true;
+}
+
+void gpu_resource_manager_t::unlink(gpu_mesh_t& mesh) {
+    if (!mesh.linked) return;
+    if (mesh.prev) mesh.prev->next = mesh.next;
+    else mostRecent = mesh.next;
+    if (mesh.next) mesh.next->prev = mesh.prev;
+    else leastRecent = mesh.prev;
+    mesh.prev = mesh.next = nullptr;
+    mesh.linked = false;
+}
+
+size_t gpu_resource_manager_t::residentBytes() const {
+    size_t total = 0;
+    for (size_t bytes : live) total += bytes;
+    return total;
+}
+
+void gpu_resource_manager_t::endFrame() {
+    // Meshes drawn this frame stay even over budget, or they would be re-uploaded next frame
+    while (budget && residentBytes() > budget && leastRecent && leastRecent->lastDrawn < frame) {
+        gpu_mesh_t& victim = *leastRecent;
+        if (victim.owner) victim.owner->evictGeometry();
+        else victim.release();
+        ++evictions;
+    }
+    ++frame;
+    if (frame > framesInFlight) deleteRetired(frame - framesInFlight);
+}
+
+void gpu_resource_manager_t::collect() {
+    deleteRetired(frame + 1);
+}
+
+void gpu_resource_manager_t::deleteRetired(unsigned long long olderThan) {
+    while (!retired.empty() && retired.front().frame < olderThan) {
+        retired_t& r = retired.front();
+        if (r.vertexArray) {
+            glDeleteVertexArrays(1, &r.name);
+            --vertexArrays;
+        }
+        else {
+            glDeleteBuffers(1, &r.name);
+            pending -= r.size;
+            --buffers;
+        }
+        retired.pop_front();
+    }
+}
+
+void gpu_resource_manager_t::print() const {
+    std::cout << "VRAM: " << residentBytes() / 1024 << " KiB";
+    if (budget) std::cout << " of " << budget / 1024 << " KiB budget";
+    std::cout << " (vertices " << live[GPU_VERTICES] / 1024
+              << ", indices " << live[GPU_INDICES] / 1024
+              << ", lights " << live[GPU_LIGHTS] / 1024
+              << ", draw records " << live[GPU_DRAW_DATA] / 1024
+              << ") | " << buffers << " buffers, " << vertexArrays << " VAOs"
+              << " | awaiting delete: " << pending / 1024 << " KiB"
+              << " | evictions: " << evictions << std::endl;
+}
+
+gpu_resource_manager_t& gpuResources() {
+    static gpu_resource_manager_t* manager = new gpu_resource_manager_t();
+    return *manager;
+}
@@ -0,0 +1,200 @@
+#ifndef GPU_RESOURCES_H
+#define GPU_RESOURCES_H
+
+#include <GL/glew.h>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+class shape_t;
+
+// What a GL object's bytes are counted under in the VRAM stats
+enum GpuCategory {
+    GPU_VERTICES,   // positions, colors and normals
+    GPU_INDICES,
+    GPU_LIGHTS,     // clustered-lighting texture buffers
+    GPU_DRAW_DATA,  // per-draw records streamed every frame (render_queue.h)
+    GPU_CATEGORY_COUNT
+};
+
+// Owns one GL buffer object. Destroying or reset()ing it hands the name to gpuResources(),
+// which deletes it once no frame in flight can still be reading it.
+class gpu_buffer_t {
+public:
+    explicit gpu_buffer_t(GpuCategory c = GPU_VERTICES) : category(c) {}
+    ~gpu_buffer_t() { reset(); }
+    gpu_buffer_t(gpu_buffer_t&& other) noexcept;
+    gpu_buffer_t& operator=(gpu_buffer_t&& other) noexcept;
+    gpu_buffer_t(const gpu_buffer_t&) = delete;
+    gpu_buffer_t& operator=(const gpu_buffer_t&) = delete;
+
+    // glBufferData, creating the buffer first if needed; leaves it bound to `target`
+    void upload(GLenum target, size_t size, const void* data, GLenum usage);
+    // glBufferStorage: immutable storage with `flags`, in a new buffer replacing this one;
+    // leaves it bound to `target`
+    void allocate(GLenum target, size_t size, GLbitfield flags);
+    // glBufferSubData into the existing storage
+    void update(GLenum target, size_t offset, size_t size, const void* data);
+    // glGetBufferSubData: copies the whole buffer back into `data`, which holds bytes()
+    void read(GLenum target, void* data) const;
+    void reset();
+
+    GLuint id() const { return name; }
+    size_t bytes() const { return size; }
+    explicit operator bool() const { return name != 0; }
+
+private:
+    GLuint name = 0;
+    size_t size = 0;
+    GpuCategory category;
+};
+
+// A buffer the CPU rewrites every frame while GL may still be reading earlier frames' data.
+// With ARB_buffer_storage it is mapped once, persistently and coherently, and split into
+// REGIONS regions used in turn; each is fenced after its frame's draws and waited on before it
+// is written again. Without it every frame orphans the storage and maps it anew.
+// map(), unmap() and fence() belong to the GL thread; between map() and unmap() any thread
+// may write to what map() returned.
+class gpu_stream_buffer_t {
+public:
+    static const unsigned int REGIONS = 3;
+
+    explicit gpu_stream_buffer_t(GpuCategory c) : buffer(c) {}
+    ~gpu_stream_buffer_t() { reset(); }
+    gpu_stream_buffer_t(const gpu_stream_buffer_t&) = delete;
+    gpu_stream_buffer_t& operator=(const gpu_stream_buffer_t&) = delete;
+
+    // `size` bytes to write this frame; null if the buffer can't be mapped
+    void* map(size_t size);
+    // Ends the writes; returns the byte offset of this frame's data in the buffer
+    size_t unmap();
+    // Once the draws reading this frame's data are issued
+    void fence();
+    void reset();
+
+    GLuint id() const { return buffer.id(); }
+    bool persistent() const { return mapped != nullptr; }
+    // Largest map() the current storage takes without being reallocated
+    size_t capacity() const { return persistent() ? regionSize : buffer.bytes(); }
+
+private:
+    gpu_buffer_t buffer;
+    uint8_t* mapped = nullptr;  // the whole persistent mapping
+    size_t regionSize = 0;
+    unsigned int region = 0;
+    GLsync fences[REGIONS] = {};
+    bool writing = false;
+};
+
+// Owns one vertex array object, released the same deferred way as gpu_buffer_t
+class gpu_vertex_array_t {
+public:
+    gpu_vertex_array_t() = default;
+    ~gpu_vertex_array_t() { reset(); }
+    gpu_vertex_array_t(const gpu_vertex_array_t&) = delete;
+    gpu_vertex_array_t& operator=(const gpu_vertex_array_t&) = delete;
+
+    // Creates the VAO if needed and binds it
+    void bind();
+    void reset();
+
+    GLuint id() const { return name; }
+    explicit operator bool() const { return name != 0; }
+
+private:
+    GLuint name = 0;
+};
+
+// A shape's GPU copy. While resident it sits in the manager's least-recently-drawn list,
+// which is what the VRAM budget evicts from.
+struct gpu_mesh_t {
+    gpu_vertex_array_t vao;
+    gpu_buffer_t positions{ GPU_VERTICES };
+    gpu_buffer_t colors{ GPU_VERTICES };
+    gpu_buffer_t normals{ GPU_VERTICES };
+    gpu_buffer_t indices{ GPU_INDICES };
+
+    shape_t* owner = nullptr;
+    unsigned long long lastDrawn = 0;   // gpuResources() frame number
+    gpu_mesh_t* prev = nullptr;
+    gpu_mesh_t* next = nullptr;
+    bool linked = false;
+
+    gpu_mesh_t() = default;
+    ~gpu_mesh_t() { release(); }
+    gpu_mesh_t(const gpu_mesh_t&) = delete;
+    gpu_mesh_t& operator=(const gpu_mesh_t&) = delete;
+
+    bool resident() const { return bool(vao); }
+    size_t bytes() const { return positions.bytes() + colors.bytes() + normals.bytes() + indices.bytes(); }
+    void release();
+};
+
+// Creates and deletes every GL buffer and VAO the renderer uses and keeps count of them.
+// Released names wait framesInFlight frames before glDelete*, and when resident bytes go
+// over the budget the least recently drawn meshes are evicted: their GPU copy is dropped
+// and, for primitives, the CPU copy too, since generateGeometry() can rebuild it.
+class gpu_resource_manager_t {
+public:
+    unsigned int framesInFlight = 2;
+    // Shapes drop their CPU geometry once it is uploaded. Primitives regenerate it and other
+    // shapes read it back from their buffers when something needs it (shape_t::ensureGeometry()).
+    bool releaseCpuGeometry = false;
+
+    GLuint createBuffer();
+    GLuint createVertexArray();
+    void retireBuffer(GLuint name, GpuCategory category, size_t size);
+    void retireVertexArray(GLuint name);
+    // Bookkeeping for glBufferData on a live buffer
+    void resized(GpuCategory category, size_t oldSize, size_t newSize);
+
+    // Marks a mesh as drawn this frame
+    void touch(gpu_mesh_t& mesh);
+    void unlink(gpu_mesh_t& mesh);
+
+    // Called once per frame by the GL backend: evicts down to the budget, then deletes
+    // whatever has been retired for long enough
+    void endFrame();
+    // Deletes everything retired so far, regardless of age (the context is going away)
+    void collect();
+
+    void setBudget(size_t bytes) { budget = bytes; }   // 0 = unlimited
+    size_t getBudget() const { return budget; }
+
+    size_t residentBytes() const;
+    size_t categoryBytes(GpuCategory category) const { return live[category]; }
+    size_t pendingBytes() const { return pending; }
+    size_t bufferCount() const { return buffers; }
+    size_t vertexArrayCount() const { return vertexArrays; }
+    size_t evictionCount() const { return evictions; }
+    unsigned long long frameNumber() const { return frame; }
+
+    void print() const;
+
+private:
+    struct retired_t {
+        GLuint name;
+        bool vertexArray;
+        size_t size;
+        unsigned long long frame;
+    };
+    std::deque<retired_t> retired;  // in retirement order, so oldest first
+
+    size_t live[GPU_CATEGORY_COUNT] = {};
+    size_t pending = 0;
+    size_t buffers = 0, vertexArrays = 0;
+    size_t evictions = 0;
+    size_t budget = 0;
+    unsigned long long frame = 1;
+
+    gpu_mesh_t* mostRecent = nullptr;
+    gpu_mesh_t* leastRecent = nullptr;
+
+    void deleteRetired(unsigned long long olderThan);
+};
+
+// The one manager for the GL context. Never destroyed, so shapes released after the
+// context is gone only queue their names.
+gpu_resource_manager_t& gpuResources();
+
+#endif
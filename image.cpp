@@ -0,0 +1,50 @@
+#include "image.h"
+#include <fstream>
+#include <iostream>
+#include <cstdlib>
+
+bool writePPM(const std::string& filename, const image_t& img) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cout << "Failed to write image " << filename << std::endl;
+        return false;
+    }
+    file << "P6\n" << img.width << " " << img.height << "\n255\n";
+    file.write(reinterpret_cast<const char*>(img.rgb.data()), img.rgb.size());
+    return true;
+}
+
+bool readPPM(const std::string& filename, image_t& img) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cout << "Failed to read image " << filename << std::endl;
+        return false;
+    }
+    std::string magic;
+    int maxval = 0;
+    file >> magic >> img.width >> img.height >> maxval;
+    if (magic != "P6" || maxval != 255 || img.width <= 0 || img.height <= 0) {
+        std::cout << "Unsupported PPM file " << filename << std::endl;
+        return false;
+    }
+    file.get(); // single whitespace after header
+    img.rgb.resize(size_t(img.width) * img.height * 3);
+    file.read(reinterpret_cast<char*>(img.rgb.data()), img.rgb.size());
+    return bool(file);
+}
+
+double compareImages(const image_t& a, const image_t& b, int tolerance) {
+    if (a.width != b.width || a.height != b.height || a.rgb.empty()) return 1.0;
+
+    size_t pixels = size_t(a.width) * a.height;
+    size_t mismatched = 0;
+    for (size_t p = 0; p < pixels; ++p) {
+        int diff = 0;
+        for (int c = 0; c < 3; ++c) {
+            int d = std::abs(int(a.rgb[p * 3 + c]) - int(b.rgb[p * 3 + c]));
+            if (d > diff) diff = d;
+        }
+        if (diff > tolerance) ++mismatched;
+    }
+    return double(mismatched) / double(pixels);
+}
@@ -0,0 +1,25 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// 8-bit RGB image, rows stored top to bottom
+struct image_t {
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> rgb;
+
+    image_t() = default;
+    image_t(int w, int h) : width(w), height(h), rgb(size_t(w) * h * 3, 0) {}
+};
+
+bool writePPM(const std::string& filename, const image_t& img);
+bool readPPM(const std::string& filename, image_t& img);
+
+// Returns the fraction of pixels whose largest channel difference exceeds tolerance
+// (0..255), or 1.0 if the images have different sizes.
+double compareImages(const image_t& a, const image_t& b, int tolerance);
+
+#endif
@@ -3,15 +3,48 @@
 #include <glm/glm.hpp>   
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <chrono>
+#include <future>
 #include <iostream>
 #include "shape.h"
 #include "globals.h"
 #include "input.h"
 #include "HIERARCHIAL.h"
+#include "static_batch.h"
+#include "renderer.h"
+#include "export.h"
+#include "mesh.h"
+#include "memory_stats.h"
+#include "render_queue.h"
 
 
 bool Wireframe = false;
+bool vertexPulling = false;
 bool tesselationMode = false;
+static bool hasExtension(const std::string& filename, const std::string& ext) {
+    return filename.size() >= ext.size() &&
+        filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+// L loads into a model of its own on another thread; the current one stays on screen, and
+// editable, until finishBackgroundLoad() swaps the result in
+static std::future<std::shared_ptr<model_t>> pendingLoad;
+
+bool finishBackgroundLoad(bool wait) {
+    if (!pendingLoad.valid()) return false;
+    if (!wait && pendingLoad.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return false;
+    std::shared_ptr<model_t> loaded = pendingLoad.get();
+    if (!loaded) return true;
+    currentModel = loaded;
+    currentNode = currentModel->getLastNode();
+    // Reset camera to view loaded model
+    cameraDistance = 5.0f;
+    cameraAngleX = 0.0f;
+    cameraAngleY = 0.0f;
+    modelRotation = glm::mat4(1.0f);
+    return true;
+}
+
 shape_t* getCurrentShape() {
     if (currentNode && currentNode->shape) {
         return currentNode->shape.get();  // unique_ptr -> raw pointer
@@ -35,31 +68,37 @@ void applyTransform(int direction) {
     if (transformParentMode && targetNode->parent.lock())
         targetNode = targetNode->parent.lock();
 
+    // A frozen batch holding this node would draw it in its old place
+    if (transformMode != NONE) currentModel->invalidateBatches(*targetNode);
+
     float step = 0.1f;
     float angle = glm::radians(5.0f);
 
     switch (transformMode) {
     case TRANSLATE:
-        if (activeAxis == 'X') targetNode->translation = glm::translate(targetNode->translation, glm::vec3(direction * step, 0, 0));
-        if (activeAxis == 'Y') targetNode->translation = glm::translate(targetNode->translation, glm::vec3(0, direction * step, 0));
-        if (activeAxis == 'Z') targetNode->translation = glm::translate(targetNode->translation, glm::vec3(0, 0, direction * step));
+        if (activeAxis == 'X') targetNode->translation.x += direction * step;
+        if (activeAxis == 'Y') targetNode->translation.y += direction * step;
+        if (activeAxis == 'Z') targetNode->translation.z += direction * step;
         break;
 
-    case ROTATE:
-        if (activeAxis == 'X') targetNode->rotation = glm::rotate(targetNode->rotation, direction * angle, glm::vec3(1, 0, 0));
-        if (activeAxis == 'Y') targetNode->rotation = glm::rotate(targetNode->rotation, direction * angle, glm::vec3(0, 1, 0));
-        if (activeAxis == 'Z') targetNode->rotation = glm::rotate(targetNode->rotation, direction * angle, glm::vec3(0, 0, 1));
+    case ROTATE: {
+        // Rotate about the node's own axis; renormalize so repeated steps don't drift
+        glm::vec3 axis(activeAxis == 'X', activeAxis == 'Y', activeAxis == 'Z');
+        if (axis != glm::vec3(0.0f))
+            targetNode->rotation = glm::normalize(targetNode->rotation * glm::angleAxis(direction * angle, axis));
         break;
+    }
 
     case SCALE:
-        if (activeAxis == 'X') targetNode->scale = glm::scale(targetNode->scale, glm::vec3(1 + direction * 0.1f, 1, 1));
-        if (activeAxis == 'Y') targetNode->scale = glm::scale(targetNode->scale, glm::vec3(1, 1 + direction * 0.1f, 1));
-        if (activeAxis == 'Z') targetNode->scale = glm::scale(targetNode->scale, glm::vec3(1, 1, 1 + direction * 0.1f));
+        if (activeAxis == 'X') targetNode->scale.x *= 1 + direction * 0.1f;
+        if (activeAxis == 'Y') targetNode->scale.y *= 1 + direction * 0.1f;
+        if (activeAxis == 'Z') targetNode->scale.z *= 1 + direction * 0.1f;
         break;
 
     default:
         break;
     }
+    if (transformMode != NONE) currentModel->nodeMoved(*targetNode);
 }
 void setupOpenGL();
 void renderScene(GLuint shaderProgram);
@@ -81,11 +120,9 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
         std::cout << "Mode: INSPECTION" << std::endl;
     }
         else if(key== GLFW_KEY_N){
-lightingEnabled = lightingEnabled;
+lightingEnabled = !lightingEnabled;
             std::cout<<"lighting"<<(lightingEnabled? "ON":"OFF")<<std::endl;
-
-
-            
+    }
     else if (key == GLFW_KEY_W) {
         Wireframe = !Wireframe;
 
@@ -97,6 +134,61 @@ lightingEnabled = lightingEnabled;
             glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
         }
     }
+    else if (key == GLFW_KEY_F) {
+        renderStats.print();
+    }
+    else if (key == GLFW_KEY_F2) {
+        vertexPulling = !vertexPulling;
+        std::cout << "Vertex pulling " << (vertexPulling ? "ON" : "OFF") << std::endl;
+    }
+    else if (key == GLFW_KEY_F3) {
+        benchmarkDrawPaths(100);
+    }
+    else if (key == GLFW_KEY_F4) {
+        benchmarkClusteredLights(50);
+    }
+    else if (key == GLFW_KEY_F5) {
+        memoryStats().print();
+    }
+    else if (key == GLFW_KEY_F6) {
+        // Shapes already on the GPU drop theirs now; the rest as they are uploaded
+        gpu_resource_manager_t& gpu = gpuResources();
+        gpu.releaseCpuGeometry = !gpu.releaseCpuGeometry;
+        if (gpu.releaseCpuGeometry) {
+            for (const auto& n : currentModel->getShapes())
+                if (n->shape && n->shape->gpu.resident()) n->shape->dropCpuGeometry();
+        }
+        std::cout << "Drop CPU geometry after upload " << (gpu.releaseCpuGeometry ? "ON" : "OFF") << std::endl;
+    }
+    else if (key == GLFW_KEY_F7) {
+        sortedSubmission = !sortedSubmission;
+        std::cout << "Sorted render queue " << (sortedSubmission ? "ON" : "OFF") << std::endl;
+    }
+    else if (key == GLFW_KEY_F8) {
+        benchmarkRenderQueue(100000, 10);
+    }
+    else if (key == GLFW_KEY_F10) {
+        benchmarkDrawLists(100000, 10);
+    }
+    else if (key == GLFW_KEY_8) {
+        occlusionCulling = !occlusionCulling;
+        std::cout << "Occlusion culling " << (occlusionCulling ? "ON" : "OFF") << std::endl;
+    }
+    else if (key == GLFW_KEY_O) {
+        animation_t& anim = currentModel->animation;
+        anim.playing = !anim.playing && anim.active();
+        if (anim.playing) {
+            anim.time = 0.0f;
+            anim.bind(currentModel->getShapes());
+        }
+        std::cout << "Animation " << (anim.playing ? "playing" : "stopped") << std::endl;
+    }
+    else if (key == GLFW_KEY_F9) {
+        syncCheckRequested = true;
+    }
+    else if (key == GLFW_KEY_F12) {
+        screenshotRequested = true;
+    }
     else if (key == GLFW_KEY_ESCAPE) {
         glfwSetWindowShouldClose(window, GLFW_TRUE);
     }
@@ -137,7 +229,7 @@ break;
             std::cout<<"camera distance "<<cameraDistance<<"zoom in"<<std::endl;
             break;
         case GLFW_KEY_E:
-           cameraDistanc+-=0.5f;
+           cameraDistance+=0.5f;
             if(cameraDistance>20.0f)cameraDistance=20.0f;
             std::cout<<"camera distance "<<cameraDistance<<"zoom out"<<std::endl;
             break;
@@ -150,7 +242,7 @@ case GLFW_KEY_V: { // Select shape (robust)
     std::cout << "Available Shapes (ID : Type) ----------------\n";
     for (const auto &n : currentModel->getShapes()) {
         if (n)
-            std::cout << "  " << n->id << " : " << shapeTypeToString(n->type) << "\n";
+            std::cout << "  " << n->id << " : " << (n->prefab ? "Prefab " + n->prefab->name : shapeTypeToString(n->type)) << "\n";
     }
     std::cout << "-------------------------------------------\n";
 
@@ -260,7 +352,10 @@ case GLFW_KEY_P: { // Toggle parent transform mode
         std::cout << "Enter RGB values (0-1): ";
         std::cin >> r >> g >> b;
         if (currentNode && currentNode->shape) {
+            currentModel->invalidateBatches(*currentNode);
             currentNode->shape->setColor(glm::vec4(r, g, b, 1.0f));
+            currentNode->color = glm::vec4(r, g, b, 1.0f);
+            currentModel->nodeEdited(*currentNode);
         }
         break;
     }
@@ -270,10 +365,11 @@ case GLFW_KEY_P: { // Toggle parent transform mode
         if (tesselationMode) {
             std::cout << "TESSELLATION MODE ACTIVATED " << std::endl;
             std::cout << "Press number keys 1-4 to set tessellation level" << std::endl;
+            std::cout << "Press 9/0 to halve/double the max geometric error instead" << std::endl;
             std::cout << "Press A again to exit tessellation mode" << std::endl;
             if (currentNode && currentNode->shape) {
                 std::cout << "Current tessellation level: " << currentNode->shape->getLevel() << std::endl;
-                std::cout << "Current triangle count: " << currentNode->shape->indices.size() / 3 << std::endl;
+                std::cout << "Current triangle count: " << currentNode->shape->triangleCount() << std::endl;
             }
             else {
                 std::cout << "No shape selected!" << std::endl;
@@ -286,8 +382,10 @@ case GLFW_KEY_P: { // Toggle parent transform mode
 
     // Add shapes
     case GLFW_KEY_1: //add sphere
-        if (tesselationMode && currentNode && currentNode->shape) {
+        if (tesselationMode && currentNode && currentNode->shape && currentNode->shape->getType() != MESH_SHAPE) {
+            currentModel->invalidateBatches(*currentNode);
             currentNode->shape->setLevel(1);
+            currentModel->nodeEdited(*currentNode);
         }
         else if (!tesselationMode) {
             currentModel->addShape(std::make_unique<sphere_t>(1));
@@ -296,8 +394,10 @@ case GLFW_KEY_P: { // Toggle parent transform mode
         }
         break;
     case GLFW_KEY_2:  //add cylinder
-        if (tesselationMode && currentNode && currentNode->shape) {
+        if (tesselationMode && currentNode && currentNode->shape && currentNode->shape->getType() != MESH_SHAPE) {
+            currentModel->invalidateBatches(*currentNode);
             currentNode->shape->setLevel(2);
+            currentModel->nodeEdited(*currentNode);
         }
         else if (!tesselationMode) {
             currentModel->addShape(std::make_unique<cylinder_t>(1));
@@ -306,8 +406,10 @@ case GLFW_KEY_P: { // Toggle parent transform mode
         }
         break;
     case GLFW_KEY_3:  //add box
-        if (tesselationMode && currentNode && currentNode->shape) {
+        if (tesselationMode && currentNode && currentNode->shape && currentNode->shape->getType() != MESH_SHAPE) {
+            currentModel->invalidateBatches(*currentNode);
             currentNode->shape->setLevel(3);
+            currentModel->nodeEdited(*currentNode);
         }
         else if (!tesselationMode) {
             currentModel->addShape(std::make_unique<box_t>(1));
@@ -316,8 +418,10 @@ case GLFW_KEY_P: { // Toggle parent transform mode
         }
         break;
     case GLFW_KEY_4: // add cone
-        if (tesselationMode && currentNode && currentNode->shape) {
+        if (tesselationMode && currentNode && currentNode->shape && currentNode->shape->getType() != MESH_SHAPE) {
+            currentModel->invalidateBatches(*currentNode);
             currentNode->shape->setLevel(4);
+            currentModel->nodeEdited(*currentNode);
         }
         else if (!tesselationMode) {
             currentModel->addShape(std::make_unique<cone_t>(1));
@@ -325,6 +429,90 @@ case GLFW_KEY_P: { // Toggle parent transform mode
             std::cout << "Cone added\n";
         }
         break;
+    case GLFW_KEY_7:
+        lodEnabled = !lodEnabled;
+        std::cout << "Mesh LOD " << (lodEnabled ? "ON" : "OFF") << std::endl;
+        break;
+    case GLFW_KEY_9: // error-bounded tessellation: halve the allowed error
+    case GLFW_KEY_0: // ... or double it
+        if (tesselationMode && currentNode && currentNode->shape && currentNode->shape->getType() != MESH_SHAPE) {
+            shape_t& shape = *currentNode->shape;
+            float error = shape.isErrorBounded() ? shape.maxError * (key == GLFW_KEY_9 ? 0.5f : 2.0f) : 0.01f;
+            currentModel->invalidateBatches(*currentNode);
+            shape.setMaxError(error);
+            currentModel->nodeEdited(*currentNode);
+            std::cout << "Max tessellation error: " << error << " (" << shape.triangleCount() << " triangles)" << std::endl;
+        }
+        break;
+    case GLFW_KEY_6: { // import an external mesh (binary STL, PLY, OBJ)
+        if (tesselationMode) break;
+        std::string path;
+        std::cout << "Enter mesh file (.stl/.ply/.obj): ";
+        std::cin >> path;
+        auto mesh = std::make_unique<mesh_t>(path);
+        mesh->generateGeometry();
+        if (!mesh->isLoaded()) break;
+        currentModel->addShape(std::move(mesh));
+        currentNode = currentModel->getLastNode();
+        currentModel->generateLods();
+        std::cout << "Mesh added\n";
+        break;
+    }
+    case GLFW_KEY_K: { // keyframe the current node at the animation time, then step 1s ahead
+        if (!currentNode || currentNode == currentModel->getRoot()) {
+            std::cout << "Select a shape to keyframe" << std::endl;
+            break;
+        }
+        currentModel->invalidateBatches(*currentNode); // animated nodes are never baked
+        animation_t& anim = currentModel->animation;
+        animation_clip_t& clip = anim.clip("default");
+        const glm::quat& q = currentNode->rotation;
+        clip.setKey(currentNode->id, ANIM_POSITION, INTERP_LINEAR, anim.time, glm::vec4(currentNode->translation, 1.0f));
+        clip.setKey(currentNode->id, ANIM_ROTATION, INTERP_LINEAR, anim.time, glm::vec4(q.x, q.y, q.z, q.w));
+        clip.setKey(currentNode->id, ANIM_SCALE, INTERP_LINEAR, anim.time, glm::vec4(currentNode->scale, 1.0f));
+        std::cout << "Keyed node " << currentNode->id << " at t=" << anim.time << "s" << std::endl;
+        anim.time += 1.0f;
+        break;
+    }
+    case GLFW_KEY_B: { // freeze the current node's subtree into one draw, or unfreeze it
+        if (!currentNode) break;
+        if (currentNode->batch) {
+            currentModel->unfreezeSubtree(*currentNode);
+            std::cout << "Unfroze node " << currentNode->id << std::endl;
+        }
+        else if (currentModel->freezeSubtree(currentNode->id)) {
+            std::cout << "Froze node " << currentNode->id << ": " << currentNode->batch->nodeIds.size()
+                      << " shapes, " << currentNode->batch->triangleCount() << " triangles in one draw" << std::endl;
+        }
+        else {
+            std::cout << "Nothing to freeze under node " << currentNode->id << std::endl;
+        }
+        break;
+    }
+    case GLFW_KEY_D: { // list the nodes nearest the current one
+        if (!currentNode || currentNode == currentModel->getRoot()) {
+            std::cout << "Select a shape to search around" << std::endl;
+            break;
+        }
+        currentModel->updateWorldTransforms(glm::mat4(1.0f));
+        glm::vec3 center = 0.5f * (currentNode->worldMin + currentNode->worldMax);
+        std::vector<model_node_t*> nearest;
+        currentModel->queryNearest(center, 6, nearest);
+        std::cout << "Nearest to node " << currentNode->id << ":";
+        for (model_node_t* n : nearest)
+            if (n != currentNode.get()) std::cout << " " << n->id << " (" << shapeTypeToString(n->type) << ")";
+        std::cout << std::endl;
+        break;
+    }
+    case GLFW_KEY_H: // mark the current box as an occluder whatever its size on screen, or unmark it
+        if (!currentNode || !currentNode->shape || currentNode->shape->getType() != BOX_SHAPE) {
+            std::cout << "Only boxes can be occluders" << std::endl;
+            break;
+        }
+        currentNode->occluder = !currentNode->occluder;
+        currentModel->nodeEdited(*currentNode);
+        std::cout << "Node " << currentNode->id << (currentNode->occluder ? " marked" : " unmarked") << " as occluder" << std::endl;
+        break;
     case GLFW_KEY_5: // remove last added shape
        
         if (!tesselationMode) {
@@ -338,12 +526,23 @@ case GLFW_KEY_P: { // Toggle parent transform mode
     case GLFW_KEY_S: {
 
         std::string filename;
-        std::cout << "Enter filename (with .mod extension): ";
+        std::cout << "Enter filename (.mod, .modz compressed, or .glb/.obj to export): ";
         std::cin >> filename;
+        if (hasExtension(filename, ".glb")) {
+            exportGLB(*currentModel, filename);
+            break;
+        }
+        if (hasExtension(filename, ".obj")) {
+            exportOBJ(*currentModel, filename);
+            break;
+        }
         if (filename.find(".mod") == std::string::npos) {
             filename += ".mod";
         }
-        currentModel->save(filename);
+        // .modz: the compressed encoding (scene_codec.h)
+        save_options_t options;
+        options.compressed = hasExtension(filename, ".modz");
+        currentModel->save(filename, options);
         break;
     }
     }
@@ -354,17 +553,18 @@ void handleInspectionKeys(int key) {
 
     // Load model
     case GLFW_KEY_L: {
+        if (pendingLoad.valid()) {
+            std::cout << "Still loading the previous file" << std::endl;
+            break;
+        }
         std::string filename;
         std::cout << "Enter filename to load: ";
         std::cin >> filename;
-        if (currentModel->load(filename)) {
-            currentNode = currentModel->getLastNode();
-            // Reset camera to view loaded model
-            cameraDistance = 5.0f;
-            cameraAngleX = 0.0f;
-            cameraAngleY = 0.0f;
-            modelRotation = glm::mat4(1.0f);
-        }
+        pendingLoad = std::async(std::launch::async, [filename]() -> std::shared_ptr<model_t> {
+            auto model = std::make_shared<model_t>();
+            if (!model->load(filename)) return nullptr;
+            return model;
+        });
         break;
     }
 
@@ -8,5 +8,8 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 void handleModellingKeys(int key);
 void handleInspectionKeys(int key);
 void applyTransform(int direction);
+// Swaps in the model that L finished loading in the background, if there is one; once per frame.
+// True if a load finished, even one that failed; `wait` blocks until a pending load does.
+bool finishBackgroundLoad(bool wait = false);
 
 #endif
@@ -3,6 +3,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <chrono>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -11,6 +12,25 @@
 #include "input.h"
 #include "globals.h"
 #include "HIERARCHIAL.h"
+#include "renderer.h"
+#include "soft_raster.h"
+#include "image.h"
+#include "scene.h"
+#include "export.h"
+#include "shader.h"
+#include "baked_shapes.h"
+#include "thread_pool.h"
+#include "static_batch.h"
+#include "tessellation.h"
+#include "simplify.h"
+#include "occlusion.h"
+#include "render_snapshot.h"
+#include "scene_sync.h"
+#include "scene_codec.h"
+#include "procedural.h"
+#include "replay.h"
+#include "memory_stats.h"
+#include "render_queue.h"
 
 // Declare Global variables
 int selectedShapeId = -1;
@@ -31,6 +51,16 @@ float cameraDistance = 5.0f;
 float cameraAngleX = 0.0f;
 float cameraAngleY = 0.0f;
 glm::mat4 modelRotation = glm::mat4(1.0f);
+bool screenshotRequested = false;
+bool syncCheckRequested = false;
+bool lodEnabled = true;
+float lodPixelError = 1.0f;
+bool occlusionCulling = true;
+bool sortedSubmission = true;
+
+// Set by renderSnapshot() for LOD selection
+static glm::vec3 cameraPosition(0.0f);
+static float pixelsPerUnit = 1.0f;  // at distance 1
 
 bool lightingEnabled = true;
 glm::vec3 lightPosition= glm::vec3(5.0f,5.0f,5.0f);
@@ -40,142 +70,128 @@ float diffuseStrength =0.7f;
 float specularStrength =0.5f;
 float shininess= 32.0f;
 
-// shaders
-GLuint createShaderProgram() {
-    //Vertexshader
-    const char* vertexShaderSrc = R"(
-    #version 330 core
-    layout(location = 0) in vec4 aPos;
-    layout(location = 1) in vec4 aColor;
-     layout(location = 1) in vec4 aNormal;
-    uniform mat4 MVP;
-    uniform mat4 model;
-    unifrm mat4 view;
-    uniform mat4 projection;
-
-    uniform bool enableLighting;
-    uniform vec3 lightPos;
-    uniform vec3 lightColor;
-    uniform vec3 viewPos;
-    uniform float ambientStrength;
-    uniform float diffuseStrength;
-    uniform float specularStrength;
-    uniform float shininess;
-    
-    
-
-    
-    out vec4 fragColor;
-    if(enableLighting){
-        vec3 fragPos=vec3(model*aPos);
-        vec2 normal=normalise(mat3(transpose(inverse(model)))*aNormal;
-    vec3 ambient=ambientStrenght*lightColor;
-    vec3 lightDir=normalize(lightPos-fragPos);
-    float diff =max(dot(normal,lightDir),0.0);
-    vec3 diffuse=diffuseStrength*diff*lightColor;
-    vec3 viewDir=normalize(viewPos-fragPos);
-    view reflectDir=reflect(-lightDir,normal);
-    float spec=pow(max(dot(viewDir,reflectDir),0.0),shininess);
-    vec3 specular= specularStrength*spec*lightColor;
-
-    vec3 result=(ambient+diffuse+specualr)*vec3(aColor);
-    fragColor=vec4(result,aColor.a);
-}
-    else{fragColor=aColor;})";
-    
-    void main() {
-        gl_Position = MVP * aPos;
-    
-        fragColor = aColor;
-    })";
-
-    //fragmentshader
-    const char* fragmentShaderSrc = R"(
-    #version 330 core
-    in vec4 fragColor;
-    out vec4 color;
-    void main() {
-        color = fragColor;
-    })";
-
-   //Compile vertex& fragment shaders, link them into a program, and return its ID
-    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vertexShaderSrc, nullptr);
-    glCompileShader(vertexShader);
-
-    Gluint success;
-    glGetShaderiv(vertexShader,GL_COMPILE_STATUS,&success);
-    if(!success){char infoLog[512];
-                 glGetShaderInfoLog(vertexShader,512,nullptr,infolog);
-                 std::cerr<<"vshader not compiled"<<infolog<<std::endl;}
-
-    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fragmentShaderSrc, nullptr);
-    glCompileShader(fragmentShader);
-    
-   glGetShaderiv(fragmentShader,GL_COMPILE_STATUS,&success);
-    if(!success){char infoLog[512];
-                 glGetShaderInfoLog(fragmentShader,512,nullptr,infolog);
-                 std::cerr<<"fshader not compiled"<<infolog<<std::endl;}
-    GLuint program = glCreateProgram();
-    glAttachShader(program, vertexShader);
-    glAttachShader(program, fragmentShader);
-    glLinkProgram(program);
-
-    glGetShaderiv(program,GL_LINK_STATUS,&success);
-    if(!success){char infoLog[512];
-                 glGetProgramInfoLog(program,512,nullptr,infolog);
-                 std::cerr<<"linking failed"<<infolog<<std::endl;}
-
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-
-    return program;
+// The shape itself, or the coarsest of its LOD levels that stays within lodPixelError on screen.
+// Reads no shared state but the camera, so draw list workers call it too.
+shape_t& lodFor(shape_t& shape, const glm::mat4& world) {
+    if (!lodEnabled || !shape.lods) return shape;
+    float scale = std::max(glm::length(glm::vec3(world[0])), std::max(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+    glm::vec3 center(world * glm::vec4(shape.lods->center, 1.0f));
+    float distance = glm::length(center - cameraPosition) - shape.lods->radius * scale;
+    return selectLod(shape, distance, scale, pixelsPerUnit, lodPixelError);
 }
 
-
-// recursively renders a hierarchical model
-void renderNode(std::shared_ptr<model_node_t> node, const glm::mat4& parentTransform) {
-    if (!node) return;
-    glm::mat4 modelMatrix = parentTransform * node->getTransform();
-
-    if (node->shape) {
-        glm::mat4 MVP = projection * view * modelMatrix;
-        glUniformMat
-            rix4fv(glGetUniformLocation(shaderProgram, "MVP"),
-            1, GL_FALSE, glm::value_ptr(MVP));
-     glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"),
-            1, GL_FALSE, glm::value_ptr(modelMatrix));
- glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"),
-            1, GL_FALSE, glm::value_ptr(view));
- glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"),
-            1, GL_FALSE, glm::value_ptr(projection));
-        glUniform1i(glGetUniformLocation(shaderProgram,"enableLighting"),lightingEnabled);
-        glUniform3fv(glGetUniformLocation(shaderProgram,"lightPos"),1,glm::value_ptr(lightPosition);
-        glUniform3fv(glGetUniformLocation(shaderProgram,"lightColor"),1,glm::value_ptr(lightColor);
-        glm::vec3 cameraPos= glm::vec3(
-        cameraDistance*sin(glm::radians(cameraAngleY))*cos(glm::radians(cameraAngleX)),
-        cameraDistance*sin(glm::radians(cameraAngleX)),
-        cameraDistance*cos(glm::radians(cameraAngleY))*cos(glm::radians(cameraAngleX))};
-        glUniform3fv(glGetUniformLocation(shaderProgram,"viewPos"),1,glm::value_ptr(cameraPos));
-     glUniform1f(glGetUniformLocation(shaderProgram,"ambientStrength"),ambientStrength);
-         glUniform1f(glGetUniformLocation(shaderProgram,"diffuseStrength"),diffuseStrength);
-         glUniform1f(glGetUniformLocation(shaderProgram,"specularStrength"),specularStrength);
-         glUniform1f(glGetUniformLocation(shaderProgram,"shininess"),shininess);
-
-  
-        
-
-        node->shape->draw(MVP, shaderProgram);
+static occlusion_culler_t occlusionCuller;
+
+// The projection's far plane; sort keys quantize depth over it
+static const float DRAW_DEPTH_RANGE = 100.0f;
+// Fewest draws a worker records into one command list
+static const size_t DRAW_LIST_GRAIN = 1024;
+
+// Draws the snapshot, sorted by state through a render queue or in hierarchy order. With
+// occlusion culling the occluders are rasterized on the culler's thread while the draws are
+// projected, then every draw is tested against them. Wireframe hides nothing, so it is never
+// culled. A draw whose color has alpha below 1 is sorted after the opaque ones, back to front.
+// For the queue, the pool's workers each take a range of draws and test, pick the LOD, build the
+// sort key and write the per-draw record into a command list of their own; the render thread
+// only merges, sorts and submits.
+void renderDraws(const render_snapshot_t& snapshot) {
+    glm::mat4 viewProjection = projection * view;
+    bool cull = occlusionCulling && !Wireframe;
+    size_t count = snapshot.drawCount();
+    thread_pool_t& pool = drawListPool ? *drawListPool : sharedThreadPool();
+    auto start = std::chrono::steady_clock::now();
+
+    static std::vector<occlusion_rect_t> bounds;
+    if (cull) {
+        occlusionCuller.begin(viewProjection, snapshot);
+        bounds.resize(count);
+        pool.parallelFor(count, DRAW_LIST_GRAIN, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                glm::vec3 lo, hi;
+                snapshot.shapes[snapshot.meshes[i]]->localBounds(lo, hi);
+                bounds[i] = occlusionCuller.project(viewProjection * snapshot.world[i], lo, hi);
+            }
+        });
+        occlusionCuller.wait();
+        renderStats.occluders = occlusionCuller.occluderCount();
+        renderStats.occluderRasterMs = occlusionCuller.rasterMs();
     }
 
-    for (auto& child : node->children) {
-        renderNode(child, modelMatrix);
+    auto submitStart = std::chrono::steady_clock::now();
+    if (sortedSubmission) {
+        static render_queue_t queue;
+        draw_record_t* records = renderBackend->mapDrawRecords(count);
+        size_t lists = std::max<size_t>(1, std::min(size_t(pool.getThreadCount()) * 4, count / DRAW_LIST_GRAIN));
+        queue.reset(lists);
+        unsigned int threads = pool.parallelFor(lists, 1, [&](size_t firstList, size_t lastList) {
+            for (size_t l = firstList; l < lastList; ++l) {
+                render_queue_t::command_list_t& list = queue.list(l);
+                size_t last = (l + 1) * count / lists;
+                for (size_t i = l * count / lists; i < last; ++i) {
+                    if (cull && !occlusionCuller.visible(bounds[i])) {
+                        if (bounds[i].offscreen) list.offscreenDraws++;
+                        else list.occludedDraws++;
+                        continue;
+                    }
+                    const glm::mat4& world = snapshot.world[i];
+                    shape_t& base = *snapshot.shapes[snapshot.meshes[i]];
+                    shape_t& shape = lodFor(base, world);
+                    if (&shape != &base) list.lodDraws++;
+                    draw_state_t state = renderBackend->drawState(shape);
+                    glm::vec4 color = shape.colors.empty() ? glm::vec4(1.0f) : shape.colors[0];
+                    if (records) fillDrawRecord(records[i], viewProjection, world, color);
+                    float depth = (viewProjection * world[3]).w;
+                    list.push(color.a < 1.0f ? translucentSortKey(state, depth, DRAW_DEPTH_RANGE) : opaqueSortKey(state, depth, DRAW_DEPTH_RANGE),
+                        shape, world, uint32_t(i));
+                }
+            }
+        });
+        for (size_t l = 0; l < lists; ++l) {
+            const render_queue_t::command_list_t& list = queue.list(l);
+            renderStats.lodDraws += list.lodDraws;
+            renderStats.occludedDraws += list.occludedDraws;
+            renderStats.offscreenDraws += list.offscreenDraws;
+        }
+        auto sortStart = std::chrono::steady_clock::now();
+        renderStats.recordMs = std::chrono::duration<double, std::milli>(sortStart - submitStart).count();
+        renderStats.drawListThreads = threads;
+        if (cull) renderStats.occlusionMs = std::chrono::duration<double, std::milli>(sortStart - start).count();
+        queue.sort();
+        renderStats.sortMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sortStart).count();
+        renderBackend->submit(queue, viewProjection);
+    }
+    else {
+        static std::vector<uint32_t> order;
+        order.clear();
+        for (uint32_t i = 0; i < count; ++i) {
+            if (!cull || occlusionCuller.visible(bounds[i])) order.push_back(i);
+            else if (bounds[i].offscreen) renderStats.offscreenDraws++;
+            else renderStats.occludedDraws++;
+        }
+        if (cull) renderStats.occlusionMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        for (uint32_t i : order) {
+            const glm::mat4& world = snapshot.world[i];
+            glm::mat4 MVP = viewProjection * world;
+            shape_t& base = *snapshot.shapes[snapshot.meshes[i]];
+            shape_t& shape = lodFor(base, world);
+            if (&shape != &base) renderStats.lodDraws++;
+            renderBackend->drawShape(shape, world, MVP);
+        }
     }
+    renderStats.submitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - submitStart).count();
 }
 
-void renderScene() {
+void publishScene() {
+    render_snapshot_t& snapshot = renderSnapshots().back();
+    // Inspection mode turns the whole model with modelRotation
+    if (currentModel) captureSnapshot(*currentModel, currentMode == INSPECTION ? modelRotation : glm::mat4(1.0f), snapshot);
+    else snapshot.clear();
+    renderSnapshots().publish();
+}
+
+void renderSnapshot() {
     projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);//perspective projection matrix
+    pixelsPerUnit = projection[1][1] * 600.0f * 0.5f;
 
     if (currentMode == INSPECTION) {
         //camera view matrix
@@ -186,23 +202,272 @@ void renderScene() {
             glm::vec3(0.0f, 0.0f, 0.0f),
             glm::vec3(0.0f, 1.0f, 0.0f)
         );
-        if (currentModel && currentModel->getRoot()) {
-            renderNode(currentModel->getRoot(), modelRotation);
-        }
     }
     //In non-inspection mode, set the camera fixed at (0,0,10) looking at the origin
     else {
         view = glm::lookAt(glm::vec3(0.0f, 0.0f, 10.0f),
             glm::vec3(0.0f, 0.0f, 0.0f),
             glm::vec3(0.0f, 1.0f, 0.0f));
-        if (currentModel && currentModel->getRoot()) {
-            renderNode(currentModel->getRoot(), glm::mat4(1.0f));
-        }
     }
+    const render_snapshot_t& snapshot = renderSnapshots().acquire();
+    renderBackend->setCamera(view, projection, snapshot.lights);
+    cameraPosition = glm::vec3(glm::inverse(view)[3]);
+    renderDraws(snapshot);
+}
+
+void renderScene() {
+    publishScene();
+    renderSnapshot();
 }
 
+// Headless path: renders the indoor scene with the CPU rasterizer, no window or GL context needed
+//   modeller --software [--load file.mod] [--workers N] [--frames N] [--out frame.ppm] [--inspect] [--wireframe] [--bench]
+int runSoftware(int argc, char** argv) {
+    unsigned int workers = 0;
+    int frames = 1;
+    bool bench = false;
+    std::string out = "frame.ppm";
+    std::string scene;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--workers" && i + 1 < argc) workers = std::stoi(argv[++i]);
+        else if (arg == "--frames" && i + 1 < argc) frames = std::stoi(argv[++i]);
+        else if (arg == "--out" && i + 1 < argc) out = argv[++i];
+        else if (arg == "--inspect") currentMode = INSPECTION;
+        else if (arg == "--wireframe") Wireframe = true;
+        else if (arg == "--bench") bench = true;
+        else if (arg == "--load" && i + 1 < argc) scene = argv[++i];
+    }
+
+    currentModel = std::make_shared<model_t>();
+    currentNode = currentModel->getRoot();
+    if (scene.empty()) buildIndoorScene();
+    else if (!currentModel->load(scene)) return 1;
+
+    if (bench) {
+        benchmarkSoftwareRaster(workers, frames);
+        return 0;
+    }
 
-int main() {
+    renderBackend = std::make_unique<software_backend_t>(800, 600, workers);
+    for (int f = 0; f < frames; ++f) {
+        renderBackend->beginFrame(glm::vec4(0.2f, 0.3f, 0.3f, 1.0f));
+        renderScene();
+        renderBackend->endFrame();
+    }
+    renderStats.print();
+    return renderBackend->saveFrame(out) ? 0 : 1;
+}
+
+// Compares two PPM frames, e.g. a GL screenshot (F12) against --software output
+//   modeller --compare a.ppm b.ppm [tolerance]
+int runCompare(int argc, char** argv) {
+    image_t a, b;
+    if (argc < 4 || !readPPM(argv[2], a) || !readPPM(argv[3], b)) {
+        std::cerr << "Usage: modeller --compare a.ppm b.ppm [tolerance]\n";
+        return 2;
+    }
+    int tolerance = argc > 4 ? std::stoi(argv[4]) : 8;
+    double mismatch = compareImages(a, b, tolerance);
+    std::cout << "Mismatched pixels: " << mismatch * 100.0 << "% (tolerance " << tolerance << ")" << std::endl;
+    return mismatch <= 0.01 ? 0 : 1;
+}
+
+// Converts a saved model for other tools, picking the format from the extension
+//   modeller --export in.mod out.glb|out.obj
+int runExport(int argc, char** argv) {
+    if (argc < 4) {
+        std::cerr << "Usage: modeller --export in.mod out.glb|out.obj\n";
+        return 2;
+    }
+    currentModel = std::make_shared<model_t>();
+    currentNode = currentModel->getRoot();
+    if (!currentModel->load(argv[2])) return 1;
+    std::string out = argv[3];
+    bool ok = out.size() > 4 && out.compare(out.size() - 4, 4, ".obj") == 0
+        ? exportOBJ(*currentModel, out)
+        : exportGLB(*currentModel, out);
+    return ok ? 0 : 1;
+}
+
+// Keyframe evaluation cost
+//   modeller --bench-animation [nodes] [frames]
+int runAnimationBench(int argc, char** argv) {
+    size_t nodes = argc > 2 ? std::stoul(argv[2]) : 100000;
+    int frames = argc > 3 ? std::stoi(argv[3]) : 100;
+    benchmarkAnimation(nodes, 4, frames > 0 ? frames : 1);
+    return 0;
+}
+
+// Transform memory and compose cost
+//   modeller --bench-transforms [nodes] [iterations]
+int runTransformBench(int argc, char** argv) {
+    size_t nodes = argc > 2 ? std::stoul(argv[2]) : 100000;
+    int iterations = argc > 3 ? std::stoi(argv[3]) : 100;
+    benchmarkTransforms(nodes > 0 ? nodes : 1, iterations > 0 ? iterations : 1);
+    return 0;
+}
+
+// World-transform propagation speedup on a wide synthetic hierarchy
+//   modeller --bench-world [nodes] [maxThreads] [frames]
+int runWorldBench(int argc, char** argv) {
+    size_t nodes = argc > 2 ? std::stoul(argv[2]) : 1000000;
+    unsigned int threads = argc > 3 ? unsigned(std::stoul(argv[3])) : 16;
+    int frames = argc > 4 ? std::stoi(argv[4]) : 10;
+    benchmarkWorldTransforms(nodes, threads > 0 ? threads : 1, frames > 0 ? frames : 1);
+    return 0;
+}
+
+// Baked vs runtime primitive creation
+//   modeller --bench-shapes [iterations]
+int runShapeBench(int argc, char** argv) {
+    int iterations = argc > 2 ? std::stoi(argv[2]) : 1000;
+    benchmarkShapeCreation(iterations > 0 ? iterations : 1);
+    return 0;
+}
+
+// Icosphere vs UV sphere triangle counts for the same error
+//   modeller --bench-tessellation
+int runTessellationBench() {
+    benchmarkSphereTessellation();
+    return 0;
+}
+
+// LOD chain simplification throughput and error
+//   modeller --bench-simplify [mesh.stl|.ply|.obj]
+int runSimplifyBench(int argc, char** argv) {
+    benchmarkSimplification(argc > 2 ? argv[2] : "");
+    return 0;
+}
+
+// Loose octree queries and upkeep against brute force
+//   modeller --bench-octree [nodes] [queries] [editsPerFrame]
+int runOctreeBench(int argc, char** argv) {
+    size_t nodes = argc > 2 ? std::stoul(argv[2]) : 100000;
+    int queries = argc > 3 ? std::stoi(argv[3]) : 200;
+    size_t edits = argc > 4 ? std::stoul(argv[4]) : 1000;
+    benchmarkSpatialQueries(nodes, queries > 0 ? queries : 1, edits > 0 ? edits : 1);
+    return 0;
+}
+
+// Views of the indoor scene with and without occlusion culling
+//   modeller --bench-occlusion [frames]
+int runOcclusionBench(int argc, char** argv) {
+    benchmarkOcclusion(argc > 2 ? std::stoi(argv[2]) : 5);
+    return 0;
+}
+
+// Frame times while a large file loads, on the render thread and on an edit thread
+//   modeller --bench-snapshot [extraNodes] [frames]
+int runSnapshotBench(int argc, char** argv) {
+    size_t extraNodes = argc > 2 ? std::stoul(argv[2]) : 20000;
+    int frames = argc > 3 ? std::stoi(argv[3]) : 60;
+    benchmarkSnapshots(extraNodes, frames > 1 ? frames : 2);
+    return 0;
+}
+
+// Delta sync bytes and latency with a replica in the same process
+//   modeller --bench-sync [nodes] [editsPerFrame] [frames]
+int runSyncBench(int argc, char** argv) {
+    size_t nodes = argc > 2 ? std::stoul(argv[2]) : 1000000;
+    size_t edits = argc > 3 ? std::stoul(argv[3]) : 100;
+    int frames = argc > 4 ? std::stoi(argv[4]) : 100;
+    benchmarkSceneSync(nodes, edits, frames > 0 ? frames : 1);
+    return 0;
+}
+
+// Plain against compressed .mod files: size, speed and error
+//   modeller --bench-codec [file.mod] [syntheticNodes] [tolerance]
+int runCodecBench(int argc, char** argv) {
+    std::string path = argc > 2 ? argv[2] : "";
+    size_t nodes = argc > 3 ? std::stoul(argv[3]) : 50000;
+    float tolerance = argc > 4 ? std::stof(argv[4]) : DEFAULT_SCENE_TOLERANCE;
+    benchmarkSceneCodec(path == "-" ? "" : path, nodes, tolerance > 0.0f ? tolerance : DEFAULT_SCENE_TOLERANCE);
+    return 0;
+}
+
+// Expanded chairs against one chair prefab: file size, load time, memory, draws
+//   modeller --bench-prefabs [chairs]
+int runPrefabBench(int argc, char** argv) {
+    size_t chairs = argc > 2 ? std::stoul(argv[2]) : 1000;
+    benchmarkPrefabs(chairs > 0 ? chairs : 1);
+    return 0;
+}
+
+// Writes a generated world without opening a window; the same arguments give the same file
+//   modeller --generate out.mod|out.modz [seed=N] [nodes=N] [rooms=N] [items=N] [depth=N]
+//            [branching=N] [mix=box,cylinder,sphere,cone] [levels=min-max]
+int runGenerate(int argc, char** argv) {
+    world_params_t params;
+    if (argc < 3 || argv[2][0] == '-' || parseWorldParams(argc, argv, 3, params) < 0) {
+        std::cerr << "Usage: modeller --generate out.mod|out.modz [key=value ...]\n";
+        return 2;
+    }
+    auto begin = std::chrono::steady_clock::now();
+    if (!writeWorld(params, argv[2])) return 1;
+    std::cout << "Generated in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count()
+              << " s" << std::endl;
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    auto startupBegin = std::chrono::steady_clock::now();
+    int serveSync = 0;
+    std::string joinSync;
+    bool startWithWorld = false;
+    world_params_t worldParams;
+    std::string recordPath, replayPath, replayBaseline;
+    double regressionThreshold = 10.0;
+    bool memoryReport = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--software") return runSoftware(argc, argv);
+        if (arg == "--compare") return runCompare(argc, argv);
+        if (arg == "--export") return runExport(argc, argv);
+        if (arg == "--bench-shapes") return runShapeBench(argc, argv);
+        if (arg == "--bench-animation") return runAnimationBench(argc, argv);
+        if (arg == "--bench-transforms") return runTransformBench(argc, argv);
+        if (arg == "--bench-world") return runWorldBench(argc, argv);
+        if (arg == "--bench-tessellation") return runTessellationBench();
+        if (arg == "--bench-simplify") return runSimplifyBench(argc, argv);
+        if (arg == "--bench-octree") return runOctreeBench(argc, argv);
+        if (arg == "--bench-occlusion") return runOcclusionBench(argc, argv);
+        if (arg == "--bench-snapshot") return runSnapshotBench(argc, argv);
+        if (arg == "--bench-sync") return runSyncBench(argc, argv);
+        if (arg == "--bench-codec") return runCodecBench(argc, argv);
+        if (arg == "--bench-prefabs") return runPrefabBench(argc, argv);
+        if (arg == "--generate") return runGenerate(argc, argv);
+        // Start on a generated world (key=value arguments as for --generate)
+        if (arg == "--world") {
+            int next = parseWorldParams(argc, argv, i + 1, worldParams);
+            if (next < 0) return 2;
+            startWithWorld = true;
+            i = next - 1;
+        }
+        // Share the scene with other instances, or follow one that does
+        if (arg == "--serve") serveSync = i + 1 < argc && argv[i + 1][0] != '-' ? std::stoi(argv[++i]) : SYNC_DEFAULT_PORT;
+        if (arg == "--join" && i + 1 < argc) joinSync = argv[++i];
+        // Record keys and console input to a file, or play a recording back headless and time it
+        //   modeller --record session.rec
+        //   modeller --replay session.rec [baseline.txt] [--regression-threshold percent]
+        if (arg == "--record" && i + 1 < argc) recordPath = argv[++i];
+        if (arg == "--replay" && i + 1 < argc) {
+            replayPath = argv[++i];
+            if (i + 1 < argc && argv[i + 1][0] != '-') replayBaseline = argv[++i];
+        }
+        if (arg == "--regression-threshold" && i + 1 < argc) regressionThreshold = std::stod(argv[++i]);
+        // Keep geometry on the GPU only, and print where memory went once the first frame is drawn
+        if (arg == "--release-geometry") gpuResources().releaseCpuGeometry = true;
+        if (arg == "--memory-report") memoryReport = true;
+        // Evict least recently drawn meshes once GPU buffers pass this many MiB
+        if (arg == "--vram-budget" && i + 1 < argc) gpuResources().setBudget(size_t(std::stod(argv[++i]) * 1048576.0));
+    }
+
+    bool replaying = !replayPath.empty();
+#ifdef GLFW_PLATFORM_NULL
+    // Replays need no display: GLFW 3.4's null platform, with Mesa's OSMesa for the context
+    if (replaying) glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#endif
     if (!glfwInit()) {
         std::cerr << "Failed to initialize GLFW\n";
         return -1;
@@ -211,6 +476,12 @@ int main() {
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    if (replaying) {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+#ifdef GLFW_PLATFORM_NULL
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+#endif
+    }
 
     GLFWwindow* window = glfwCreateWindow(800, 600, "24b0020_24b2165", nullptr, nullptr);
     if (!window) {
@@ -221,38 +492,122 @@ int main() {
     glfwMakeContextCurrent(window);
 
     glewExperimental = GL_TRUE;
-    if (glewInit() != GLEW_OK) {
+    GLenum glewStatus = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    // An OSMesa context has no GLX display, but the entry points are loaded all the same
+    if (glewStatus == GLEW_ERROR_NO_GLX_DISPLAY) glewStatus = GLEW_OK;
+#endif
+    if (glewStatus != GLEW_OK) {
         std::cerr << "Failed to init GLEW\n";
         return -1;
     }
 
     glEnable(GL_DEPTH_TEST);
     glPolygonMode(GL_FRONT_AND_BACK, GL_LINE); // Wireframe mode
+    Wireframe = true;
 
-    shaderProgram = createShaderProgram();
-    if (shaderProgram == 0) {
+    if (!loadShaderVariants()) {
         std::cerr << "Failed to create shader program\n";
         return -1;
     }
+    shaderProgram = selectShaderProgram(lightingEnabled);
     std::cout << "Shaders compiled and linked successfully!" << std::endl;
 
     currentModel = std::make_shared<model_t>();
     currentNode = currentModel->getRoot();
+    if (startWithWorld) buildWorld(worldParams);
+    renderBackend = std::make_unique<gl_backend_t>(800, 600);
     glfwSetKeyCallback(window, keyCallback);
 
+    //   modeller --serve [port]       others join with
+    //   modeller --join host[:port]
+    std::unique_ptr<sync_server_t> syncServer;
+    std::unique_ptr<sync_client_t> syncClient;
+    if (serveSync) {
+        syncServer = std::make_unique<sync_server_t>();
+        if (!syncServer->listen(serveSync)) syncServer.reset();
+    }
+    if (!joinSync.empty()) {
+        size_t colon = joinSync.rfind(':');
+        int port = colon == std::string::npos ? SYNC_DEFAULT_PORT : std::stoi(joinSync.substr(colon + 1));
+        syncClient = std::make_unique<sync_client_t>();
+        if (!syncClient->connect(joinSync.substr(0, colon), port)) syncClient.reset();
+    }
+
+    input_recorder_t recorder;
+    input_replayer_t replayer;
+    if (!recordPath.empty()) recorder.start(window, *currentModel);
+    if (replaying && !replayer.start(replayPath, *currentModel)) return 1;
+
+    double lastTime = glfwGetTime();
     while (!glfwWindowShouldClose(window)) {
-        glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);//clear both colour and depth buffer also add this colour 0.2f, 0.3f, 0.3f to background
+        auto frameBegin = std::chrono::steady_clock::now();
+        double now = glfwGetTime();
+        if (replaying) {
+            if (replayer.done()) break;
+            replayer.beginFrame();
+        }
+        else {
+            recorder.beginFrame();
+            if (finishBackgroundLoad() && recorder.active()) recorder.loaded();
+        }
+        // Recorded and replayed sessions step animation by frames, not by the clock
+        currentModel->updateAnimation(replaying || recorder.active() ? REPLAY_TIMESTEP : float(now - lastTime));
+        lastTime = now;
+        if (syncClient) syncClient->update(currentModel);
+        if (syncServer) {
+            if (syncCheckRequested) syncServer->requestDigest();
+            syncServer->update(currentModel);
+        }
+        syncCheckRequested = false;
 
-        glUseProgram(shaderProgram);
+        //clear both colour and depth buffer also add this colour 0.2f, 0.3f, 0.3f to background
+        renderBackend->beginFrame(glm::vec4(0.2f, 0.3f, 0.3f, 1.0f));
         renderScene();
+        renderBackend->endFrame();
+
+        if (screenshotRequested) {
+            renderBackend->saveFrame("screenshot.ppm");
+            std::cout << "Saved screenshot.ppm" << std::endl;
+            screenshotRequested = false;
+        }
+
+        if (replaying) {
+            // The frame isn't done until the GPU is
+            glFinish();
+            replayer.frameTime(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameBegin).count());
+        }
 
         glfwSwapBuffers(window);
-        glfwPollEvents();// call the keycallback function
+        if (startupBegin != std::chrono::steady_clock::time_point()) {
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startupBegin).count();
+            std::cout << "Startup to first frame: " << ms << " ms" << std::endl;
+            startupBegin = std::chrono::steady_clock::time_point();
+            if (memoryReport) {
+                memoryStats().print();
+                break;
+            }
+        }
+        if (replaying) replayer.dispatch(window);
+        else glfwPollEvents();// call the keycallback function
     }
+    int status = 0;
+    if (recorder.active()) recorder.finish(*currentModel, recordPath);
+    if (replaying && !replayer.finish(*currentModel, replayBaseline, regressionThreshold)) status = 1;
+
+    // Release every GL object while the context still exists
+    syncServer.reset();
+    syncClient.reset();
+    renderBackend.reset();
+    currentNode.reset();
+    currentModel.reset();
+    renderSnapshots().clear();
+    gpuResources().collect();
+    if (gpuResources().bufferCount() || gpuResources().vertexArrayCount())
+        std::cerr << "GPU objects still alive at exit: " << gpuResources().bufferCount() << " buffers, "
+                  << gpuResources().vertexArrayCount() << " VAOs" << std::endl;
 
     glfwDestroyWindow(window);
     glfwTerminate();
-    return 0;
+    return status;
 }
-
@@ -0,0 +1,50 @@
+#include "memory_stats.h"
+#include "gpu_resources.h"
+#include <fstream>
+#include <iostream>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+size_t memory_stats_t::trackedBytes() const {
+    size_t total = 0;
+    for (int tag = 0; tag < MEM_TAG_COUNT; ++tag) total += bytes(MemoryTag(tag));
+    return total;
+}
+
+void memory_stats_t::print() const {
+    const char* names[MEM_TAG_COUNT] = { "geometry", "scene graph", "I/O buffers" };
+    auto mib = [](size_t bytes) { return double(bytes) / 1048576.0; };
+    std::cout << "Memory (MiB, live / peak, blocks):" << std::endl;
+    for (int tag = 0; tag < MEM_TAG_COUNT; ++tag) {
+        MemoryTag t = MemoryTag(tag);
+        std::cout << "  " << names[tag] << ": " << mib(bytes(t)) << " / " << mib(peakBytes(t)) << ", "
+                  << blockCount(t) << std::endl;
+    }
+    const gpu_resource_manager_t& gpu = gpuResources();
+    std::cout << "  GL buffers: " << mib(gpu.residentBytes()) << " (vertices " << mib(gpu.categoryBytes(GPU_VERTICES))
+              << ", indices " << mib(gpu.categoryBytes(GPU_INDICES)) << ", lights " << mib(gpu.categoryBytes(GPU_LIGHTS))
+              << ", draw records " << mib(gpu.categoryBytes(GPU_DRAW_DATA)) << ", awaiting delete " << mib(gpu.pendingBytes()) << ")" << std::endl;
+    size_t tracked = trackedBytes();
+    size_t resident = residentBytes();
+    if (resident) {
+        std::cout << "  resident: " << mib(resident) << ", of which untracked " << mib(resident > tracked ? resident - tracked : 0)
+                  << " (allocator overhead, shape objects, driver copies, code)" << std::endl;
+    }
+    std::cout << "  CPU geometry " << (gpu.releaseCpuGeometry ? "dropped" : "kept") << " after upload" << std::endl;
+}
+
+memory_stats_t& memoryStats() {
+    // Never destroyed: shapes in static storage still free through it at exit
+    static memory_stats_t* stats = new memory_stats_t();
+    return *stats;
+}
+
+size_t residentBytes() {
+#ifndef _WIN32
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, residentPages = 0;
+    if (statm >> pages >> residentPages) return residentPages * size_t(sysconf(_SC_PAGESIZE));
+#endif
+    return 0;
+}
@@ -0,0 +1,92 @@
+#ifndef MEMORY_STATS_H
+#define MEMORY_STATS_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// What tracked CPU memory is counted under; GL buffers are counted by gpuResources()
+enum MemoryTag {
+    MEM_GEOMETRY,     // shapes' vertices, colors, normals and indices
+    MEM_SCENE_GRAPH,  // nodes and their child lists
+    MEM_IO,           // export, mesh import and sync buffers
+    MEM_TAG_COUNT
+};
+
+// Live and peak bytes per tag. The counters are atomic, since shapes are built on loader and
+// pool threads.
+class memory_stats_t {
+public:
+    void allocated(MemoryTag tag, size_t bytes) {
+        size_t now = live[tag].fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        blocks[tag].fetch_add(1, std::memory_order_relaxed);
+        size_t high = peak[tag].load(std::memory_order_relaxed);
+        while (now > high && !peak[tag].compare_exchange_weak(high, now, std::memory_order_relaxed)) {}
+    }
+    void freed(MemoryTag tag, size_t bytes) {
+        live[tag].fetch_sub(bytes, std::memory_order_relaxed);
+        blocks[tag].fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    size_t bytes(MemoryTag tag) const { return live[tag].load(std::memory_order_relaxed); }
+    size_t peakBytes(MemoryTag tag) const { return peak[tag].load(std::memory_order_relaxed); }
+    size_t blockCount(MemoryTag tag) const { return blocks[tag].load(std::memory_order_relaxed); }
+    size_t trackedBytes() const;
+
+    // Every tag, GL memory from gpuResources() and the process's resident set, with what
+    // the tags don't account for
+    void print() const;
+
+private:
+    std::atomic<size_t> live[MEM_TAG_COUNT] = {};
+    std::atomic<size_t> peak[MEM_TAG_COUNT] = {};
+    std::atomic<size_t> blocks[MEM_TAG_COUNT] = {};
+};
+
+memory_stats_t& memoryStats();
+
+// Resident set size of the process, 0 where it can't be read
+size_t residentBytes();
+
+// std::allocator with what it hands out counted under Tag
+template <class T, MemoryTag Tag>
+struct tagged_allocator_t {
+    using value_type = T;
+    template <class U> struct rebind { using other = tagged_allocator_t<U, Tag>; };
+
+    tagged_allocator_t() noexcept = default;
+    template <class U> tagged_allocator_t(const tagged_allocator_t<U, Tag>&) noexcept {}
+
+    T* allocate(size_t n) {
+        T* p = std::allocator<T>().allocate(n);
+        memoryStats().allocated(Tag, n * sizeof(T));
+        return p;
+    }
+    void deallocate(T* p, size_t n) noexcept {
+        memoryStats().freed(Tag, n * sizeof(T));
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    friend bool operator==(const tagged_allocator_t&, const tagged_allocator_t&) { return true; }
+    friend bool operator!=(const tagged_allocator_t&, const tagged_allocator_t&) { return false; }
+};
+
+template <class T> using geometry_vector_t = std::vector<T, tagged_allocator_t<T, MEM_GEOMETRY>>;
+template <class T> using io_vector_t = std::vector<T, tagged_allocator_t<T, MEM_IO>>;
+
+// Child lists and the model's list of nodes
+struct model_node_t;
+using node_list_t = std::vector<std::shared_ptr<model_node_t>, tagged_allocator_t<std::shared_ptr<model_node_t>, MEM_SCENE_GRAPH>>;
+
+// A member that counts its owner's own size under Tag for as long as the owner lives, for
+// objects that are not allocated through a tagged allocator (make_shared)
+template <MemoryTag Tag, class Owner>
+struct tracked_object_t {
+    tracked_object_t() noexcept { memoryStats().allocated(Tag, sizeof(Owner)); }
+    tracked_object_t(const tracked_object_t&) noexcept : tracked_object_t() {}
+    tracked_object_t& operator=(const tracked_object_t&) noexcept { return *this; }
+    ~tracked_object_t() { memoryStats().freed(Tag, sizeof(Owner)); }
+};
+
+#endif
@@ -0,0 +1,622 @@
+#include "mesh.h"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <limits>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+void mesh_t::generateGeometry() {
+    if (loaded || failed) return;
+    vertices.clear();
+    colors.clear();
+    normals.clear();
+    indices.clear();
+    loaded = importMesh(path, vertices, normals, indices);
+    failed = !loaded;
+    colors.assign(vertices.size(), glm::vec4(1.0f));
+    if (!vertices.empty()) {
+        boundsMin = boundsMax = glm::vec3(vertices[0]);
+        for (const auto& v : vertices) {
+            boundsMin = glm::min(boundsMin, glm::vec3(v));
+            boundsMax = glm::max(boundsMax, glm::vec3(v));
+        }
+    }
+}
+
+namespace {
+
+// Read-only view of a whole file; mmap on POSIX, plain read elsewhere
+class mapped_file_t {
+public:
+    const char* data = nullptr;
+    size_t size = 0;
+
+    explicit mapped_file_t(const std::string& filename) {
+#ifndef _WIN32
+        fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size == 0) return;
+        size = size_t(st.st_size);
+        void* p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) { size = 0; return; }
+        ::madvise(p, size, MADV_SEQUENTIAL | MADV_WILLNEED);
+        data = static_cast<const char*>(p);
+        memoryStats().allocated(MEM_IO, size);  // mapped rather than allocated, but resident as it is read
+#else
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+        if (!file.is_open()) return;
+        copy.resize(size_t(file.tellg()));
+        file.seekg(0);
+        file.read(copy.data(), copy.size());
+        data = copy.data();
+        size = copy.size();
+#endif
+    }
+
+    ~mapped_file_t() {
+#ifndef _WIN32
+        if (data) {
+            memoryStats().freed(MEM_IO, size);
+            ::munmap(const_cast<char*>(data), size);
+        }
+        if (fd >= 0) ::close(fd);
+#endif
+    }
+
+    bool ok() const { return data != nullptr; }
+
+private:
+#ifndef _WIN32
+    int fd = -1;
+#else
+    io_vector_t<char> copy;
+#endif
+};
+
+// Splits [0, count) into one contiguous range per worker and runs fn(first, last, worker)
+template <class Fn>
+void parallelRanges(size_t count, unsigned int threads, Fn fn) {
+    if (threads <= 1 || count < 4096) {
+        fn(size_t(0), count, 0u);
+        return;
+    }
+    size_t per = (count + threads - 1) / threads;
+    std::vector<std::thread> pool;
+    for (unsigned int t = 1; t < threads; ++t) {
+        size_t first = std::min(count, t * per), last = std::min(count, first + per);
+        pool.emplace_back(fn, first, last, t);
+    }
+    fn(size_t(0), std::min(count, per), 0u);
+    for (auto& th : pool) th.join();
+}
+
+bool hasSuffix(const std::string& s, const char* suffix) {
+    size_t n = std::strlen(suffix);
+    if (s.size() < n) return false;
+    for (size_t i = 0; i < n; ++i)
+        if (std::tolower(static_cast<unsigned char>(s[s.size() - n + i])) != suffix[i]) return false;
+    return true;
+}
+
+float readF32(const char* p) {
+    float v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// ---- binary STL ----
+
+bool parseSTL(const mapped_file_t& file, unsigned int threads,
+    geometry_vector_t<glm::vec4>& vertices, geometry_vector_t<unsigned int>& indices) {
+    if (file.size < 84) return false;
+    uint32_t count;
+    std::memcpy(&count, file.data + 80, sizeof(count));
+    if (84 + size_t(count) * 50 > file.size) {
+        std::cout << "Not a binary STL (ASCII STL is not supported)" << std::endl;
+        return false;
+    }
+
+    vertices.resize(size_t(count) * 3);
+    indices.resize(size_t(count) * 3);
+    parallelRanges(count, threads, [&](size_t first, size_t last, unsigned int) {
+        for (size_t t = first; t < last; ++t) {
+            const char* rec = file.data + 84 + t * 50 + 12; // skip facet normal
+            for (int k = 0; k < 3; ++k) {
+                vertices[t * 3 + k] = glm::vec4(readF32(rec), readF32(rec + 4), readF32(rec + 8), 1.0f);
+                indices[t * 3 + k] = unsigned(t * 3 + k);
+                rec += 12;
+            }
+        }
+    });
+    return true;
+}
+
+// ---- PLY (ascii, binary little/big endian) ----
+
+enum ply_type_t { PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64, PLY_UNKNOWN };
+
+struct ply_property_t {
+    std::string name;
+    ply_type_t type = PLY_UNKNOWN;
+    bool isList = false;
+    ply_type_t countType = PLY_UNKNOWN;
+};
+
+struct ply_element_t {
+    std::string name;
+    size_t count = 0;
+    std::vector<ply_property_t> props;
+};
+
+ply_type_t plyType(const std::string& t) {
+    if (t == "char" || t == "int8") return PLY_INT8;
+    if (t == "uchar" || t == "uint8") return PLY_UINT8;
+    if (t == "short" || t == "int16") return PLY_INT16;
+    if (t == "ushort" || t == "uint16") return PLY_UINT16;
+    if (t == "int" || t == "int32") return PLY_INT32;
+    if (t == "uint" || t == "uint32") return PLY_UINT32;
+    if (t == "float" || t == "float32") return PLY_FLOAT32;
+    if (t == "double" || t == "float64") return PLY_FLOAT64;
+    return PLY_UNKNOWN;
+}
+
+size_t plyTypeSize(ply_type_t t) {
+    static const size_t sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8, 0 };
+    return sizes[t];
+}
+
+double plyRead(const char* p, ply_type_t t, bool bigEndian) {
+    unsigned char b[8];
+    size_t n = plyTypeSize(t);
+    std::memcpy(b, p, n);
+    if (bigEndian) std::reverse(b, b + n);
+    switch (t) {
+    case PLY_INT8: return double(int8_t(b[0]));
+    case PLY_UINT8: return double(b[0]);
+    case PLY_INT16: { int16_t v; std::memcpy(&v, b, 2); return v; }
+    case PLY_UINT16: { uint16_t v; std::memcpy(&v, b, 2); return v; }
+    case PLY_INT32: { int32_t v; std::memcpy(&v, b, 4); return v; }
+    case PLY_UINT32: { uint32_t v; std::memcpy(&v, b, 4); return v; }
+    case PLY_FLOAT32: { float v; std::memcpy(&v, b, 4); return v; }
+    case PLY_FLOAT64: { double v; std::memcpy(&v, b, 8); return v; }
+    default: return 0.0;
+    }
+}
+
+// Parses a number at p, after any whitespace, without reading past `end`; the mapped file has
+// no terminating NUL for strtod to stop at. Null when there is no number there.
+template <class T>
+const char* parseNumber(const char* p, const char* end, T& value) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) ++p;
+    if (p < end && *p == '+') ++p;
+    auto result = std::from_chars(p, end, value);
+    return result.ec == std::errc() ? result.ptr : nullptr;
+}
+
+// A face index as read from the file; out-of-range values become one no vertex has
+unsigned int plyIndex(double v) {
+    return v >= 0.0 && v < double(std::numeric_limits<unsigned int>::max()) ? unsigned(v)
+                                                                             : std::numeric_limits<unsigned int>::max();
+}
+
+void pushFan(geometry_vector_t<unsigned int>& indices, const unsigned int* poly, size_t n) {
+    for (size_t k = 1; k + 1 < n; ++k) {
+        indices.push_back(poly[0]);
+        indices.push_back(poly[k]);
+        indices.push_back(poly[k + 1]);
+    }
+}
+
+bool parsePLY(const mapped_file_t& file, unsigned int threads,
+    geometry_vector_t<glm::vec4>& vertices, geometry_vector_t<unsigned int>& indices) {
+    const char* end = file.data + file.size;
+    const char* headerEnd = nullptr;
+    for (const char* p = file.data; p + 10 <= end; ++p) {
+        if (std::memcmp(p, "end_header", 10) == 0) {
+            headerEnd = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            break;
+        }
+    }
+    if (file.size < 3 || std::strncmp(file.data, "ply", 3) != 0 || !headerEnd) return false;
+
+    std::string format;
+    std::vector<ply_element_t> elements;
+    std::istringstream header(std::string(file.data, headerEnd));
+    std::string line;
+    while (std::getline(header, line)) {
+        std::istringstream ls(line);
+        std::string token;
+        ls >> token;
+        if (token == "format") ls >> format;
+        else if (token == "element") {
+            elements.emplace_back();
+            ls >> elements.back().name >> elements.back().count;
+        }
+        else if (token == "property" && !elements.empty()) {
+            ply_property_t prop;
+            std::string type;
+            ls >> type;
+            if (type == "list") {
+                prop.isList = true;
+                ls >> type;
+                prop.countType = plyType(type);
+                ls >> type;
+            }
+            prop.type = plyType(type);
+            ls >> prop.name;
+            if (prop.type == PLY_UNKNOWN || (prop.isList && prop.countType == PLY_UNKNOWN)) {
+                std::cout << "Unsupported PLY property type: " << line << std::endl;
+                return false;
+            }
+            elements.back().props.push_back(prop);
+        }
+    }
+
+    bool ascii = format == "ascii";
+    bool bigEndian = format == "binary_big_endian";
+    const char* p = headerEnd + 1;
+
+    for (const auto& el : elements) {
+        bool isVertex = el.name == "vertex";
+        bool isFace = el.name == "face";
+        int xyz[3] = { -1, -1, -1 };
+        for (size_t i = 0; i < el.props.size(); ++i) {
+            if (el.props[i].name == "x") xyz[0] = int(i);
+            if (el.props[i].name == "y") xyz[1] = int(i);
+            if (el.props[i].name == "z") xyz[2] = int(i);
+        }
+
+        if (ascii) {
+            // Every record takes at least a byte, which bounds a header's count before it is trusted
+            if (el.count > size_t(end - p)) return false;
+            if (isVertex) vertices.resize(el.count);
+            std::vector<unsigned int> poly;
+            for (size_t r = 0; r < el.count; ++r) {
+                double xyzv[3] = { 0, 0, 0 };
+                for (size_t i = 0; i < el.props.size(); ++i) {
+                    double v = 0.0;
+                    if (!(p = parseNumber(p, end, v))) return false;
+                    if (el.props[i].isList) {
+                        if (!(v >= 0.0 && v <= double(end - p))) return false;
+                        size_t n = size_t(v);
+                        poly.resize(n);
+                        for (size_t k = 0; k < n; ++k) {
+                            if (!(p = parseNumber(p, end, v))) return false;
+                            poly[k] = plyIndex(v);
+                        }
+                        if (isFace && (el.props[i].name == "vertex_indices" || el.props[i].name == "vertex_index"))
+                            pushFan(indices, poly.data(), n);
+                        continue;
+                    }
+                    for (int k = 0; k < 3; ++k) if (int(i) == xyz[k]) xyzv[k] = v;
+                }
+                if (isVertex) vertices[r] = glm::vec4(float(xyzv[0]), float(xyzv[1]), float(xyzv[2]), 1.0f);
+            }
+            continue;
+        }
+
+        bool fixedStride = true;
+        size_t stride = 0;
+        std::vector<size_t> offsets;
+        for (const auto& prop : el.props) {
+            offsets.push_back(stride);
+            if (prop.isList) fixedStride = false;
+            else stride += plyTypeSize(prop.type);
+        }
+
+        if (isVertex && fixedStride && xyz[0] >= 0 && xyz[1] >= 0 && xyz[2] >= 0) {
+            if (stride == 0 || el.count > size_t(end - p) / stride) return false;
+            vertices.resize(el.count);
+            const char* base = p;
+            parallelRanges(el.count, threads, [&](size_t first, size_t last, unsigned int) {
+                for (size_t r = first; r < last; ++r) {
+                    const char* rec = base + r * stride;
+                    float c[3];
+                    for (int k = 0; k < 3; ++k)
+                        c[k] = float(plyRead(rec + offsets[xyz[k]], el.props[xyz[k]].type, bigEndian));
+                    vertices[r] = glm::vec4(c[0], c[1], c[2], 1.0f);
+                }
+            });
+            p += el.count * stride;
+            continue;
+        }
+
+        // Variable-length records (faces, or elements we only skip) are walked serially
+        std::vector<unsigned int> poly;
+        if (isFace) indices.reserve(el.count * 3);
+        for (size_t r = 0; r < el.count; ++r) {
+            for (const auto& prop : el.props) {
+                if (!prop.isList) {
+                    if (plyTypeSize(prop.type) > size_t(end - p)) return false;
+                    p += plyTypeSize(prop.type);
+                    continue;
+                }
+                if (plyTypeSize(prop.countType) > size_t(end - p)) return false;
+                double count = plyRead(p, prop.countType, bigEndian);
+                p += plyTypeSize(prop.countType);
+                size_t itemSize = plyTypeSize(prop.type);
+                if (!(count >= 0.0) || size_t(count) > size_t(end - p) / itemSize) return false;
+                size_t n = size_t(count);
+                if (isFace && (prop.name == "vertex_indices" || prop.name == "vertex_index")) {
+                    poly.resize(n);
+                    for (size_t k = 0; k < n; ++k) poly[k] = plyIndex(plyRead(p + k * itemSize, prop.type, bigEndian));
+                    pushFan(indices, poly.data(), n);
+                }
+                p += n * itemSize;
+            }
+        }
+    }
+    // Faces may come before the vertices they index, so indices are checked once both are read
+    bool ok = true;
+    for (unsigned int& i : indices) {
+        if (i >= vertices.size()) { ok = false; i = 0; }
+    }
+    if (!ok) std::cout << "PLY has out-of-range face indices, clamped to 0" << std::endl;
+    return !vertices.empty();
+}
+
+// ---- OBJ (positions and faces only) ----
+
+// Chunk boundaries snapped to line starts
+std::vector<const char*> splitLines(const char* begin, const char* end, unsigned int parts) {
+    std::vector<const char*> cuts{ begin };
+    size_t size = size_t(end - begin);
+    for (unsigned int i = 1; i < parts; ++i) {
+        const char* p = std::max(cuts.back(), begin + size * i / parts);
+        const char* nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        cuts.push_back(nl ? nl + 1 : end);
+    }
+    cuts.push_back(end);
+    return cuts;
+}
+
+bool isBlank(char c) { return c == ' ' || c == '\t'; }
+
+// Visits every "v" and "f" line in [p, end): onVertex(x, y, z), onFace(first index token pointers)
+template <class VertexFn, class FaceFn>
+void scanOBJ(const char* p, const char* end, VertexFn onVertex, FaceFn onFace) {
+    while (p < end) {
+        const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (!eol) eol = end;
+        while (p < eol && isBlank(*p)) ++p;
+        if (p + 1 < eol && isBlank(p[1])) {
+            if (p[0] == 'v') onVertex(p + 2, eol);
+            else if (p[0] == 'f') onFace(p + 2, eol);
+        }
+        p = eol + 1;
+    }
+}
+
+// Parses up to `max` vertex references of a face line ("7", "7/1", "7//3", "-1/...")
+size_t faceIndices(const char* p, const char* eol, long* out, size_t max) {
+    size_t n = 0;
+    while (p < eol && n < max) {
+        while (p < eol && isBlank(*p)) ++p;
+        if (p >= eol || *p == '\r') break;
+        long v = 0;
+        const char* next = parseNumber(p, eol, v);
+        if (!next) break;
+        out[n++] = v;
+        p = next;
+        while (p < eol && !isBlank(*p)) ++p; // skip /vt/vn
+    }
+    return n;
+}
+
+bool parseOBJ(const mapped_file_t& file, unsigned int threads,
+    geometry_vector_t<glm::vec4>& vertices, geometry_vector_t<unsigned int>& indices) {
+    const char* end = file.data + file.size;
+    unsigned int parts = file.size < (1 << 20) ? 1 : threads;
+    std::vector<const char*> cuts = splitLines(file.data, end, parts);
+
+    // Pass 1: vertex and triangle counts per chunk
+    std::vector<size_t> vcount(parts, 0), tcount(parts, 0);
+    parallelRanges(parts, parts, [&](size_t first, size_t last, unsigned int) {
+        for (size_t c = first; c < last; ++c) {
+            long tmp[64];
+            scanOBJ(cuts[c], cuts[c + 1],
+                [&](const char*, const char*) { ++vcount[c]; },
+                [&](const char* p, const char* eol) {
+                    size_t n = faceIndices(p, eol, tmp, 64);
+                    if (n >= 3) tcount[c] += n - 2;
+                });
+        }
+    });
+
+    std::vector<size_t> vbase(parts + 1, 0), tbase(parts + 1, 0);
+    for (unsigned int c = 0; c < parts; ++c) {
+        vbase[c + 1] = vbase[c] + vcount[c];
+        tbase[c + 1] = tbase[c] + tcount[c];
+    }
+    vertices.resize(vbase[parts]);
+    indices.resize(tbase[parts] * 3);
+
+    // Pass 2: each chunk writes its own slice of the output arrays
+    std::atomic<bool> ok{ true };
+    parallelRanges(parts, parts, [&](size_t first, size_t last, unsigned int) {
+        for (size_t c = first; c < last; ++c) {
+            size_t v = vbase[c], t = tbase[c] * 3;
+            long tmp[64];
+            unsigned int poly[64];
+            scanOBJ(cuts[c], cuts[c + 1],
+                [&](const char* p, const char* eol) {
+                    float xyz[3] = { 0.0f, 0.0f, 0.0f };
+                    for (int k = 0; k < 3 && p; ++k) p = parseNumber(p, eol, xyz[k]);
+                    vertices[v++] = glm::vec4(xyz[0], xyz[1], xyz[2], 1.0f);
+                },
+                [&](const char* p, const char* eol) {
+                    size_t n = faceIndices(p, eol, tmp, 64);
+                    if (n < 3) return;
+                    for (size_t k = 0; k < n; ++k) {
+                        long idx = tmp[k] < 0 ? long(v) + tmp[k] : tmp[k] - 1;
+                        if (idx < 0 || size_t(idx) >= vertices.size()) { ok.store(false, std::memory_order_relaxed); idx = 0; }
+                        poly[k] = unsigned(idx);
+                    }
+                    for (size_t k = 1; k + 1 < n; ++k) {
+                        indices[t++] = poly[0];
+                        indices[t++] = poly[k];
+                        indices[t++] = poly[k + 1];
+                    }
+                });
+        }
+    });
+    if (!ok) std::cout << "OBJ has out-of-range face indices, clamped to 0" << std::endl;
+    return !vertices.empty();
+}
+
+// ---- welding ----
+
+// Merges vertices closer than eps using a uniform hash grid (cell = 4 * eps), so only
+// the neighbouring cell along an axis has to be checked when a point is near that face.
+void weldVertices(geometry_vector_t<glm::vec4>& vertices, geometry_vector_t<unsigned int>& indices, float relativeEps) {
+    if (vertices.empty()) return;
+    glm::vec3 lo(vertices[0]), hi(vertices[0]);
+    for (const auto& v : vertices) {
+        lo = glm::min(lo, glm::vec3(v));
+        hi = glm::max(hi, glm::vec3(v));
+    }
+    float eps = std::max(glm::length(hi - lo) * relativeEps, 1e-12f);
+    float cell = eps * 4.0f;
+    const uint32_t EMPTY = 0xffffffffu;
+
+    size_t capacity = 1;
+    while (capacity < vertices.size() * 2) capacity <<= 1;
+    std::vector<uint64_t> keys(capacity);
+    std::vector<uint32_t> heads(capacity, EMPTY);
+    std::vector<uint32_t> next(vertices.size(), EMPTY);
+    std::vector<uint32_t> remap(vertices.size());
+
+    auto cellKey = [](int64_t x, int64_t y, int64_t z) {
+        return (uint64_t(x & 0x1fffff) << 42) | (uint64_t(y & 0x1fffff) << 21) | uint64_t(z & 0x1fffff);
+    };
+    auto slot = [&](uint64_t key) {
+        size_t h = size_t((key * 0x9E3779B97F4A7C15ull) >> 20) & (capacity - 1);
+        while (heads[h] != EMPTY && keys[h] != key) h = (h + 1) & (capacity - 1);
+        return h;
+    };
+
+    uint32_t unique = 0;
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        glm::vec3 p(vertices[i]);
+        glm::vec3 g = (p - lo) / cell;
+        int64_t c[3] = { int64_t(std::floor(g.x)), int64_t(std::floor(g.y)), int64_t(std::floor(g.z)) };
+        int lowSide[3], highSide[3];
+        for (int k = 0; k < 3; ++k) {
+            float f = g[k] - float(c[k]);
+            lowSide[k] = f < 0.25f ? -1 : 0;
+            highSide[k] = f > 0.75f ? 1 : 0;
+        }
+
+        uint32_t match = EMPTY;
+        for (int dx = lowSide[0]; dx <= highSide[0] && match == EMPTY; ++dx)
+            for (int dy = lowSide[1]; dy <= highSide[1] && match == EMPTY; ++dy)
+                for (int dz = lowSide[2]; dz <= highSide[2] && match == EMPTY; ++dz) {
+                    size_t h = slot(cellKey(c[0] + dx, c[1] + dy, c[2] + dz));
+                    for (uint32_t u = heads[h]; u != EMPTY; u = next[u]) {
+                        glm::vec3 d = glm::vec3(vertices[u]) - p;
+                        if (glm::dot(d, d) <= eps * eps) { match = u; break; }
+                    }
+                }
+
+        if (match == EMPTY) {
+            match = unique++;
+            vertices[match] = vertices[i]; // match <= i, so compaction is in place
+            size_t h = slot(cellKey(c[0], c[1], c[2]));
+            keys[h] = cellKey(c[0], c[1], c[2]);
+            next[match] = heads[h];
+            heads[h] = match;
+        }
+        remap[i] = match;
+    }
+    vertices.resize(unique);
+
+    // Remap and drop triangles that collapsed
+    size_t out = 0;
+    for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+        unsigned int a = remap[indices[t]], b = remap[indices[t + 1]], c = remap[indices[t + 2]];
+        if (a == b || b == c || a == c) continue;
+        indices[out++] = a;
+        indices[out++] = b;
+        indices[out++] = c;
+    }
+    indices.resize(out);
+}
+
+void computeNormals(const geometry_vector_t<glm::vec4>& vertices, const geometry_vector_t<unsigned int>& indices,
+    geometry_vector_t<glm::vec4>& normals) {
+    std::vector<glm::vec3> acc(vertices.size(), glm::vec3(0.0f));
+    for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+        glm::vec3 a(vertices[indices[t]]), b(vertices[indices[t + 1]]), c(vertices[indices[t + 2]]);
+        glm::vec3 n = glm::cross(b - a, c - a); // area weighted
+        acc[indices[t]] += n;
+        acc[indices[t + 1]] += n;
+        acc[indices[t + 2]] += n;
+    }
+    normals.resize(vertices.size());
+    for (size_t i = 0; i < acc.size(); ++i) {
+        float len = glm::length(acc[i]);
+        normals[i] = len > 0.0f ? glm::vec4(acc[i] / len, 0.0f) : glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
+    }
+}
+
+} // namespace
+
+bool importMesh(const std::string& filename,
+    geometry_vector_t<glm::vec4>& vertices,
+    geometry_vector_t<glm::vec4>& normals,
+    geometry_vector_t<unsigned int>& indices,
+    unsigned int threads,
+    float weldEpsilon) {
+    auto start = std::chrono::steady_clock::now();
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+    mapped_file_t file(filename);
+    if (!file.ok()) {
+        std::cout << "Failed to open mesh " << filename << std::endl;
+        return false;
+    }
+
+    bool ok = false;
+    if (hasSuffix(filename, ".stl")) ok = parseSTL(file, threads, vertices, indices);
+    else if (hasSuffix(filename, ".ply")) ok = parsePLY(file, threads, vertices, indices);
+    else if (hasSuffix(filename, ".obj")) ok = parseOBJ(file, threads, vertices, indices);
+    else std::cout << "Unknown mesh format: " << filename << std::endl;
+    if (!ok) {
+        std::cout << "Failed to parse mesh " << filename << std::endl;
+        vertices.clear();
+        indices.clear();
+        return false;
+    }
+
+    auto parsed = std::chrono::steady_clock::now();
+    size_t rawVertices = vertices.size();
+    weldVertices(vertices, indices, weldEpsilon);
+    computeNormals(vertices, indices, normals);
+    auto done = std::chrono::steady_clock::now();
+
+    double parseSec = std::chrono::duration<double>(parsed - start).count();
+    double totalSec = std::chrono::duration<double>(done - start).count();
+    double mb = double(file.size) / (1024.0 * 1024.0);
+    std::cout << "Imported " << filename << ": " << mb << " MB, "
+              << vertices.size() << " vertices (" << rawVertices << " before welding), "
+              << indices.size() / 3 << " triangles | parse " << mb / std::max(parseSec, 1e-9) << " MB/s, "
+              << "total " << totalSec * 1000.0 << " ms (" << mb / std::max(totalSec, 1e-9) << " MB/s, "
+              << threads << " threads)" << std::endl;
+    return true;
+}
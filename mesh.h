@@ -0,0 +1,41 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "shape.h"
+
+// Triangle mesh loaded from an external file (binary STL, PLY or OBJ).
+// The path is what gets saved in .mod; geometry is (re)loaded from it on demand.
+class mesh_t : public shape_t {
+public:
+    std::string path;
+
+    explicit mesh_t(const std::string& filename) : shape_t(1), path(filename) {
+        shapetype = MESH_SHAPE;
+    }
+
+    // Loads the file the first time; tessellation level has no meaning for meshes. A file that
+    // fails to load is not tried again, or every draw would retry it.
+    void generateGeometry() override;
+    bool isLoaded() const { return loaded; }
+    // Bounds of the loaded vertices, kept when the geometry itself is released
+    void localBounds(glm::vec3& lo, glm::vec3& hi) const override { lo = boundsMin; hi = boundsMax; }
+
+private:
+    bool loaded = false;
+    bool failed = false;  // the import was tried and failed
+    glm::vec3 boundsMin{ 0.0f }, boundsMax{ 0.0f };
+};
+
+// Memory-maps `filename`, parses it on `threads` workers (0 = all cores) straight into
+// vertices/indices and welds vertices closer than weldEpsilon (relative to the bounding box).
+bool importMesh(const std::string& filename,
+    geometry_vector_t<glm::vec4>& vertices,
+    geometry_vector_t<glm::vec4>& normals,
+    geometry_vector_t<unsigned int>& indices,
+    unsigned int threads = 0,
+    float weldEpsilon = 1e-6f);
+
+#endif
@@ -0,0 +1,302 @@
+#include "occlusion.h"
+#include "HIERARCHIAL.h"
+#include "globals.h"
+#include "renderer.h"
+#include "render_snapshot.h"
+#include "scene.h"
+#include "shape.h"
+#include "soft_raster.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define OCCLUSION_SSE 1
+#endif
+
+namespace {
+
+const glm::vec4 unitCube[8] = {
+    { -1, -1, -1, 1 }, { 1, -1, -1, 1 }, { -1, 1, -1, 1 }, { 1, 1, -1, 1 },
+    { -1, -1, 1, 1 }, { 1, -1, 1, 1 }, { -1, 1, 1, 1 }, { 1, 1, 1, 1 } };
+// Two triangles per face; winding doesn't matter, both sides are rasterized
+const int cubeTriangles[36] = {
+    0, 1, 3, 0, 3, 2,  4, 5, 7, 4, 7, 6,  0, 1, 5, 0, 5, 4,
+    2, 3, 7, 2, 7, 6,  0, 2, 6, 0, 6, 4,  1, 3, 7, 1, 7, 5 };
+
+// Clip-space point to occlusion buffer pixels (x, y) and NDC depth
+glm::vec3 toScreen(const glm::vec4& p) {
+    float inv = 1.0f / p.w;
+    return glm::vec3((p.x * inv * 0.5f + 0.5f) * OCCLUSION_WIDTH,
+        (p.y * inv * 0.5f + 0.5f) * OCCLUSION_HEIGHT, p.z * inv);
+}
+
+} // namespace
+
+occlusion_culler_t::occlusion_culler_t() : depth(size_t(OCCLUSION_WIDTH) * OCCLUSION_HEIGHT, 1.0f) {}
+
+occlusion_culler_t::~occlusion_culler_t() {
+    if (!worker.joinable()) return;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_one();
+    worker.join();
+}
+
+void occlusion_culler_t::begin(const glm::mat4& viewProjection, const render_snapshot_t& snapshot) {
+    wait();
+
+    // Marked boxes always occlude; other boxes only when they are large on screen
+    std::vector<std::pair<float, size_t>> candidates;
+    const float screenArea = float(OCCLUSION_WIDTH) * OCCLUSION_HEIGHT;
+    for (size_t i = 0; i < snapshot.boxes.size(); ++i) {
+        occlusion_rect_t rect = project(viewProjection * snapshot.boxes[i], glm::vec3(-1.0f), glm::vec3(1.0f));
+        if (rect.offscreen) continue;
+        float area = float(rect.x1 - rect.x0 + 1) * float(rect.y1 - rect.y0 + 1) / screenArea;
+        if (snapshot.boxMarked[i]) candidates.emplace_back(2.0f + area, i);
+        else if (area >= OCCLUDER_MIN_SCREEN_AREA) candidates.emplace_back(area, i);
+    }
+    std::sort(candidates.begin(), candidates.end(),
+        [](const auto& a, const auto& b) { return a.first > b.first; });
+    if (candidates.size() > MAX_OCCLUDERS) candidates.resize(MAX_OCCLUDERS);
+
+    occluders.clear();
+    for (const auto& c : candidates) occluders.push_back(viewProjection * snapshot.boxes[c.second]);
+
+    if (!worker.joinable()) worker = std::thread(&occlusion_culler_t::workerLoop, this);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        pending = true;
+    }
+    wake.notify_one();
+}
+
+void occlusion_culler_t::wait() {
+    std::unique_lock<std::mutex> guard(lock);
+    done.wait(guard, [this] { return !pending; });
+}
+
+void occlusion_culler_t::workerLoop() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        wake.wait(guard, [this] { return pending || stopping; });
+        if (stopping) return;
+        guard.unlock();
+        rasterize();
+        guard.lock();
+        pending = false;
+        done.notify_all();
+    }
+}
+
+void occlusion_culler_t::rasterize() {
+    auto start = std::chrono::steady_clock::now();
+    std::fill(depth.begin(), depth.end(), 1.0f);
+    for (const glm::mat4& MVP : occluders) {
+        glm::vec4 corners[8];
+        for (int i = 0; i < 8; ++i) corners[i] = MVP * unitCube[i];
+        for (int t = 0; t < 36; t += 3) {
+            // Clip against the near plane (z >= -w); the far side needs no clipping since
+            // anything past it is at depth >= 1, which the buffer already holds
+            glm::vec4 in[3] = { corners[cubeTriangles[t]], corners[cubeTriangles[t + 1]], corners[cubeTriangles[t + 2]] };
+            glm::vec4 poly[4];
+            int count = 0;
+            for (int i = 0; i < 3; ++i) {
+                const glm::vec4& a = in[i];
+                const glm::vec4& b = in[(i + 1) % 3];
+                float da = a.z + a.w, db = b.z + b.w;
+                if (da >= 0.0f) poly[count++] = a;
+                if ((da >= 0.0f) != (db >= 0.0f)) poly[count++] = a + (b - a) * (da / (da - db));
+            }
+            if (count < 3) continue;
+            glm::vec3 s0 = toScreen(poly[0]);
+            for (int i = 1; i + 1 < count; ++i) rasterizeTriangle(s0, toScreen(poly[i]), toScreen(poly[i + 1]));
+        }
+    }
+    rasterTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void occlusion_culler_t::rasterizeTriangle(const glm::vec3& a, const glm::vec3& b0, const glm::vec3& c0) {
+    float area = (b0.x - a.x) * (c0.y - a.y) - (c0.x - a.x) * (b0.y - a.y);
+    if (std::fabs(area) < 1e-6f) return;
+    // Counter-clockwise, so every edge function is positive inside
+    glm::vec3 b = area > 0.0f ? b0 : c0, c = area > 0.0f ? c0 : b0;
+    area = std::fabs(area);
+
+    int x0 = std::max(0, int(std::floor(std::min({ a.x, b.x, c.x }))));
+    int x1 = std::min(OCCLUSION_WIDTH - 1, int(std::floor(std::max({ a.x, b.x, c.x }))));
+    int y0 = std::max(0, int(std::floor(std::min({ a.y, b.y, c.y }))));
+    int y1 = std::min(OCCLUSION_HEIGHT - 1, int(std::floor(std::max({ a.y, b.y, c.y }))));
+    if (x0 > x1 || y0 > y1) return;
+
+    // Edge functions e = ex * x + ey * y + e0. A pixel is wholly inside when every edge is at
+    // least half its footprint (|ex| + |ey|) / 2 positive at the centre
+    const glm::vec3* v[3] = { &a, &b, &c };
+    float ex[3], ey[3], e0[3], margin[3];
+    for (int i = 0; i < 3; ++i) {
+        const glm::vec3& p = *v[i];
+        const glm::vec3& q = *v[(i + 1) % 3];
+        ex[i] = p.y - q.y;
+        ey[i] = q.x - p.x;
+        e0[i] = p.x * q.y - p.y * q.x;
+        margin[i] = 0.5f * (std::fabs(ex[i]) + std::fabs(ey[i]));
+    }
+    // Depth plane, pushed out to the farthest corner of each pixel
+    float dzdx = ((b.z - a.z) * (c.y - a.y) - (c.z - a.z) * (b.y - a.y)) / area;
+    float dzdy = ((c.z - a.z) * (b.x - a.x) - (b.z - a.z) * (c.x - a.x)) / area;
+    float zBias = 0.5f * (std::fabs(dzdx) + std::fabs(dzdy));
+    float zMax = std::max({ a.z, b.z, c.z });
+
+    // Four pixels at a time from a 4-aligned column; pixels outside the triangle's box fail
+    // the edge tests, so the extra ones are harmless
+    int start = x0 & ~3;
+    for (int y = y0; y <= y1; ++y) {
+        float cy = float(y) + 0.5f;
+        float* row = depth.data() + size_t(y) * OCCLUSION_WIDTH;
+        for (int x = start; x <= x1; x += 4) {
+            float cx = float(x) + 0.5f;
+#ifdef OCCLUSION_SSE
+            __m128 px = _mm_add_ps(_mm_set1_ps(cx), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+            __m128 inside = _mm_cmpeq_ps(px, px);
+            for (int i = 0; i < 3; ++i) {
+                __m128 e = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ex[i]), px), _mm_set1_ps(ey[i] * cy + e0[i]));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(e, _mm_set1_ps(margin[i])));
+            }
+            if (_mm_movemask_ps(inside) == 0) continue;
+            __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(dzdx), _mm_sub_ps(px, _mm_set1_ps(a.x))),
+                _mm_set1_ps(a.z + dzdy * (cy - a.y) + zBias));
+            z = _mm_min_ps(z, _mm_set1_ps(zMax));
+            __m128 old = _mm_loadu_ps(row + x);
+            __m128 nearer = _mm_min_ps(old, z);
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+#else
+            for (int lane = 0; lane < 4; ++lane) {
+                float px = cx + float(lane);
+                bool inside = true;
+                for (int i = 0; i < 3; ++i) inside = inside && ex[i] * px + ey[i] * cy + e0[i] >= margin[i];
+                if (!inside) continue;
+                float z = std::min(zMax, a.z + dzdx * (px - a.x) + dzdy * (cy - a.y) + zBias);
+                row[x + lane] = std::min(row[x + lane], z);
+            }
+#endif
+        }
+    }
+}
+
+occlusion_rect_t occlusion_culler_t::project(const glm::mat4& MVP, const glm::vec3& lo, const glm::vec3& hi) const {
+    occlusion_rect_t rect;
+    glm::vec4 corners[8];
+    int outside[6] = { 0, 0, 0, 0, 0, 0 };
+    for (int i = 0; i < 8; ++i) {
+        glm::vec4& p = corners[i];
+        p = MVP * glm::vec4((i & 1) ? hi.x : lo.x, (i & 2) ? hi.y : lo.y, (i & 4) ? hi.z : lo.z, 1.0f);
+        outside[0] += p.x < -p.w; outside[1] += p.x > p.w;
+        outside[2] += p.y < -p.w; outside[3] += p.y > p.w;
+        outside[4] += p.z < -p.w; outside[5] += p.z > p.w;
+        rect.clipped = rect.clipped || p.z < -p.w;
+    }
+    for (int plane = 0; plane < 6; ++plane) rect.offscreen = rect.offscreen || outside[plane] == 8;
+    if (rect.offscreen || rect.clipped) {
+        rect.x0 = 0; rect.y0 = 0;
+        rect.x1 = OCCLUSION_WIDTH - 1; rect.y1 = OCCLUSION_HEIGHT - 1;
+        return rect;
+    }
+
+    glm::vec3 lower(1e30f), upper(-1e30f);
+    for (const glm::vec4& p : corners) {
+        glm::vec3 s = toScreen(p);
+        lower = glm::min(lower, s);
+        upper = glm::max(upper, s);
+    }
+    rect.x0 = std::max(0, int(std::floor(lower.x)));
+    rect.y0 = std::max(0, int(std::floor(lower.y)));
+    rect.x1 = std::min(OCCLUSION_WIDTH - 1, int(std::floor(upper.x)));
+    rect.y1 = std::min(OCCLUSION_HEIGHT - 1, int(std::floor(upper.y)));
+    rect.nearest = lower.z;
+    return rect;
+}
+
+bool occlusion_culler_t::visible(const occlusion_rect_t& rect) const {
+    if (rect.offscreen) return false;
+    if (rect.clipped || occluders.empty()) return true;
+    // Hidden only if every pixel it touches holds an occluder nearer than its nearest point
+    for (int y = rect.y0; y <= rect.y1; ++y) {
+        const float* row = depth.data() + size_t(y) * OCCLUSION_WIDTH;
+        int x = rect.x0;
+#ifdef OCCLUSION_SSE
+        __m128 nearest = _mm_set1_ps(rect.nearest);
+        for (; x + 3 <= rect.x1; x += 4)
+            if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), nearest)) != 0) return true;
+#endif
+        for (; x <= rect.x1; ++x)
+            if (row[x] >= rect.nearest) return true;
+    }
+    return false;
+}
+
+void benchmarkOcclusion(int frames) {
+    currentModel = std::make_shared<model_t>();
+    currentNode = currentModel->getRoot();
+    buildIndoorScene();
+    // Culling works per draw, so the scene is drawn node by node rather than as one batch
+    currentModel->unfreezeSubtree(*currentModel->getRoot());
+
+    std::unique_ptr<render_backend_t> previous = std::move(renderBackend);
+    renderBackend = std::make_unique<software_backend_t>(800, 600, 0);
+    Mode previousMode = currentMode;
+    bool previousWireframe = Wireframe, previousCulling = occlusionCulling;
+    float previousDistance = cameraDistance, previousX = cameraAngleX, previousY = cameraAngleY;
+    currentMode = INSPECTION;
+    Wireframe = false;
+
+    struct view_t { const char* name; float distance, angleX, angleY; };
+    const view_t views[] = {
+        { "inside, facing the back wall", 5.0f, 0.0f, 0.0f },
+        { "inside, facing the left wall", 5.0f, 10.0f, 90.0f },
+        { "behind the back wall", 12.0f, 5.0f, 180.0f },
+        { "outside the right wall", 14.0f, 10.0f, 90.0f },
+        { "above the ceiling", 8.0f, 75.0f, 30.0f } };
+
+    std::cout << "Occlusion culling benchmark (" << frames << " frames per view, "
+              << currentModel->getShapeCount() << " shapes)" << std::endl;
+    for (const view_t& v : views) {
+        cameraDistance = v.distance;
+        cameraAngleX = v.angleX;
+        cameraAngleY = v.angleY;
+        double ms[2] = { 0.0, 0.0 }, cullMs = 0.0, rasterMs = 0.0;
+        size_t draws[2] = { 0, 0 }, occluded = 0, offscreen = 0, occluderCount = 0;
+        for (int culling = 0; culling < 2; ++culling) {
+            occlusionCulling = culling == 1;
+            for (int f = 0; f < frames; ++f) {
+                renderBackend->beginFrame(glm::vec4(0.2f, 0.3f, 0.3f, 1.0f));
+                renderScene();
+                renderBackend->endFrame();
+                ms[culling] += renderStats.frameMs;
+            }
+            draws[culling] = renderStats.drawCalls;
+            if (culling) {
+                occluded = renderStats.occludedDraws;
+                offscreen = renderStats.offscreenDraws;
+                occluderCount = renderStats.occluders;
+                cullMs = renderStats.occlusionMs;
+                rasterMs = renderStats.occluderRasterMs;
+            }
+        }
+        std::cout << "  " << v.name << ": " << draws[0] << " -> " << draws[1] << " draws ("
+                  << occluded << " occluded, " << offscreen << " outside the view, " << occluderCount
+                  << " occluders), culling " << cullMs << " ms (raster " << rasterMs << " ms), frame "
+                  << ms[0] / frames << " -> " << ms[1] / frames << " ms" << std::endl;
+    }
+
+    renderBackend = std::move(previous);
+    currentMode = previousMode;
+    Wireframe = previousWireframe;
+    occlusionCulling = previousCulling;
+    cameraDistance = previousDistance;
+    cameraAngleX = previousX;
+    cameraAngleY = previousY;
+}
@@ -0,0 +1,74 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+
+struct render_snapshot_t;
+
+// Low-resolution depth buffer the occluders are drawn into; width is a multiple of 4 for SSE
+const int OCCLUSION_WIDTH = 256;
+const int OCCLUSION_HEIGHT = 192;
+// Boxes not marked as occluders are picked when they cover this fraction of the view
+const float OCCLUDER_MIN_SCREEN_AREA = 0.02f;
+const size_t MAX_OCCLUDERS = 64;
+
+// A box projected onto the occlusion buffer: the pixels it touches and its nearest depth
+struct occlusion_rect_t {
+    int x0 = 0, y0 = 0, x1 = -1, y1 = -1;  // inclusive
+    float nearest = -1.0f;                 // NDC depth, -1 at the near plane
+    bool offscreen = false;                // wholly outside the view frustum
+    bool clipped = false;                  // crosses the near plane, so it can't be tested
+};
+
+// Software occlusion culling. begin() picks the occluders from a render snapshot (boxes marked
+// with model_node_t::occluder, plus any box covering OCCLUDER_MIN_SCREEN_AREA of the view) and
+// rasterizes them on a worker thread while the caller walks the scene; after wait(),
+// visible() tests boxes against the result. Coverage is only written for pixels an occluder
+// covers completely, at the farthest depth it reaches inside them, so nothing that would
+// show on screen is ever culled.
+class occlusion_culler_t {
+public:
+    occlusion_culler_t();
+    ~occlusion_culler_t();
+
+    occlusion_culler_t(const occlusion_culler_t&) = delete;
+    occlusion_culler_t& operator=(const occlusion_culler_t&) = delete;
+
+    void begin(const glm::mat4& viewProjection, const render_snapshot_t& snapshot);
+    // Blocks until the occluders started by begin() are in the buffer
+    void wait();
+
+    // Screen bounds of the object-space box [lo, hi] under MVP; safe to call during rasterization
+    occlusion_rect_t project(const glm::mat4& MVP, const glm::vec3& lo, const glm::vec3& hi) const;
+    // False when the box is off screen or behind the occluders; only valid after wait()
+    bool visible(const occlusion_rect_t& rect) const;
+
+    size_t occluderCount() const { return occluders.size(); }
+    double rasterMs() const { return rasterTime; }  // worker time for the last frame's occluders
+
+private:
+    std::vector<float> depth;          // NDC depth per pixel, rows bottom to top
+    std::vector<glm::mat4> occluders;  // MVP of each occluding box
+    double rasterTime = 0.0;
+
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable wake, done;
+    bool pending = false;
+    bool stopping = false;
+
+    void rasterize();
+    void rasterizeTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c);
+    void workerLoop();
+};
+
+// Renders views of the indoor scene, unbatched, with and without culling and prints draws,
+// culling time and frame time for each
+void benchmarkOcclusion(int frames);
+
+#endif
@@ -0,0 +1,313 @@
+#include "octree.h"
+#include "HIERARCHIAL.h"
+#include "shape.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <queue>
+#include <random>
+#include <unordered_set>
+
+namespace {
+
+// Squared distance from p to the box [lo, hi]; 0 inside
+float distance2(const glm::vec3& p, const glm::vec3& lo, const glm::vec3& hi) {
+    glm::vec3 d = glm::max(glm::max(lo - p, p - hi), glm::vec3(0.0f));
+    return glm::dot(d, d);
+}
+
+bool overlaps(const glm::vec3& aLo, const glm::vec3& aHi, const glm::vec3& bLo, const glm::vec3& bHi) {
+    return aLo.x <= bHi.x && aHi.x >= bLo.x && aLo.y <= bHi.y && aHi.y >= bLo.y && aLo.z <= bHi.z && aHi.z >= bLo.z;
+}
+
+} // namespace
+
+void loose_octree_t::reset(const glm::vec3& lo, const glm::vec3& hi) {
+    cells.clear();
+    entries.clear();
+    freeEntries.clear();
+    overflow.clear();
+    lookup.clear();
+    cell_t root;
+    root.center = 0.5f * (lo + hi);
+    glm::vec3 size = hi - lo;
+    // Half again the scene's size, so nodes can move out a little before they overflow
+    root.half = std::max(0.75f * std::max(size.x, std::max(size.y, size.z)), 1.0f);
+    cells.push_back(root);
+}
+
+bool loose_octree_t::fits(const cell_t& cell, const glm::vec3& lo, const glm::vec3& hi) const {
+    glm::vec3 c = 0.5f * (lo + hi), e = 0.5f * (hi - lo);
+    glm::vec3 d = glm::abs(c - cell.center);
+    return std::max(e.x, std::max(e.y, e.z)) <= cell.half && d.x <= cell.half && d.y <= cell.half && d.z <= cell.half;
+}
+
+int loose_octree_t::cellFor(const glm::vec3& lo, const glm::vec3& hi) {
+    if (cells.empty() || !fits(cells[0], lo, hi)) return -1;
+    glm::vec3 c = 0.5f * (lo + hi), e = 0.5f * (hi - lo);
+    float extent = std::max(e.x, std::max(e.y, e.z));
+    int cell = 0;
+    for (int depth = 0; depth < MAX_DEPTH; ++depth) {
+        float childHalf = cells[cell].half * 0.5f;
+        if (extent > childHalf) break;
+        const glm::vec3 center = cells[cell].center;
+        int octant = (c.x >= center.x) | ((c.y >= center.y) << 1) | ((c.z >= center.z) << 2);
+        int child = cells[cell].children[octant];
+        if (child < 0) {
+            cell_t next;
+            next.center = center + glm::vec3((octant & 1) ? childHalf : -childHalf,
+                (octant & 2) ? childHalf : -childHalf, (octant & 4) ? childHalf : -childHalf);
+            next.half = childHalf;
+            next.parent = cell;
+            child = int(cells.size());
+            cells.push_back(next);  // may reallocate; only indices are held across it
+            cells[cell].children[octant] = child;
+        }
+        cell = child;
+    }
+    return cell;
+}
+
+void loose_octree_t::link(uint32_t e, int cell) {
+    entry_t& entry = entries[e];
+    entry.cell = cell;
+    std::vector<uint32_t>& list = cell < 0 ? overflow : cells[cell].items;
+    entry.slot = uint32_t(list.size());
+    list.push_back(e);
+    for (int c = cell; c >= 0; c = cells[c].parent) cells[c].count++;
+}
+
+void loose_octree_t::unlink(uint32_t e) {
+    entry_t& entry = entries[e];
+    std::vector<uint32_t>& list = entry.cell < 0 ? overflow : cells[entry.cell].items;
+    // Swap-remove; the entry moved into the hole takes over the slot
+    list[entry.slot] = list.back();
+    entries[list[entry.slot]].slot = entry.slot;
+    list.pop_back();
+    for (int c = entry.cell; c >= 0; c = cells[c].parent) cells[c].count--;
+}
+
+void loose_octree_t::update(model_node_t* node, const glm::vec3& lo, const glm::vec3& hi) {
+    auto it = lookup.find(node);
+    if (it != lookup.end()) {
+        entry_t& entry = entries[it->second];
+        entry.lo = lo;
+        entry.hi = hi;
+        if (entry.cell >= 0 && fits(cells[entry.cell], lo, hi)) return;
+        unlink(it->second);
+        link(it->second, cellFor(lo, hi));
+        return;
+    }
+    uint32_t e;
+    if (!freeEntries.empty()) {
+        e = freeEntries.back();
+        freeEntries.pop_back();
+    }
+    else {
+        e = uint32_t(entries.size());
+        entries.emplace_back();
+    }
+    entries[e].node = node;
+    entries[e].lo = lo;
+    entries[e].hi = hi;
+    lookup.emplace(node, e);
+    link(e, cellFor(lo, hi));
+}
+
+void loose_octree_t::remove(const model_node_t* node) {
+    auto it = lookup.find(node);
+    if (it == lookup.end()) return;
+    unlink(it->second);
+    entries[it->second].node = nullptr;
+    freeEntries.push_back(it->second);
+    lookup.erase(it);
+}
+
+void loose_octree_t::queryBox(const glm::vec3& lo, const glm::vec3& hi, std::vector<model_node_t*>& out) const {
+    for (uint32_t e : overflow)
+        if (overlaps(entries[e].lo, entries[e].hi, lo, hi)) out.push_back(entries[e].node);
+    if (cells.empty()) return;
+    std::vector<int> stack{ 0 };
+    while (!stack.empty()) {
+        const cell_t& cell = cells[stack.back()];
+        stack.pop_back();
+        glm::vec3 loose(2.0f * cell.half);
+        if (cell.count == 0 || !overlaps(cell.center - loose, cell.center + loose, lo, hi)) continue;
+        for (uint32_t e : cell.items)
+            if (overlaps(entries[e].lo, entries[e].hi, lo, hi)) out.push_back(entries[e].node);
+        for (int child : cell.children)
+            if (child >= 0) stack.push_back(child);
+    }
+}
+
+void loose_octree_t::querySphere(const glm::vec3& center, float radius, std::vector<model_node_t*>& out) const {
+    float r2 = radius * radius;
+    for (uint32_t e : overflow)
+        if (distance2(center, entries[e].lo, entries[e].hi) <= r2) out.push_back(entries[e].node);
+    if (cells.empty()) return;
+    std::vector<int> stack{ 0 };
+    while (!stack.empty()) {
+        const cell_t& cell = cells[stack.back()];
+        stack.pop_back();
+        glm::vec3 loose(2.0f * cell.half);
+        if (cell.count == 0 || distance2(center, cell.center - loose, cell.center + loose) > r2) continue;
+        for (uint32_t e : cell.items)
+            if (distance2(center, entries[e].lo, entries[e].hi) <= r2) out.push_back(entries[e].node);
+        for (int child : cell.children)
+            if (child >= 0) stack.push_back(child);
+    }
+}
+
+void loose_octree_t::queryNearest(const glm::vec3& point, size_t k, std::vector<model_node_t*>& out) const {
+    // Best first: cells by the distance to their loose bounds, which hold everything below
+    // them, entries by the distance to their box. An entry popped before any cell left in
+    // the queue is nearer than everything not yet seen.
+    struct candidate_t { float d2; int cell; uint32_t entry; };
+    auto farther = [](const candidate_t& a, const candidate_t& b) { return a.d2 > b.d2; };
+    std::priority_queue<candidate_t, std::vector<candidate_t>, decltype(farther)> queue(farther);
+    for (uint32_t e : overflow) queue.push({ distance2(point, entries[e].lo, entries[e].hi), -1, e });
+    if (!cells.empty() && cells[0].count > 0) queue.push({ 0.0f, 0, 0 });
+
+    size_t found = 0;
+    while (!queue.empty() && found < k) {
+        candidate_t c = queue.top();
+        queue.pop();
+        if (c.cell < 0) {
+            out.push_back(entries[c.entry].node);
+            ++found;
+            continue;
+        }
+        const cell_t& cell = cells[c.cell];
+        for (uint32_t e : cell.items) queue.push({ distance2(point, entries[e].lo, entries[e].hi), -1, e });
+        for (int child : cell.children) {
+            if (child < 0 || cells[child].count == 0) continue;
+            glm::vec3 loose(2.0f * cells[child].half);
+            queue.push({ distance2(point, cells[child].center - loose, cells[child].center + loose), child, 0 });
+        }
+    }
+}
+
+void benchmarkSpatialQueries(size_t nodeCount, int queries, size_t editsPerFrame) {
+    // Groups of boxes scattered through a 200-unit cube, like benchmarkWorldTransforms()
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    model_t model;
+    auto part = std::shared_ptr<shape_t>(createPrimitive(BOX_SHAPE, 1));
+    std::vector<model_node_t*> leaves;
+    size_t groups = std::max<size_t>(1, nodeCount / 256);
+    size_t perGroup = std::max<size_t>(1, nodeCount / groups) - 1;
+    for (size_t g = 0; g < groups; ++g) {
+        auto group = std::make_shared<model_node_t>();
+        group->translation = glm::vec3(dist(rng), dist(rng), dist(rng)) * 100.0f;
+        group->rotation = glm::normalize(glm::quat(dist(rng), dist(rng), dist(rng), dist(rng)));
+        model.root_node->addChild(group);
+        for (size_t i = 0; i < perGroup; ++i) {
+            auto node = std::make_shared<model_node_t>(part, BOX_SHAPE);
+            node->translation = glm::vec3(dist(rng), dist(rng), dist(rng)) * 10.0f;
+            node->scale = glm::vec3(0.2f + 0.15f * dist(rng));
+            group->addChild(node);
+            leaves.push_back(node.get());
+        }
+    }
+    model.invalidateSpatialIndex();
+    size_t total = groups * (1 + perGroup);
+
+    using clock = std::chrono::steady_clock;
+    auto ms = [](clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    };
+    std::vector<model_node_t*> found;
+    model.queryBox(glm::vec3(0.0f), glm::vec3(0.0f), found);  // builds the tree
+    auto start = clock::now();
+    model.invalidateSpatialIndex();
+    model.queryBox(glm::vec3(0.0f), glm::vec3(0.0f), found);
+    std::cout << "Spatial queries: " << total << " nodes, octree built in " << ms(start) << " ms" << std::endl;
+
+    // Brute force as a caller would write it today: every world matrix, then every box
+    std::vector<std::shared_ptr<model_node_t>> all;
+    auto bruteForce = [&](auto&& test, std::vector<model_node_t*>& out) {
+        model.updateWorldTransforms(glm::mat4(1.0f));
+        all.clear();
+        model.getAllNodes(all);
+        for (const auto& n : all)
+            if (n != model.root_node && test(*n)) out.push_back(n.get());
+    };
+
+    std::vector<glm::vec3> points(queries);
+    for (auto& p : points) p = glm::vec3(dist(rng), dist(rng), dist(rng)) * 100.0f;
+    const float half = 10.0f;
+    const size_t k = 8;
+    double treeMs[3] = { 0, 0, 0 }, bruteMs[3] = { 0, 0, 0 };
+    size_t hits[3] = { 0, 0, 0 }, mismatches = 0;
+    std::vector<model_node_t*> expected;
+    auto same = [](std::vector<model_node_t*> a, std::vector<model_node_t*> b) {
+        std::sort(a.begin(), a.end());
+        std::sort(b.begin(), b.end());
+        return a == b;
+    };
+    for (const glm::vec3& p : points) {
+        found.clear(); expected.clear();
+        start = clock::now();
+        model.queryBox(p - half, p + half, found);
+        treeMs[0] += ms(start);
+        start = clock::now();
+        bruteForce([&](const model_node_t& n) { return overlaps(n.worldMin, n.worldMax, p - half, p + half); }, expected);
+        bruteMs[0] += ms(start);
+        hits[0] += found.size();
+        mismatches += !same(found, expected);
+
+        found.clear(); expected.clear();
+        start = clock::now();
+        model.querySphere(p, half, found);
+        treeMs[1] += ms(start);
+        start = clock::now();
+        bruteForce([&](const model_node_t& n) { return distance2(p, n.worldMin, n.worldMax) <= half * half; }, expected);
+        bruteMs[1] += ms(start);
+        hits[1] += found.size();
+        mismatches += !same(found, expected);
+
+        found.clear(); expected.clear();
+        start = clock::now();
+        model.queryNearest(p, k, found);
+        treeMs[2] += ms(start);
+        start = clock::now();
+        bruteForce([](const model_node_t&) { return true; }, expected);
+        std::partial_sort(expected.begin(), expected.begin() + std::min(k, expected.size()), expected.end(),
+            [&](const model_node_t* a, const model_node_t* b) {
+                return distance2(p, a->worldMin, a->worldMax) < distance2(p, b->worldMin, b->worldMax);
+            });
+        expected.resize(std::min(k, expected.size()));
+        bruteMs[2] += ms(start);
+        hits[2] += found.size();
+        // Ties may come out in either order; compare the distances
+        for (size_t i = 0; i < found.size() && i < expected.size(); ++i)
+            mismatches += distance2(p, found[i]->worldMin, found[i]->worldMax) != distance2(p, expected[i]->worldMin, expected[i]->worldMax);
+    }
+    const char* names[3] = { "box (20 units)", "sphere (r 10)", "nearest 8" };
+    for (int q = 0; q < 3; ++q)
+        std::cout << "  " << names[q] << ": octree " << treeMs[q] * 1000.0 / queries << " us, brute force "
+                  << bruteMs[q] * 1000.0 / queries << " us (" << double(hits[q]) / queries << " nodes per query)" << std::endl;
+    if (mismatches) std::cout << "  " << mismatches << " queries DIFFER from brute force" << std::endl;
+
+    // Continuous editing: nodes drift every frame and are re-indexed as applyTransform() does
+    const int frames = 100;
+    start = clock::now();
+    for (int f = 0; f < frames; ++f) {
+        for (size_t i = 0; i < editsPerFrame; ++i) {
+            model_node_t* n = leaves[rng() % leaves.size()];
+            n->translation += glm::vec3(dist(rng), dist(rng), dist(rng)) * 0.5f;
+            model.nodeMoved(*n);
+        }
+    }
+    double editMs = ms(start) / frames;
+    std::cout << "  editing " << editsPerFrame << " nodes per frame: " << editMs << " ms/frame ("
+              << editMs * 1000.0 / editsPerFrame << " us per edit)" << std::endl;
+    // Groups carry their whole subtree
+    start = clock::now();
+    for (int f = 0; f < frames; ++f) {
+        model_node_t& group = *model.root_node->children[rng() % model.root_node->children.size()];
+        group.translation += glm::vec3(dist(rng), dist(rng), dist(rng)) * 0.5f;
+        model.nodeMoved(group);
+    }
+    std::cout << "  moving a group of " << perGroup << ": " << ms(start) * 1000.0 / frames << " us" << std::endl;
+}
@@ -0,0 +1,71 @@
+#ifndef OCTREE_H
+#define OCTREE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+
+struct model_node_t;
+
+// Loose octree over one axis-aligned box per scene node. A cell's loose bounds are twice its
+// size, so a box goes in the deepest cell that holds its centre and is at least as big as the
+// box, and a small move usually leaves it where it is. Boxes outside the root cube go on an
+// overflow list that every query scans; needsRebuild() says when that list has grown too long.
+class loose_octree_t {
+public:
+    static const int MAX_DEPTH = 12;
+
+    // Drops every box and sizes the root cube to hold [lo, hi] with room to grow
+    void reset(const glm::vec3& lo, const glm::vec3& hi);
+    // Inserts the node's box, or moves it if the node is already in the tree
+    void update(model_node_t* node, const glm::vec3& lo, const glm::vec3& hi);
+    void remove(const model_node_t* node);
+
+    size_t size() const { return lookup.size(); }
+    size_t cellCount() const { return cells.size(); }
+    size_t overflowCount() const { return overflow.size(); }
+    bool needsRebuild() const { return overflow.size() > 64 && overflow.size() * 8 > lookup.size(); }
+
+    // Nodes whose boxes overlap the box [lo, hi]
+    void queryBox(const glm::vec3& lo, const glm::vec3& hi, std::vector<model_node_t*>& out) const;
+    // Nodes whose boxes come within `radius` of `center`
+    void querySphere(const glm::vec3& center, float radius, std::vector<model_node_t*>& out) const;
+    // The k nodes whose boxes are nearest `point`, nearest first; a box around the point is at 0
+    void queryNearest(const glm::vec3& point, size_t k, std::vector<model_node_t*>& out) const;
+
+private:
+    struct cell_t {
+        glm::vec3 center{ 0.0f };
+        float half = 0.0f;             // half the cell's size; its loose bounds reach 2 * half
+        int parent = -1;
+        int children[8] = { -1, -1, -1, -1, -1, -1, -1, -1 };
+        std::vector<uint32_t> items;   // entries stored in this cell
+        size_t count = 0;              // entries in this cell and below, to skip empty branches
+    };
+    struct entry_t {
+        model_node_t* node = nullptr;  // nullptr while on the free list
+        glm::vec3 lo{ 0.0f }, hi{ 0.0f };
+        int cell = -1;                 // -1: on the overflow list
+        uint32_t slot = 0;             // index in the cell's items (or in overflow)
+    };
+
+    std::vector<cell_t> cells;         // [0] is the root once reset() has run
+    std::vector<entry_t> entries;
+    std::vector<uint32_t> freeEntries;
+    std::vector<uint32_t> overflow;
+    std::unordered_map<const model_node_t*, uint32_t> lookup;
+
+    bool fits(const cell_t& cell, const glm::vec3& lo, const glm::vec3& hi) const;
+    int cellFor(const glm::vec3& lo, const glm::vec3& hi);  // creates cells on the way down
+    void link(uint32_t entry, int cell);
+    void unlink(uint32_t entry);
+};
+
+// Region and nearest queries on a synthetic scene of `nodes` nodes, octree against a brute force
+// walk that recomputes every world matrix, plus the cost of keeping the tree current while
+// `editsPerFrame` nodes move every frame
+void benchmarkSpatialQueries(size_t nodes, int queries, size_t editsPerFrame);
+
+#endif
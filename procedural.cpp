@@ -0,0 +1,276 @@
+#include "procedural.h"
+#include "HIERARCHIAL.h"
+#include "globals.h"
+#include "scene.h"
+#include "scene_codec.h"
+#include "shape.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace {
+
+const ShapeType WORLD_TYPES[4] = { BOX_SHAPE, CYLINDER_SHAPE, SPHERE_SHAPE, CONE_SHAPE };
+
+const glm::vec4 FLOOR_COLORS[] = {
+    { 0.6f, 0.4f, 0.2f, 1.0f }, { 0.45f, 0.45f, 0.5f, 1.0f }, { 0.7f, 0.65f, 0.55f, 1.0f },
+};
+const glm::vec4 ITEM_COLORS[] = {
+    { 0.4f, 0.25f, 0.1f, 1.0f }, { 0.5f, 0.3f, 0.15f, 1.0f }, { 0.9f, 0.9f, 0.7f, 1.0f },
+    { 0.8f, 0.2f, 0.2f, 1.0f }, { 0.2f, 0.4f, 0.8f, 1.0f }, { 0.2f, 0.7f, 0.3f, 1.0f },
+    { 0.3f, 0.3f, 0.3f, 1.0f }, { 0.95f, 0.95f, 0.95f, 1.0f },
+};
+
+// Rooms are cubes of this half-width standing on a grid, their top face at y = 0
+const float ROOM_HALF = 4.0f;
+const float ROOM_SPACING = 10.0f;
+
+// The engine's output is fixed by the standard but the distributions are not, so values are
+// drawn from it directly
+struct world_rng_t {
+    std::mt19937 engine;
+
+    explicit world_rng_t(uint32_t seed) : engine(seed) {}
+    float uniform(float lo, float hi) { return lo + (hi - lo) * float(engine() >> 8) * (1.0f / 16777216.0f); }
+    size_t below(size_t n) { return size_t(engine() % n); }
+};
+
+class world_generator_t {
+public:
+    world_generator_t(const world_params_t& p, const std::function<void(const saved_node_t&)>& e)
+        : params(p), emit(e), rng(p.seed) {
+        for (float w : params.typeWeights) weightSum += w > 0.0f ? w : 0.0f;
+    }
+
+    void run() {
+        size_t side = 1;
+        while (side * side < params.rooms) ++side;
+        for (size_t r = 0; r < params.rooms; ++r) {
+            saved_node_t room;
+            room.id = nextId++;
+            room.type = BOX_SHAPE;
+            room.level = 1;
+            room.translation = glm::vec3(float(r % side) * ROOM_SPACING, -ROOM_HALF, float(r / side) * ROOM_SPACING);
+            room.scale = glm::vec3(ROOM_HALF);
+            room.color = FLOOR_COLORS[rng.below(3)];
+            room.occluder = true;
+            emit(room);
+            for (size_t i = 0; i < params.itemsPerRoom; ++i) item(room.id);
+        }
+    }
+
+private:
+    const world_params_t& params;
+    const std::function<void(const saved_node_t&)>& emit;
+    world_rng_t rng;
+    float weightSum = 0.0f;
+    int nextId = 1;
+
+    ShapeType pickType() {
+        float x = rng.uniform(0.0f, weightSum);
+        for (int t = 0; t < 4; ++t) {
+            float w = params.typeWeights[t] > 0.0f ? params.typeWeights[t] : 0.0f;
+            if (x < w) return WORLD_TYPES[t];
+            x -= w;
+        }
+        for (int t = 3; t >= 0; --t)
+            if (params.typeWeights[t] > 0.0f) return WORLD_TYPES[t];
+        return BOX_SHAPE;
+    }
+
+    unsigned int pickLevel() {
+        return params.minLevel + unsigned(rng.below(params.maxLevel - params.minLevel + 1));
+    }
+
+    // Stands on the room's top face, turned about y. Transforms are relative to the parent's
+    // scale, so `half` is the item's half-size in the world.
+    void item(int roomId) {
+        saved_node_t n;
+        n.id = nextId++;
+        n.parent_id = roomId;
+        n.type = pickType();
+        n.level = pickLevel();
+        glm::vec3 half(rng.uniform(0.2f, 0.7f), rng.uniform(0.1f, 0.5f), rng.uniform(0.2f, 0.7f));
+        float reach = ROOM_HALF - 0.7f;
+        glm::vec3 offset(rng.uniform(-reach, reach), ROOM_HALF + half.y, rng.uniform(-reach, reach));
+        n.translation = offset / ROOM_HALF;
+        n.scale = half / ROOM_HALF;
+        n.rotation = glm::angleAxis(rng.uniform(0.0f, glm::radians(360.0f)), glm::vec3(0.0f, 1.0f, 0.0f));
+        n.color = ITEM_COLORS[rng.below(8)];
+        emit(n);
+        parts(n.id, half, n.color, params.depth);
+    }
+
+    // Smaller parts against a random face of a parent of half-size `parentHalf`, unrotated, so
+    // the parent's non-uniform scale never shears them
+    void parts(int parentId, const glm::vec3& parentHalf, const glm::vec4& color, int levelsLeft) {
+        if (levelsLeft <= 0) return;
+        for (int b = 0; b < params.branching; ++b) {
+            saved_node_t n;
+            n.id = nextId++;
+            n.parent_id = parentId;
+            n.type = pickType();
+            n.level = pickLevel();
+            glm::vec3 half = parentHalf * glm::vec3(rng.uniform(0.2f, 0.45f), rng.uniform(0.2f, 0.45f), rng.uniform(0.2f, 0.45f));
+            int face = int(rng.below(6));
+            int axis = face / 2;
+            glm::vec3 offset;
+            for (int k = 0; k < 3; ++k) offset[k] = rng.uniform(-1.0f, 1.0f) * (parentHalf[k] - half[k]);
+            offset[axis] = (face % 2 ? -1.0f : 1.0f) * (parentHalf[axis] + half[axis]);
+            n.translation = offset / parentHalf;
+            n.scale = half / parentHalf;
+            n.color = rng.below(10) < 7 ? color : ITEM_COLORS[rng.below(8)];
+            emit(n);
+            parts(n.id, half, n.color, levelsLeft - 1);
+        }
+    }
+};
+
+// Whole string as a number, or false
+bool readNumber(const std::string& text, double& value) {
+    char* end = nullptr;
+    value = std::strtod(text.c_str(), &end);
+    return !text.empty() && end && *end == '\0';
+}
+
+} // namespace
+
+size_t worldNodeCount(const world_params_t& params) {
+    // Every step saturates, so a count past the limit stays past it instead of wrapping
+    const size_t limit = std::numeric_limits<size_t>::max();
+    auto mul = [limit](size_t a, size_t b) { return b != 0 && a > limit / b ? limit : a * b; };
+    auto add = [limit](size_t a, size_t b) { return a > limit - b ? limit : a + b; };
+    size_t perItem = 0, level = 1;
+    for (int d = 0; d <= params.depth; ++d) {
+        perItem = add(perItem, level);
+        level = mul(level, size_t(params.branching > 0 ? params.branching : 0));
+    }
+    return mul(params.rooms, add(1, mul(params.itemsPerRoom, perItem)));
+}
+
+void fitWorldToNodeCount(world_params_t& params, size_t nodes) {
+    world_params_t one = params;
+    one.rooms = 1;
+    size_t perRoom = worldNodeCount(one);
+    params.rooms = std::max<size_t>(1, (nodes + perRoom / 2) / perRoom);
+}
+
+int parseWorldParams(int argc, char** argv, int first, world_params_t& params) {
+    double nodes = 0.0;
+    int i = first;
+    for (; i < argc; ++i) {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        if (eq == std::string::npos || arg[0] == '-') break;
+        std::string key = arg.substr(0, eq), value = arg.substr(eq + 1);
+        double v = 0.0;
+        bool ok = true;
+        if (key == "mix") {
+            float weights[4] = {};
+            size_t at = 0;
+            float sum = 0.0f;
+            for (int t = 0; t < 4 && ok; ++t) {
+                size_t comma = value.find(',', at);
+                ok = readNumber(value.substr(at, comma == std::string::npos ? std::string::npos : comma - at), v) && v >= 0.0;
+                weights[t] = float(v);
+                sum += weights[t];
+                at = comma == std::string::npos ? value.size() + 1 : comma + 1;
+            }
+            ok = ok && at == value.size() + 1 && sum > 0.0f;
+            if (ok) std::copy(weights, weights + 4, params.typeWeights);
+        }
+        else if (key == "levels") {
+            size_t dash = value.find('-');
+            double lo = 0.0, hi = 0.0;
+            ok = readNumber(value.substr(0, dash), lo);
+            hi = lo;
+            if (ok && dash != std::string::npos) ok = readNumber(value.substr(dash + 1), hi);
+            ok = ok && lo >= 1.0 && hi <= 4.0 && lo <= hi;
+            if (ok) {
+                params.minLevel = unsigned(lo);
+                params.maxLevel = unsigned(hi);
+            }
+        }
+        else if (!readNumber(value, v) || v < 0.0) ok = false;
+        else if (key == "seed" && v <= 4294967295.0) params.seed = uint32_t(v);
+        else if (key == "nodes" && v <= double(MAX_WORLD_NODES)) nodes = v;
+        else if (key == "rooms" && v <= double(MAX_WORLD_NODES)) params.rooms = size_t(v);
+        else if (key == "items" && v <= double(MAX_WORLD_NODES)) params.itemsPerRoom = size_t(v);
+        else if (key == "depth" && v <= 16.0) params.depth = int(v);
+        else if (key == "branching" && v <= 64.0) params.branching = int(v);
+        else ok = false;
+        if (!ok) {
+            std::cout << "Bad world parameter '" << arg << "'" << std::endl;
+            return -1;
+        }
+    }
+    if (nodes > 0.0) fitWorldToNodeCount(params, size_t(nodes));
+    // Each value can be in range and the product of rooms, items, depth and branching not
+    if (worldNodeCount(params) > MAX_WORLD_NODES) {
+        std::cout << "Bad world parameters: more than " << MAX_WORLD_NODES << " nodes" << std::endl;
+        return -1;
+    }
+    return i;
+}
+
+void generateWorld(const world_params_t& params, const std::function<void(const saved_node_t&)>& emit) {
+    world_generator_t(params, emit).run();
+}
+
+void buildWorld(const world_params_t& params) {
+    currentModel->clear();
+    std::shared_ptr<model_node_t> root = currentModel->getRoot();
+    // By generated id, which counts up from 1 in the order nodes come
+    std::vector<std::shared_ptr<model_node_t>> nodes(1, root);
+    nodes.reserve(worldNodeCount(params) + 1);
+
+    // createShape() reports every node; a large world would spend its time printing
+    std::cout.setstate(std::ios::failbit);
+    generateWorld(params, [&](const saved_node_t& n) {
+        currentNode = n.parent_id > 0 && size_t(n.parent_id) < nodes.size() ? nodes[n.parent_id] : root;
+        auto node = createShape(createPrimitive(n.type, n.level), n.translation, n.scale, n.color);
+        node->occluder = n.occluder;
+        if (n.rotation != glm::quat(1.0f, 0.0f, 0.0f, 0.0f)) {
+            node->rotation = n.rotation;
+            currentModel->nodeMoved(*node);
+        }
+        nodes.push_back(node);
+    });
+    std::cout.clear();
+    currentNode = root;
+    std::cout << "Generated a world of " << currentModel->getShapeCount() << " nodes in " << params.rooms
+              << " rooms (seed " << params.seed << ")" << std::endl;
+}
+
+bool writeWorld(const world_params_t& params, const std::string& filename) {
+    bool compressed = filename.size() > 5 && filename.compare(filename.size() - 5, 5, ".modz") == 0;
+    std::ofstream file(filename, compressed ? std::ios::binary : std::ios::out);
+    if (!file.is_open()) {
+        std::cout << "Failed to write world to " << filename << std::endl;
+        return false;
+    }
+    size_t count = worldNodeCount(params);
+    if (compressed) {
+        std::vector<saved_node_t> nodes;
+        nodes.reserve(count);
+        generateWorld(params, [&nodes](const saved_node_t& n) { nodes.push_back(n); });
+        writeCompressedScene(file, nodes, std::string(), DEFAULT_SCENE_TOLERANCE);
+    }
+    else {
+        file << "MODEL_FILE_VERSION 2.0\n";
+        file << "SHAPE_COUNT " << count << "\n";
+        generateWorld(params, [&file](const saved_node_t& n) { writeSavedNode(file, n); });
+    }
+    file.close();
+    if (!file) {
+        std::cout << "Failed to write world to " << filename << std::endl;
+        return false;
+    }
+    std::cout << "Wrote a world of " << count << " nodes in " << params.rooms << " rooms (seed " << params.seed
+              << ") to " << filename << std::endl;
+    return true;
+}
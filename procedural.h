@@ -0,0 +1,51 @@
+#ifndef PROCEDURAL_H
+#define PROCEDURAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+struct saved_node_t;
+
+// A generated world: rooms on a grid, each a platform with furniture items standing on it,
+// and under every item a tree of parts `depth` levels deep with `branching` parts per node.
+// The same parameters give the same world on every platform.
+struct world_params_t {
+    uint32_t seed = 1;
+    size_t rooms = 16;
+    size_t itemsPerRoom = 12;
+    int depth = 2;
+    int branching = 3;
+    // Relative shares of boxes, cylinders, spheres and cones among items and parts
+    float typeWeights[4] = { 4.0f, 3.0f, 2.0f, 1.0f };
+    unsigned int minLevel = 1, maxLevel = 2;  // tessellation level, picked per node
+};
+
+// Most nodes parseWorldParams() accepts; ten times the 10M --generate was sized for
+const size_t MAX_WORLD_NODES = 100000000;
+
+// Nodes the parameters give, the root not counted; SIZE_MAX when that doesn't fit in a size_t
+size_t worldNodeCount(const world_params_t& params);
+// Sets the number of rooms so the world has about `nodes` nodes
+void fitWorldToNodeCount(world_params_t& params, size_t nodes);
+
+// Reads key=value arguments from argv[first] on: seed, nodes, rooms, items, depth, branching,
+// mix=box,cylinder,sphere,cone (weights) and levels=min-max; nodes= is applied last. Returns the
+// index after the last one read, or -1 with a message if one is malformed or together they give
+// more than MAX_WORLD_NODES nodes.
+int parseWorldParams(int argc, char** argv, int first, world_params_t& params);
+
+// Every node of the world, each parent before its children, with ids counting up from 1 and
+// rooms under parent -1
+void generateWorld(const world_params_t& params, const std::function<void(const saved_node_t&)>& emit);
+
+// Replaces currentModel's contents with the world, built through createShape(). Every node
+// gets geometry of its own, which limits this to a few hundred thousand nodes; larger worlds
+// are meant for writeWorld().
+void buildWorld(const world_params_t& params);
+// Writes the world to a .mod file as it is generated, without building a model. A .modz file
+// is compressed (scene_codec.h), which keeps the nodes in memory until they are encoded.
+bool writeWorld(const world_params_t& params, const std::string& filename);
+
+#endif
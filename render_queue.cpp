@@ -0,0 +1,249 @@
+#include "render_queue.h"
+#include "HIERARCHIAL.h"
+#include "globals.h"
+#include "renderer.h"
+#include "scene.h"
+#include "shape.h"
+#include "thread_pool.h"
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <thread>
+
+namespace {
+
+uint64_t quantizeDepth(float depth, float depthRange, int bits) {
+    float t = depthRange > 0.0f ? depth / depthRange : 0.0f;
+    t = std::min(std::max(t, 0.0f), 1.0f);
+    return uint64_t(t * float((1u << bits) - 1) + 0.5f);
+}
+
+// A copy of `source` and its subtree under `parent`, drawing the same shapes
+void copySubtree(model_t& model, const model_node_t& source, model_node_t& parent) {
+    auto node = model.attachShape(parent, source.shape);
+    node->type = source.type;
+    node->translation = source.translation;
+    node->rotation = source.rotation;
+    node->scale = source.scale;
+    node->color = source.color;
+    node->occluder = source.occluder;
+    for (const auto& child : source.children) copySubtree(model, *child, *node);
+}
+
+// Replaces currentModel with the indoor scene, unbatched, and copies of its room behind it on a
+// grid until there are about `nodes` nodes. Each copy sits under a node of its own and shares the
+// room's shapes, the way prefab definitions or imported meshes are shared.
+void buildScaledIndoorScene(size_t nodes, size_t& roomNodes, size_t& copies) {
+    currentModel = std::make_shared<model_t>();
+    currentNode = currentModel->getRoot();
+    model_t& model = *currentModel;
+    std::cout.setstate(std::ios::failbit);
+    buildIndoorScene();
+    std::cout.clear();
+    // Sorting and culling work per draw, so the scene is drawn node by node rather than as one batch
+    model.unfreezeSubtree(*model.getRoot());
+
+    model.updateWorldTransforms(glm::mat4(1.0f));
+    glm::vec3 lo(1e30f), hi(-1e30f);
+    for (const auto& node : model.getShapes()) {
+        if (!node->shape) continue;
+        lo = glm::min(lo, node->worldMin);
+        hi = glm::max(hi, node->worldMax);
+    }
+    glm::vec3 spacing = lo.x <= hi.x ? hi - lo + glm::vec3(1.0f) : glm::vec3(10.0f);
+    roomNodes = model.getShapeCount();
+    copies = std::max<size_t>(1, nodes / (roomNodes + 1));
+    size_t side = size_t(std::ceil(std::sqrt(double(copies))));
+    node_list_t room = model.getRoot()->children;
+    model.invalidateSpatialIndex();
+    for (size_t c = 1; c < copies; ++c) {
+        auto group = model.attachShape(*model.getRoot(), nullptr);
+        group->translation = glm::vec3((float(c % side) - float(side / 2)) * spacing.x, 0.0f, -float(c / side) * spacing.z);
+        for (const auto& node : room) copySubtree(model, *node, *group);
+    }
+}
+
+} // namespace
+
+thread_pool_t* drawListPool = nullptr;
+
+uint64_t opaqueSortKey(const draw_state_t& state, float depth, float depthRange) {
+    return uint64_t(state.program & 0xFu) << 59 | uint64_t(state.mesh & 0xFFFFFFu) << 35
+        | uint64_t(state.material & 0xFFFFu) << 19 | quantizeDepth(depth, depthRange, 19);
+}
+
+uint64_t translucentSortKey(const draw_state_t& state, float depth, float depthRange) {
+    uint64_t farFirst = ((uint64_t(1) << 24) - 1) - quantizeDepth(depth, depthRange, 24);
+    return uint64_t(1) << 63 | farFirst << 39 | uint64_t(state.program & 0xFu) << 35
+        | uint64_t(state.mesh & 0xFFFFFFu) << 11;
+}
+
+void fillDrawRecord(draw_record_t& record, const glm::mat4& viewProjection, const glm::mat4& world, const glm::vec4& color) {
+    record.MVP = viewProjection * world;
+    record.model = world;
+    glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(world)));
+    for (int c = 0; c < 3; ++c) record.normalMatrix[c] = glm::vec4(normalMatrix[c], 0.0f);
+    record.color = color;
+}
+
+void render_queue_t::reset(size_t count) {
+    lists.resize(count);
+    for (command_list_t& list : lists) {
+        list.packets.clear();
+        list.draws.clear();
+        list.lodDraws = list.occludedDraws = list.offscreenDraws = 0;
+    }
+    packets.clear();
+    items.clear();
+}
+
+void render_queue_t::sort() {
+    // Merge, taking every pass's histogram on the way
+    size_t counts[8][256] = {};
+    for (const command_list_t& list : lists) {
+        uint32_t offset = uint32_t(items.size());
+        for (packet_t p : list.packets) {
+            for (int b = 0; b < 8; ++b) counts[b][(p.key >> (8 * b)) & 0xFF]++;
+            p.draw += offset;
+            packets.push_back(p);
+        }
+        items.insert(items.end(), list.draws.begin(), list.draws.end());
+    }
+    size_t n = packets.size();
+    if (n < 2) return;
+
+    scratch.resize(n);
+    for (int b = 0; b < 8; ++b) {
+        size_t* offset = counts[b];
+        int shift = 8 * b;
+        if (offset[(packets[0].key >> shift) & 0xFF] == n) continue;
+        size_t sum = 0;
+        for (int v = 0; v < 256; ++v) {
+            size_t c = offset[v];
+            offset[v] = sum;
+            sum += c;
+        }
+        for (const packet_t& p : packets) scratch[offset[(p.key >> shift) & 0xFF]++] = p;
+        packets.swap(scratch);
+    }
+}
+
+void benchmarkRenderQueue(size_t nodes, int frames) {
+    if (!renderBackend || std::string(renderBackend->name()) != "OpenGL") {
+        std::cout << "The render queue benchmark needs the OpenGL backend" << std::endl;
+        return;
+    }
+    std::shared_ptr<model_t> previousModel = currentModel;
+    std::shared_ptr<model_node_t> previousNode = currentNode;
+    size_t roomNodes = 0, copies = 0;
+    buildScaledIndoorScene(nodes, roomNodes, copies);
+    model_t& model = *currentModel;
+
+    Mode previousMode = currentMode;
+    bool previousCulling = occlusionCulling, previousSorted = sortedSubmission, previousPulling = vertexPulling;
+    currentMode = INSPECTION;
+    // Every node is submitted, seen or not
+    occlusionCulling = false;
+
+    std::cout << "Render queue benchmark: indoor scene of " << roomNodes << " nodes copied to " << copies
+              << " rooms, " << model.getShapeCount() << " nodes, " << frames << " frames per run" << std::endl;
+    for (int pulled = 0; pulled < 2; ++pulled) {
+        for (int sorted = 0; sorted < 2; ++sorted) {
+            vertexPulling = pulled != 0;
+            sortedSubmission = sorted != 0;
+            // First frame uploads or releases geometry and is not timed
+            renderBackend->beginFrame(glm::vec4(0.2f, 0.3f, 0.3f, 1.0f));
+            renderScene();
+            renderBackend->endFrame();
+            glFinish();
+
+            double submitMs = 0.0, sortMs = 0.0;
+            double start = glfwGetTime();
+            for (int f = 0; f < frames; ++f) {
+                renderBackend->beginFrame(glm::vec4(0.2f, 0.3f, 0.3f, 1.0f));
+                renderScene();
+                renderBackend->endFrame();
+                submitMs += renderStats.submitMs;
+                sortMs += renderStats.sortMs;
+            }
+            glFinish();
+            double ms = (glfwGetTime() - start) * 1000.0 / frames;
+            std::cout << "  " << (pulled ? "vertex pulling" : "vertex buffers") << ", "
+                      << (sorted ? "sorted queue" : "hierarchy order") << ": " << renderStats.drawCalls << " draws, "
+                      << renderStats.programSwitches << " program switches, " << renderStats.vaoBinds
+                      << " VAO binds, submit " << submitMs / frames << " ms";
+            if (sorted) std::cout << " (sort " << sortMs / frames << " ms)";
+            std::cout << ", frame " << ms << " ms" << std::endl;
+        }
+    }
+
+    currentMode = previousMode;
+    occlusionCulling = previousCulling;
+    sortedSubmission = previousSorted;
+    vertexPulling = previousPulling;
+    currentModel = previousModel;
+    currentNode = previousNode;
+}
+
+void benchmarkDrawLists(size_t nodes, int frames) {
+    if (!renderBackend || std::string(renderBackend->name()) != "OpenGL") {
+        std::cout << "The draw list benchmark needs the OpenGL backend" << std::endl;
+        return;
+    }
+    std::shared_ptr<model_t> previousModel = currentModel;
+    std::shared_ptr<model_node_t> previousNode = currentNode;
+    size_t roomNodes = 0, copies = 0;
+    buildScaledIndoorScene(nodes, roomNodes, copies);
+
+    Mode previousMode = currentMode;
+    bool previousCulling = occlusionCulling, previousSorted = sortedSubmission, previousWireframe = Wireframe;
+    thread_pool_t* previousPool = drawListPool;
+    currentMode = INSPECTION;
+    occlusionCulling = true;
+    sortedSubmission = true;
+    // Wireframe is never culled
+    Wireframe = false;
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+    unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    std::cout << "Draw list benchmark: " << currentModel->getShapeCount() << " nodes (" << copies << " rooms), "
+              << frames << " frames per run, " << cores << " cores" << std::endl;
+    for (unsigned int workers = 1; workers <= std::max(4u, cores); workers *= 2) {
+        thread_pool_t pool(workers);
+        drawListPool = &pool;
+        // First frame uploads geometry and sizes the buffers and is not timed
+        renderBackend->beginFrame(glm::vec4(0.2f, 0.3f, 0.3f, 1.0f));
+        renderScene();
+        renderBackend->endFrame();
+        glFinish();
+
+        double recordMs = 0.0, sortMs = 0.0, submitMs = 0.0, frameMs = 0.0;
+        for (int f = 0; f < frames; ++f) {
+            renderBackend->beginFrame(glm::vec4(0.2f, 0.3f, 0.3f, 1.0f));
+            renderScene();
+            renderBackend->endFrame();
+            recordMs += renderStats.recordMs;
+            sortMs += renderStats.sortMs;
+            submitMs += renderStats.submitMs;
+            frameMs += renderStats.frameMs;
+        }
+        glFinish();
+        drawListPool = previousPool;
+        std::cout << "  " << workers << " worker" << (workers > 1 ? "s" : "") << " (" << renderStats.drawListThreads
+                  << " recording): record " << recordMs / frames
+                  << " ms, sort " << sortMs / frames << " ms, submit " << submitMs / frames << " ms, CPU frame "
+                  << frameMs / frames << " ms (" << renderStats.drawCalls << " draws, " << renderStats.occludedDraws
+                  << " occluded, " << renderStats.offscreenDraws << " outside the view)" << std::endl;
+    }
+    std::cout << "  per-draw records: " << renderStats.drawRecords << std::endl;
+
+    currentMode = previousMode;
+    occlusionCulling = previousCulling;
+    sortedSubmission = previousSorted;
+    Wireframe = previousWireframe;
+    glPolygonMode(GL_FRONT_AND_BACK, Wireframe ? GL_LINE : GL_FILL);
+    currentModel = previousModel;
+    currentNode = previousNode;
+}
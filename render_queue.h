@@ -0,0 +1,98 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class shape_t;
+
+// What a backend needs bound to draw a shape, as sort key fields (render_backend_t::drawState)
+struct draw_state_t {
+    uint32_t program = 0;   // shader permutation, 4 bits
+    uint32_t mesh = 0;      // vertex array or pulled primitive, 24 bits
+    uint32_t material = 0;  // per-draw uniforms beyond the transform, 16 bits
+};
+
+// A draw's 64-bit sort key; sorting the keys as integers gives the submission order.
+//   opaque:      0 | program:4 | mesh:24 | material:16 | depth:19    state first, then front to back
+//   translucent: 1 | depth:24 inverted | program:4 | mesh:24 | 11 unused    after every opaque
+//                                                                           draw, back to front
+// Depth is the draw origin's distance from the camera as a fraction of `depthRange`.
+uint64_t opaqueSortKey(const draw_state_t& state, float depth, float depthRange);
+uint64_t translucentSortKey(const draw_state_t& state, float depth, float depthRange);
+inline bool isTranslucentKey(uint64_t key) { return (key >> 63) != 0; }
+
+// A draw's per-draw data as the DRAW_RECORDS shaders read it from a texture buffer, 12 texels
+struct draw_record_t {
+    glm::mat4 MVP;
+    glm::mat4 model;
+    glm::vec4 normalMatrix[3];  // columns of transpose(inverse(mat3(model))), w unused
+    glm::vec4 color;            // pulled primitives' color
+};
+const int DRAW_RECORD_TEXELS = int(sizeof(draw_record_t) / sizeof(glm::vec4));
+
+void fillDrawRecord(draw_record_t& record, const glm::mat4& viewProjection, const glm::mat4& world, const glm::vec4& color);
+
+// One frame's draws. renderDraws() (main.cpp) has workers record them into command lists, each
+// list written by one task only; sort() merges the lists in order and sorts the packets, and the
+// backend submits them in key order.
+class render_queue_t {
+public:
+    struct packet_t {
+        uint64_t key;
+        uint32_t draw;  // index into the list's draws, then into the queue's
+    };
+    struct draw_t {
+        shape_t* shape;            // LOD level already chosen
+        const glm::mat4* world;    // the snapshot's, valid while it is drawn
+        uint32_t record;           // its draw_record_t, when the backend maps them
+    };
+    // A range of the traversal, recorded by one task, with what it counted on the way
+    struct command_list_t {
+        std::vector<packet_t> packets;
+        std::vector<draw_t> draws;
+        size_t lodDraws = 0, occludedDraws = 0, offscreenDraws = 0;
+
+        void push(uint64_t key, shape_t& shape, const glm::mat4& world, uint32_t record) {
+            packets.push_back({ key, uint32_t(draws.size()) });
+            draws.push_back({ &shape, &world, record });
+        }
+    };
+
+    // Empties the queue and gives it `count` empty command lists, keeping their capacity
+    void reset(size_t count);
+    size_t listCount() const { return lists.size(); }
+    command_list_t& list(size_t i) { return lists[i]; }
+
+    // Merges the lists in order, then LSD radix sorts the keys a byte per pass; stable, and
+    // passes where every key has the same byte are skipped
+    void sort();
+
+    size_t size() const { return packets.size(); }
+    const std::vector<packet_t>& sorted() const { return packets; }
+    const draw_t& draw(const packet_t& packet) const { return items[packet.draw]; }
+
+private:
+    std::vector<command_list_t> lists;
+    std::vector<packet_t> packets, scratch;  // capacity kept from frame to frame
+    std::vector<draw_t> items;
+};
+
+class thread_pool_t;
+// Pool renderDraws() records command lists on; sharedThreadPool() when null
+extern thread_pool_t* drawListPool;
+
+// Builds the indoor scene, copies the room on a grid until it has about `nodes` nodes and renders
+// it `frames` times in hierarchy order and through the sorted queue, with buffers and with vertex
+// pulling (F8); prints program switches, VAO binds, submission and frame time for each. Needs a
+// GL backend; the current model is restored afterwards.
+void benchmarkRenderQueue(size_t nodes, int frames);
+
+// The same scene with occlusion culling, drawn `frames` times with draw lists recorded on 1, 2,
+// 4, ... workers up to the core count (at least 4; F10); prints recording, sort and submission
+// time and CPU frame time for each, and where the per-draw records went
+void benchmarkDrawLists(size_t nodes, int frames);
+
+#endif
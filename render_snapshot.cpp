@@ -0,0 +1,203 @@
+#include "render_snapshot.h"
+#include "HIERARCHIAL.h"
+#include "globals.h"
+#include "renderer.h"
+#include "scene.h"
+#include "shape.h"
+#include "soft_raster.h"
+#include "static_batch.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+namespace {
+
+// Scene nodes carry their world matrix; nodes of a prefab's definition are shared by every
+// instance, so inside one (`inPrefab`) the matrices are composed here instead
+void captureNode(const model_node_t& node, const glm::mat4& world, bool inPrefab, render_snapshot_t& out,
+    std::unordered_map<const shape_t*, uint32_t>& meshIds) {
+    auto addDraw = [&](std::shared_ptr<shape_t> shape) {
+        auto inserted = meshIds.emplace(shape.get(), uint32_t(out.shapes.size()));
+        if (inserted.second) out.shapes.push_back(shape);
+        out.world.push_back(world);
+        out.meshes.push_back(inserted.first->second);
+    };
+    if (node.batch) addDraw(node.batch);
+    if (node.shape && !node.baked) addDraw(node.shape);
+    if (node.shape && node.shape->getType() == BOX_SHAPE) {
+        out.boxes.push_back(world);
+        out.boxMarked.push_back(node.occluder);
+    }
+    if (node.prefab && node.prefab->root) {
+        const model_node_t& root = *node.prefab->root;
+        captureNode(root, world * root.getTransform(), true, out, meshIds);
+    }
+    for (const auto& child : node.children)
+        captureNode(*child, inPrefab ? world * child->getTransform() : child->world, inPrefab, out, meshIds);
+}
+
+} // namespace
+
+void render_snapshot_t::clear() {
+    world.clear();
+    meshes.clear();
+    shapes.clear();
+    boxes.clear();
+    boxMarked.clear();
+    lights.clear();
+}
+
+void captureSnapshot(model_t& model, const glm::mat4& rootTransform, render_snapshot_t& out) {
+    out.clear();
+    if (!model.getRoot()) return;
+    model.updateWorldTransforms(rootTransform, &sharedThreadPool());
+    thread_local std::unordered_map<const shape_t*, uint32_t> meshIds;
+    meshIds.clear();
+    captureNode(*model.getRoot(), model.getRoot()->world, false, out, meshIds);
+    out.lights = model.lights;
+}
+
+void snapshot_exchange_t::publish() {
+    buffers[writeIndex].sequence = ++published;
+    // Release: the capture is visible to whoever swaps this buffer out next
+    writeIndex = middle.exchange(writeIndex | FRESH, std::memory_order_acq_rel) & 3;
+}
+
+const render_snapshot_t& snapshot_exchange_t::acquire() {
+    if (middle.load(std::memory_order_relaxed) & FRESH)
+        readIndex = middle.exchange(readIndex, std::memory_order_acq_rel) & 3;
+    return buffers[readIndex];
+}
+
+void snapshot_exchange_t::clear() {
+    for (render_snapshot_t& buffer : buffers) buffer.clear();
+}
+
+snapshot_exchange_t& renderSnapshots() {
+    static snapshot_exchange_t exchange;
+    return exchange;
+}
+
+void benchmarkSnapshots(size_t extraNodes, int frames) {
+    // The indoor scene plus a field of boxes, written out and loaded back like a user's file
+    const std::string filename = "snapshot_bench.mod";
+    std::shared_ptr<model_t> previousModel = currentModel;
+    std::shared_ptr<model_node_t> previousNode = currentNode;
+    currentModel = std::make_shared<model_t>();
+    currentNode = currentModel->getRoot();
+    buildIndoorScene();
+    currentModel->save(filename);
+    {
+        std::ofstream file(filename, std::ios::app);
+        size_t side = size_t(std::ceil(std::sqrt(double(extraNodes))));
+        for (size_t i = 0; i < extraNodes; ++i) {
+            float x = float(i % side) / float(side) * 16.0f - 8.0f;
+            float z = float(i / side) / float(side) * 10.0f - 5.0f;
+            file << "SHAPE " << 100000 + i << "\nTYPE " << int(BOX_SHAPE) << "\nTRANSLATION " << x << " -1.3 " << z
+                 << "\nROTATION 0 0 0 1\nSCALE 0.02 0.02 0.02\nPARENT -1\nCOLOR 0.5 0.5 0.5 1\n";
+        }
+    }
+    currentModel = previousModel;
+    currentNode = previousNode;
+
+    // load() reports what it loaded; keep that out of the timings
+    auto quietLoad = [&](model_t& model) {
+        std::cout.setstate(std::ios::failbit);
+        auto start = std::chrono::steady_clock::now();
+        model.load(filename);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout.clear();
+        return ms;
+    };
+    // The edit each step makes besides the load: slide the first node a little
+    auto edit = [](model_t& model, int step) {
+        if (model.getRoot()->children.empty()) return;
+        model_node_t& node = *model.getRoot()->children.front();
+        node.translation.x = 0.1f * std::sin(0.2f * float(step));
+        model.nodeMoved(node);
+    };
+
+    std::unique_ptr<render_backend_t> previousBackend = std::move(renderBackend);
+    renderBackend = std::make_unique<software_backend_t>(800, 600, 0);
+    Mode previousMode = currentMode;
+    currentMode = INSPECTION;
+    const int loadFrame = std::min(10, frames / 2);
+
+    auto report = [&](const char* name, std::vector<double> ms, double loadMs) {
+        double sum = 0.0, sq = 0.0;
+        for (double m : ms) { sum += m; sq += m * m; }
+        double mean = sum / ms.size(), deviation = std::sqrt(std::max(0.0, sq / ms.size() - mean * mean));
+        std::sort(ms.begin(), ms.end());
+        std::cout << "  " << name << ": mean " << mean << " ms, median " << ms[ms.size() / 2] << " ms, max "
+                  << ms.back() << " ms, std dev " << deviation << " ms (load " << loadMs << " ms)" << std::endl;
+    };
+    std::cout << "Render snapshots: " << frames << " frames, " << extraNodes
+              << " extra nodes loaded at frame " << loadFrame << std::endl;
+
+    // Editing, loading and drawing on one thread: the frame that loads waits for all of it
+    {
+        model_t model;
+        quietLoad(model);
+        double loadMs = 0.0;
+        std::vector<double> ms;
+        for (int f = 0; f < frames; ++f) {
+            auto start = std::chrono::steady_clock::now();
+            if (f == loadFrame) loadMs = quietLoad(model);
+            edit(model, f);
+            captureSnapshot(model, glm::mat4(1.0f), renderSnapshots().back());
+            renderSnapshots().publish();
+            renderBackend->beginFrame(glm::vec4(0.2f, 0.3f, 0.3f, 1.0f));
+            renderSnapshot();
+            renderBackend->endFrame();
+            ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+        report("one thread", ms, loadMs);
+    }
+
+    // Edits on their own thread publishing a snapshot per step; the render thread draws
+    // whatever was published last and never waits for the load
+    {
+        model_t model;
+        quietLoad(model);
+        std::atomic<int> renderedFrames{ 0 };
+        std::atomic<bool> stop{ false };
+        double loadMs = 0.0;
+        std::thread editor([&] {
+            bool loaded = false;
+            for (int step = 0; !stop.load(); ++step) {
+                if (!loaded && renderedFrames.load() >= loadFrame) {
+                    loadMs = quietLoad(model);
+                    loaded = true;
+                }
+                edit(model, step);
+                captureSnapshot(model, glm::mat4(1.0f), renderSnapshots().back());
+                renderSnapshots().publish();
+                std::this_thread::sleep_for(std::chrono::milliseconds(8));
+            }
+        });
+        while (renderSnapshots().acquire().sequence == 0) std::this_thread::yield();
+        std::vector<double> ms;
+        for (int f = 0; f < frames; ++f) {
+            auto start = std::chrono::steady_clock::now();
+            renderBackend->beginFrame(glm::vec4(0.2f, 0.3f, 0.3f, 1.0f));
+            renderSnapshot();
+            renderBackend->endFrame();
+            ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            renderedFrames.store(f + 1);
+        }
+        stop.store(true);
+        editor.join();
+        report("edit thread", ms, loadMs);
+    }
+
+    // Nothing drawn from here on may point into the benchmark's models
+    renderSnapshots().clear();
+    renderBackend = std::move(previousBackend);
+    currentMode = previousMode;
+    std::remove(filename.c_str());
+}
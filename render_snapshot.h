@@ -0,0 +1,77 @@
+#ifndef RENDER_SNAPSHOT_H
+#define RENDER_SNAPSHOT_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+#include "clustered_lights.h"
+
+class shape_t;
+class model_t;
+
+// Everything the renderer reads in one frame, flattened out of the node hierarchy into flat
+// arrays. Captured by the edit side and not changed once published, so drawing never touches
+// model_node_t and nodes can be added, removed, moved or reloaded meanwhile. Shapes are shared
+// rather than copied, so that holds for node and transform edits only: setColor(), setLevel(),
+// setMaxError(), makeResident() and dropCpuGeometry() change a published shape in place and run
+// on the thread that draws, between frames, as the key handlers do.
+struct render_snapshot_t {
+    // One entry per draw (a static batch or an unbaked shape), in hierarchy order; prefab
+    // instances add their definition's draws, each under the instance's matrix
+    std::vector<glm::mat4> world;
+    std::vector<uint32_t> meshes;                  // index into `shapes`
+    // Each distinct shape once; holding them keeps them alive while the snapshot is drawn
+    std::vector<std::shared_ptr<shape_t>> shapes;
+    // Box nodes, baked ones included, as occluder candidates (occlusion.h)
+    std::vector<glm::mat4> boxes;
+    std::vector<uint8_t> boxMarked;                // model_node_t::occluder
+    std::vector<light_t> lights;
+    uint64_t sequence = 0;                         // publish count; 0 until something is published
+
+    size_t drawCount() const { return world.size(); }
+    void clear();
+};
+
+// Flattens `model` into `out`, first updating its world transforms under rootTransform.
+// Array capacity is kept from one capture to the next.
+void captureSnapshot(model_t& model, const glm::mat4& rootTransform, render_snapshot_t& out);
+
+// Hands snapshots from one edit thread to one render thread without locks. Of three buffers
+// the edit side writes one, the render side draws another, and the third holds the latest
+// published snapshot; publish() and acquire() each swap their buffer with that one atomically.
+class snapshot_exchange_t {
+public:
+    // Edit side: the buffer to capture into, then publish() it
+    render_snapshot_t& back() { return buffers[writeIndex]; }
+    void publish();
+
+    // Render side: the newest published snapshot, or the one it already has if nothing new
+    // came in; valid until the next acquire()
+    const render_snapshot_t& acquire();
+
+    // Empties all three buffers, releasing the shapes they hold; neither side may be using them
+    void clear();
+
+private:
+    static const unsigned FRESH = 4;  // set in `middle` when it holds a snapshot not yet acquired
+    render_snapshot_t buffers[3];
+    std::atomic<unsigned> middle{ 1 };
+    unsigned writeIndex = 0;  // edit side only
+    unsigned readIndex = 2;   // render side only
+    uint64_t published = 0;   // edit side only
+};
+
+// The exchange between the app's edit side and renderScene(); created on first use
+snapshot_exchange_t& renderSnapshots();
+
+// Renders frames with the software backend while a large model is loaded (and nodes keep
+// being edited) on the same thread, then with the edits on their own thread publishing
+// snapshots, and prints frame time statistics for both
+void benchmarkSnapshots(size_t extraNodes, int frames);
+
+#endif
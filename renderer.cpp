@@ -0,0 +1,370 @@
+#include "renderer.h"
+#include "shape.h"
+#include "globals.h"
+#include "image.h"
+#include "shader.h"
+#include "HIERARCHIAL.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <GLFW/glfw3.h>
+#include <iostream>
+
+render_stats_t renderStats;
+std::unique_ptr<render_backend_t> renderBackend;
+
+void render_stats_t::print() const {
+    std::cout << "Backend: " << (renderBackend ? renderBackend->name() : "none")
+              << " | Draws: " << drawCalls
+              << " | Triangles: " << triangles
+              << " | Geometry: " << geometryBytes / 1024 << " KiB"
+              << " | Frame: " << frameMs << " ms";
+    if (lodDraws > 0)
+        std::cout << " | LOD draws: " << lodDraws;
+    if (lights > 0)
+        std::cout << " | Lights: " << lights << " (" << lightBinMs << " ms binning)";
+    if (occluders > 0 || occludedDraws + offscreenDraws > 0)
+        std::cout << " | Culled: " << occludedDraws << " occluded, " << offscreenDraws << " outside view ("
+                  << occluders << " occluders, " << occlusionMs << " ms, raster " << occluderRasterMs << " ms)";
+    if (programSwitches + vaoBinds > 0)
+        std::cout << " | Programs: " << programSwitches << " | VAO binds: " << vaoBinds;
+    std::cout << " | Submit: " << submitMs << " ms";
+    if (drawListThreads > 0)
+        std::cout << " (record " << recordMs << " ms on " << drawListThreads << " threads, sort " << sortMs << " ms)";
+    if (drawRecords)
+        std::cout << " | Draw records: " << drawRecords;
+    if (trianglesPerSecond > 0.0)
+        std::cout << " | " << trianglesPerSecond / 1.0e6 << " Mtri/s";
+    std::cout << std::endl;
+    if (gpuResources().bufferCount() > 0) gpuResources().print();
+}
+
+void render_backend_t::submit(const render_queue_t& queue, const glm::mat4& viewProjection) {
+    for (const render_queue_t::packet_t& packet : queue.sorted()) {
+        const render_queue_t::draw_t& draw = queue.draw(packet);
+        drawShape(*draw.shape, *draw.world, viewProjection * *draw.world);
+    }
+}
+
+gl_backend_t::~gl_backend_t() {
+    if (recordTexture) glDeleteTextures(1, &recordTexture);
+}
+
+void gl_backend_t::beginFrame(const glm::vec4& clearColor) {
+    frameStart = glfwGetTime();
+    renderStats.reset();
+    glClearColor(clearColor.r, clearColor.g, clearColor.b, clearColor.a);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    // Lighting is a compiled-in permutation, not a per-vertex branch
+    shaderProgram = selectShaderProgram(lightingEnabled);
+    glUseProgram(shaderProgram);
+    renderStats.programSwitches++;
+}
+
+void gl_backend_t::setCamera(const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, const std::vector<light_t>& lights) {
+    viewPos = glm::vec3(glm::inverse(viewMatrix)[3]);
+    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"),
+        1, GL_FALSE, glm::value_ptr(viewMatrix));
+    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"),
+        1, GL_FALSE, glm::value_ptr(projectionMatrix));
+
+    clusters.build(lights, viewMatrix, projectionMatrix);
+    clusters.upload();
+    renderStats.lights = clusters.lightCount();
+    renderStats.lightBinMs = clusters.buildMs;
+}
+
+bool gl_backend_t::usesPulling(const shape_t& shape) const {
+    return vertexPulling && shape.getType() != MESH_SHAPE && !shape.isErrorBounded();
+}
+
+// Uniforms that stay the same for the whole frame
+void gl_backend_t::setFrameUniforms(GLuint program, bool clustered) {
+    if (clustered) clusters.bind(program, width, height);
+    glUniform3fv(glGetUniformLocation(program, "lightPos"), 1, glm::value_ptr(lightPosition));
+    glUniform3fv(glGetUniformLocation(program, "lightColor"), 1, glm::value_ptr(lightColor));
+    glUniform3fv(glGetUniformLocation(program, "viewPos"), 1, glm::value_ptr(viewPos));
+    glUniform1f(glGetUniformLocation(program, "ambientStrength"), ambientStrength);
+    glUniform1f(glGetUniformLocation(program, "diffuseStrength"), diffuseStrength);
+    glUniform1f(glGetUniformLocation(program, "specularStrength"), specularStrength);
+    glUniform1f(glGetUniformLocation(program, "shininess"), shininess);
+}
+
+void gl_backend_t::drawShape(shape_t& shape, const glm::mat4& model, const glm::mat4& MVP) {
+    bool pulled = usesPulling(shape);
+    bool clustered = lightingEnabled && clusters.lightCount() > 0;
+    GLuint program = selectShaderProgram(lightingEnabled, pulled, clustered);
+    if (program != shaderProgram) {
+        shaderProgram = program;
+        glUseProgram(shaderProgram);
+        renderStats.programSwitches++;
+    }
+    setFrameUniforms(shaderProgram, clustered);
+    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"),
+        1, GL_FALSE, glm::value_ptr(model));
+
+    if (pulled) drawPulled(shape, MVP);
+    else shape.draw(MVP, shaderProgram);
+    renderStats.vaoBinds++;
+    renderStats.drawCalls++;
+    renderStats.triangles += shape.triangleCount();
+    renderStats.geometryBytes += shape.geometryBytes();
+}
+
+draw_state_t gl_backend_t::drawState(const shape_t& shape) const {
+    bool pulled = usesPulling(shape);
+    draw_state_t state;
+    state.program = selectShaderVariant(lightingEnabled, pulled, lightingEnabled && clusters.lightCount() > 0);
+    if (pulled) {
+        // The primitive is rebuilt from its type and level, and its color is a uniform
+        state.mesh = uint32_t(shape.getType()) << 8 | (shape.getLevel() & 0xFFu);
+        glm::vec4 c = shape.colors.empty() ? glm::vec4(1.0f) : glm::clamp(shape.colors[0], 0.0f, 1.0f);
+        state.material = uint32_t(c.r * 31.0f + 0.5f) << 11 | uint32_t(c.g * 63.0f + 0.5f) << 5 | uint32_t(c.b * 31.0f + 0.5f);
+    }
+    else {
+        // Not uploaded yet: 0, and the draws are grouped from the next frame on
+        state.mesh = shape.gpu.vao.id();
+    }
+    return state;
+}
+
+draw_record_t* gl_backend_t::mapDrawRecords(size_t count) {
+    recordsMapped = false;
+    if (count == 0) return nullptr;
+    if (maxTextureBufferTexels < 0) glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTextureBufferTexels);
+    // The shaders see the whole buffer as one texture, every region and the slack included
+    size_t bytes = count * sizeof(draw_record_t);
+    size_t regions = GLEW_ARB_buffer_storage ? gpu_stream_buffer_t::REGIONS : 1;
+    if ((bytes + bytes / 4 + 256) / sizeof(glm::vec4) * regions > size_t(maxTextureBufferTexels)) return nullptr;
+    void* data = recordBuffer.map(bytes);
+    recordsMapped = data != nullptr;
+    return static_cast<draw_record_t*>(data);
+}
+
+void gl_backend_t::submit(const render_queue_t& queue, const glm::mat4& viewProjection) {
+    bool clustered = lightingEnabled && clusters.lightCount() > 0;
+    bool frameUniformsSet[SHADER_VARIANT_COUNT] = {};
+    bool records = recordsMapped;
+    recordsMapped = false;
+    GLint recordBase = 0;
+    if (records) {
+        recordBase = GLint(recordBuffer.unmap() / sizeof(glm::vec4));
+        if (!recordTexture) glGenTextures(1, &recordTexture);
+        // Units 1-3 hold the light clusters
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(GL_TEXTURE_BUFFER, recordTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, recordBuffer.id());
+        glActiveTexture(GL_TEXTURE0);
+        renderStats.drawRecords = recordBuffer.persistent() ? "persistently mapped buffer" : "buffer mapped each frame";
+    }
+    GLuint boundVAO = 0;
+    int shapeType = -1, level = -1;
+    glm::vec4 objectColor(-1.0f);
+    bool blending = false;
+
+    for (const render_queue_t::packet_t& packet : queue.sorted()) {
+        const render_queue_t::draw_t& draw = queue.draw(packet);
+        shape_t& shape = *draw.shape;
+        bool pulled = usesPulling(shape);
+        ShaderVariant variant = selectShaderVariant(lightingEnabled, pulled, clustered);
+        program_uniforms_t& u = uniforms[records][variant];
+        GLuint program = (records ? drawRecordPrograms : shaderPrograms)[variant];
+        if (u.program != program) {
+            u.program = program;
+            u.model = glGetUniformLocation(u.program, "model");
+            u.MVP = glGetUniformLocation(u.program, "MVP");
+            u.shapeType = glGetUniformLocation(u.program, "shapeType");
+            u.level = glGetUniformLocation(u.program, "level");
+            u.objectColor = glGetUniformLocation(u.program, "objectColor");
+            u.drawRecord = glGetUniformLocation(u.program, "drawRecord");
+            u.drawRecords = glGetUniformLocation(u.program, "drawRecords");
+        }
+        if (u.program != shaderProgram) {
+            shaderProgram = u.program;
+            glUseProgram(shaderProgram);
+            renderStats.programSwitches++;
+            shapeType = level = -1;
+            objectColor = glm::vec4(-1.0f);
+        }
+        if (!frameUniformsSet[variant]) {
+            setFrameUniforms(shaderProgram, clustered);
+            if (records) glUniform1i(u.drawRecords, 4);
+            frameUniformsSet[variant] = true;
+        }
+        if (isTranslucentKey(packet.key) && !blending) {
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            glDepthMask(GL_FALSE);
+            blending = true;
+        }
+
+        if (records) {
+            glUniform1i(u.drawRecord, recordBase + GLint(draw.record) * DRAW_RECORD_TEXELS);
+        }
+        else {
+            glm::mat4 MVP = viewProjection * *draw.world;
+            glUniformMatrix4fv(u.model, 1, GL_FALSE, glm::value_ptr(*draw.world));
+            glUniformMatrix4fv(u.MVP, 1, GL_FALSE, glm::value_ptr(MVP));
+        }
+        if (pulled) {
+            if (shape.gpu.resident() || !shape.vertices.empty()) {
+                if (shape.gpu.vao.id() == boundVAO) boundVAO = 0;  // deleting a bound VAO unbinds it
+                shape.releaseGeometry();
+            }
+            if (int(shape.getType()) != shapeType) {
+                shapeType = shape.getType();
+                glUniform1i(u.shapeType, shapeType);
+            }
+            if (int(shape.getLevel()) != level) {
+                level = int(shape.getLevel());
+                glUniform1i(u.level, level);
+            }
+            glm::vec4 color = shape.colors.empty() ? glm::vec4(1.0f) : shape.colors[0];
+            if (!records && color != objectColor) {
+                objectColor = color;
+                glUniform4fv(u.objectColor, 1, glm::value_ptr(color));
+            }
+            if (boundVAO != emptyVAO.id() || !emptyVAO) {
+                emptyVAO.bind();
+                boundVAO = emptyVAO.id();
+                renderStats.vaoBinds++;
+            }
+            glDrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(shape.triangleCount() * 3));
+        }
+        else {
+            if (!shape.gpu.resident()) boundVAO = 0;  // the upload leaves no VAO bound
+            shape.makeResident();
+            if (boundVAO != shape.gpu.vao.id()) {
+                glBindVertexArray(shape.gpu.vao.id());
+                boundVAO = shape.gpu.vao.id();
+                renderStats.vaoBinds++;
+            }
+            glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(shape.indexCount()), GL_UNSIGNED_INT, 0);
+        }
+        renderStats.drawCalls++;
+        renderStats.triangles += shape.triangleCount();
+        renderStats.geometryBytes += shape.geometryBytes();
+    }
+
+    if (boundVAO) glBindVertexArray(0);
+    if (blending) {
+        glDisable(GL_BLEND);
+        glDepthMask(GL_TRUE);
+    }
+    if (records) recordBuffer.fence();
+}
+
+void gl_backend_t::drawPulled(shape_t& shape, const glm::mat4& MVP) {
+    // Nothing but the color is needed any more
+    if (shape.gpu.resident() || !shape.vertices.empty()) shape.releaseGeometry();
+
+    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "MVP"), 1, GL_FALSE, glm::value_ptr(MVP));
+    glUniform1i(glGetUniformLocation(shaderProgram, "shapeType"), shape.getType());
+    glUniform1i(glGetUniformLocation(shaderProgram, "level"), shape.getLevel());
+    glm::vec4 color = shape.colors.empty() ? glm::vec4(1.0f) : shape.colors[0];
+    glUniform4fv(glGetUniformLocation(shaderProgram, "objectColor"), 1, glm::value_ptr(color));
+
+    emptyVAO.bind();
+    glDrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(shape.triangleCount() * 3));
+    glBindVertexArray(0);
+}
+
+void gl_backend_t::endFrame() {
+    renderStats.frameMs = (glfwGetTime() - frameStart) * 1000.0;
+    renderStats.trianglesPerSecond = 0.0; // not meaningful without a GPU timer query
+    gpuResources().endFrame();
+}
+
+bool gl_backend_t::saveFrame(const std::string& filename) {
+    image_t img(width, height);
+    std::vector<uint8_t> rows(img.rgb.size());
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, rows.data());
+
+    // GL returns rows bottom to top
+    size_t stride = size_t(width) * 3;
+    for (int y = 0; y < height; ++y) {
+        std::copy(rows.begin() + (height - 1 - y) * stride,
+            rows.begin() + (height - y) * stride,
+            img.rgb.begin() + y * stride);
+    }
+    return writePPM(filename, img);
+}
+
+void benchmarkDrawPaths(int frames) {
+    if (!renderBackend) return;
+    bool previous = vertexPulling;
+    std::cout << "Draw path benchmark (" << frames << " frames per path)" << std::endl;
+    for (int pulled = 0; pulled < 2; ++pulled) {
+        vertexPulling = pulled != 0;
+        // First frame (re)builds or releases geometry and is not timed
+        renderBackend->beginFrame(glm::vec4(0.2f, 0.3f, 0.3f, 1.0f));
+        renderScene();
+        renderBackend->endFrame();
+        glFinish();
+        size_t bytes = renderStats.geometryBytes;
+
+        double start = glfwGetTime();
+        for (int f = 0; f < frames; ++f) {
+            renderBackend->beginFrame(glm::vec4(0.2f, 0.3f, 0.3f, 1.0f));
+            renderScene();
+            renderBackend->endFrame();
+        }
+        glFinish();
+        double ms = (glfwGetTime() - start) * 1000.0 / frames;
+        std::cout << "  " << (pulled ? "vertex pulling" : "vertex buffers") << ": "
+                  << ms << " ms/frame, geometry " << bytes / 1024.0 << " KiB, "
+                  << renderStats.triangles << " triangles" << std::endl;
+    }
+    vertexPulling = previous;
+}
+
+void benchmarkClusteredLights(int frames) {
+    if (!renderBackend || !currentModel) return;
+    std::vector<light_t> saved = currentModel->lights;
+
+    // Spread the lights over the scene's bounds
+    currentModel->updateWorldTransforms(glm::mat4(1.0f));
+    glm::vec3 lo(1e30f), hi(-1e30f);
+    for (const auto& node : currentModel->getShapes()) {
+        if (!node->shape && !node->prefab) continue;
+        lo = glm::min(lo, node->worldMin);
+        hi = glm::max(hi, node->worldMax);
+    }
+    if (lo.x > hi.x) lo = glm::vec3(-5.0f), hi = glm::vec3(5.0f);
+
+    std::cout << "Clustered lighting benchmark (" << frames << " frames per run, "
+              << CLUSTER_X << "x" << CLUSTER_Y << "x" << CLUSTER_Z << " clusters)" << std::endl;
+    unsigned int seed = 1;
+    auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0f; };
+    for (size_t count = 1; count <= 1024; count *= 4) {
+        currentModel->lights.clear();
+        for (size_t i = 0; i < count; ++i) {
+            light_t light;
+            light.position = lo + (hi - lo) * glm::vec3(random(), random(), random());
+            light.color = glm::vec3(0.2f + random(), 0.2f + random(), 0.2f + random()) * 0.5f;
+            light.radius = 1.0f + 2.0f * random();
+            currentModel->lights.push_back(light);
+        }
+        // First frame compiles/warms up and is not timed
+        renderBackend->beginFrame(glm::vec4(0.2f, 0.3f, 0.3f, 1.0f));
+        renderScene();
+        renderBackend->endFrame();
+        glFinish();
+
+        double binMs = 0.0;
+        size_t visible = 0;
+        double start = glfwGetTime();
+        for (int f = 0; f < frames; ++f) {
+            renderBackend->beginFrame(glm::vec4(0.2f, 0.3f, 0.3f, 1.0f));
+            renderScene();
+            renderBackend->endFrame();
+            binMs += renderStats.lightBinMs;
+            visible = renderStats.lights;
+        }
+        glFinish();
+        double ms = (glfwGetTime() - start) * 1000.0 / frames;
+        std::cout << "  " << count << " lights: " << ms << " ms/frame, binning " << binMs / frames
+                  << " ms, " << visible << " in view" << std::endl;
+    }
+    currentModel->lights = saved;
+}
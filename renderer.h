@@ -0,0 +1,154 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <glm/glm.hpp>
+#include <GL/glew.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include "clustered_lights.h"
+#include "gpu_resources.h"
+#include "render_queue.h"
+#include "shader.h"
+
+class shape_t;
+
+// Per-frame counters filled in by whichever backend is active (press F to print)
+struct render_stats_t {
+    size_t drawCalls = 0;
+    size_t triangles = 0;
+    size_t geometryBytes = 0;   // vertex/index data held for the shapes drawn, CPU + GPU
+    size_t lodDraws = 0;        // draws that used a simplified level (simplify.h)
+    size_t lights = 0;          // point lights in view after clustering
+    double lightBinMs = 0.0;    // CPU time spent binning them
+    size_t occluders = 0;       // boxes rasterized for occlusion culling (occlusion.h)
+    size_t occludedDraws = 0;   // draws skipped because occluders hide them
+    size_t offscreenDraws = 0;  // ... or because they are outside the view
+    double occlusionMs = 0.0;   // render thread time from picking occluders to the last test, walk included
+                                // (with draw lists, whose workers run the tests, to the end of recording)
+    double occluderRasterMs = 0.0;  // occluder rasterization, on its own thread
+    size_t programSwitches = 0;
+    size_t vaoBinds = 0;        // glBindVertexArray calls, unbinding not counted
+    double submitMs = 0.0;      // render thread time from the visibility tests to the last draw, recording and sort included
+    double recordMs = 0.0;      // draw lists recorded across the pool (drawListPool)
+    double sortMs = 0.0;
+    unsigned int drawListThreads = 0;  // threads the lists were dealt to; 1 while another job has the pool
+    const char* drawRecords = nullptr;  // where per-draw data went; null when it went in uniforms
+    double frameMs = 0.0;
+    double trianglesPerSecond = 0.0;
+
+    void reset() {
+        drawCalls = 0;
+        triangles = 0;
+        geometryBytes = 0;
+        lodDraws = 0;
+        lights = 0;
+        lightBinMs = 0.0;
+        occluders = 0;
+        occludedDraws = 0;
+        offscreenDraws = 0;
+        occlusionMs = 0.0;
+        occluderRasterMs = 0.0;
+        programSwitches = 0;
+        vaoBinds = 0;
+        submitMs = 0.0;
+        recordMs = 0.0;
+        sortMs = 0.0;
+        drawListThreads = 0;
+        drawRecords = nullptr;
+    }
+    void print() const;
+};
+
+extern render_stats_t renderStats;
+
+// Everything renderScene() needs from a render target.
+// The GL backend issues real draw calls, the software backend rasterizes on the CPU.
+class render_backend_t {
+public:
+    virtual ~render_backend_t() = default;
+
+    virtual const char* name() const = 0;
+    virtual void beginFrame(const glm::vec4& clearColor) = 0;
+    // Camera and point lights for the draws that follow
+    virtual void setCamera(const glm::mat4& view, const glm::mat4& projection, const std::vector<light_t>& lights) = 0;
+    virtual void drawShape(shape_t& shape, const glm::mat4& model, const glm::mat4& MVP) = 0;
+    // Sort key fields for drawing `shape` (render_queue.h); all zero when state costs nothing to change
+    virtual draw_state_t drawState(const shape_t& shape) const { (void)shape; return draw_state_t(); }
+    // Room for `count` per-draw records (render_queue.h) that workers fill in before submit();
+    // null when the backend takes the data some other way. Render thread only.
+    virtual draw_record_t* mapDrawRecords(size_t count) { (void)count; return nullptr; }
+    // Draws a sorted queue; by default one drawShape() per packet
+    virtual void submit(const render_queue_t& queue, const glm::mat4& viewProjection);
+    virtual void endFrame() = 0;
+
+    // Write the last finished frame as a binary PPM
+    virtual bool saveFrame(const std::string& filename) = 0;
+};
+
+// Default backend: per-node uniforms + glDrawElements through shape_t::draw().
+// With vertexPulling set, primitives are drawn with glDrawArrays from an empty VAO and
+// the vertex shader rebuilds them, so they hold no geometry at all.
+// submit() draws a sorted queue setting only what changed from the previous packet: the
+// program, its per-frame uniforms once, the VAO, and the pulled primitive's uniforms.
+// Translucent packets are blended without writing depth. When the frame's draw records were
+// mapped, each packet reads its transform and color from them and sets one uniform.
+class gl_backend_t : public render_backend_t {
+public:
+    gl_backend_t(int w, int h) : width(w), height(h) {}
+    ~gl_backend_t() override;
+
+    const char* name() const override { return "OpenGL"; }
+    void beginFrame(const glm::vec4& clearColor) override;
+    void setCamera(const glm::mat4& view, const glm::mat4& projection, const std::vector<light_t>& lights) override;
+    void drawShape(shape_t& shape, const glm::mat4& model, const glm::mat4& MVP) override;
+    draw_state_t drawState(const shape_t& shape) const override;
+    draw_record_t* mapDrawRecords(size_t count) override;
+    void submit(const render_queue_t& queue, const glm::mat4& viewProjection) override;
+    void endFrame() override;
+    bool saveFrame(const std::string& filename) override;
+
+private:
+    // Uniform locations of one program, looked up the first time submit() uses it
+    struct program_uniforms_t {
+        GLuint program = 0;
+        GLint model = -1, MVP = -1, shapeType = -1, level = -1, objectColor = -1;
+        GLint drawRecord = -1, drawRecords = -1;
+    };
+
+    int width, height;
+    glm::vec3 viewPos{ 0.0f };
+    double frameStart = 0.0;
+    gpu_vertex_array_t emptyVAO;  // core profile needs a bound VAO even with no attributes
+    light_clusters_t clusters;  // the frame's point lights, rebinned in setCamera()
+    program_uniforms_t uniforms[2][SHADER_VARIANT_COUNT];  // [1]: drawRecordPrograms
+    gpu_stream_buffer_t recordBuffer{ GPU_DRAW_DATA };
+    GLuint recordTexture = 0;
+    GLint maxTextureBufferTexels = -1;
+    bool recordsMapped = false;
+
+    bool usesPulling(const shape_t& shape) const;
+    void setFrameUniforms(GLuint program, bool clustered);
+    void drawPulled(shape_t& shape, const glm::mat4& MVP);
+};
+
+// Renders the current scene `frames` times through the buffer path and the vertex-pulling
+// path (F3) and prints ms/frame and geometry memory for each
+void benchmarkDrawPaths(int frames);
+
+// Renders the current scene with 1, 4, 16, ... 1024 random point lights (F4) and prints
+// ms/frame, binning time and lights in view; the model's own lights are restored
+void benchmarkClusteredLights(int frames);
+
+extern std::unique_ptr<render_backend_t> renderBackend;
+
+// Edit side: captures currentModel into renderSnapshots() and publishes it (main.cpp)
+void publishScene();
+// Render side: draws the latest published snapshot through renderBackend; reads nothing from
+// the model, so it may run while another thread edits and publishes (main.cpp)
+void renderSnapshot();
+// publishScene() then renderSnapshot(), for callers that edit and draw on one thread
+void renderScene();
+
+#endif
@@ -0,0 +1,272 @@
+#include "replay.h"
+#include "HIERARCHIAL.h"
+#include "input.h"
+#include "scene_sync.h"
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+input_recorder_t* activeRecorder = nullptr;
+
+// Reads from std::cin's own buffer a character at a time, keeping a copy of each one
+class console_tee_t : public std::streambuf {
+public:
+    console_tee_t(std::streambuf* source, std::string& log) : source(source), log(log) {}
+
+protected:
+    int_type underflow() override {
+        int_type c = source->sbumpc();
+        if (traits_type::eq_int_type(c, traits_type::eof())) return c;
+        ch = traits_type::to_char_type(c);
+        log += ch;
+        setg(&ch, &ch, &ch + 1);
+        return c;
+    }
+
+private:
+    std::streambuf* source;
+    std::string& log;
+    char ch = 0;
+};
+
+std::string escapeConsole(const std::string& text) {
+    std::string out;
+    for (char c : text) {
+        if (c == '\n') out += "\\n";
+        else if (c == '\r') out += "\\r";
+        else if (c == '\\') out += "\\\\";
+        else out += c;
+    }
+    return out;
+}
+
+std::string unescapeConsole(const std::string& text) {
+    std::string out;
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] != '\\' || i + 1 == text.size()) {
+            out += text[i];
+            continue;
+        }
+        char c = text[++i];
+        out += c == 'n' ? '\n' : c == 'r' ? '\r' : c;
+    }
+    return out;
+}
+
+// Nearest-rank percentile of sorted values
+double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0.0;
+    size_t rank = size_t(p / 100.0 * double(sorted.size()) + 0.999999);
+    return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+} // namespace
+
+bool input_recording_t::save(const std::string& filename) const {
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+        std::cout << "Failed to save recording to " << filename << std::endl;
+        return false;
+    }
+    file << "INPUT_RECORDING 1\n";
+    file << std::hex << "START " << startDigest << std::dec << " " << startNodes << "\n";
+    size_t load = 0;
+    for (const recorded_key_t& k : keys) {
+        // A load taken at the start of a frame comes before that frame's keys
+        for (; load < loads.size() && loads[load] <= k.frame; ++load) file << "LOADED " << loads[load] << "\n";
+        file << "KEY " << k.frame << " " << k.time << " " << k.key << " " << k.scancode << " " << k.action << " "
+             << k.mods << "\n";
+        if (!k.console.empty()) file << "CONSOLE " << escapeConsole(k.console) << "\n";
+    }
+    for (; load < loads.size(); ++load) file << "LOADED " << loads[load] << "\n";
+    file << "END " << frames << " " << std::hex << endDigest << std::dec << " " << endNodes << "\n";
+    file.close();
+    if (!file) {
+        std::cout << "Failed to save recording to " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool input_recording_t::load(const std::string& filename) {
+    std::ifstream file(filename);
+    std::string line, word;
+    if (!file.is_open() || !std::getline(file, line) || line.compare(0, 15, "INPUT_RECORDING") != 0) {
+        std::cout << "Not an input recording: " << filename << std::endl;
+        return false;
+    }
+    *this = input_recording_t();
+    bool ended = false;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        std::istringstream in(line);
+        in >> word;
+        if (word == "START") in >> std::hex >> startDigest >> std::dec >> startNodes;
+        else if (word == "KEY") {
+            recorded_key_t k;
+            in >> k.frame >> k.time >> k.key >> k.scancode >> k.action >> k.mods;
+            keys.push_back(k);
+        }
+        else if (word == "CONSOLE" && !keys.empty()) keys.back().console += unescapeConsole(line.substr(std::min<size_t>(8, line.size())));
+        else if (word == "LOADED") {
+            uint32_t frame = 0;
+            in >> frame;
+            loads.push_back(frame);
+        }
+        else if (word == "END") {
+            in >> frames >> std::hex >> endDigest >> std::dec >> endNodes;
+            ended = true;
+        }
+        if (in.fail()) {
+            std::cout << "Malformed line in " << filename << ": " << line << std::endl;
+            return false;
+        }
+    }
+    if (!ended) {
+        std::cout << "Recording " << filename << " has no END; the session didn't exit cleanly" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+input_recorder_t::~input_recorder_t() {
+    if (console) std::cin.rdbuf(console);
+    if (activeRecorder == this) activeRecorder = nullptr;
+}
+
+void input_recorder_t::start(GLFWwindow* window, model_t& model) {
+    recorded = input_recording_t();
+    recorded.startDigest = sceneDigest(model, recorded.startNodes);
+    startTime = glfwGetTime();
+    recording = true;
+    activeRecorder = this;
+    consoleRead.clear();
+    console = std::cin.rdbuf();
+    consoleTee = std::make_unique<console_tee_t>(console, consoleRead);
+    std::cin.rdbuf(consoleTee.get());
+    glfwSetKeyCallback(window, &input_recorder_t::keyCallback);
+}
+
+void input_recorder_t::keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    input_recorder_t* r = activeRecorder;
+    if (!r || !r->recording) {
+        ::keyCallback(window, key, scancode, action, mods);
+        return;
+    }
+    recorded_key_t k;
+    k.frame = r->recorded.frames;
+    k.time = glfwGetTime() - r->startTime;
+    k.key = key;
+    k.scancode = scancode;
+    k.action = action;
+    k.mods = mods;
+    r->consoleRead.clear();
+    ::keyCallback(window, key, scancode, action, mods);
+    k.console = r->consoleRead;
+    r->recorded.keys.push_back(std::move(k));
+}
+
+bool input_recorder_t::finish(model_t& model, const std::string& filename) {
+    if (!recording) return false;
+    recording = false;
+    std::cin.rdbuf(console);
+    console = nullptr;
+    recorded.endDigest = sceneDigest(model, recorded.endNodes);
+    if (!recorded.save(filename)) return false;
+    std::cout << "Recorded " << recorded.frames << " frames and " << recorded.keys.size() << " key events to "
+              << filename << std::endl;
+    return true;
+}
+
+input_replayer_t::~input_replayer_t() {
+    if (console) std::cin.rdbuf(console);
+}
+
+bool input_replayer_t::start(const std::string& filename, model_t& model) {
+    if (!recording.load(filename)) return false;
+    size_t nodes = 0;
+    if (sceneDigest(model, nodes) != recording.startDigest || nodes != recording.startNodes) {
+        std::cout << "The scene differs from the one " << filename << " was recorded on (" << nodes << " nodes here, "
+                  << recording.startNodes << " there); start with the same --world arguments" << std::endl;
+        return false;
+    }
+    // Handlers read their console input in the order they ran, so it plays back as one stream
+    std::string text;
+    for (const recorded_key_t& k : recording.keys) text += k.console;
+    consoleInput.str(text);
+    console = std::cin.rdbuf(&consoleInput);
+    frameMs.reserve(recording.frames);
+    return true;
+}
+
+void input_replayer_t::beginFrame() {
+    ++frame;
+    for (; nextLoad < recording.loads.size() && recording.loads[nextLoad] <= frame; ++nextLoad)
+        finishBackgroundLoad(true);
+}
+
+void input_replayer_t::dispatch(GLFWwindow* window) {
+    for (; nextKey < recording.keys.size() && recording.keys[nextKey].frame <= frame; ++nextKey) {
+        const recorded_key_t& k = recording.keys[nextKey];
+        keyCallback(window, k.key, k.scancode, k.action, k.mods);
+    }
+}
+
+bool input_replayer_t::finish(model_t& model, const std::string& baseline, double thresholdPercent) {
+    std::cin.rdbuf(console);
+    console = nullptr;
+    bool passed = true;
+
+    std::ofstream csv("replay_frames.csv");
+    csv << "frame,ms\n";
+    for (size_t i = 0; i < frameMs.size(); ++i) csv << i + 1 << "," << frameMs[i] << "\n";
+
+    std::vector<double> sorted = frameMs;
+    std::sort(sorted.begin(), sorted.end());
+    double mean = 0.0;
+    for (double ms : sorted) mean += ms;
+    mean /= double(std::max<size_t>(sorted.size(), 1));
+    double p95 = percentile(sorted, 95.0);
+    std::cout << "Replayed " << frameMs.size() << " frames: mean " << mean << " ms, median " << percentile(sorted, 50.0)
+              << " ms, p95 " << p95 << " ms, p99 " << percentile(sorted, 99.0) << " ms, max "
+              << (sorted.empty() ? 0.0 : sorted.back()) << " ms (every frame in replay_frames.csv)" << std::endl;
+
+    size_t nodes = 0;
+    uint64_t digest = sceneDigest(model, nodes);
+    std::cout << "Scene digest " << std::hex << digest << std::dec << " (" << nodes << " nodes)";
+    if (digest == recording.endDigest && nodes == recording.endNodes) {
+        std::cout << ", matches the recording" << std::endl;
+    }
+    else {
+        std::cout << ", the recording ended on " << std::hex << recording.endDigest << std::dec << " ("
+                  << recording.endNodes << " nodes): FAILED" << std::endl;
+        passed = false;
+    }
+
+    if (baseline.empty()) return passed;
+    std::ifstream in(baseline);
+    std::string word;
+    double baselineP95 = 0.0;
+    if (!in.is_open()) {
+        std::ofstream out(baseline);
+        out << "REPLAY_BASELINE 1\n";
+        out << "FRAMES " << frameMs.size() << "\n";
+        out << "P95_MS " << p95 << "\n";
+        std::cout << "No baseline yet; wrote " << baseline << std::endl;
+        return passed;
+    }
+    while (in >> word)
+        if (word == "P95_MS") in >> baselineP95;
+    if (baselineP95 <= 0.0) {
+        std::cout << "No P95_MS in baseline " << baseline << std::endl;
+        return false;
+    }
+    double change = (p95 / baselineP95 - 1.0) * 100.0;
+    bool regressed = change > thresholdPercent;
+    std::cout << "p95 " << p95 << " ms against baseline " << baselineP95 << " ms: " << (change >= 0.0 ? "+" : "")
+              << change << "% (limit +" << thresholdPercent << "%)" << (regressed ? ": REGRESSED" : "") << std::endl;
+    return passed && !regressed;
+}
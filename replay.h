@@ -0,0 +1,110 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct GLFWwindow;
+class model_t;
+
+// Animation advances by this much per frame while recording or replaying, so a replay reaches
+// the state its session did however long each frame takes
+const float REPLAY_TIMESTEP = 1.0f / 60.0f;
+
+// A key event as keyCallback() got it, with the frame whose glfwPollEvents() delivered it and
+// what its handler read from the console
+struct recorded_key_t {
+    uint32_t frame = 0;
+    double time = 0.0;  // seconds into the recording, for reading the file
+    int key = 0, scancode = 0, action = 0, mods = 0;
+    std::string console;
+};
+
+// A recorded session, saved as text:
+//   INPUT_RECORDING 1
+//   START <digest> <nodes>          the scene it started from (sceneDigest())
+//   KEY <frame> <time> <key> <scancode> <action> <mods>
+//   CONSOLE <text>                  read while handling the KEY above; \n and \\ escaped
+//   LOADED <frame>                  a background load (L) finished at the start of this frame
+//   END <frames> <digest> <nodes>   the scene it ended with
+struct input_recording_t {
+    uint64_t startDigest = 0, endDigest = 0;
+    size_t startNodes = 0, endNodes = 0;
+    uint32_t frames = 0;
+    std::vector<recorded_key_t> keys;
+    std::vector<uint32_t> loads;
+
+    bool save(const std::string& filename) const;
+    // False with a message if the file can't be read or isn't a recording
+    bool load(const std::string& filename);
+};
+
+// Records a session of the running app (modeller --record file). Key events go through the
+// recorder on their way to keyCallback(), and everything read from std::cin is copied as it
+// is read.
+class input_recorder_t {
+public:
+    input_recorder_t() = default;
+    ~input_recorder_t();
+
+    input_recorder_t(const input_recorder_t&) = delete;
+    input_recorder_t& operator=(const input_recorder_t&) = delete;
+
+    void start(GLFWwindow* window, model_t& model);
+    bool active() const { return recording; }
+    // Once per frame, before anything else
+    void beginFrame() { ++recorded.frames; }
+    // finishBackgroundLoad() took a finished load this frame
+    void loaded() { recorded.loads.push_back(recorded.frames); }
+    // Stops recording and saves it with the model's final digest
+    bool finish(model_t& model, const std::string& filename);
+
+private:
+    bool recording = false;
+    double startTime = 0.0;
+    input_recording_t recorded;
+    std::unique_ptr<std::streambuf> consoleTee;
+    std::streambuf* console = nullptr;  // std::cin's own buffer while the tee stands in
+    std::string consoleRead;            // what the tee read while the current key was handled
+
+    static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
+};
+
+// Plays a recording back in place of the window's events (modeller --replay file), one frame
+// of recorded events per frame, and times each frame
+class input_replayer_t {
+public:
+    input_replayer_t() = default;
+    ~input_replayer_t();
+
+    input_replayer_t(const input_replayer_t&) = delete;
+    input_replayer_t& operator=(const input_replayer_t&) = delete;
+
+    // Loads the recording and points std::cin at its console input
+    bool start(const std::string& filename, model_t& model);
+    bool done() const { return frame >= recording.frames; }
+    // Once per frame, in place of finishBackgroundLoad(): waits for a load the session took
+    // this frame, so it lands on the same frame
+    void beginFrame();
+    // In place of glfwPollEvents(): sends this frame's keys to keyCallback()
+    void dispatch(GLFWwindow* window);
+    void frameTime(double ms) { frameMs.push_back(ms); }
+    // Prints frame time statistics, writes every frame's time to replay_frames.csv and checks
+    // the final scene against the recording's. With a baseline file, fails if p95 frame time
+    // is more than `thresholdPercent` over the baseline's; without one, writes it.
+    bool finish(model_t& model, const std::string& baseline, double thresholdPercent);
+
+private:
+    input_recording_t recording;
+    uint32_t frame = 0;
+    size_t nextKey = 0, nextLoad = 0;
+    std::vector<double> frameMs;
+    std::stringbuf consoleInput;
+    std::streambuf* console = nullptr;
+};
+
+#endif
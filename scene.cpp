@@ -3,12 +3,20 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <unordered_set>
 
 #include "shape.h"
 #include "HIERARCHIAL.h"
 #include "globals.h"
+#include "scene.h"
+#include "render_snapshot.h"
+#include "static_batch.h"
 
 // Helper function to create and position a shape
 std::shared_ptr<model_node_t> createShape(std::unique_ptr<shape_t> shape,
@@ -26,14 +34,46 @@ std::shared_ptr<model_node_t> createShape(std::unique_ptr<shape_t> shape,
     auto node = currentModel->getLastNode();
 
     // Set position
-    node->translation = glm::translate(glm::mat4(1.0f), position);
+    node->translation = position;
 
     // Set scale
-    node->scale = glm::scale(glm::mat4(1.0f), scale);
+    node->scale = scale;
+    currentModel->nodeMoved(*node);
 
     return node;
 }
 
+namespace {
+
+// A chair around the centre of its seat
+struct chair_part_t {
+    ShapeType type;
+    glm::vec3 position, scale;
+};
+
+const chair_part_t CHAIR_PARTS[] = {
+    { BOX_SHAPE, { 0.0f, 0.0f, 0.0f }, { 0.4f, 0.05f, 0.4f } },          // Seat
+    { BOX_SHAPE, { 0.0f, 0.4f, 0.2f }, { 0.4f, 0.4f, 0.05f } },          // Backrest
+    { CYLINDER_SHAPE, { -0.15f, -0.5f, -0.15f }, { 0.03f, 0.5f, 0.03f } }, // Legs
+    { CYLINDER_SHAPE, { 0.15f, -0.5f, -0.15f }, { 0.03f, 0.5f, 0.03f } },
+    { CYLINDER_SHAPE, { -0.15f, -0.5f, 0.15f }, { 0.03f, 0.5f, 0.03f } },
+    { CYLINDER_SHAPE, { 0.15f, -0.5f, 0.15f }, { 0.03f, 0.5f, 0.03f } },
+};
+
+void addChairParts(model_t& model, model_node_t& parent, const glm::vec3& offset, const glm::vec4& color) {
+    for (const chair_part_t& part : CHAIR_PARTS) {
+        std::shared_ptr<shape_t> shape = createPrimitive(part.type, 1);
+        shape->generateGeometry();
+        shape->setColor(color);
+        auto node = model.attachShape(parent, shape);
+        node->translation = offset + part.position;
+        node->scale = part.scale;
+        model.nodeMoved(*node);
+    }
+}
+
+} // namespace
+
 // Build a complete indoor scene
 void buildIndoorScene() {
     std::cout << "Building indoor scene..." << std::endl;
@@ -71,19 +111,19 @@ void buildIndoorScene() {
     createShape(std::make_unique<box_t>(1),
         glm::vec3(0.0f, 0.0f, -6.0f),
         glm::vec3(10.0f, 4.0f, 0.1f),
-        wallColor);
+        wallColor)->occluder = true;
 
     // Left Wall
     createShape(std::make_unique<box_t>(1),
         glm::vec3(-10.0f, 1.0f, 0.0f),
         glm::vec3(0.1f, 3.0f, 12.0f),
-        wallColor);
+        wallColor)->occluder = true;
 
     // Right Wall
     createShape(std::make_unique<box_t>(1),
         glm::vec3(10.0f, 1.0f, 0.0f),
         glm::vec3(0.1f, 3.0f, 12.0f),
-        wallColor);
+        wallColor)->occluder = true;
 
     // === TABLE (in center) ===
 
@@ -114,63 +154,19 @@ void buildIndoorScene() {
         glm::vec3(0.05f, 0.8f, 0.05f),
         tableColor);
 
-    // === CHAIRS (around table) ===
+    // === CHAIRS (around table): built once as a prefab and placed twice ===
 
     // Chair 1 (front)
-    // Seat
-    createShape(std::make_unique<box_t>(1),
-        glm::vec3(0.0f, -0.5f, 1.2f),
-        glm::vec3(0.4f, 0.05f, 0.4f),
-        chairColor);
-    // Backrest
-    createShape(std::make_unique<box_t>(1),
-        glm::vec3(0.0f, -0.1f, 1.4f),
-        glm::vec3(0.4f, 0.4f, 0.05f),
-        chairColor);
-    // Legs
-    createShape(std::make_unique<cylinder_t>(1),
-        glm::vec3(-0.15f, -1.0f, 1.05f),
-        glm::vec3(0.03f, 0.5f, 0.03f),
-        chairColor);
-    createShape(std::make_unique<cylinder_t>(1),
-        glm::vec3(0.15f, -1.0f, 1.05f),
-        glm::vec3(0.03f, 0.5f, 0.03f),
-        chairColor);
-    createShape(std::make_unique<cylinder_t>(1),
-        glm::vec3(-0.15f, -1.0f, 1.35f),
-        glm::vec3(0.03f, 0.5f, 0.03f),
-        chairColor);
-    createShape(std::make_unique<cylinder_t>(1),
-        glm::vec3(0.15f, -1.0f, 1.35f),
-        glm::vec3(0.03f, 0.5f, 0.03f),
-        chairColor);
+    auto chair1 = currentModel->attachShape(*currentModel->getRoot(), nullptr);
+    chair1->translation = glm::vec3(0.0f, -0.5f, 1.2f);
+    addChairParts(*currentModel, *chair1, glm::vec3(0.0f), chairColor);
+    chair1 = currentModel->makePrefab("chair", *chair1);
 
-    // Chair 2 (back)
-    createShape(std::make_unique<box_t>(1),
-        glm::vec3(0.0f, -0.5f, -1.2f),
-        glm::vec3(0.4f, 0.05f, 0.4f),
-        chairColor);
-    createShape(std::make_unique<box_t>(1),
-        glm::vec3(0.0f, -0.1f, -1.4f),
-        glm::vec3(0.4f, 0.4f, 0.05f),
-        chairColor);
-    // Legs
-    createShape(std::make_unique<cylinder_t>(1),
-        glm::vec3(-0.15f, -1.0f, 1.05f),
-        glm::vec3(0.03f, 0.5f, 0.03f),
-        chairColor);
-    createShape(std::make_unique<cylinder_t>(1),
-        glm::vec3(0.15f, -1.0f, 1.05f),
-        glm::vec3(0.03f, 0.5f, 0.03f),
-        chairColor);
-    createShape(std::make_unique<cylinder_t>(1),
-        glm::vec3(-0.15f, -1.0f, -1.45f),
-        glm::vec3(0.03f, 0.5f, 0.03f),
-        chairColor);
-    createShape(std::make_unique<cylinder_t>(1),
-        glm::vec3(0.15f, -1.0f, -1.45f),
-        glm::vec3(0.03f, 0.5f, 0.03f),
-        chairColor);
+    // Chair 2 (back), turned to face the table
+    auto chair2 = currentModel->placePrefab(*currentModel->getRoot(), chair1->prefab);
+    chair2->translation = glm::vec3(0.0f, -0.5f, -1.2f);
+    chair2->rotation = glm::angleAxis(glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    currentModel->nodeMoved(*chair2);
 
     // === LAMP (on table) ===
 
@@ -187,7 +183,7 @@ void buildIndoorScene() {
         tableColor);
 
     // Lamp shade (cone upside down)
-    createShape(std::make_unique<cone_t>(2),
+    auto lampShade = createShape(std::make_unique<cone_t>(2),
         glm::vec3(0.5f, 1.0f, 0.0f),
         glm::vec3(0.25f, 0.3f, 0.25f),
         lampColor);
@@ -259,15 +255,144 @@ void buildIndoorScene() {
         glm::vec4(0.3f, 0.3f, 0.3f, 1.0f));
 
     // Light bulb (sphere)
-    createShape(std::make_unique<sphere_t>(2),
+    auto bulb = createShape(std::make_unique<sphere_t>(2),
         glm::vec3(0.0f, 3.0f, 0.0f),
         glm::vec3(0.15f, 0.2f, 0.15f),
         lampColor);
 
+    // === LIGHTS (point lights on top of the global light, clustered per fragment) ===
+
+    light_t ceilingLight;
+    ceilingLight.position = glm::vec3(0.0f, 2.7f, 0.0f);
+    ceilingLight.color = glm::vec3(1.0f, 0.85f, 0.6f) * 2.0f;
+    ceilingLight.radius = 6.0f;
+    currentModel->lights.push_back(ceilingLight);
+    light_t tableLamp;
+    tableLamp.position = glm::vec3(0.5f, 0.8f, 0.0f);
+    tableLamp.color = glm::vec3(1.0f, 0.7f, 0.4f) * 1.5f;
+    tableLamp.radius = 2.5f;
+    currentModel->lights.push_back(tableLamp);
+
+    // === ANIMATION (O to play) ===
+
+    animation_clip_t& idle = currentModel->animation.clip("idle");
+    // Chair 1 slides out from the table and back
+    glm::vec4 chairRest(chair1->translation, 1.0f);
+    glm::vec4 chairOut = chairRest + glm::vec4(0.0f, 0.0f, 0.5f, 0.0f);
+    idle.addChannel(chair1->id, ANIM_POSITION, INTERP_LINEAR, { 0.0f, 1.5f, 3.0f, 4.0f },
+        { chairRest, chairOut, chairOut, chairRest });
+    // Lamp shade nods about z, slerped
+    glm::quat tiltA = glm::angleAxis(glm::radians(15.0f), glm::vec3(0, 0, 1));
+    glm::quat tiltB = glm::angleAxis(glm::radians(-15.0f), glm::vec3(0, 0, 1));
+    idle.addChannel(lampShade->id, ANIM_ROTATION, INTERP_LINEAR, { 0.0f, 1.0f, 3.0f, 4.0f },
+        { glm::vec4(0, 0, 0, 1), glm::vec4(tiltA.x, tiltA.y, tiltA.z, tiltA.w),
+          glm::vec4(tiltB.x, tiltB.y, tiltB.z, tiltB.w), glm::vec4(0, 0, 0, 1) });
+    // Ceiling bulb swings on a smooth curve
+    glm::vec4 bulbRest(bulb->translation, 1.0f);
+    idle.addChannel(bulb->id, ANIM_POSITION, INTERP_CUBIC, { 0.0f, 1.0f, 2.0f, 3.0f, 4.0f },
+        { bulbRest, bulbRest + glm::vec4(0.3f, 0.05f, 0, 0), bulbRest,
+          bulbRest + glm::vec4(-0.3f, 0.05f, 0, 0), bulbRest });
+    currentModel->animation.bind(currentModel->getShapes());
+
+    // Everything that doesn't move goes into one static batch (B in modelling mode toggles it)
+    currentModel->freezeSubtree(currentModel->getRoot()->id);
+
     std::cout << "Indoor scene created with " << currentModel->getShapeCount() << " objects!" << std::endl;
     std::cout << "Press 'I' for inspection mode to view the scene" << std::endl;
     std::cout << "Use arrow keys to rotate and +/- to zoom" << std::endl;
 
     // Set current node to root
     currentNode = currentModel->getRoot();
-}
\ No newline at end of file
+}
+
+namespace {
+
+// Nodes, plus every distinct shape's and batch's geometry, in the scene and in the prefab
+// definitions
+size_t modelBytes(model_t& model) {
+    std::unordered_set<const shape_t*> counted;
+    size_t bytes = 0;
+    std::vector<const model_node_t*> stack{ model.getRoot().get() };
+    for (const auto& p : model.prefabs) stack.push_back(p->root.get());
+    while (!stack.empty()) {
+        const model_node_t* n = stack.back();
+        stack.pop_back();
+        bytes += sizeof(model_node_t) + n->children.capacity() * sizeof(n->children[0]);
+        for (const shape_t* s : { static_cast<const shape_t*>(n->shape.get()), static_cast<const shape_t*>(n->batch.get()) })
+            if (s && counted.insert(s).second) bytes += s->geometryBytes();
+        for (const auto& c : n->children) stack.push_back(c.get());
+    }
+    return bytes;
+}
+
+size_t fileBytes(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    return file.is_open() ? size_t(file.tellg()) : 0;
+}
+
+} // namespace
+
+void benchmarkPrefabs(size_t chairs) {
+    using clock = std::chrono::steady_clock;
+    auto ms = [](clock::time_point a, clock::time_point b) {
+        return std::chrono::duration<double, std::milli>(b - a).count();
+    };
+    const glm::vec4 chairColor(0.5f, 0.3f, 0.15f, 1.0f);
+    size_t side = size_t(std::ceil(std::sqrt(double(chairs))));
+    auto position = [side](size_t i) { return glm::vec3(float(i % side), 0.0f, float(i / side)); };
+
+    // The same chairs twice: every part its own node, and one prefab placed `chairs` times
+    model_t expanded, instanced;
+    std::cout.setstate(std::ios::failbit);
+    for (size_t i = 0; i < chairs; ++i) addChairParts(expanded, *expanded.getRoot(), position(i), chairColor);
+    auto first = instanced.attachShape(*instanced.getRoot(), nullptr);
+    addChairParts(instanced, *first, glm::vec3(0.0f), chairColor);
+    first = instanced.makePrefab("chair", *first);
+    for (size_t i = 1; i < chairs; ++i) {
+        auto chair = instanced.placePrefab(*instanced.getRoot(), first->prefab);
+        chair->translation = position(i);
+    }
+    std::cout.clear();
+
+    std::cout << "Prefabs: " << chairs << " chairs of " << sizeof(CHAIR_PARTS) / sizeof(CHAIR_PARTS[0]) << " parts" << std::endl;
+    struct form_t { const char* name; model_t& model; const char* file; };
+    for (const form_t& form : { form_t{ "expanded", expanded, "prefab_bench_expanded.mod" },
+                                form_t{ "prefab", instanced, "prefab_bench_prefab.mod" } }) {
+        std::cout.setstate(std::ios::failbit);
+        form.model.save(form.file);
+        model_t loaded;
+        auto start = clock::now();
+        loaded.load(form.file);
+        double loadMs = ms(start, clock::now());
+        std::cout.clear();
+
+        render_snapshot_t snapshot;
+        captureSnapshot(loaded, glm::mat4(1.0f), snapshot);
+        start = clock::now();
+        const int captures = 20;
+        for (int i = 0; i < captures; ++i) captureSnapshot(loaded, glm::mat4(1.0f), snapshot);
+        double captureMs = ms(start, clock::now()) / captures;
+
+        std::cout << "  " << form.name << ": " << loaded.getShapeCount() << " nodes, file " << fileBytes(form.file) / 1024
+                  << " KiB, load " << loadMs << " ms, memory " << modelBytes(loaded) / 1024 << " KiB, "
+                  << snapshot.drawCount() << " draws, capture " << captureMs << " ms" << std::endl;
+        std::remove(form.file);
+    }
+
+    // An edit to the definition shows in every instance
+    prefab_t& chair = *first->prefab;
+    model_node_t& seat = *chair.root->children.front();
+    const glm::vec4 red(0.8f, 0.2f, 0.2f, 1.0f);
+    seat.color = red;
+    seat.shape->setColor(red);
+    instanced.prefabEdited(chair);
+    render_snapshot_t snapshot;
+    captureSnapshot(instanced, glm::mat4(1.0f), snapshot);
+    size_t updated = 0;
+    for (uint32_t mesh : snapshot.meshes) {
+        const shape_t& shape = *snapshot.shapes[mesh];
+        if (&shape == chair.root->batch.get() && !shape.colors.empty() && shape.colors.front() == red) ++updated;
+    }
+    std::cout << "  seat recolored in the definition: " << updated << " of " << chairs << " chairs drawn with it"
+              << (updated == chairs ? "" : " (MISMATCH)") << std::endl;
+}
@@ -0,0 +1,23 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <glm/glm.hpp>
+#include <memory>
+#include "shape.h"
+#include "HIERARCHIAL.h"
+
+// Adds a shape under the current node with the given position, scale and color
+std::shared_ptr<model_node_t> createShape(std::unique_ptr<shape_t> shape,
+    glm::vec3 position,
+    glm::vec3 scale,
+    glm::vec4 color);
+
+// Replaces currentModel's contents with the furnished room
+void buildIndoorScene();
+
+// Saves and loads the same grid of chairs with every part its own node and as one prefab
+// placed `chairs` times; prints file size, load time, memory and draws for each, then edits
+// the prefab and checks that every instance draws the edit
+void benchmarkPrefabs(size_t chairs);
+
+#endif
@@ -0,0 +1,631 @@
+#include "scene_codec.h"
+#include "HIERARCHIAL.h"
+#include "globals.h"
+#include "scene.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <unordered_map>
+
+namespace {
+
+const char MAGIC[4] = { 'M', 'O', 'D', 'Z' };
+const uint8_t FORMAT_VERSION = 3;  // 2: prefab instances, 3: tessellation levels
+
+// Node flags: which values differ from the prediction, and which extras follow
+enum : uint8_t {
+    NODE_TRANSLATION = 1 << 0,
+    NODE_ROTATION = 1 << 1,
+    NODE_SCALE = 1 << 2,
+    NODE_COLOR = 1 << 3,
+    NODE_OCCLUDER = 1 << 4,
+    NODE_MAX_ERROR = 1 << 5,
+    NODE_MESH = 1 << 6,
+    NODE_PREFAB = 1 << 7,
+};
+
+// The streams, in file order; values of one kind together compress much better than interleaved
+enum { STREAM_TYPES, STREAM_FLAGS, STREAM_IDS, STREAM_PARENTS, STREAM_TRANSLATION, STREAM_ROTATION,
+    STREAM_SCALE, STREAM_COLOR, STREAM_EXTRA, STREAM_TAIL, STREAM_COUNT };
+
+// Block modes of the entropy stage
+enum : uint8_t { BLOCK_RAW = 0, BLOCK_RANS = 1, BLOCK_RUN = 2 };
+
+// A run or a skewed rANS block decodes to far more than it takes in the file, so the streams
+// may decode to at most this many times the file's size, or DECODE_FLOOR bytes for small files
+// of near-identical nodes; anything more is malformed rather than allocated
+const uint64_t DECODE_EXPANSION = 64;
+const uint64_t DECODE_FLOOR = uint64_t(16) << 20;
+
+// rANS with 32-bit states and byte renormalization; frequencies sum to 1 << PROB_BITS
+const int PROB_BITS = 12;
+const uint32_t PROB_SCALE = 1u << PROB_BITS;
+const uint32_t RANS_LOW = 1u << 23;
+
+void putVarint(std::vector<uint8_t>& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(uint8_t(v) | 0x80);
+        v >>= 7;
+    }
+    out.push_back(uint8_t(v));
+}
+
+void putSigned(std::vector<uint8_t>& out, int64_t v) {
+    putVarint(out, (uint64_t(v) << 1) ^ uint64_t(v >> 63));
+}
+
+void putFloat(std::vector<uint8_t>& out, float f) {
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof bits);
+    for (int i = 0; i < 4; ++i) out.push_back(uint8_t(bits >> (8 * i)));
+}
+
+bool getVarint(const uint8_t*& p, const uint8_t* end, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t b = *p++;
+        v |= uint64_t(b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+// Cursor over one decoded stream; `ok` turns false on the first read past its end
+struct stream_reader_t {
+    const uint8_t* p = nullptr;
+    const uint8_t* end = nullptr;
+    bool ok = true;
+
+    uint8_t byte() {
+        if (p >= end) { ok = false; return 0; }
+        return *p++;
+    }
+    uint64_t varint() {
+        uint64_t v = 0;
+        if (!getVarint(p, end, v)) ok = false;
+        return v;
+    }
+    int64_t signedVarint() {
+        uint64_t v = varint();
+        return int64_t(v >> 1) ^ -int64_t(v & 1);
+    }
+    float real() {
+        uint32_t bits = 0;
+        for (int i = 0; i < 4; ++i) bits |= uint32_t(byte()) << (8 * i);
+        float f;
+        std::memcpy(&f, &bits, sizeof f);
+        return f;
+    }
+};
+
+// Scales symbol counts to frequencies summing to PROB_SCALE, keeping every present symbol
+void normalizeFrequencies(const size_t counts[256], size_t total, uint32_t freq[256]) {
+    uint32_t sum = 0;
+    int largest = 0;
+    for (int s = 0; s < 256; ++s) {
+        freq[s] = counts[s] ? std::max<uint32_t>(1, uint32_t(uint64_t(counts[s]) * PROB_SCALE / total)) : 0;
+        sum += freq[s];
+        if (freq[s] > freq[largest]) largest = s;
+    }
+    if (sum < PROB_SCALE) freq[largest] += PROB_SCALE - sum;
+    // Rounding every rare symbol up to 1 can overshoot; take it back from the commonest ones
+    while (sum > PROB_SCALE) {
+        int most = 0;
+        for (int s = 1; s < 256; ++s)
+            if (freq[s] > freq[most]) most = s;
+        --freq[most];
+        --sum;
+    }
+}
+
+// Quantization steps; half a step is the largest error of a value
+struct steps_t {
+    double position, rotation;
+    explicit steps_t(float tolerance)
+        : position(2.0 * tolerance),
+          // Each component off by a quarter of the tolerance stays within it after normalizing
+          rotation(0.5 * tolerance) {}
+};
+
+int64_t quantize(float value, double step) {
+    double q = std::nearbyint(double(value) / step);
+    const double limit = 4.0e18;
+    if (!(q > -limit)) return q != q ? 0 : -int64_t(limit);  // NaN goes to 0
+    if (q > limit) return int64_t(limit);
+    return int64_t(q);
+}
+
+// A node's values in quantization steps: translation, rotation (w >= 0), scale, color
+struct quantized_t {
+    int64_t v[14];
+};
+
+quantized_t quantizeNode(const saved_node_t& n, const steps_t& steps) {
+    glm::quat r = n.rotation.w < 0.0f ? -n.rotation : n.rotation;
+    quantized_t q;
+    for (int i = 0; i < 3; ++i) q.v[i] = quantize(n.translation[i], steps.position);
+    for (int i = 0; i < 4; ++i) q.v[3 + i] = quantize(r[i], steps.rotation);
+    for (int i = 0; i < 3; ++i) q.v[7 + i] = quantize(n.scale[i], steps.position);
+    for (int i = 0; i < 4; ++i) q.v[10 + i] = quantize(n.color[i], steps.position);
+    return q;
+}
+
+// What a first child is predicted to be: no translation or rotation, unit scale, white
+quantized_t identity(const steps_t& steps) {
+    saved_node_t n;
+    return quantizeNode(n, steps);
+}
+
+// Ranges of quantized_t::v per flag
+struct field_range_t { uint8_t flag; int first, count, stream; };
+const field_range_t FIELDS[] = {
+    { NODE_TRANSLATION, 0, 3, STREAM_TRANSLATION },
+    { NODE_ROTATION, 3, 4, STREAM_ROTATION },
+    { NODE_SCALE, 7, 3, STREAM_SCALE },
+    { NODE_COLOR, 10, 4, STREAM_COLOR },
+};
+
+} // namespace
+
+void compressBytes(const uint8_t* data, size_t size, std::vector<uint8_t>& out) {
+    size_t counts[256] = {};
+    for (size_t i = 0; i < size; ++i) ++counts[data[i]];
+    int distinct = 0;
+    for (size_t c : counts) distinct += c != 0;
+
+    if (size > 0 && distinct == 1) {
+        out.push_back(BLOCK_RUN);
+        putVarint(out, size);
+        out.push_back(data[0]);
+        return;
+    }
+    auto raw = [&] {
+        out.push_back(BLOCK_RAW);
+        putVarint(out, size);
+        out.insert(out.end(), data, data + size);
+    };
+    if (size < 64) {
+        raw();
+        return;
+    }
+
+    uint32_t freq[256], start[256];
+    normalizeFrequencies(counts, size, freq);
+    for (uint32_t s = 0, sum = 0; s < 256; ++s) {
+        start[s] = sum;
+        sum += freq[s];
+    }
+
+    // Encoded back to front, two states taking alternate symbols, so the decoder runs forwards
+    std::vector<uint8_t> buffer(size + size / 2 + 16);
+    uint8_t* end = buffer.data() + buffer.size();
+    uint8_t* p = end;
+    uint32_t state[2] = { RANS_LOW, RANS_LOW };
+    for (size_t i = size; i-- > 0; ) {
+        uint32_t& x = state[i & 1];
+        uint8_t s = data[i];
+        uint32_t limit = ((RANS_LOW >> PROB_BITS) << 8) * freq[s];
+        while (x >= limit) {
+            *--p = uint8_t(x);
+            x >>= 8;
+        }
+        x = ((x / freq[s]) << PROB_BITS) + (x % freq[s]) + start[s];
+        if (p - buffer.data() < 8) {
+            // Too many bytes for too little data
+            raw();
+            return;
+        }
+    }
+    for (int k = 1; k >= 0; --k) {
+        p -= 4;
+        for (int b = 0; b < 4; ++b) p[b] = uint8_t(state[k] >> (8 * b));
+    }
+
+    std::vector<uint8_t> table;
+    putVarint(table, size_t(distinct));
+    for (int s = 0; s < 256; ++s) {
+        if (!freq[s]) continue;
+        table.push_back(uint8_t(s));
+        putVarint(table, freq[s]);
+    }
+    size_t encoded = size_t(end - p);
+    if (table.size() + encoded + 8 >= size) {
+        raw();
+        return;
+    }
+    out.push_back(BLOCK_RANS);
+    putVarint(out, size);
+    out.insert(out.end(), table.begin(), table.end());
+    putVarint(out, encoded);
+    out.insert(out.end(), p, end);
+}
+
+bool decompressBytes(const uint8_t*& in, const uint8_t* end, std::vector<uint8_t>& out, uint64_t limit) {
+    if (in >= end) return false;
+    uint8_t mode = *in++;
+    uint64_t size = 0;
+    if (!getVarint(in, end, size) || size > limit) return false;
+    size_t first = out.size();
+
+    if (mode == BLOCK_RUN) {
+        if (in >= end) return false;
+        out.resize(first + size, *in++);
+        return true;
+    }
+    if (mode == BLOCK_RAW) {
+        if (uint64_t(end - in) < size) return false;
+        out.insert(out.end(), in, in + size);
+        in += size;
+        return true;
+    }
+    if (mode != BLOCK_RANS) return false;
+
+    uint64_t distinct = 0;
+    if (!getVarint(in, end, distinct) || distinct > 256) return false;
+    uint32_t freq[256] = {}, start[256] = {};
+    uint32_t sum = 0;
+    for (uint64_t k = 0; k < distinct; ++k) {
+        uint64_t f = 0;
+        if (in >= end) return false;
+        uint8_t s = *in++;
+        if (!getVarint(in, end, f) || f == 0 || f > PROB_SCALE) return false;
+        freq[s] = uint32_t(f);
+        sum += uint32_t(f);
+    }
+    if (sum != PROB_SCALE) return false;
+    uint8_t slot[PROB_SCALE];
+    for (uint32_t s = 0, at = 0; s < 256; ++s) {
+        start[s] = at;
+        std::memset(slot + at, int(s), freq[s]);
+        at += freq[s];
+    }
+
+    uint64_t encoded = 0;
+    if (!getVarint(in, end, encoded) || uint64_t(end - in) < encoded || encoded < 8) return false;
+    const uint8_t* p = in;
+    const uint8_t* stop = in + encoded;
+    in = stop;
+    uint32_t state[2];
+    for (int k = 0; k < 2; ++k) {
+        state[k] = uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+        p += 4;
+    }
+
+    out.resize(first + size);
+    uint8_t* o = out.data() + first;
+    const uint32_t mask = PROB_SCALE - 1;
+    for (size_t i = 0; i < size; ++i) {
+        uint32_t& x = state[i & 1];
+        uint8_t s = slot[x & mask];
+        o[i] = s;
+        x = freq[s] * (x >> PROB_BITS) + (x & mask) - start[s];
+        while (x < RANS_LOW) {
+            if (p >= stop) return false;
+            x = (x << 8) | *p++;
+        }
+    }
+    return true;
+}
+
+bool isCompressedScene(std::istream& in) {
+    char head[4] = {};
+    std::streampos at = in.tellg();
+    in.read(head, 4);
+    bool match = in.gcount() == 4 && std::memcmp(head, MAGIC, 4) == 0;
+    in.clear();
+    in.seekg(at);
+    return match;
+}
+
+bool writeCompressedScene(std::ostream& out, const std::vector<saved_node_t>& nodes, const std::string& tail,
+    float tolerance) {
+    if (!(tolerance > 0.0f)) tolerance = DEFAULT_SCENE_TOLERANCE;
+    steps_t steps(tolerance);
+    std::vector<uint8_t> streams[STREAM_COUNT];
+
+    // Each node is predicted from the previous child of the same parent
+    std::unordered_map<int, quantized_t> lastChild;
+    const quantized_t fresh = identity(steps);
+    int previousId = -1, previousParent = -1;
+    for (const saved_node_t& n : nodes) {
+        quantized_t q = quantizeNode(n, steps);
+        auto sibling = lastChild.find(n.parent_id);
+        const quantized_t& predicted = sibling != lastChild.end() ? sibling->second : fresh;
+
+        uint8_t flags = 0;
+        for (const field_range_t& f : FIELDS) {
+            bool differs = false;
+            for (int i = f.first; i < f.first + f.count; ++i) differs = differs || q.v[i] != predicted.v[i];
+            if (!differs) continue;
+            flags |= f.flag;
+            for (int i = f.first; i < f.first + f.count; ++i) putSigned(streams[f.stream], q.v[i] - predicted.v[i]);
+        }
+        if (n.occluder) flags |= NODE_OCCLUDER;
+        if (n.maxError > 0.0f) {
+            flags |= NODE_MAX_ERROR;
+            putFloat(streams[STREAM_EXTRA], n.maxError);
+        }
+        if (n.type == MESH_SHAPE) {
+            flags |= NODE_MESH;
+            putVarint(streams[STREAM_EXTRA], n.meshPath.size());
+            streams[STREAM_EXTRA].insert(streams[STREAM_EXTRA].end(), n.meshPath.begin(), n.meshPath.end());
+        }
+        if (!n.prefab.empty()) {
+            flags |= NODE_PREFAB;
+            putVarint(streams[STREAM_EXTRA], n.prefab.size());
+            streams[STREAM_EXTRA].insert(streams[STREAM_EXTRA].end(), n.prefab.begin(), n.prefab.end());
+        }
+        // The level shares the type's byte; it is 1 to 4
+        streams[STREAM_TYPES].push_back(uint8_t(n.type) | uint8_t(std::min(n.level, 15u) << 4));
+        streams[STREAM_FLAGS].push_back(flags);
+        // Ids usually count up by one and siblings usually follow each other
+        putSigned(streams[STREAM_IDS], int64_t(n.id) - previousId - 1);
+        putSigned(streams[STREAM_PARENTS], int64_t(n.parent_id) - previousParent);
+        previousId = n.id;
+        previousParent = n.parent_id;
+        lastChild[n.parent_id] = q;
+    }
+    streams[STREAM_TAIL].assign(tail.begin(), tail.end());
+
+    std::vector<uint8_t> file(MAGIC, MAGIC + 4);
+    file.push_back(FORMAT_VERSION);
+    putFloat(file, tolerance);
+    putVarint(file, nodes.size());
+    for (const auto& stream : streams) compressBytes(stream.data(), stream.size(), file);
+    out.write(reinterpret_cast<const char*>(file.data()), std::streamsize(file.size()));
+    return bool(out);
+}
+
+bool readCompressedScene(std::istream& in, std::vector<saved_node_t>& nodes, std::string& tail) {
+    std::vector<uint8_t> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const uint8_t* p = file.data();
+    const uint8_t* end = p + file.size();
+    if (file.size() < 9 || std::memcmp(p, MAGIC, 4) != 0 || p[4] == 0 || p[4] > FORMAT_VERSION) return false;
+    const uint8_t version = p[4];
+    p += 5;
+    stream_reader_t header{ p, end };
+    float tolerance = header.real();
+    uint64_t count = header.varint();
+    p = header.p;
+    if (!header.ok || !(tolerance > 0.0f) || count > (uint64_t(1) << 32)) return false;
+
+    // Decode every stream first, then walk them side by side
+    std::vector<uint8_t> decoded;
+    size_t offsets[STREAM_COUNT + 1] = {};
+    const uint64_t budget = std::max(DECODE_FLOOR, uint64_t(file.size()) * DECODE_EXPANSION);
+    for (int s = 0; s < STREAM_COUNT; ++s) {
+        offsets[s] = decoded.size();
+        if (!decompressBytes(p, end, decoded, budget - decoded.size())) return false;
+    }
+    offsets[STREAM_COUNT] = decoded.size();
+    // Every node has a type byte, which bounds the count before anything is reserved for it
+    if (count > offsets[STREAM_TYPES + 1] - offsets[STREAM_TYPES]) return false;
+    stream_reader_t streams[STREAM_COUNT];
+    for (int s = 0; s < STREAM_COUNT; ++s)
+        streams[s] = stream_reader_t{ decoded.data() + offsets[s], decoded.data() + offsets[s + 1] };
+
+    steps_t steps(tolerance);
+    std::unordered_map<int, quantized_t> lastChild;
+    const quantized_t fresh = identity(steps);
+    int64_t previousId = -1, previousParent = -1;
+    nodes.clear();
+    nodes.reserve(size_t(count));
+    for (uint64_t k = 0; k < count; ++k) {
+        saved_node_t n;
+        uint8_t type = streams[STREAM_TYPES].byte();
+        n.type = ShapeType(version >= 3 ? type & 15 : type);
+        if (version >= 3) n.level = type >> 4;
+        uint8_t flags = streams[STREAM_FLAGS].byte();
+        previousId += streams[STREAM_IDS].signedVarint() + 1;
+        previousParent += streams[STREAM_PARENTS].signedVarint();
+        n.id = int(previousId);
+        n.parent_id = int(previousParent);
+
+        auto sibling = lastChild.find(n.parent_id);
+        quantized_t q = sibling != lastChild.end() ? sibling->second : fresh;
+        for (const field_range_t& f : FIELDS) {
+            if (!(flags & f.flag)) continue;
+            for (int i = f.first; i < f.first + f.count; ++i) q.v[i] += streams[f.stream].signedVarint();
+        }
+        lastChild[n.parent_id] = q;
+        for (int i = 0; i < 3; ++i) n.translation[i] = float(double(q.v[i]) * steps.position);
+        for (int i = 0; i < 4; ++i) n.rotation[i] = float(double(q.v[3 + i]) * steps.rotation);
+        for (int i = 0; i < 3; ++i) n.scale[i] = float(double(q.v[7 + i]) * steps.position);
+        for (int i = 0; i < 4; ++i) n.color[i] = float(double(q.v[10 + i]) * steps.position);
+
+        n.occluder = (flags & NODE_OCCLUDER) != 0;
+        stream_reader_t& extra = streams[STREAM_EXTRA];
+        if (flags & NODE_MAX_ERROR) n.maxError = extra.real();
+        auto text = [&extra](std::string& out) {
+            uint64_t length = extra.varint();
+            if (!extra.ok || length > uint64_t(extra.end - extra.p)) return false;
+            out.assign(reinterpret_cast<const char*>(extra.p), size_t(length));
+            extra.p += length;
+            return true;
+        };
+        if ((flags & NODE_MESH) && !text(n.meshPath)) return false;
+        if ((flags & NODE_PREFAB) && !text(n.prefab)) return false;
+        nodes.push_back(std::move(n));
+    }
+    for (const stream_reader_t& s : streams)
+        if (!s.ok) return false;
+    const stream_reader_t& t = streams[STREAM_TAIL];
+    tail.assign(reinterpret_cast<const char*>(t.p), size_t(t.end - t.p));
+    return true;
+}
+
+namespace {
+
+size_t fileSize(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    return file.is_open() ? size_t(file.tellg()) : 0;
+}
+
+// Racks of parts in rows: mostly identity rotation and unit scale, evenly spaced along x, from a
+// small palette, with every tenth part turned a quarter about y
+void buildSyntheticAssembly(model_t& model, size_t nodes) {
+    const glm::vec4 palette[] = { { 0.7f, 0.7f, 0.72f, 1.0f }, { 0.2f, 0.3f, 0.8f, 1.0f }, { 0.9f, 0.6f, 0.1f, 1.0f } };
+    const size_t partsPerRow = 50, rowsPerRack = 20;
+    std::shared_ptr<model_node_t> rack, row;
+    size_t made = 0, rows = 0, racks = 0;
+    while (made < nodes) {
+        if (!rack || rows == rowsPerRack) {
+            rack = model.attachShape(*model.getRoot(), std::shared_ptr<shape_t>(createPrimitive(BOX_SHAPE, 1)));
+            rack->translation = glm::vec3(float(racks % 40) * 3.0f, 0.0f, float(racks / 40) * 2.5f);
+            ++racks;
+            rows = 0;
+            ++made;
+            continue;
+        }
+        row = model.attachShape(*rack, std::shared_ptr<shape_t>(createPrimitive(BOX_SHAPE, 1)));
+        row->translation = glm::vec3(0.0f, 0.1f * float(rows), 0.0f);
+        ++rows;
+        ++made;
+        for (size_t i = 0; i < partsPerRow && made < nodes; ++i, ++made) {
+            ShapeType type = i % 3 == 0 ? CYLINDER_SHAPE : SPHERE_SHAPE;
+            auto part = model.attachShape(*row, std::shared_ptr<shape_t>(createPrimitive(type, 1)));
+            part->translation = glm::vec3(0.05f * float(i), 0.0f, 0.0f);
+            if (i % 10 == 9) part->rotation = glm::angleAxis(glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+            part->scale = glm::vec3(0.02f);
+            part->color = palette[(i / 10) % 3];
+        }
+    }
+}
+
+// Largest difference between the nodes of `a` and the nodes of `b` with the same ids
+void largestErrors(model_t& a, model_t& b, float& translation, float& rotation, float& scale, float& color,
+    size_t& missing) {
+    std::unordered_map<int, const model_node_t*> byId;
+    for (const auto& n : b.getShapes()) byId[n->id] = n.get();
+    translation = rotation = scale = color = 0.0f;
+    missing = 0;
+    for (size_t i = 1; i < a.getShapes().size(); ++i) {
+        const model_node_t& n = *a.getShapes()[i];
+        auto it = byId.find(n.id);
+        if (it == byId.end()) {
+            ++missing;
+            continue;
+        }
+        const model_node_t& m = *it->second;
+        glm::quat r = glm::normalize(n.rotation);
+        glm::quat s = glm::dot(r, m.rotation) < 0.0f ? -m.rotation : m.rotation;
+        for (int k = 0; k < 3; ++k) {
+            translation = std::max(translation, std::abs(n.translation[k] - m.translation[k]));
+            scale = std::max(scale, std::abs(n.scale[k] - m.scale[k]));
+        }
+        for (int k = 0; k < 4; ++k) {
+            rotation = std::max(rotation, std::abs(r[k] - s[k]));
+            color = std::max(color, std::abs(n.color[k] - m.color[k]));
+        }
+    }
+}
+
+void measureScene(const char* name, model_t& model, float tolerance) {
+    using clock = std::chrono::steady_clock;
+    auto ms = [](clock::time_point a, clock::time_point b) {
+        return std::chrono::duration<double, std::milli>(b - a).count();
+    };
+    const std::string plainFile = "codec_bench.mod", packedFile = "codec_bench.modz";
+    save_options_t packed;
+    packed.compressed = true;
+    packed.tolerance = tolerance;
+
+    // load() and save() report what they do; keep that out of the timings
+    std::cout.setstate(std::ios::failbit);
+    auto t0 = clock::now();
+    model.save(plainFile);
+    auto t1 = clock::now();
+    model.save(packedFile, packed);
+    auto t2 = clock::now();
+    model_t plain, decoded;
+    plain.load(plainFile);
+    auto t3 = clock::now();
+    decoded.load(packedFile);
+    auto t4 = clock::now();
+    std::cout.clear();
+
+    // Decoding alone, without building the model
+    std::vector<saved_node_t> nodes;
+    std::string tail;
+    const int repeats = 5;
+    double decodeMs = 1e30;
+    for (int r = 0; r < repeats; ++r) {
+        std::ifstream file(packedFile, std::ios::binary);
+        auto start = clock::now();
+        readCompressedScene(file, nodes, tail);
+        decodeMs = std::min(decodeMs, ms(start, clock::now()));
+    }
+
+    size_t plainBytes = fileSize(plainFile), packedBytes = fileSize(packedFile);
+    float et, er, es, ec;
+    size_t missing;
+    largestErrors(model, decoded, et, er, es, ec, missing);
+    bool within = missing == 0 && et <= tolerance && er <= tolerance && es <= tolerance && ec <= tolerance;
+
+    std::cout << "  " << name << ": " << model.getShapeCount() << " nodes, plain " << plainBytes / 1024
+              << " KiB, compressed " << packedBytes / 1024 << " KiB (" << double(plainBytes) / double(std::max<size_t>(packedBytes, 1))
+              << "x)" << std::endl;
+    std::cout << "    save " << ms(t0, t1) << " ms plain, " << ms(t1, t2) << " ms compressed; load "
+              << ms(t2, t3) << " ms plain, " << ms(t3, t4) << " ms compressed" << std::endl;
+    std::cout << "    decode alone: " << decodeMs << " ms, " << double(plainBytes) / (decodeMs * 1e6)
+              << " GB/s of plain file" << std::endl;
+    std::cout << "    largest error: translation " << et << ", rotation " << er << ", scale " << es << ", color " << ec
+              << (within ? " (within " : " (NOT within ") << tolerance << ")" << std::endl;
+
+    // The entropy stage by itself on the plain file's bytes
+    std::ifstream text(plainFile, std::ios::binary);
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(text)), std::istreambuf_iterator<char>());
+    std::vector<uint8_t> packedBytesOnly, unpacked;
+    compressBytes(bytes.data(), bytes.size(), packedBytesOnly);
+    double entropyMs = 1e30;
+    for (int r = 0; r < repeats; ++r) {
+        unpacked.clear();
+        const uint8_t* p = packedBytesOnly.data();
+        auto start = clock::now();
+        decompressBytes(p, p + packedBytesOnly.size(), unpacked, bytes.size());
+        entropyMs = std::min(entropyMs, ms(start, clock::now()));
+    }
+    std::cout << "    rANS alone on the plain file: " << double(bytes.size()) / double(std::max<size_t>(packedBytesOnly.size(), 1))
+              << "x, decode " << double(bytes.size()) / (entropyMs * 1e6) << " GB/s"
+              << (unpacked == bytes ? "" : " (MISMATCH)") << std::endl;
+
+    std::remove(plainFile.c_str());
+    std::remove(packedFile.c_str());
+}
+
+} // namespace
+
+void benchmarkSceneCodec(const std::string& path, size_t syntheticNodes, float tolerance) {
+    std::cout << "Scene encoding, tolerance " << tolerance << std::endl;
+
+    std::shared_ptr<model_t> previousModel = currentModel;
+    std::shared_ptr<model_node_t> previousNode = currentNode;
+    currentModel = std::make_shared<model_t>();
+    currentNode = currentModel->getRoot();
+    std::cout.setstate(std::ios::failbit);
+    buildIndoorScene();
+    std::cout.clear();
+    measureScene("indoor scene", *currentModel, tolerance);
+    currentModel = previousModel;
+    currentNode = previousNode;
+
+    if (!path.empty()) {
+        model_t model;
+        std::cout.setstate(std::ios::failbit);
+        bool loaded = model.load(path);
+        std::cout.clear();
+        if (loaded) measureScene(path.c_str(), model, tolerance);
+        else std::cout << "  could not load " << path << std::endl;
+    }
+
+    model_t assembly;
+    buildSyntheticAssembly(assembly, syntheticNodes);
+    measureScene("synthetic assembly", assembly, tolerance);
+}
@@ -0,0 +1,61 @@
+#ifndef SCENE_CODEC_H
+#define SCENE_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "shape.h"
+
+// One SHAPE block of a .mod file, whichever encoding it came from
+struct saved_node_t {
+    int id = 0;
+    ShapeType type = SPHERE_SHAPE;
+    int parent_id = -1;
+    glm::vec4 color{ 1.0f };
+    glm::vec3 translation{ 0.0f };
+    glm::quat rotation{ 1.0f, 0.0f, 0.0f, 0.0f };
+    glm::vec3 scale{ 1.0f };
+    std::string meshPath;
+    unsigned int level = 2;  // tessellation level of a primitive
+    float maxError = 0.0f;
+    bool occluder = false;
+    std::string prefab;  // instance of the named prefab, which it is drawn from
+};
+
+// Compressed .mod encoding. Translation, scale and color are quantized so no component moves
+// by more than `tolerance`, rotation finely enough that the same holds once load() normalizes
+// it. Each node's values are coded as the difference from its previous sibling's (from identity
+// for a first child), so runs of equal siblings and identity transforms cost a flag bit. Node
+// fields go in separate streams, each compressed with an order-0 rANS coder. Prefab
+// definitions, lights, batches and animation are kept as the text the plain format uses,
+// compressed the same way.
+const float DEFAULT_SCENE_TOLERANCE = 1e-4f;
+
+// The node as a SHAPE block of the plain format
+void writeSavedNode(std::ostream& out, const saved_node_t& node);
+
+// True if the stream starts like a compressed scene; leaves the read position where it was
+bool isCompressedScene(std::istream& in);
+bool writeCompressedScene(std::ostream& out, const std::vector<saved_node_t>& nodes, const std::string& tail,
+    float tolerance);
+// False if the data is malformed
+bool readCompressedScene(std::istream& in, std::vector<saved_node_t>& nodes, std::string& tail);
+
+// The entropy stage on its own: order-0 rANS with two interleaved states, or the bytes as they
+// are when that would not be smaller
+void compressBytes(const uint8_t* data, size_t size, std::vector<uint8_t>& out);
+// Appends the decoded bytes to `out`; `in` moves past what was read. False if malformed or the
+// block would decode to more than `limit` bytes
+bool decompressBytes(const uint8_t*& in, const uint8_t* end, std::vector<uint8_t>& out, uint64_t limit);
+
+// Saves the indoor scene, a synthetic assembly of `syntheticNodes` nodes and, if given, the
+// .mod file `path`, both plain and compressed at `tolerance`; prints sizes, ratio, encode and
+// decode times, entropy decode speed and the largest error after loading back
+void benchmarkSceneCodec(const std::string& path, size_t syntheticNodes, float tolerance);
+
+#endif
@@ -0,0 +1,899 @@
+#include "scene_sync.h"
+#include "HIERARCHIAL.h"
+#include "mesh.h"
+#include "shape.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Each message is a 4-byte little-endian length, then its type, then records to the end
+enum : uint8_t { MSG_SNAPSHOT = 1, MSG_DELTA = 2, MSG_DIGEST = 3 };
+
+// Fields a record carries; a move along one axis, the common edit, fits the first mask byte
+enum : uint32_t {
+    FIELD_TX = 1 << 0, FIELD_TY = 1 << 1, FIELD_TZ = 1 << 2,
+    FIELD_ROTATION = 1 << 3,
+    FIELD_SX = 1 << 4, FIELD_SY = 1 << 5, FIELD_SZ = 1 << 6,
+    FIELD_COLOR = 1 << 7,
+    FIELD_LEVEL = 1 << 8,       // tessellation level and max error
+    FIELD_OCCLUDER = 1 << 9,
+    FIELD_ADDED = 1 << 10,      // parent, type and (for meshes) path come before the fields
+    FIELD_REMOVED = 1 << 11,    // the node and its subtree; nothing follows
+    FIELD_PREFAB = 1 << 12,     // with FIELD_ADDED: a prefab instance, its prefab's name after the type
+};
+
+const int ROOT_ID = -1;
+// A client this far behind is dropped rather than buffered for without end
+const size_t MAX_PENDING_BYTES = size_t(512) << 20;
+const size_t MAX_MESSAGE_BYTES = size_t(1) << 30;
+
+int wireId(const model_node_t& node) {
+    return node.parent.expired() ? ROOT_ID : node.id;
+}
+
+sync_node_state_t stateOf(const model_node_t& node) {
+    sync_node_state_t s;
+    if (auto parent = node.parent.lock()) s.parent = wireId(*parent);
+    s.type = uint8_t(node.type);
+    s.level = node.shape ? uint8_t(node.shape->getLevel()) : 1;
+    s.maxError = node.shape ? node.shape->maxError : 0.0f;
+    s.occluder = node.occluder;
+    s.translation = node.translation;
+    s.rotation = node.rotation;
+    s.scale = node.scale;
+    s.color = node.color;
+    return s;
+}
+
+// Bitwise, so -0 against 0 or a NaN still counts as a change
+bool same(float a, float b) { return std::memcmp(&a, &b, sizeof(float)) == 0; }
+
+uint32_t changedFields(const sync_node_state_t& a, const sync_node_state_t& b) {
+    uint32_t mask = 0;
+    if (!same(a.translation.x, b.translation.x)) mask |= FIELD_TX;
+    if (!same(a.translation.y, b.translation.y)) mask |= FIELD_TY;
+    if (!same(a.translation.z, b.translation.z)) mask |= FIELD_TZ;
+    for (int i = 0; i < 4; ++i)
+        if (!same(a.rotation[i], b.rotation[i])) mask |= FIELD_ROTATION;
+    if (!same(a.scale.x, b.scale.x)) mask |= FIELD_SX;
+    if (!same(a.scale.y, b.scale.y)) mask |= FIELD_SY;
+    if (!same(a.scale.z, b.scale.z)) mask |= FIELD_SZ;
+    for (int i = 0; i < 4; ++i)
+        if (!same(a.color[i], b.color[i])) mask |= FIELD_COLOR;
+    if (a.level != b.level || !same(a.maxError, b.maxError)) mask |= FIELD_LEVEL;
+    if (a.occluder != b.occluder) mask |= FIELD_OCCLUDER;
+    return mask;
+}
+
+void putVarint(io_vector_t<uint8_t>& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(uint8_t(v) | 0x80);
+        v >>= 7;
+    }
+    out.push_back(uint8_t(v));
+}
+
+// Zigzag, so small negative numbers stay short too
+void putSigned(io_vector_t<uint8_t>& out, int64_t v) {
+    putVarint(out, (uint64_t(v) << 1) ^ uint64_t(v >> 63));
+}
+
+void putFloat(io_vector_t<uint8_t>& out, float f) {
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof bits);
+    for (int i = 0; i < 4; ++i) out.push_back(uint8_t(bits >> (8 * i)));
+}
+
+// Bounds-checked reads; once anything runs past the end, `ok` stays false and reads give 0
+struct wire_reader_t {
+    const uint8_t* p;
+    const uint8_t* end;
+    bool ok = true;
+
+    bool more() const { return ok && p < end; }
+    uint8_t byte() {
+        if (p >= end) { ok = false; return 0; }
+        return *p++;
+    }
+    uint64_t varint() {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t b = byte();
+            v |= uint64_t(b & 0x7f) << shift;
+            if (!(b & 0x80)) return v;
+        }
+        ok = false;
+        return 0;
+    }
+    int64_t signedVarint() {
+        uint64_t v = varint();
+        return int64_t(v >> 1) ^ -int64_t(v & 1);
+    }
+    float real() {
+        uint32_t bits = 0;
+        for (int i = 0; i < 4; ++i) bits |= uint32_t(byte()) << (8 * i);
+        float f;
+        std::memcpy(&f, &bits, sizeof f);
+        return f;
+    }
+};
+
+void putFields(io_vector_t<uint8_t>& out, uint32_t mask, const sync_node_state_t& s) {
+    if (mask & FIELD_TX) putFloat(out, s.translation.x);
+    if (mask & FIELD_TY) putFloat(out, s.translation.y);
+    if (mask & FIELD_TZ) putFloat(out, s.translation.z);
+    if (mask & FIELD_ROTATION)
+        for (int i = 0; i < 4; ++i) putFloat(out, s.rotation[i]);
+    if (mask & FIELD_SX) putFloat(out, s.scale.x);
+    if (mask & FIELD_SY) putFloat(out, s.scale.y);
+    if (mask & FIELD_SZ) putFloat(out, s.scale.z);
+    if (mask & FIELD_COLOR)
+        for (int i = 0; i < 4; ++i) putFloat(out, s.color[i]);
+    if (mask & FIELD_LEVEL) {
+        out.push_back(s.level);
+        putFloat(out, s.maxError);
+    }
+    if (mask & FIELD_OCCLUDER) out.push_back(s.occluder ? 1 : 0);
+}
+
+void readFields(wire_reader_t& in, uint32_t mask, sync_node_state_t& s) {
+    if (mask & FIELD_TX) s.translation.x = in.real();
+    if (mask & FIELD_TY) s.translation.y = in.real();
+    if (mask & FIELD_TZ) s.translation.z = in.real();
+    if (mask & FIELD_ROTATION)
+        for (int i = 0; i < 4; ++i) s.rotation[i] = in.real();
+    if (mask & FIELD_SX) s.scale.x = in.real();
+    if (mask & FIELD_SY) s.scale.y = in.real();
+    if (mask & FIELD_SZ) s.scale.z = in.real();
+    if (mask & FIELD_COLOR)
+        for (int i = 0; i < 4; ++i) s.color[i] = in.real();
+    if (mask & FIELD_LEVEL) {
+        s.level = in.byte();
+        s.maxError = in.real();
+    }
+    if (mask & FIELD_OCCLUDER) s.occluder = in.byte() != 0;
+}
+
+// A record for a node the client doesn't have yet: where it goes, then whatever differs
+// from a fresh node
+void putAdded(io_vector_t<uint8_t>& out, int& previousId, int id, const model_node_t& node,
+    const sync_node_state_t& s) {
+    uint32_t mask = FIELD_ADDED | changedFields(sync_node_state_t{}, s);
+    if (node.prefab) mask |= FIELD_PREFAB;
+    putSigned(out, int64_t(id) - previousId);
+    previousId = id;
+    putVarint(out, mask);
+    putSigned(out, s.parent);
+    out.push_back(s.type);
+    auto putText = [&out](const std::string& text) {
+        putVarint(out, text.size());
+        out.insert(out.end(), text.begin(), text.end());
+    };
+    if (node.type == MESH_SHAPE) {
+        auto mesh = std::dynamic_pointer_cast<mesh_t>(node.shape);
+        putText(mesh ? mesh->path : std::string());
+    }
+    if (node.prefab) putText(node.prefab->name);
+    putFields(out, mask, s);
+}
+
+// The rest of a FIELD_ADDED record, after its mask
+void readAdded(wire_reader_t& in, uint32_t mask, sync_node_state_t& s, std::string& path, std::string& prefab) {
+    auto readText = [&in](std::string& text) {
+        size_t length = size_t(in.varint());
+        if (length > size_t(in.end - in.p)) {
+            in.ok = false;
+            return;
+        }
+        text.assign(reinterpret_cast<const char*>(in.p), length);
+        in.p += length;
+    };
+    s.parent = int(in.signedVarint());
+    s.type = in.byte();
+    if (s.type == MESH_SHAPE) readText(path);
+    if (mask & FIELD_PREFAB) readText(prefab);
+    readFields(in, mask, s);
+}
+
+// Parent-first walk of a prefab's definition, without its root
+template <class Fn>
+void forEachPrefabNode(const prefab_t& prefab, Fn fn) {
+    std::vector<model_node_t*> stack;
+    for (auto it = prefab.root->children.rbegin(); it != prefab.root->children.rend(); ++it) stack.push_back(it->get());
+    while (!stack.empty()) {
+        model_node_t* n = stack.back();
+        stack.pop_back();
+        fn(*n);
+        for (auto it = n->children.rbegin(); it != n->children.rend(); ++it) stack.push_back(it->get());
+    }
+}
+
+// Snapshots start with the prefab definitions: their count, then for each its name, node
+// count and an added record per node, with the definition's root as ROOT_ID
+void putPrefabs(io_vector_t<uint8_t>& out, model_t& model) {
+    putVarint(out, model.prefabs.size());
+    for (const auto& prefab : model.prefabs) {
+        putVarint(out, prefab->name.size());
+        out.insert(out.end(), prefab->name.begin(), prefab->name.end());
+        size_t count = 0;
+        forEachPrefabNode(*prefab, [&count](model_node_t&) { ++count; });
+        putVarint(out, count);
+        int previousId = 0;
+        forEachPrefabNode(*prefab, [&](model_node_t& n) { putAdded(out, previousId, n.id, n, stateOf(n)); });
+    }
+}
+
+// Starts a message in `out`; endMessage() fills in the length
+void beginMessage(io_vector_t<uint8_t>& out, uint8_t type) {
+    out.assign(4, 0);
+    out.push_back(type);
+}
+
+void endMessage(io_vector_t<uint8_t>& out) {
+    uint32_t size = uint32_t(out.size() - 4);
+    for (int i = 0; i < 4; ++i) out[i] = uint8_t(size >> (8 * i));
+}
+
+// Parent-first walk, so a replica can add every node as it reads it
+template <class Fn>
+void forEachNode(model_t& model, Fn fn) {
+    std::vector<model_node_t*> stack{ model.getRoot().get() };
+    while (!stack.empty()) {
+        model_node_t* n = stack.back();
+        stack.pop_back();
+        fn(*n);
+        for (auto it = n->children.rbegin(); it != n->children.rend(); ++it) stack.push_back(it->get());
+    }
+}
+
+uint64_t fnv1a(const uint8_t* data, size_t size) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < size; ++i) h = (h ^ data[i]) * 1099511628211ull;
+    return h;
+}
+
+// A fresh primitive, or a mesh to load from the same path; geometry is built on first draw
+std::shared_ptr<shape_t> createSyncedShape(uint8_t type, const std::string& path) {
+    if (type == MESH_SHAPE) return std::make_shared<mesh_t>(path);
+    return std::shared_ptr<shape_t>(createPrimitive(ShapeType(type), 1));
+}
+
+// The node's fields from `s`, without telling any model
+void setState(model_node_t& node, uint32_t mask, const sync_node_state_t& s) {
+    node.translation = s.translation;
+    node.rotation = s.rotation;
+    node.scale = s.scale;
+    node.occluder = s.occluder;
+    if (mask & FIELD_COLOR) {
+        node.color = s.color;
+        if (node.shape) node.shape->setColor(s.color);
+    }
+    if ((mask & FIELD_LEVEL) && node.shape) {
+        shape_t& shape = *node.shape;
+        // A peer's level goes straight into the shape below, so it gets setLevel()'s range here
+        unsigned int level = std::min(std::max(unsigned(s.level), 1u), 4u);
+        if (shape.vertices.empty() && !shape.gpu.resident()) {
+            shape.level = level;
+            shape.maxError = s.maxError > 0.0f ? s.maxError : 0.0f;
+        }
+        else if (s.maxError > 0.0f) {
+            shape.level = level;
+            shape.setMaxError(s.maxError);
+        }
+        else shape.setLevel(level);
+    }
+}
+
+void applyState(model_t& model, model_node_t& node, uint32_t mask, const sync_node_state_t& s) {
+    // A frozen batch holding the node would draw it as it was; the root is never baked in
+    if (!(mask & FIELD_ADDED) && !node.parent.expired()) model.invalidateBatches(node);
+    setState(node, mask, s);
+    const uint32_t moved = FIELD_TX | FIELD_TY | FIELD_TZ | FIELD_ROTATION | FIELD_SX | FIELD_SY | FIELD_SZ;
+    if (mask & moved) model.nodeMoved(node);
+}
+
+#ifndef _WIN32
+void setNonBlocking(int fd) {
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+}
+
+#ifdef MSG_NOSIGNAL
+const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+const int SEND_FLAGS = 0;
+#endif
+#endif
+
+} // namespace
+
+uint64_t sceneDigest(model_t& model, size_t& nodeCount) {
+    uint64_t digest = 0;
+    nodeCount = 0;
+    io_vector_t<uint8_t> record;
+    forEachNode(model, [&](const model_node_t& node) {
+        int previousId = 0;
+        record.clear();
+        putAdded(record, previousId, wireId(node), node, stateOf(node));
+        digest += fnv1a(record.data(), record.size());
+        ++nodeCount;
+    });
+    // Definitions count towards the digest but not the node count
+    record.clear();
+    putPrefabs(record, model);
+    return digest + fnv1a(record.data(), record.size());
+}
+
+// ---- Server ----
+
+sync_server_t::sync_server_t() = default;
+
+sync_server_t::~sync_server_t() {
+#ifndef _WIN32
+    for (client_t& c : clients) ::close(c.fd);
+    if (listenFd >= 0) ::close(listenFd);
+#endif
+    // The journal only grows while someone takes from it
+    if (auto model = source.lock()) model->trackEdits(false);
+}
+
+bool sync_server_t::listen(int port) {
+#ifndef _WIN32
+    listenFd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        std::cout << "Scene sync: could not create a socket" << std::endl;
+        return false;
+    }
+    int one = 1;
+    ::setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(uint16_t(port));
+    socklen_t length = sizeof addr;
+    if (::bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0 || ::listen(listenFd, 8) != 0 ||
+        ::getsockname(listenFd, reinterpret_cast<sockaddr*>(&addr), &length) != 0) {
+        std::cout << "Scene sync: could not listen on port " << port << std::endl;
+        ::close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+    setNonBlocking(listenFd);
+    boundPort = ntohs(addr.sin_port);
+    std::cout << "Scene sync: serving on port " << boundPort << std::endl;
+    return true;
+#else
+    (void)port;
+    std::cout << "Scene sync needs POSIX sockets" << std::endl;
+    return false;
+#endif
+}
+
+void sync_server_t::acceptClients() {
+#ifndef _WIN32
+    while (true) {
+        int fd = ::accept(listenFd, nullptr, nullptr);
+        if (fd < 0) break;
+        setNonBlocking(fd);
+        client_t client;
+        client.fd = fd;
+        clients.push_back(std::move(client));
+        std::cout << "Scene sync: client joined (" << clients.size() << " connected)" << std::endl;
+    }
+#endif
+}
+
+void sync_server_t::update(const std::shared_ptr<model_t>& modelPtr) {
+    if (listenFd < 0 || !modelPtr) return;
+    model_t& model = *modelPtr;
+    acceptClients();
+
+    bool reset = model.takeEdits(edits);
+    std::shared_ptr<model_t> previous = source.lock();
+    if (previous != modelPtr) {
+        if (previous) previous->trackEdits(false);
+        model.trackEdits(true);
+        source = modelPtr;
+        reset = true;
+    }
+    if (clients.empty()) {
+        // Nothing to send; whoever joins next gets a snapshot, which brings the mirror up to date
+        mirrorCurrent = false;
+        return;
+    }
+    if (reset || !mirrorCurrent)
+        for (client_t& c : clients) c.needsSnapshot = true;
+
+    bool anyDelta = false;
+    for (const client_t& c : clients) anyDelta = anyDelta || !c.needsSnapshot;
+    if (anyDelta && !edits.empty()) {
+        encodeDelta();
+        if (message.size() > 5) {
+            for (client_t& c : clients)
+                if (!c.needsSnapshot) queue(c);
+        }
+    }
+
+    bool anySnapshot = false;
+    for (const client_t& c : clients) anySnapshot = anySnapshot || c.needsSnapshot;
+    if (anySnapshot) {
+        encodeSnapshot(model);
+        for (client_t& c : clients) {
+            if (!c.needsSnapshot) continue;
+            queue(c);
+            c.needsSnapshot = false;
+        }
+    }
+
+    if (digestRequested) {
+        size_t count = 0;
+        uint64_t digest = sceneDigest(model, count);
+        beginMessage(message, MSG_DIGEST);
+        putVarint(message, count);
+        putVarint(message, digest);
+        endMessage(message);
+        for (client_t& c : clients) queue(c);
+        digestRequested = false;
+        std::cout << "Scene sync: sent digest of " << count << " nodes" << std::endl;
+    }
+    flush();
+}
+
+void sync_server_t::encodeDelta() {
+    // The last entry for a node decides whether it is still there; records keep the order
+    // nodes first show up in, so a node added under a new parent comes after it
+    std::unordered_map<int, size_t> slot;
+    size_t unique = 0;
+    for (size_t i = 0; i < edits.size(); ++i) {
+        auto inserted = slot.emplace(edits[i].id, unique);
+        if (inserted.second) edits[unique++] = edits[i];
+        else edits[inserted.first->second].node = edits[i].node;
+    }
+    edits.resize(unique);
+
+    beginMessage(message, MSG_DELTA);
+    int previousId = 0;
+    size_t records = 0;
+    for (const node_edit_t& e : edits) {
+        if (!e.node) {
+            if (!mirror.erase(e.id)) continue;  // added and removed between two updates
+            putSigned(message, int64_t(e.id) - previousId);
+            previousId = e.id;
+            putVarint(message, FIELD_REMOVED);
+            ++records;
+            continue;
+        }
+        int id = wireId(*e.node);
+        sync_node_state_t s = stateOf(*e.node);
+        auto known = mirror.find(id);
+        if (known == mirror.end()) {
+            putAdded(message, previousId, id, *e.node, s);
+            mirror.emplace(id, s);
+        }
+        else {
+            uint32_t mask = changedFields(known->second, s);
+            if (!mask) continue;
+            putSigned(message, int64_t(id) - previousId);
+            previousId = id;
+            putVarint(message, mask);
+            putFields(message, mask, s);
+            known->second = s;
+        }
+        ++records;
+    }
+    endMessage(message);
+    if (records) {
+        editCount += records;
+        deltaByteCount += message.size();
+    }
+}
+
+void sync_server_t::encodeSnapshot(model_t& model) {
+    mirror.clear();
+    beginMessage(message, MSG_SNAPSHOT);
+    putPrefabs(message, model);
+    int previousId = 0;
+    forEachNode(model, [&](const model_node_t& node) {
+        int id = wireId(node);
+        sync_node_state_t s = stateOf(node);
+        mirror.emplace(id, s);
+        if (id == ROOT_ID) {
+            // Every replica has a root already; send only how it differs from a fresh one
+            uint32_t mask = changedFields(sync_node_state_t{}, s);
+            putSigned(message, int64_t(id) - previousId);
+            previousId = id;
+            putVarint(message, mask);
+            putFields(message, mask, s);
+        }
+        else putAdded(message, previousId, id, node, s);
+    });
+    endMessage(message);
+    mirrorCurrent = true;
+    snapshotByteCount += message.size();
+}
+
+void sync_server_t::queue(client_t& client) {
+    if (client.outbox.size() - client.sent + message.size() > MAX_PENDING_BYTES) {
+#ifndef _WIN32
+        std::cout << "Scene sync: dropping a client that fell too far behind" << std::endl;
+        ::close(client.fd);
+#endif
+        client.fd = -1;
+        return;
+    }
+    client.outbox.insert(client.outbox.end(), message.begin(), message.end());
+}
+
+void sync_server_t::flush() {
+#ifndef _WIN32
+    for (client_t& c : clients) {
+        while (c.fd >= 0 && c.sent < c.outbox.size()) {
+            ssize_t n = ::send(c.fd, c.outbox.data() + c.sent, c.outbox.size() - c.sent, SEND_FLAGS);
+            if (n > 0) c.sent += size_t(n);
+            else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            else if (n < 0 && errno == EINTR) continue;
+            else {
+                std::cout << "Scene sync: client left" << std::endl;
+                ::close(c.fd);
+                c.fd = -1;
+            }
+        }
+        if (c.sent == c.outbox.size()) {
+            c.outbox.clear();
+            c.sent = 0;
+        }
+    }
+#endif
+    clients.erase(std::remove_if(clients.begin(), clients.end(), [](const client_t& c) { return c.fd < 0; }),
+        clients.end());
+}
+
+// ---- Client ----
+
+sync_client_t::~sync_client_t() {
+    close();
+}
+
+void sync_client_t::close() {
+#ifndef _WIN32
+    if (fd >= 0) ::close(fd);
+#endif
+    fd = -1;
+}
+
+bool sync_client_t::connect(const std::string& host, int port) {
+#ifndef _WIN32
+    addrinfo hints{}, *found = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (::getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0) {
+        std::cout << "Scene sync: unknown host " << host << std::endl;
+        return false;
+    }
+    for (addrinfo* a = found; a && fd < 0; a = a->ai_next) {
+        fd = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && ::connect(fd, a->ai_addr, a->ai_addrlen) != 0) close();
+    }
+    ::freeaddrinfo(found);
+    if (fd < 0) {
+        std::cout << "Scene sync: could not connect to " << host << ":" << port << std::endl;
+        return false;
+    }
+    setNonBlocking(fd);
+    std::cout << "Scene sync: joined " << host << ":" << port << std::endl;
+    return true;
+#else
+    (void)host;
+    (void)port;
+    std::cout << "Scene sync needs POSIX sockets" << std::endl;
+    return false;
+#endif
+}
+
+void sync_client_t::update(const std::shared_ptr<model_t>& modelPtr) {
+    if (fd < 0 || !modelPtr) return;
+#ifndef _WIN32
+    uint8_t chunk[65536];
+    while (true) {
+        ssize_t n = ::recv(fd, chunk, sizeof chunk, 0);
+        if (n > 0) {
+            inbox.insert(inbox.end(), chunk, chunk + n);
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n < 0 && errno == EINTR) continue;
+        std::cout << "Scene sync: lost the connection to the server" << std::endl;
+        close();
+        break;
+    }
+#endif
+
+    model_t& model = *modelPtr;
+    if (replica.lock() != modelPtr) {
+        // Another model than last time (a file was loaded meanwhile): index what it has
+        nodes.clear();
+        forEachNode(model, [&](model_node_t& node) { nodes[wireId(node)] = node.shared_from_this(); });
+        replica = modelPtr;
+    }
+
+    size_t pos = 0;
+    while (inbox.size() - pos >= 4) {
+        uint32_t size = 0;
+        for (int i = 0; i < 4; ++i) size |= uint32_t(inbox[pos + i]) << (8 * i);
+        if (size > MAX_MESSAGE_BYTES) {
+            std::cout << "Scene sync: bad message from the server" << std::endl;
+            close();
+            inbox.clear();
+            return;
+        }
+        if (inbox.size() - pos - 4 < size) break;
+        apply(inbox.data() + pos + 4, size, model);
+        pos += 4 + size_t(size);
+    }
+    inbox.erase(inbox.begin(), inbox.begin() + pos);
+}
+
+void sync_client_t::apply(const uint8_t* data, size_t size, model_t& model) {
+    wire_reader_t in{ data, data + size };
+    uint8_t type = in.byte();
+    ++applied;
+
+    if (type == MSG_DIGEST) {
+        size_t count = size_t(in.varint());
+        uint64_t digest = in.varint();
+        size_t localCount = 0;
+        uint64_t local = sceneDigest(model, localCount);
+        digestResult = in.ok && local == digest && localCount == count ? 1 : 0;
+        std::cout << "Scene sync: replica " << (digestResult ? "matches" : "differs from") << " the server ("
+                  << localCount << " nodes here, " << count << " there)" << std::endl;
+        return;
+    }
+    if (type == MSG_SNAPSHOT) {
+        model.clear();
+        nodes.clear();
+        nodes[ROOT_ID] = model.getRoot();
+
+        // Prefabs go in before the nodes placing them, and each only sees the ones before it
+        uint64_t prefabCount = in.varint();
+        for (uint64_t k = 0; k < prefabCount && in.ok; ++k) {
+            auto prefab = std::make_shared<prefab_t>();
+            prefab->root = std::make_shared<model_node_t>();
+            size_t length = size_t(in.varint());
+            if (length > size_t(in.end - in.p)) break;
+            prefab->name.assign(reinterpret_cast<const char*>(in.p), length);
+            in.p += length;
+            uint64_t count = in.varint();
+            std::unordered_map<int, model_node_t*> defNodes{ { ROOT_ID, prefab->root.get() } };
+            int id = 0;
+            for (uint64_t i = 0; i < count && in.ok; ++i) {
+                id += int(in.signedVarint());
+                uint32_t mask = uint32_t(in.varint());
+                sync_node_state_t s;
+                std::string path, name;
+                readAdded(in, mask, s, path, name);
+                if (!in.ok || !(mask & FIELD_ADDED)) {
+                    in.ok = false;
+                    break;
+                }
+                std::shared_ptr<shape_t> shape = (mask & FIELD_PREFAB) ? nullptr : createSyncedShape(s.type, path);
+                auto node = std::make_shared<model_node_t>(shape, ShapeType(s.type));
+                if (mask & FIELD_PREFAB) node->prefab = model.findPrefab(name);
+                node->id = id;
+                model_node_t::reserveId(id);
+                setState(*node, mask, s);
+                auto parent = defNodes.find(s.parent);
+                (parent != defNodes.end() ? parent->second : prefab->root.get())->addChild(node);
+                defNodes[id] = node.get();
+            }
+            prefab->update();
+            model.prefabs.push_back(prefab);
+        }
+    }
+
+    int id = 0;
+    while (in.more()) {
+        id += int(in.signedVarint());
+        uint32_t mask = uint32_t(in.varint());
+        if (mask & FIELD_REMOVED) {
+            auto found = nodes.find(id);
+            if (found == nodes.end() || id == ROOT_ID) continue;
+            std::shared_ptr<model_node_t> node = found->second;
+            std::vector<model_node_t*> stack{ node.get() };
+            while (!stack.empty()) {
+                model_node_t* n = stack.back();
+                stack.pop_back();
+                nodes.erase(wireId(*n));
+                for (const auto& c : n->children) stack.push_back(c.get());
+            }
+            model.removeNode(*node);
+            continue;
+        }
+
+        std::shared_ptr<model_node_t> node;
+        sync_node_state_t s;
+        if (mask & FIELD_ADDED) {
+            std::string path, prefab;
+            readAdded(in, mask, s, path, prefab);
+            if (!in.ok || nodes.count(id)) break;
+            auto parent = nodes.find(s.parent);
+            model_node_t& parentNode = parent != nodes.end() ? *parent->second : *model.getRoot();
+            // An instance of a prefab the replica lacks stays an empty node
+            if (mask & FIELD_PREFAB) node = model.placePrefab(parentNode, model.findPrefab(prefab));
+            else node = model.attachShape(parentNode, createSyncedShape(s.type, path));
+            node->id = id;
+            model_node_t::reserveId(id);
+            // The root is ROOT_ID on the wire; locally it makes way for the server's node
+            if (model.getRoot()->id == id) model.getRoot()->id = model_node_t::next_id++;
+            nodes[id] = node;
+        }
+        else {
+            auto found = nodes.find(id);
+            if (found != nodes.end()) {
+                node = found->second;
+                s = stateOf(*node);
+            }
+            readFields(in, mask, s);  // into a throwaway state for a node this replica lacks
+        }
+        if (!in.ok) break;
+        if (node) applyState(model, *node, mask, s);
+    }
+    if (!in.ok) {
+        std::cout << "Scene sync: bad message from the server" << std::endl;
+        close();
+    }
+}
+
+// ---- Benchmark ----
+
+namespace {
+
+// Every node's synced state by wire id
+std::unordered_map<int, sync_node_state_t> collectStates(model_t& model) {
+    std::unordered_map<int, sync_node_state_t> states;
+    forEachNode(model, [&](const model_node_t& node) { states.emplace(wireId(node), stateOf(node)); });
+    return states;
+}
+
+} // namespace
+
+void benchmarkSceneSync(size_t nodeCount, size_t editsPerFrame, int frames) {
+    std::mt19937 rng(43);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    const ShapeType types[] = { SPHERE_SHAPE, CYLINDER_SHAPE, BOX_SHAPE, CONE_SHAPE };
+
+    // A wide tree, each node under one of the nodes made before it
+    auto sourcePtr = std::make_shared<model_t>();
+    model_t& source = *sourcePtr;
+    std::vector<std::shared_ptr<model_node_t>> made{ source.getRoot() };
+    made.reserve(nodeCount + 1);
+    for (size_t i = 0; i < nodeCount; ++i) {
+        size_t parent = made.size() < 64 ? 0 : size_t(rng() % made.size());
+        auto node = source.attachShape(*made[parent],
+            std::shared_ptr<shape_t>(createPrimitive(types[rng() % 4], 1 + rng() % 2)));
+        node->translation = glm::vec3(unit(rng), unit(rng), unit(rng)) * 10.0f;
+        node->rotation = glm::normalize(glm::quat(unit(rng), unit(rng), unit(rng), unit(rng)));
+        node->scale = glm::vec3(0.2f + 0.1f * unit(rng));
+        node->color = glm::vec4(0.5f + 0.5f * unit(rng), 0.5f + 0.5f * unit(rng), 0.5f + 0.5f * unit(rng), 1.0f);
+        node->shape->setColor(node->color);
+        made.push_back(node);
+    }
+    std::cout << "Scene sync: " << nodeCount << " nodes, " << editsPerFrame << " edits per frame, "
+              << frames << " frames" << std::endl;
+
+    sync_server_t server;
+    sync_client_t client;
+    auto replicaPtr = std::make_shared<model_t>();
+    model_t& replica = *replicaPtr;
+    if (!server.listen(0) || !client.connect("127.0.0.1", server.port())) return;
+
+    using clock = std::chrono::steady_clock;
+    auto ms = [](clock::time_point a, clock::time_point b) {
+        return std::chrono::duration<double, std::milli>(b - a).count();
+    };
+    // Flushes on the server side and applies on the client side until the next message is in
+    auto deliver = [&](size_t messages) {
+        while (client.connected() && client.messagesApplied() < messages) {
+            server.update(sourcePtr);
+            client.update(replicaPtr);
+        }
+    };
+
+    std::cout.setstate(std::ios::failbit);  // join and leave lines
+    auto start = clock::now();
+    server.update(sourcePtr);
+    while (server.clientCount() == 0) server.update(sourcePtr);
+    deliver(1);
+    auto end = clock::now();
+    std::cout.clear();
+    std::cout << "  snapshot: " << server.snapshotBytes() / 1024 << " KiB, "
+              << double(server.snapshotBytes()) / double(nodeCount + 1) << " bytes per node, "
+              << ms(start, end) << " ms to encode, send and apply" << std::endl;
+
+    std::vector<double> latency;
+    size_t madeEdits = 0;
+    for (int f = 0; f < frames; ++f) {
+        for (size_t e = 0; e < editsPerFrame; ++e) {
+            auto& node = *made[1 + rng() % (made.size() - 1)];
+            unsigned kind = rng() % 100;
+            if (kind < 70) {
+                // What the + and - keys do: one axis at a time
+                node.translation[rng() % 3] += 0.1f;
+                source.nodeMoved(node);
+            }
+            else if (kind < 80) {
+                node.rotation = glm::normalize(node.rotation * glm::angleAxis(0.087f, glm::vec3(0.0f, 1.0f, 0.0f)));
+                source.nodeMoved(node);
+            }
+            else if (kind < 90) {
+                node.color = glm::vec4(unit(rng) * 0.5f + 0.5f, 0.5f, 0.5f, 1.0f);
+                node.shape->setColor(node.color);
+                source.nodeEdited(node);
+            }
+            else if (kind < 95) {
+                node.shape->level = 1 + rng() % 4;
+                source.nodeEdited(node);
+            }
+            else if (kind < 98 || made.size() < 3) {
+                auto added = source.attachShape(node, std::shared_ptr<shape_t>(createPrimitive(BOX_SHAPE, 1)));
+                added->translation = glm::vec3(0.5f, 0.0f, 0.0f);
+                source.nodeMoved(*added);
+                made.push_back(added);
+            }
+            else {
+                // Last made is always a leaf, since children are only made under earlier nodes
+                source.removeNode(*made.back());
+                made.pop_back();
+            }
+            ++madeEdits;
+        }
+        size_t expected = client.messagesApplied() + 1;
+        auto frameStart = clock::now();
+        server.update(sourcePtr);
+        deliver(expected);
+        latency.push_back(ms(frameStart, clock::now()));
+    }
+
+    std::sort(latency.begin(), latency.end());
+    if (!latency.empty()) {
+        std::cout << "  deltas: " << server.editsSent() << " node records for " << madeEdits << " edits, "
+                  << double(server.deltaBytes()) / double(std::max<size_t>(server.editsSent(), 1))
+                  << " bytes per record, " << double(server.deltaBytes()) / double(std::max<size_t>(madeEdits, 1))
+                  << " bytes per edit" << std::endl;
+        std::cout << "  latency per frame (encode, send, apply): median " << latency[latency.size() / 2]
+                  << " ms, max " << latency.back() << " ms" << std::endl;
+    }
+
+    // The replica against the source, field by field
+    auto expect = collectStates(source);
+    auto got = collectStates(replica);
+    size_t mismatched = 0;
+    int firstBad = 0;
+    for (const auto& [id, s] : expect) {
+        auto it = got.find(id);
+        bool match = it != got.end() && it->second.parent == s.parent && it->second.type == s.type &&
+            !changedFields(it->second, s);
+        if (!match && mismatched++ == 0) firstBad = id;
+    }
+    mismatched += got.size() > expect.size() ? got.size() - expect.size() : 0;
+    if (mismatched) std::cout << "  replica: " << mismatched << " nodes differ, first " << firstBad << std::endl;
+    else std::cout << "  replica: all " << got.size() << " nodes match the source" << std::endl;
+
+    size_t sourceCount = 0, replicaCount = 0;
+    bool digestsMatch = sceneDigest(source, sourceCount) == sceneDigest(replica, replicaCount);
+    std::cout << "  digest: " << (digestsMatch && sourceCount == replicaCount ? "match" : "differ") << std::endl;
+}
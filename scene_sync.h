@@ -0,0 +1,128 @@
+#ifndef SCENE_SYNC_H
+#define SCENE_SYNC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "memory_stats.h"
+
+struct model_node_t;
+struct node_edit_t;
+class model_t;
+
+const int SYNC_DEFAULT_PORT = 7878;
+
+// What a replica keeps of each node. The root travels as id -1, since every instance's root
+// has an id of its own; nodes directly under it have parent -1.
+struct sync_node_state_t {
+    int parent = -1;
+    uint8_t type = 0;
+    uint8_t level = 1;
+    bool occluder = false;
+    float maxError = 0.0f;
+    glm::vec3 translation{ 0.0f };
+    glm::quat rotation{ 1.0f, 0.0f, 0.0f, 0.0f };
+    glm::vec3 scale{ 1.0f };
+    glm::vec4 color{ 1.0f };
+};
+
+// Serves the model to other modeller instances over TCP on the loopback interface. A client
+// that connects gets the whole model once; after that each update() sends one message with
+// the nodes edited since the last one (model_t's edit journal), each carrying only the fields
+// that changed. Floats go over bit for bit, so replicas match the source exactly.
+class sync_server_t {
+public:
+    sync_server_t();
+    ~sync_server_t();
+
+    sync_server_t(const sync_server_t&) = delete;
+    sync_server_t& operator=(const sync_server_t&) = delete;
+
+    // Port 0 picks a free one, see port(); false and a message if the socket can't be opened
+    bool listen(int port);
+    int port() const { return boundPort; }
+
+    // Once per frame: takes in new clients and sends out the model's edits; a model other than
+    // last frame's, or one that was cleared or loaded, goes out whole instead
+    void update(const std::shared_ptr<model_t>& model);
+    // Sends a digest of the model with the next update(); clients check their replica against it
+    void requestDigest() { digestRequested = true; }
+
+    size_t clientCount() const { return clients.size(); }
+    // Totals since listen(), counting each message once however many clients it went to
+    size_t editsSent() const { return editCount; }
+    size_t deltaBytes() const { return deltaByteCount; }
+    size_t snapshotBytes() const { return snapshotByteCount; }
+
+private:
+    struct client_t {
+        int fd = -1;
+        io_vector_t<uint8_t> outbox;
+        size_t sent = 0;               // bytes of outbox already on the socket
+        bool needsSnapshot = true;
+    };
+
+    int listenFd = -1;
+    int boundPort = 0;
+    std::vector<client_t> clients;
+    std::weak_ptr<model_t> source;     // the model `mirror` describes
+    bool mirrorCurrent = false;        // false while nobody listens and edits go unsent
+    std::unordered_map<int, sync_node_state_t> mirror;  // what the clients have, by wire id
+    bool digestRequested = false;
+    size_t editCount = 0, deltaByteCount = 0, snapshotByteCount = 0;
+
+    std::vector<node_edit_t> edits;    // scratch, kept for its capacity
+    io_vector_t<uint8_t> message;
+
+    void acceptClients();
+    void encodeDelta();
+    void encodeSnapshot(model_t& model);
+    void queue(client_t& client);
+    void flush();
+};
+
+// Keeps a replica of a served model. Local edits to the replica are not sent back.
+class sync_client_t {
+public:
+    sync_client_t() = default;
+    ~sync_client_t();
+
+    sync_client_t(const sync_client_t&) = delete;
+    sync_client_t& operator=(const sync_client_t&) = delete;
+
+    bool connect(const std::string& host, int port);
+    bool connected() const { return fd >= 0; }
+
+    // Once per frame: applies every complete message received so far to `model`
+    void update(const std::shared_ptr<model_t>& model);
+
+    size_t messagesApplied() const { return applied; }
+    // Result of the last digest the server sent: 1 matched, 0 differed, -1 none yet
+    int digestMatched() const { return digestResult; }
+
+private:
+    int fd = -1;
+    io_vector_t<uint8_t> inbox;
+    size_t applied = 0;
+    int digestResult = -1;
+    std::weak_ptr<model_t> replica;    // the model `nodes` indexes
+    std::unordered_map<int, std::shared_ptr<model_node_t>> nodes;  // by wire id
+
+    void apply(const uint8_t* data, size_t size, model_t& model);
+    void close();
+};
+
+// Order-independent hash of every node's synced state; equal models give equal digests
+uint64_t sceneDigest(model_t& model, size_t& nodeCount);
+
+// Serves a synthetic model of `nodes` nodes to a client in the same process over loopback TCP,
+// then makes `editsPerFrame` random edits per frame and prints the snapshot size, bytes per
+// edit and per-frame latency, and checks the replica against the source field by field
+void benchmarkSceneSync(size_t nodes, size_t editsPerFrame, int frames);
+
+#endif
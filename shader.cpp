@@ -0,0 +1,239 @@
+#include "shader.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#ifdef _WIN32
+#include <direct.h>
+#include <windows.h>
+#define mkdir(path, mode) _mkdir(path)
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Directory of the running executable with a trailing separator; empty if it can't be found,
+// which leaves paths relative to the working directory
+static std::string executableDir() {
+    char path[4096];
+#ifdef _WIN32
+    DWORD n = GetModuleFileNameA(nullptr, path, sizeof(path));
+    if (n == 0 || n == sizeof(path)) return "";
+    std::string exe(path, n);
+    size_t slash = exe.find_last_of("\\/");
+#else
+    ssize_t n = readlink("/proc/self/exe", path, sizeof(path));
+    if (n <= 0 || n == ssize_t(sizeof(path))) return "";
+    std::string exe(path, size_t(n));
+    size_t slash = exe.rfind('/');
+#endif
+    return slash == std::string::npos ? "" : exe.substr(0, slash + 1);
+}
+
+// The GLSL files and the cache live next to the executable, wherever it was started from
+static const std::string shaderDir = executableDir();
+
+GLuint shaderPrograms[SHADER_VARIANT_COUNT] = {};
+GLuint drawRecordPrograms[SHADER_VARIANT_COUNT] = {};
+std::string shaderCacheDir = shaderDir + "shader_cache";
+
+std::string shaderPath(const std::string& file) {
+    if (!shaderDir.empty() && std::ifstream(shaderDir + file).good()) return shaderDir + file;
+    return file;
+}
+
+std::string loadShaderFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Failed to open shader " << path << std::endl;
+        return "";
+    }
+    std::stringstream ss;
+    ss << file.rdbuf();
+    return ss.str();
+}
+
+// Puts "#define X" lines right after the #version directive
+static std::string injectDefines(const std::string& src, const std::vector<std::string>& defines) {
+    std::string block;
+    for (const auto& d : defines) block += "#define " + d + "\n";
+    size_t version = src.find("#version");
+    if (version == std::string::npos) return block + src;
+    size_t eol = src.find('\n', version);
+    if (eol == std::string::npos) return src + "\n" + block;
+    return src.substr(0, eol + 1) + block + src.substr(eol + 1);
+}
+
+// FNV-1a, 64 bit
+static uint64_t hashString(const std::string& s, uint64_t h = 1469598103934665603ull) {
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static std::string glString(GLenum name) {
+    const GLubyte* s = glGetString(name);
+    return s ? reinterpret_cast<const char*>(s) : "";
+}
+
+static bool binaryCacheSupported() {
+    if (!GLEW_ARB_get_program_binary) return false;
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+static GLuint compileStage(GLenum stage, const std::string& src, const char* label) {
+    GLuint shader = glCreateShader(stage);
+    const char* text = src.c_str();
+    glShaderSource(shader, 1, &text, nullptr);
+    glCompileShader(shader);
+
+    GLint success;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        char infoLog[512];
+        glGetShaderInfoLog(shader, 512, nullptr, infoLog);
+        std::cerr << label << " not compiled" << infoLog << std::endl;
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+static bool loadCachedProgram(GLuint program, const std::string& cacheFile) {
+    std::ifstream file(cacheFile, std::ios::binary);
+    if (!file.is_open()) return false;
+    GLenum format = 0;
+    if (!file.read(reinterpret_cast<char*>(&format), sizeof(format))) return false;
+    std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (binary.empty()) return false;
+
+    glProgramBinary(program, format, binary.data(), GLsizei(binary.size()));
+    GLint success = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    return success != 0; // drivers reject binaries from other versions here
+}
+
+static void storeCachedProgram(GLuint program, const std::string& cacheFile) {
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) return;
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, nullptr, &format, binary.data());
+
+    mkdir(shaderCacheDir.c_str(), 0755);
+    std::string tmp = cacheFile + ".tmp";
+    std::ofstream file(tmp, std::ios::binary);
+    if (!file.is_open()) return;
+    file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+    file.write(binary.data(), binary.size());
+    file.close();
+    std::rename(tmp.c_str(), cacheFile.c_str()); // never leave a half-written cache entry
+}
+
+GLuint createShaderProgram(const std::string& vertexPath,
+    const std::string& fragmentPath,
+    const std::vector<std::string>& defines,
+    bool* cacheHit) {
+    if (cacheHit) *cacheHit = false;
+    std::string vertexSrc = loadShaderFile(vertexPath);
+    std::string fragmentSrc = loadShaderFile(fragmentPath);
+    if (vertexSrc.empty() || fragmentSrc.empty()) return 0;
+    vertexSrc = injectDefines(vertexSrc, defines);
+    fragmentSrc = injectDefines(fragmentSrc, defines);
+
+    bool useCache = binaryCacheSupported();
+    std::string cacheFile;
+    GLuint program = glCreateProgram();
+    if (useCache) {
+        uint64_t h = hashString(vertexSrc);
+        h = hashString(fragmentSrc, h);
+        h = hashString(glString(GL_VENDOR) + "|" + glString(GL_RENDERER) + "|" + glString(GL_VERSION), h);
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(h));
+        cacheFile = shaderCacheDir + "/" + name;
+        if (loadCachedProgram(program, cacheFile)) {
+            if (cacheHit) *cacheHit = true;
+            return program;
+        }
+        // A rejected binary leaves the program unusable, start over
+        glDeleteProgram(program);
+        program = glCreateProgram();
+    }
+
+    //Compile vertex& fragment shaders, link them into a program, and return its ID
+    GLuint vertexShader = compileStage(GL_VERTEX_SHADER, vertexSrc, "vshader");
+    GLuint fragmentShader = compileStage(GL_FRAGMENT_SHADER, fragmentSrc, "fshader");
+    if (!vertexShader || !fragmentShader) {
+        glDeleteShader(vertexShader);
+        glDeleteShader(fragmentShader);
+        glDeleteProgram(program);
+        return 0;
+    }
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    if (useCache) glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program);
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    GLint success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        char infoLog[512];
+        glGetProgramInfoLog(program, 512, nullptr, infoLog);
+        std::cerr << "linking failed" << infoLog << std::endl;
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    if (useCache) storeCachedProgram(program, cacheFile);
+    return program;
+}
+
+bool loadShaderVariants() {
+    static const std::vector<std::string> variantDefines[SHADER_VARIANT_COUNT] = {
+        {},
+        { "LIGHTING" },
+        { "VERTEX_PULLING" },
+        { "VERTEX_PULLING", "LIGHTING" },
+        { "LIGHTING", "CLUSTERED_LIGHTS" },
+        { "VERTEX_PULLING", "LIGHTING", "CLUSTERED_LIGHTS" },
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::string vertexPath = shaderPath("vertex_shader.glsl"), fragmentPath = shaderPath("fragment_shader.glsl");
+    int hits = 0;
+    for (int v = 0; v < SHADER_VARIANT_COUNT; ++v) {
+        bool hit = false;
+        shaderPrograms[v] = createShaderProgram(vertexPath, fragmentPath, variantDefines[v], &hit);
+        if (shaderPrograms[v] == 0) return false;
+        hits += hit ? 1 : 0;
+
+        std::vector<std::string> defines = variantDefines[v];
+        defines.push_back("DRAW_RECORDS");
+        drawRecordPrograms[v] = createShaderProgram(vertexPath, fragmentPath, defines, &hit);
+        if (drawRecordPrograms[v] == 0) return false;
+        hits += hit ? 1 : 0;
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Shader programs ready in " << ms << " ms ("
+              << hits << "/" << 2 * SHADER_VARIANT_COUNT << " from binary cache)" << std::endl;
+    return true;
+}
+
+ShaderVariant selectShaderVariant(bool lighting, bool vertexPulling, bool clusteredLights) {
+    if (lighting && clusteredLights) return vertexPulling ? SHADER_PULLED_LIT_CLUSTERED : SHADER_LIT_CLUSTERED;
+    if (vertexPulling) return lighting ? SHADER_PULLED_LIT : SHADER_PULLED_UNLIT;
+    return lighting ? SHADER_LIT : SHADER_UNLIT;
+}
+
+GLuint selectShaderProgram(bool lighting, bool vertexPulling, bool clusteredLights) {
+    return shaderPrograms[selectShaderVariant(lighting, vertexPulling, clusteredLights)];
+}
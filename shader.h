@@ -0,0 +1,50 @@
+#ifndef SHADER_H
+#define SHADER_H
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+
+// Program variants compiled from the same GLSL files with different #defines
+enum ShaderVariant {
+    SHADER_UNLIT,
+    SHADER_LIT,      // LIGHTING defined
+    SHADER_PULLED_UNLIT, // VERTEX_PULLING: primitives rebuilt from gl_VertexID, no vertex buffers
+    SHADER_PULLED_LIT,
+    SHADER_LIT_CLUSTERED,        // LIGHTING + CLUSTERED_LIGHTS: the model's point lights per fragment
+    SHADER_PULLED_LIT_CLUSTERED,
+    SHADER_VARIANT_COUNT
+};
+
+extern GLuint shaderPrograms[SHADER_VARIANT_COUNT];
+// The same variants with DRAW_RECORDS: the transform, normal matrix and pulled color come from
+// a texture buffer of per-draw records instead of uniforms (render_queue.h)
+extern GLuint drawRecordPrograms[SHADER_VARIANT_COUNT];
+
+// `file` in the executable's directory if it is there, otherwise `file` as given (relative to the
+// working directory)
+std::string shaderPath(const std::string& file);
+
+// Reads a whole text file; empty string if it cannot be opened
+std::string loadShaderFile(const std::string& path);
+
+// Builds a program from two GLSL files with `defines` injected after #version.
+// Program binaries are cached in shaderCacheDir keyed by a hash of the sources,
+// the defines and the driver vendor/renderer/version; a stale or rejected binary
+// falls back to compiling. cacheHit reports which path was taken.
+GLuint createShaderProgram(const std::string& vertexPath,
+    const std::string& fragmentPath,
+    const std::vector<std::string>& defines,
+    bool* cacheHit = nullptr);
+
+// Builds every ShaderVariant, with and without DRAW_RECORDS; returns false if any fails
+bool loadShaderVariants();
+
+// Variant for the current lighting state and draw path, and its program
+ShaderVariant selectShaderVariant(bool lighting, bool vertexPulling = false, bool clusteredLights = false);
+GLuint selectShaderProgram(bool lighting, bool vertexPulling = false, bool clusteredLights = false);
+
+// shader_cache/ next to the executable
+extern std::string shaderCacheDir;
+
+#endif
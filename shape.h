@@ -3,56 +3,106 @@
 #include <iostream>
 #include <vector>
 #include <memory>
+#include <cstring>
 #include <GL/glew.h>   
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include "baked_shapes.h"
+#include "gpu_resources.h"
+#include "memory_stats.h"
+#include "tessellation.h"
 
 // Shape Types
 enum ShapeType {
     SPHERE_SHAPE,
     CONE_SHAPE,
     BOX_SHAPE,
-    CYLINDER_SHAPE
+    CYLINDER_SHAPE,
+    MESH_SHAPE      // external triangle mesh, see mesh.h
 };
 
+struct lod_chain_t;  // simplify.h
+
 // Base Class
 class shape_t {
 public:
-    std::vector<glm::vec4> vertices;
-    std::vector<glm::vec4> colors;
-    std::vector<glm::vec4> normals;
-    std::vector<unsigned int> indices;
+    geometry_vector_t<glm::vec4> vertices;
+    geometry_vector_t<glm::vec4> colors;
+    geometry_vector_t<glm::vec4> normals;
+    geometry_vector_t<unsigned int> indices;
 
-    GLuint VAO = 0, VBO = 0, CBO = 0, EBO = 0,NBO=0;
+    gpu_mesh_t gpu;  // VAO and buffers, created on the first draw
     ShapeType shapetype;
     unsigned int level;
-    shape_t() : level(1) {}
+    float maxError = 0.0f;  // > 0: tessellate to this error instead of `level`, see setMaxError()
+    std::shared_ptr<lod_chain_t> lods;  // simplified copies for distant draws, see buildLodChain()
+    shape_t() : level(1) { gpu.owner = this; }
     shape_t(unsigned int tesselation_level) : level(tesselation_level) {
         if (level < 1) level = 1;
         if (level > 4) level = 4;
+        gpu.owner = this;
     }
 
-    virtual ~shape_t() {
-        if (VAO) glDeleteVertexArrays(1, &VAO);
-        if (VBO) glDeleteBuffers(1, &VBO);
-        if (CBO) glDeleteBuffers(1, &CBO);
-       if (CBO) glDeleteBuffers(1, &NBO);
-      if (EBO) glDeleteBuffers(1, &EBO);
+    virtual ~shape_t() = default;
+
+    // Hands the GL objects to gpuResources() for deferred deletion
+    void deleteBuffers() { gpu.release(); }
+
+    // VRAM budget eviction: primitives drop their CPU copy too, since generateGeometry()
+    // rebuilds it; meshes and batches have nothing to rebuild from and keep theirs
+    void evictGeometry() {
+        if (shapetype == MESH_SHAPE) {
+            ensureGeometry();  // the buffers may hold the only copy
+            deleteBuffers();
+        }
+        else releaseGeometry();
     }
 
     ShapeType getType() const { return shapetype; }
 
+    // Object-space bounding box; every primitive fills [-1, 1] on each axis
+    virtual void localBounds(glm::vec3& lo, glm::vec3& hi) const {
+        lo = glm::vec3(-1.0f);
+        hi = glm::vec3(1.0f);
+    }
+
     virtual void generateGeometry() = 0;
+    // Builds the geometry with trig loops, bypassing the baked tables
+    virtual void generateProcedural() { generateGeometry(); }
     unsigned int getLevel() const { return level; }
+    // Neither this nor setMaxError() means anything for a mesh or batch, which keeps its level
     void setLevel(unsigned int l) {
+        if (shapetype == MESH_SHAPE) return;
         if (l < 1) l = 1;
         if (l > 4) l = 4;
-        if (level != l) {
+        if (level != l || maxError > 0.0f) {
             level = l;
-            generateGeometry();
-            VAO = VBO = CBO = NBO=EBO = 0; // force GPU buffer update
+            maxError = 0.0f;
+            retessellate();
+        }
+    }
+    // Error-bounded tessellation: as few triangles as keep every facet within `error` of the
+    // true surface (object space, where primitives span [-1, 1]), with no cap on the count.
+    // 0 goes back to the fixed level.
+    bool isErrorBounded() const { return maxError > 0.0f; }
+    void setMaxError(float error) {
+        if (shapetype == MESH_SHAPE) return;
+        if (error < 0.0f) error = 0.0f;
+        if (error != maxError) {
+            maxError = error;
+            retessellate();
         }
     }
+    // New geometry for the current level or error, keeping the color. Meshes and batches don't
+    // depend on either, and keep their geometry and LOD chain (nothing would rebuild the chain).
+    void retessellate() {
+        if (shapetype == MESH_SHAPE) return;
+        glm::vec4 c = colors.empty() ? glm::vec4(1.0f) : colors[0];
+        lods.reset();
+        deleteBuffers(); // re-uploaded on the next draw
+        generateGeometry();
+        setColor(c);
+    }
     virtual void setColor(const glm::vec4& c) {
         if (vertices.empty()) {
             colors.assign(1, c);
@@ -62,23 +112,25 @@ public:
         }
 
         // Update GPU buffer if already created
-        if (CBO != 0) {
-            glBindBuffer(GL_ARRAY_BUFFER, CBO);
-            glBufferSubData(GL_ARRAY_BUFFER, 0, colors.size() * sizeof(glm::vec4), colors.data());
+        if (gpu.colors && colors.size() * sizeof(glm::vec4) < gpu.colors.bytes()) {
+            // The CPU copy was dropped after upload; the buffer still wants every vertex
+            std::vector<glm::vec4> fill(gpu.colors.bytes() / sizeof(glm::vec4), c);
+            gpu.colors.update(GL_ARRAY_BUFFER, 0, gpu.colors.bytes(), fill.data());
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+        else if (gpu.colors) {
+            gpu.colors.update(GL_ARRAY_BUFFER, 0, colors.size() * sizeof(glm::vec4), colors.data());
             glBindBuffer(GL_ARRAY_BUFFER, 0);
         }
     }
 
     void setupBuffers() {
-        if (VAO != 0) return;
+        if (gpu.resident()) return;
 
-        glGenVertexArrays(1, &VAO);
-        glBindVertexArray(VAO);
+        gpu.vao.bind();
 
         // Vertex positions
-        glGenBuffers(1, &VBO);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER,
+        gpu.positions.upload(GL_ARRAY_BUFFER,
             vertices.size() * sizeof(glm::vec4),
             vertices.data(),
             GL_STATIC_DRAW);
@@ -91,9 +143,7 @@ public:
         }
 
         // Vertex colors
-        glGenBuffers(1, &CBO);
-        glBindBuffer(GL_ARRAY_BUFFER, CBO);
-        glBufferData(GL_ARRAY_BUFFER,
+        gpu.colors.upload(GL_ARRAY_BUFFER,
             colors.size() * sizeof(glm::vec4),
             colors.data(),
             GL_STATIC_DRAW);
@@ -101,22 +151,18 @@ public:
         glEnableVertexAttribArray(1);
 //Normals
         if(normals.empty()){
-            normals.assign(vertices.size(),glm::vec3 (0.0f,1.0f,0.0f));
+            normals.assign(vertices.size(),glm::vec4 (0.0f,1.0f,0.0f,0.0f));
         }
-         glGenBuffers(1, &NBO);
-        glBindBuffer(GL_ARRAY_BUFFER, NBO);
-        glBufferData(GL_ARRAY_BUFFER,
+        gpu.normals.upload(GL_ARRAY_BUFFER,
             normals.size() * sizeof(glm::vec4),
             normals.data(),
             GL_STATIC_DRAW);
-        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
         glEnableVertexAttribArray(2);
 
         
         // Indices
-        glGenBuffers(1, &EBO);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+        gpu.indices.upload(GL_ELEMENT_ARRAY_BUFFER,
             indices.size() * sizeof(unsigned int),
             indices.data(),
             GL_STATIC_DRAW);
@@ -124,11 +170,19 @@ public:
         glBindVertexArray(0);
     }
 
-    virtual void draw(const glm::mat4& MVP, GLuint shaderProgram) {
-        if (VAO == 0) {
-            generateGeometry();
+    // Uploads the geometry if it is not on the GPU and marks it drawn this frame; an upload
+    // leaves no VAO bound
+    void makeResident() {
+        if (!gpu.resident()) {
+            ensureGeometry();
             setupBuffers();
+            if (gpuResources().releaseCpuGeometry) dropCpuGeometry();
         }
+        gpuResources().touch(gpu);
+    }
+
+    virtual void draw(const glm::mat4& MVP, GLuint shaderProgram) {
+        makeResident();
 
         // Upload MVP
         GLint mvpLoc = glGetUniformLocation(shaderProgram, "MVP");
@@ -136,11 +190,100 @@ public:
             glUniformMatrix4fv(mvpLoc, 1, GL_FALSE, glm::value_ptr(MVP));
         }
 
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(indices.size()), GL_UNSIGNED_INT, 0);
+        glBindVertexArray(gpu.vao.id());
+        glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(indexCount()), GL_UNSIGNED_INT, 0);
         glBindVertexArray(0);
     }
 
+    // Drops the CPU and GPU geometry, keeping only the color (vertex-pulled primitives need nothing else)
+    void releaseGeometry() {
+        deleteBuffers();
+        dropCpuGeometry();
+    }
+
+    // Drops the CPU geometry but not the GPU copy, keeping only the color
+    void dropCpuGeometry() {
+        glm::vec4 c = colors.empty() ? glm::vec4(1.0f) : colors[0];
+        geometry_vector_t<glm::vec4>().swap(vertices);
+        geometry_vector_t<glm::vec4>().swap(normals);
+        geometry_vector_t<unsigned int>().swap(indices);
+        geometry_vector_t<glm::vec4>(1, c).swap(colors);
+    }
+
+    // Rebuilds geometry dropped by releaseGeometry() or dropCpuGeometry() without losing the
+    // color. Meshes and batches have nothing to rebuild from, so theirs is read back from the
+    // GPU copy.
+    void ensureGeometry() {
+        if (!vertices.empty()) return;
+        if (shapetype == MESH_SHAPE && gpu.resident()) {
+            readBackGeometry();
+            return;
+        }
+        bool colored = !colors.empty();
+        glm::vec4 c = colored ? colors[0] : glm::vec4(1.0f);
+        generateGeometry();
+        if (colored) setColor(c);
+    }
+
+    // Indices drawn, whether or not the CPU copy is still there
+    size_t indexCount() const {
+        return indices.empty() && gpu.resident() ? gpu.indices.bytes() / sizeof(unsigned int) : indices.size();
+    }
+
+    // The GPU copy back into the CPU vectors, see ensureGeometry()
+    void readBackGeometry() {
+        vertices.resize(gpu.positions.bytes() / sizeof(glm::vec4));
+        colors.resize(gpu.colors.bytes() / sizeof(glm::vec4));
+        normals.resize(gpu.normals.bytes() / sizeof(glm::vec4));
+        indices.resize(gpu.indices.bytes() / sizeof(unsigned int));
+        gpu.positions.read(GL_ARRAY_BUFFER, vertices.data());
+        gpu.colors.read(GL_ARRAY_BUFFER, colors.data());
+        gpu.normals.read(GL_ARRAY_BUFFER, normals.data());
+        gpu.vao.bind();  // the element buffer binding belongs to the VAO
+        gpu.indices.read(GL_ELEMENT_ARRAY_BUFFER, indices.data());
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Triangles generateGeometry() produces, known without generating anything
+    size_t triangleCount() const {
+        if (isErrorBounded()) {
+            switch (shapetype) {
+            case SPHERE_SHAPE: return size_t(20) << (2 * icosphereSubdivisionsForError(maxError));
+            case CONE_SHAPE: return 3 * size_t(circleSegmentsForError(maxError));
+            case BOX_SHAPE: return 12;
+            case CYLINDER_SHAPE: return 4 * size_t(circleSegmentsForError(maxError));
+            default: return indexCount() / 3;
+            }
+        }
+        switch (shapetype) {
+        case SPHERE_SHAPE: return 200 * level * level;
+        case CONE_SHAPE: return 60 * level;
+        case BOX_SHAPE: return 12 * level * level;
+        case CYLINDER_SHAPE: return 80 * level;
+        default: return indexCount() / 3;
+        }
+    }
+
+    // CPU copies plus whatever was uploaded to the GPU
+    size_t geometryBytes() const {
+        size_t cpu = (vertices.capacity() + colors.capacity() + normals.capacity()) * sizeof(glm::vec4)
+            + indices.capacity() * sizeof(unsigned int);
+        return cpu + gpu.bytes();
+    }
+
+    // Copies the compile-time geometry for this type and level, if there is one
+    bool useBakedGeometry() {
+        const baked_mesh_t* baked = findBakedMesh(shapetype, level);
+        if (!baked) return false;
+        vertices.resize(baked->vertexCount);
+        std::memcpy(glm::value_ptr(vertices.front()), baked->positions, baked->vertexCount * sizeof(glm::vec4));
+        indices.assign(baked->indices, baked->indices + baked->indexCount);
+        colors.assign(vertices.size(), glm::vec4(1.0f));
+        normals.clear();
+        return true;
+    }
+
     void changeTesselation(int delta) {
         int newLevel = static_cast<int>(level) + delta;
         if (newLevel < 1) newLevel = 1;
@@ -156,12 +299,21 @@ public:
     }
 
     void generateGeometry() override {
+        if (isErrorBounded()) {
+            // UV grids waste triangles at the poles; an icosphere spreads them evenly
+            generateIcosphere(icosphereSubdivisionsForError(maxError), vertices, normals, indices);
+            colors.assign(vertices.size(), glm::vec4(1.0f));
+        }
+        else if (!useBakedGeometry()) generateProcedural();
+    }
+
+    void generateProcedural() override { generateGrid(10 * level, 10 * level); }
+
+    void generateGrid(unsigned int stacks, unsigned int slices) {
         vertices.clear();
         colors.clear();
         indices.clear();
         normals.clear();
-        unsigned int stacks = 10 * level;
-        unsigned int slices = 10 * level;
 
         for (unsigned int i = 0; i <= stacks; ++i) {
             float phi = glm::pi<float>() * i / stacks;
@@ -201,11 +353,17 @@ public:
     }
 
     void generateGeometry() override {
+        if (isErrorBounded()) generateSlices(circleSegmentsForError(maxError));
+        else if (!useBakedGeometry()) generateProcedural();
+    }
+
+    void generateProcedural() override { generateSlices(20 * level); }
+
+    void generateSlices(unsigned int slices) {
         vertices.clear();
         colors.clear();
         indices.clear();
 
-        unsigned int slices = 20 * level;
         vertices.emplace_back(0, 1, 0, 1); // top
         colors.emplace_back(1, 1, 1, 1);
         // Center of base
@@ -253,12 +411,19 @@ public:
     box_t(unsigned int tesselation_level = 1) : shape_t(tesselation_level) {
         shapetype = BOX_SHAPE;
     }
+    // Flat faces have no error to bound, so error-bounded boxes are one quad per face
     void generateGeometry() override {
+        if (isErrorBounded()) generateFaces(1);
+        else if (!useBakedGeometry()) generateProcedural();
+    }
+
+    void generateProcedural() override { generateFaces(level); }
+
+    void generateFaces(unsigned int n) { // n: tessellation subdivisions per edge
         vertices.clear();
         colors.clear();
         indices.clear();
 
-        unsigned int n = level; // tessellation subdivisions per edge
         if (n < 1) n = 1;
 
         auto addFace = [&](glm::vec4 v0, glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec4 color) {
@@ -323,13 +488,16 @@ public:
     }
 
     void generateGeometry() override {
-        std::cout << "Cylinder generateGeometry() called " << std::endl;
+        if (isErrorBounded()) generateSlices(circleSegmentsForError(maxError));
+        else if (!useBakedGeometry()) generateProcedural();
+    }
+
+    void generateProcedural() override { generateSlices(20 * level); }
+
+    void generateSlices(unsigned int slices) {
         vertices.clear();
         colors.clear();
         indices.clear();
-        unsigned int slices = 20 * level;
-        std::cout << "Tesselation level: " << level << std::endl;
-        std::cout << "Slices: " << slices << std::endl;
 
         // Generate cylindrical surface vertices (unchanged)
         for (unsigned int i = 0; i <= slices; ++i) {
@@ -340,9 +508,6 @@ public:
             colors.emplace_back(1, 1, 1, 1); 
             vertices.emplace_back(x, -1, z, 1); // Bottom vertex (odd index)
             colors.emplace_back(1, 1, 1, 1);
-            if (i % 10 == 0) { // Debug every 10th iteration
-                std::cout << "Iteration " << i << ": Added vertices at (" << x << ", 1, " << z << ") and (" << x << ", -1, " << z << ")" << std::endl;
-            }
         }
 
         // Add center vertices for top and bottom caps
@@ -354,8 +519,6 @@ public:
         vertices.emplace_back(0, -1, 0, 1); // Bottom center
         colors.emplace_back(1, 1, 1, 1); 
 
-        std::cout << "After vertex generation: " << vertices.size() << " vertices" << std::endl;
-
         // Generate cylindrical surface indices 
         for (unsigned int i = 0; i < slices; ++i) {
             unsigned int curr = i * 2; // Current pair start
@@ -368,9 +531,6 @@ public:
             indices.push_back(curr + 1); // Current bottom
             indices.push_back(next + 1); // Next bottom
             indices.push_back(next); // Next top
-            if (i % 10 == 0) { 
-                std::cout << "Triangle pair " << i << ": indices (" << curr << "," << curr + 1 << "," << next << ") and (" << curr + 1 << "," << next + 1 << "," << next << ")" << std::endl;
-            }
         }
 
         // Generate top cap triangles
@@ -392,10 +552,19 @@ public:
             indices.push_back(next);
             indices.push_back(curr);
         }
-
-        std::cout << "After index generation: " << indices.size() << " indices" << std::endl;
-        std::cout << " End generateGeometry() " << std::endl;
     }
 };
 
+// Factory for the procedural primitives, used by load() and the exporters
+inline std::unique_ptr<shape_t> createPrimitive(ShapeType type, unsigned int level) {
+    switch (type) {
+    case SPHERE_SHAPE: return std::make_unique<sphere_t>(level);
+    case CYLINDER_SHAPE: return std::make_unique<cylinder_t>(level);
+    case BOX_SHAPE: return std::make_unique<box_t>(level);
+    case CONE_SHAPE: return std::make_unique<cone_t>(level);
+    case MESH_SHAPE: break; // needs a file, see mesh_t
+    }
+    return nullptr;
+}
+
 #endif // SHAPE_H
@@ -0,0 +1,412 @@
+#include "simplify.h"
+#include "mesh.h"
+#include "tessellation.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <queue>
+#include <unordered_map>
+
+namespace {
+
+// Symmetric 4x4 plane quadric: xx xy xz xw yy yz yw zz zw ww
+struct quadric_t {
+    double q[10] = {};
+
+    void addPlane(double a, double b, double c, double d, double weight) {
+        q[0] += weight * a * a; q[1] += weight * a * b; q[2] += weight * a * c; q[3] += weight * a * d;
+        q[4] += weight * b * b; q[5] += weight * b * c; q[6] += weight * b * d;
+        q[7] += weight * c * c; q[8] += weight * c * d;
+        q[9] += weight * d * d;
+    }
+    quadric_t& operator+=(const quadric_t& o) {
+        for (int i = 0; i < 10; ++i) q[i] += o.q[i];
+        return *this;
+    }
+    // Sum of weighted squared distances from p to the planes
+    double error(const glm::vec3& p) const {
+        double x = p.x, y = p.y, z = p.z;
+        return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+             + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+             + q[7] * z * z + 2 * q[8] * z + q[9];
+    }
+    // Point of least error, if the 3x3 part is well conditioned
+    bool minimum(glm::vec3& p) const {
+        double det = q[0] * (q[4] * q[7] - q[5] * q[5]) - q[1] * (q[1] * q[7] - q[5] * q[2])
+                   + q[2] * (q[1] * q[5] - q[4] * q[2]);
+        if (std::fabs(det) < 1e-12) return false;
+        double bx = -q[3], by = -q[6], bz = -q[8];
+        double x = bx * (q[4] * q[7] - q[5] * q[5]) - q[1] * (by * q[7] - q[5] * bz) + q[2] * (by * q[5] - q[4] * bz);
+        double y = q[0] * (by * q[7] - bz * q[5]) - bx * (q[1] * q[7] - q[5] * q[2]) + q[2] * (q[1] * bz - by * q[2]);
+        double z = q[0] * (q[4] * bz - q[5] * by) - q[1] * (q[1] * bz - by * q[2]) + bx * (q[1] * q[5] - q[4] * q[2]);
+        p = glm::vec3(float(x / det), float(y / det), float(z / det));
+        return true;
+    }
+};
+
+struct collapse_t {
+    double cost;
+    uint32_t keep, drop;
+    uint32_t keepVersion, dropVersion;
+    glm::vec3 position;
+    bool operator>(const collapse_t& o) const { return cost > o.cost; }
+};
+
+// Open edges get a plane through them, perpendicular to their face, so borders hold their shape
+const double BOUNDARY_WEIGHT = 10.0;
+
+class simplifier_t {
+public:
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> source;               // input vertex each welded vertex came from
+    std::vector<uint32_t> triangles;            // 3 per triangle
+    std::vector<uint8_t> triangleRemoved;
+    std::vector<std::vector<uint32_t>> vertexTriangles;
+    std::vector<quadric_t> quadrics;
+    std::vector<uint32_t> version;
+    std::vector<uint8_t> vertexRemoved;
+    std::priority_queue<collapse_t, std::vector<collapse_t>, std::greater<collapse_t>> heap;
+    size_t liveTriangles = 0;
+    double maxCost = 0.0;
+
+    void weld(const geometry_vector_t<glm::vec4>& vertices, const geometry_vector_t<unsigned int>& indices) {
+        struct key_hash_t {
+            size_t operator()(const glm::vec3& p) const {
+                uint32_t b[3];
+                std::memcpy(b, &p.x, 4); std::memcpy(b + 1, &p.y, 4); std::memcpy(b + 2, &p.z, 4);
+                return (size_t(b[0]) * 73856093u) ^ (size_t(b[1]) * 19349663u) ^ (size_t(b[2]) * 83492791u);
+            }
+        };
+        std::unordered_map<glm::vec3, uint32_t, key_hash_t> unique;
+        unique.reserve(vertices.size());
+        std::vector<uint32_t> remap(vertices.size());
+        for (size_t i = 0; i < vertices.size(); ++i) {
+            glm::vec3 p(vertices[i]);
+            auto it = unique.find(p);
+            if (it == unique.end()) {
+                it = unique.emplace(p, uint32_t(positions.size())).first;
+                positions.push_back(p);
+                source.push_back(uint32_t(i));
+            }
+            remap[i] = it->second;
+        }
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+            uint32_t a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+            if (a == b || b == c || c == a) continue;
+            triangles.insert(triangles.end(), { a, b, c });
+        }
+    }
+
+    void buildQuadrics() {
+        size_t n = positions.size(), triCount = triangles.size() / 3;
+        quadrics.assign(n, quadric_t());
+        vertexTriangles.assign(n, {});
+        version.assign(n, 0);
+        vertexRemoved.assign(n, 0);
+        triangleRemoved.assign(triCount, 0);
+        liveTriangles = triCount;
+
+        std::unordered_map<uint64_t, int> edgeUse;
+        edgeUse.reserve(triangles.size());
+        for (size_t t = 0; t < triCount; ++t) {
+            const uint32_t* v = &triangles[t * 3];
+            glm::vec3 normal = glm::cross(positions[v[1]] - positions[v[0]], positions[v[2]] - positions[v[0]]);
+            float length = glm::length(normal);
+            if (length > 0.0f) normal /= length;
+            double d = -double(glm::dot(normal, positions[v[0]]));
+            quadric_t face;
+            face.addPlane(normal.x, normal.y, normal.z, d, 1.0);
+            for (int k = 0; k < 3; ++k) {
+                quadrics[v[k]] += face;
+                vertexTriangles[v[k]].push_back(uint32_t(t));
+                edgeUse[edgeKey(v[k], v[(k + 1) % 3])]++;
+            }
+        }
+        for (size_t t = 0; t < triCount; ++t) {
+            const uint32_t* v = &triangles[t * 3];
+            glm::vec3 normal = glm::normalize(glm::cross(positions[v[1]] - positions[v[0]], positions[v[2]] - positions[v[0]]));
+            for (int k = 0; k < 3; ++k) {
+                uint32_t a = v[k], b = v[(k + 1) % 3];
+                if (edgeUse[edgeKey(a, b)] != 1) continue;
+                glm::vec3 edge = positions[b] - positions[a];
+                glm::vec3 side = glm::cross(edge, normal);
+                float length = glm::length(side);
+                if (length <= 0.0f) continue;
+                side /= length;
+                quadric_t border;
+                border.addPlane(side.x, side.y, side.z, -double(glm::dot(side, positions[a])),
+                    BOUNDARY_WEIGHT * glm::dot(edge, edge));
+                quadrics[a] += border;
+                quadrics[b] += border;
+            }
+        }
+        // One candidate per edge, however many faces share it
+        for (const auto& edge : edgeUse) pushCollapse(uint32_t(edge.first >> 32), uint32_t(edge.first));
+    }
+
+    static uint64_t edgeKey(uint32_t a, uint32_t b) {
+        return (uint64_t(std::min(a, b)) << 32) | std::max(a, b);
+    }
+
+    void pushCollapse(uint32_t keep, uint32_t drop) {
+        quadric_t q = quadrics[keep];
+        q += quadrics[drop];
+        glm::vec3 best;
+        double cost;
+        glm::vec3 mid = (positions[keep] + positions[drop]) * 0.5f;
+        float reach = glm::length(positions[keep] - positions[drop]);
+        // A nearly singular quadric can put its minimum far outside the surface
+        if (q.minimum(best) && glm::length(best - mid) <= reach) {
+            cost = q.error(best);
+        }
+        else {
+            // Flat or degenerate neighbourhood: pick the best of the endpoints and the midpoint
+            const glm::vec3 candidates[3] = { positions[keep], positions[drop], mid };
+            best = candidates[0];
+            cost = q.error(best);
+            for (int i = 1; i < 3; ++i) {
+                double c = q.error(candidates[i]);
+                if (c < cost) { cost = c; best = candidates[i]; }
+            }
+        }
+        heap.push({ std::max(cost, 0.0), keep, drop, version[keep], version[drop], best });
+    }
+
+    // Moving `v` to `p` must not turn any of its faces (other than those that vanish) over
+    bool flips(uint32_t v, uint32_t other, const glm::vec3& p) const {
+        for (uint32_t t : vertexTriangles[v]) {
+            if (triangleRemoved[t]) continue;
+            const uint32_t* tri = &triangles[t * 3];
+            if (tri[0] == other || tri[1] == other || tri[2] == other) continue;
+            glm::vec3 corners[3] = { positions[tri[0]], positions[tri[1]], positions[tri[2]] };
+            glm::vec3 before = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+            for (int k = 0; k < 3; ++k)
+                if (tri[k] == v) corners[k] = p;
+            glm::vec3 after = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+            if (glm::dot(before, after) <= 0.0f) return true;
+        }
+        return false;
+    }
+
+    void run(size_t targetTriangles) {
+        std::vector<uint32_t> neighbours;
+        while (liveTriangles > targetTriangles && !heap.empty()) {
+            collapse_t c = heap.top();
+            heap.pop();
+            if (vertexRemoved[c.keep] || vertexRemoved[c.drop]) continue;
+            if (version[c.keep] != c.keepVersion || version[c.drop] != c.dropVersion) continue;
+            if (flips(c.keep, c.drop, c.position) || flips(c.drop, c.keep, c.position)) continue;
+
+            maxCost = std::max(maxCost, c.cost);
+            positions[c.keep] = c.position;
+            quadrics[c.keep] += quadrics[c.drop];
+            vertexRemoved[c.drop] = 1;
+            ++version[c.keep];
+            ++version[c.drop];
+
+            std::vector<uint32_t>& kept = vertexTriangles[c.keep];
+            for (uint32_t t : vertexTriangles[c.drop]) {
+                if (triangleRemoved[t]) continue;
+                uint32_t* tri = &triangles[t * 3];
+                if (tri[0] == c.keep || tri[1] == c.keep || tri[2] == c.keep) {
+                    triangleRemoved[t] = 1;
+                    --liveTriangles;
+                    continue;
+                }
+                for (int k = 0; k < 3; ++k)
+                    if (tri[k] == c.drop) tri[k] = c.keep;
+                kept.push_back(t);
+            }
+            std::vector<uint32_t>().swap(vertexTriangles[c.drop]);
+            kept.erase(std::remove_if(kept.begin(), kept.end(), [&](uint32_t t) { return triangleRemoved[t] != 0; }), kept.end());
+
+            neighbours.clear();
+            for (uint32_t t : kept)
+                for (int k = 0; k < 3; ++k)
+                    if (triangles[t * 3 + k] != c.keep) neighbours.push_back(triangles[t * 3 + k]);
+            std::sort(neighbours.begin(), neighbours.end());
+            neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+            for (uint32_t n : neighbours) pushCollapse(c.keep, n);
+        }
+    }
+};
+
+} // namespace
+
+float simplifyMesh(const geometry_vector_t<glm::vec4>& vertices, const geometry_vector_t<glm::vec4>& colors,
+    const geometry_vector_t<glm::vec4>& normals, const geometry_vector_t<unsigned int>& indices,
+    size_t targetTriangles, lod_mesh_t& out) {
+    simplifier_t s;
+    s.weld(vertices, indices);
+    s.buildQuadrics();
+    s.run(targetTriangles);
+
+    glm::vec4 fallback = colors.empty() ? glm::vec4(1.0f) : colors[0];
+    std::vector<uint32_t> remap(s.positions.size(), UINT32_MAX);
+    out.vertices.clear();
+    out.colors.clear();
+    out.normals.clear();
+    out.indices.clear();
+    out.indices.reserve(s.liveTriangles * 3);
+    for (size_t t = 0; t < s.triangleRemoved.size(); ++t) {
+        if (s.triangleRemoved[t]) continue;
+        for (int k = 0; k < 3; ++k) {
+            uint32_t v = s.triangles[t * 3 + k];
+            if (remap[v] == UINT32_MAX) {
+                remap[v] = uint32_t(out.vertices.size());
+                uint32_t from = s.source[v];
+                out.vertices.push_back(glm::vec4(s.positions[v], 1.0f));
+                out.colors.push_back(colors.size() == vertices.size() ? colors[from] : fallback);
+                if (normals.size() == vertices.size()) out.normals.push_back(normals[from]);
+            }
+            out.indices.push_back(remap[v]);
+        }
+    }
+    return float(std::sqrt(s.maxCost));
+}
+
+std::shared_ptr<lod_chain_t> buildLodChain(shape_t& shape, unsigned int maxLevels, size_t minTriangles) {
+    auto start = std::chrono::steady_clock::now();
+    shape.ensureGeometry();
+    auto chain = std::make_shared<lod_chain_t>();
+    chain->sourceTriangles = shape.indices.size() / 3;
+    if (!shape.vertices.empty()) {
+        glm::vec3 lo(shape.vertices[0]), hi = lo;
+        for (const auto& v : shape.vertices) {
+            lo = glm::min(lo, glm::vec3(v));
+            hi = glm::max(hi, glm::vec3(v));
+        }
+        chain->center = (lo + hi) * 0.5f;
+        chain->radius = glm::length(hi - lo) * 0.5f;
+    }
+
+    const shape_t* previous = &shape;
+    float error = 0.0f;
+    size_t triangles = chain->sourceTriangles;
+    while (chain->levels.size() < maxLevels && triangles / 2 >= minTriangles) {
+        auto level = std::make_unique<lod_mesh_t>();
+        error += simplifyMesh(previous->vertices, previous->colors, previous->normals, previous->indices,
+            triangles / 2, *level);
+        size_t reduced = level->indices.size() / 3;
+        // Stuck (flips everywhere): further levels would not get any cheaper
+        if (reduced == 0 || reduced > triangles * 9 / 10) break;
+        level->error = error;
+        triangles = reduced;
+        previous = level.get();
+        chain->levels.push_back(std::move(level));
+    }
+    chain->buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return chain;
+}
+
+void buildLodChains(const std::vector<shape_t*>& shapes, thread_pool_t* pool) {
+    std::vector<shape_t*> work;
+    for (shape_t* shape : shapes) {
+        if (!shape || shape->lods) continue;
+        // Geometry first, on this thread: mesh loading has its own worker threads
+        shape->ensureGeometry();
+        if (shape->indices.size() / 3 >= LOD_MIN_TRIANGLES) work.push_back(shape);
+    }
+    if (work.empty()) return;
+
+    auto build = [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) work[i]->lods = buildLodChain(*work[i]);
+    };
+    if (pool) pool->parallelFor(work.size(), 1, build);
+    else build(0, work.size());
+}
+
+shape_t& selectLod(shape_t& shape, float distance, float worldScale, float pixelsPerUnit, float maxPixelError) {
+    if (!shape.lods) return shape;
+    float scale = worldScale * pixelsPerUnit / std::max(distance, 1e-3f);
+    shape_t* chosen = &shape;
+    for (const auto& level : shape.lods->levels) {
+        if (level->error * scale > maxPixelError) break;
+        chosen = level.get();
+    }
+    return *chosen;
+}
+
+void benchmarkSimplification(const std::string& filename) {
+    std::unique_ptr<shape_t> source;
+    if (filename.empty()) {
+        auto sphere = std::make_unique<lod_mesh_t>();
+        generateIcosphere(7, sphere->vertices, sphere->normals, sphere->indices);
+        sphere->colors.assign(sphere->vertices.size(), glm::vec4(1.0f));
+        source = std::move(sphere);
+        std::cout << "Simplifying an icosphere (7 subdivisions)" << std::endl;
+    }
+    else {
+        auto mesh = std::make_unique<mesh_t>(filename);
+        mesh->generateGeometry();
+        if (!mesh->isLoaded()) return;
+        source = std::move(mesh);
+        std::cout << "Simplifying " << filename << std::endl;
+    }
+
+    const shape_t* previous = source.get();
+    size_t triangles = source->indices.size() / 3;
+    float error = 0.0f;
+    glm::vec3 lo(1e30f), hi(-1e30f);
+    for (const auto& v : source->vertices) {
+        lo = glm::min(lo, glm::vec3(v));
+        hi = glm::max(hi, glm::vec3(v));
+    }
+    float radius = std::max(glm::length(hi - lo) * 0.5f, 1e-6f);
+    std::cout << "  source: " << triangles << " triangles, " << source->vertices.size() << " vertices" << std::endl;
+    std::vector<std::unique_ptr<lod_mesh_t>> levels;
+    for (int l = 1; l <= 6 && triangles >= 512; ++l) {
+        auto level = std::make_unique<lod_mesh_t>();
+        auto start = std::chrono::steady_clock::now();
+        error += simplifyMesh(previous->vertices, previous->colors, previous->normals, previous->indices,
+            triangles / 2, *level);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "  LOD " << l << ": " << level->indices.size() / 3 << " triangles, "
+                  << level->vertices.size() << " vertices, error " << error << " ("
+                  << error / radius << " of radius), "
+                  << seconds * 1000.0 << " ms, " << triangles / seconds / 1.0e6 << " Mtri/s in";
+        // The icosphere's true surface is known, so the bound can be checked
+        if (filename.empty()) std::cout << ", measured " << measureSphereError(level->vertices, level->indices);
+        std::cout << std::endl;
+        triangles = level->indices.size() / 3;
+        previous = level.get();
+        levels.push_back(std::move(level));
+    }
+
+    // Whole chains for several copies of the second level at once, one copy per task
+    if (levels.size() < 2) return;
+    const shape_t& copied = *levels[1];
+    const size_t copies = 8;
+    std::vector<std::unique_ptr<lod_mesh_t>> meshes;
+    std::vector<shape_t*> shapes;
+    for (size_t i = 0; i < copies; ++i) {
+        auto copy = std::make_unique<lod_mesh_t>();
+        copy->vertices = copied.vertices;
+        copy->colors = copied.colors;
+        copy->normals = copied.normals;
+        copy->indices = copied.indices;
+        shapes.push_back(copy.get());
+        meshes.push_back(std::move(copy));
+    }
+    for (int parallel = 0; parallel < 2; ++parallel) {
+        for (shape_t* s : shapes) s->lods.reset();
+        auto start = std::chrono::steady_clock::now();
+        buildLodChains(shapes, parallel ? &sharedThreadPool() : nullptr);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        // Every level is simplified from the one before it
+        size_t in = 0;
+        for (shape_t* s : shapes) {
+            size_t previousTriangles = s->indices.size() / 3;
+            for (const auto& level : s->lods->levels) {
+                in += previousTriangles;
+                previousTriangles = level->indices.size() / 3;
+            }
+        }
+        std::cout << "  " << copies << " chains, " << (parallel ? sharedThreadPool().getThreadCount() : 1)
+                  << " thread(s): " << seconds * 1000.0 << " ms, " << in / seconds / 1.0e6 << " Mtri/s" << std::endl;
+    }
+}
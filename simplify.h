@@ -0,0 +1,57 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+#include "shape.h"
+
+class thread_pool_t;
+
+// One reduced copy of a shape's geometry. Like static_batch_t it is its own data,
+// so there is nothing to regenerate.
+class lod_mesh_t : public shape_t {
+public:
+    float error = 0.0f;  // object-space distance from the original surface, upper bound
+
+    lod_mesh_t() : shape_t(1) { shapetype = MESH_SHAPE; }
+    void generateGeometry() override {}
+};
+
+// Reduced levels of detail for one shape, finest first. Built by buildLodChain() and kept on
+// the shape (shape_t::lods) so the renderer can draw a coarser level the further away it is.
+struct lod_chain_t {
+    std::vector<std::unique_ptr<lod_mesh_t>> levels;
+    glm::vec3 center{ 0.0f };   // object-space bounding sphere of the original
+    float radius = 0.0f;
+    size_t sourceTriangles = 0;
+    double buildMs = 0.0;
+};
+
+// Garland-Heckbert quadric error simplification: collapses the cheapest edge (by summed
+// squared distance to the planes of the faces around it) until at most targetTriangles are
+// left, rejecting collapses that would flip a face. Vertices at the same position are welded
+// first so seams do not open. Colors and normals follow the vertex that is kept.
+// Returns an upper bound on the distance of the result from the input.
+float simplifyMesh(const geometry_vector_t<glm::vec4>& vertices, const geometry_vector_t<glm::vec4>& colors,
+    const geometry_vector_t<glm::vec4>& normals, const geometry_vector_t<unsigned int>& indices,
+    size_t targetTriangles, lod_mesh_t& out);
+
+// Halves the triangle count level by level, each level simplified from the one before, until
+// fewer than minTriangles would remain or maxLevels levels exist
+std::shared_ptr<lod_chain_t> buildLodChain(shape_t& shape, unsigned int maxLevels = 4, size_t minTriangles = 256);
+
+// Shapes of at least LOD_MIN_TRIANGLES triangles without a chain get one, one shape per task on `pool`
+const size_t LOD_MIN_TRIANGLES = 2048;
+void buildLodChains(const std::vector<shape_t*>& shapes, thread_pool_t* pool);
+
+// Coarsest level of `shape` whose error, seen `distance` away through a projection with
+// `pixelsPerUnit` pixels per world unit at distance 1, stays under maxPixelError
+shape_t& selectLod(shape_t& shape, float distance, float worldScale, float pixelsPerUnit, float maxPixelError);
+
+// Simplifies the mesh in `filename` (or an icosphere when empty) into a LOD chain and prints
+// triangles, error and triangles/s per level
+void benchmarkSimplification(const std::string& filename);
+
+#endif
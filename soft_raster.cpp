@@ -0,0 +1,346 @@
+#include "soft_raster.h"
+#include "shape.h"
+#include "globals.h"
+#include "image.h"
+#include "HIERARCHIAL.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define SOFT_RASTER_SSE 1
+#endif
+
+void transformPoints(const glm::mat4& m, const glm::vec4* in, glm::vec4* out, size_t n) {
+#ifdef SOFT_RASTER_SSE
+    // glm is column major: out = c0*x + c1*y + c2*z + c3*w
+    const __m128 c0 = _mm_loadu_ps(&m[0][0]);
+    const __m128 c1 = _mm_loadu_ps(&m[1][0]);
+    const __m128 c2 = _mm_loadu_ps(&m[2][0]);
+    const __m128 c3 = _mm_loadu_ps(&m[3][0]);
+    for (size_t i = 0; i < n; ++i) {
+        __m128 r = _mm_mul_ps(c0, _mm_set1_ps(in[i].x));
+        r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(in[i].y)));
+        r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(in[i].z)));
+        r = _mm_add_ps(r, _mm_mul_ps(c3, _mm_set1_ps(in[i].w)));
+        _mm_storeu_ps(&out[i].x, r);
+    }
+#else
+    for (size_t i = 0; i < n; ++i) out[i] = m * in[i];
+#endif
+}
+
+// Runs fn(worker) on `count` threads, the calling thread acting as worker 0
+static void runWorkers(unsigned int count, const std::function<void(unsigned int)>& fn) {
+    std::vector<std::thread> threads;
+    for (unsigned int w = 1; w < count; ++w) threads.emplace_back(fn, w);
+    fn(0);
+    for (auto& t : threads) t.join();
+}
+
+static uint32_t packColor(const glm::vec4& c) {
+    auto channel = [](float v) { return uint32_t(std::min(std::max(v, 0.0f), 1.0f) * 255.0f + 0.5f); };
+    return channel(c.r) | (channel(c.g) << 8) | (channel(c.b) << 16) | (channel(c.a) << 24);
+}
+
+software_backend_t::software_backend_t(int w, int h, unsigned int workers)
+    : width(w), height(h) {
+    workerCount = workers ? workers : std::max(1u, std::thread::hardware_concurrency());
+    tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    colorBuffer.assign(size_t(width) * height, 0);
+    depthBuffer.assign(size_t(width) * height, 1.0f);
+    bins.assign(workerCount, std::vector<std::vector<uint32_t>>(tilesX * tilesY));
+}
+
+void software_backend_t::beginFrame(const glm::vec4& clearColor) {
+    frameStart = std::chrono::steady_clock::now();
+    renderStats.reset();
+    clear = clearColor;
+    triangles.clear();
+}
+
+void software_backend_t::setCamera(const glm::mat4& viewMatrix, const glm::mat4&, const std::vector<light_t>& lights) {
+    viewPos = glm::vec3(glm::inverse(viewMatrix)[3]);
+    pointLights = lights;
+    renderStats.lights = pointLights.size();
+}
+
+void software_backend_t::drawShape(shape_t& shape, const glm::mat4& model, const glm::mat4& MVP) {
+    shape.ensureGeometry();
+    size_t n = shape.vertices.size();
+    if (n == 0) return;
+
+    clipScratch.resize(n);
+    litScratch.resize(n);
+    transformPoints(MVP, shape.vertices.data(), clipScratch.data(), n);
+
+    // Same Gouraud model as the GL vertex shader
+    if (lightingEnabled) {
+        worldScratch.resize(n);
+        normalScratch.resize(n);
+        transformPoints(model, shape.vertices.data(), worldScratch.data(), n);
+        glm::mat4 normalMatrix = glm::mat4(glm::mat3(glm::transpose(glm::inverse(model))));
+        if (shape.normals.size() == n) {
+            transformPoints(normalMatrix, shape.normals.data(), normalScratch.data(), n);
+        }
+        else {
+            glm::vec4 up = normalMatrix * glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
+            std::fill(normalScratch.begin(), normalScratch.end(), up);
+        }
+        glm::vec3 ambient = ambientStrength * lightColor;
+        for (size_t i = 0; i < n; ++i) {
+            glm::vec4 base = i < shape.colors.size() ? shape.colors[i]
+                : (shape.colors.empty() ? glm::vec4(1.0f) : shape.colors[0]);
+            glm::vec3 fragPos(worldScratch[i]);
+            glm::vec3 normal = glm::normalize(glm::vec3(normalScratch[i]));
+            glm::vec3 lightDir = glm::normalize(lightPosition - fragPos);
+            float diff = std::max(glm::dot(normal, lightDir), 0.0f);
+            glm::vec3 diffuse = diffuseStrength * diff * lightColor;
+            glm::vec3 viewDir = glm::normalize(viewPos - fragPos);
+            glm::vec3 reflectDir = glm::reflect(-lightDir, normal);
+            float spec = std::pow(std::max(glm::dot(viewDir, reflectDir), 0.0f), shininess);
+            glm::vec3 specular = specularStrength * spec * lightColor;
+            // Point lights: every light per vertex, where the GL backend goes per fragment by cluster
+            glm::vec3 point(0.0f);
+            for (const light_t& light : pointLights) {
+                glm::vec3 toLight = light.position - fragPos;
+                float d = glm::length(toLight);
+                if (d >= light.radius) continue;
+                glm::vec3 dir = toLight / std::max(d, 1e-4f);
+                float pointDiff = std::max(glm::dot(normal, dir), 0.0f);
+                float pointSpec = std::pow(std::max(glm::dot(viewDir, glm::reflect(-dir, normal)), 0.0f), shininess);
+                point += lightFalloff(d, light.radius) * (diffuseStrength * pointDiff + specularStrength * pointSpec) * light.color;
+            }
+            litScratch[i] = glm::vec4((ambient + diffuse + specular + point) * glm::vec3(base), base.a);
+        }
+    }
+    else {
+        for (size_t i = 0; i < n; ++i) {
+            litScratch[i] = i < shape.colors.size() ? shape.colors[i]
+                : (shape.colors.empty() ? glm::vec4(1.0f) : shape.colors[0]);
+        }
+    }
+
+    const auto& idx = shape.indices;
+    for (size_t i = 0; i + 2 < idx.size(); i += 3) {
+        if (idx[i] >= n || idx[i + 1] >= n || idx[i + 2] >= n) continue;
+        clipAndQueue({ clipScratch[idx[i]], litScratch[idx[i]] },
+            { clipScratch[idx[i + 1]], litScratch[idx[i + 1]] },
+            { clipScratch[idx[i + 2]], litScratch[idx[i + 2]] });
+    }
+    renderStats.drawCalls++;
+}
+
+// Clips against the near plane (z >= -w) so every queued vertex has w > 0
+void software_backend_t::clipAndQueue(const sw_vertex_t& a, const sw_vertex_t& b, const sw_vertex_t& c) {
+    const sw_vertex_t* in[3] = { &a, &b, &c };
+    float d[3];
+    int inside = 0;
+    for (int i = 0; i < 3; ++i) {
+        d[i] = in[i]->clip.z + in[i]->clip.w;
+        if (d[i] >= 0.0f) ++inside;
+    }
+    if (inside == 3) {
+        triangles.push_back({ { a, b, c } });
+        return;
+    }
+    if (inside == 0) return;
+
+    sw_vertex_t poly[4];
+    int count = 0;
+    for (int i = 0; i < 3; ++i) {
+        int j = (i + 1) % 3;
+        if (d[i] >= 0.0f) poly[count++] = *in[i];
+        if ((d[i] >= 0.0f) != (d[j] >= 0.0f)) {
+            float t = d[i] / (d[i] - d[j]);
+            poly[count].clip = glm::mix(in[i]->clip, in[j]->clip, t);
+            poly[count].color = glm::mix(in[i]->color, in[j]->color, t);
+            ++count;
+        }
+    }
+    for (int i = 1; i + 1 < count; ++i) {
+        triangles.push_back({ { poly[0], poly[i], poly[i + 1] } });
+    }
+}
+
+void software_backend_t::setupAndBin(size_t first, size_t last, std::vector<std::vector<uint32_t>>& workerBins) {
+    for (auto& bin : workerBins) bin.clear();
+
+    for (size_t i = first; i < last; ++i) {
+        const sw_triangle_t& tri = triangles[i];
+        setup_t& s = setups[i];
+        float minPX = 1e30f, minPY = 1e30f, maxPX = -1e30f, maxPY = -1e30f, minZ = 1e30f;
+        for (int k = 0; k < 3; ++k) {
+            const glm::vec4& clip = tri.v[k].clip;
+            float invW = 1.0f / std::max(clip.w, 1e-6f);
+            s.invW[k] = invW;
+            s.p[k] = glm::vec3((clip.x * invW * 0.5f + 0.5f) * width,
+                (0.5f - clip.y * invW * 0.5f) * height,
+                clip.z * invW * 0.5f + 0.5f);
+            s.color[k] = tri.v[k].color;
+            minPX = std::min(minPX, s.p[k].x); maxPX = std::max(maxPX, s.p[k].x);
+            minPY = std::min(minPY, s.p[k].y); maxPY = std::max(maxPY, s.p[k].y);
+            minZ = std::min(minZ, s.p[k].z);
+        }
+        if (minZ > 1.0f) continue; // entirely beyond the far plane
+
+        s.minX = std::max(0, int(std::floor(minPX)));
+        s.minY = std::max(0, int(std::floor(minPY)));
+        s.maxX = std::min(width - 1, int(std::ceil(maxPX)));
+        s.maxY = std::min(height - 1, int(std::ceil(maxPY)));
+        if (s.minX > s.maxX || s.minY > s.maxY) continue;
+
+        for (int ty = s.minY / TILE_SIZE; ty <= s.maxY / TILE_SIZE; ++ty)
+            for (int tx = s.minX / TILE_SIZE; tx <= s.maxX / TILE_SIZE; ++tx)
+                workerBins[ty * tilesX + tx].push_back(uint32_t(i));
+    }
+}
+
+void software_backend_t::writePixel(int x, int y, float z, const glm::vec4& color) {
+    if (z < 0.0f || z > 1.0f) return;
+    size_t p = size_t(y) * width + x;
+    if (z < depthBuffer[p]) {
+        depthBuffer[p] = z;
+        colorBuffer[p] = packColor(color);
+    }
+}
+
+void software_backend_t::fillTriangle(const setup_t& t, int x0, int y0, int x1, int y1) {
+    // Edge function E_ab(p) = (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x)
+    const glm::vec3* p = t.p;
+    float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[1].y - p[0].y) * (p[2].x - p[0].x);
+    if (std::fabs(area) < 1e-12f) return;
+    float sign = area > 0.0f ? 1.0f : -1.0f;
+    float invArea = 1.0f / std::fabs(area);
+
+    // Per-edge coefficients, edge k is opposite vertex k
+    float A[3], B[3], C[3];
+    for (int k = 0; k < 3; ++k) {
+        const glm::vec3& a = p[(k + 1) % 3];
+        const glm::vec3& b = p[(k + 2) % 3];
+        A[k] = -(b.y - a.y) * sign;
+        B[k] = (b.x - a.x) * sign;
+        C[k] = ((b.y - a.y) * a.x - (b.x - a.x) * a.y) * sign;
+    }
+
+    for (int y = y0; y <= y1; ++y) {
+        float py = y + 0.5f;
+        float px = x0 + 0.5f;
+        float e[3];
+        for (int k = 0; k < 3; ++k) e[k] = A[k] * px + B[k] * py + C[k];
+        for (int x = x0; x <= x1; ++x) {
+            if (e[0] >= 0.0f && e[1] >= 0.0f && e[2] >= 0.0f) {
+                float b0 = e[0] * invArea, b1 = e[1] * invArea, b2 = e[2] * invArea;
+                float z = b0 * p[0].z + b1 * p[1].z + b2 * p[2].z;
+                // Perspective-correct color
+                float q0 = b0 * t.invW[0], q1 = b1 * t.invW[1], q2 = b2 * t.invW[2];
+                float inv = 1.0f / (q0 + q1 + q2);
+                writePixel(x, y, z, (q0 * t.color[0] + q1 * t.color[1] + q2 * t.color[2]) * inv);
+            }
+            e[0] += A[0]; e[1] += A[1]; e[2] += A[2];
+        }
+    }
+}
+
+void software_backend_t::drawEdges(const setup_t& t, int x0, int y0, int x1, int y1) {
+    for (int k = 0; k < 3; ++k) {
+        int j = (k + 1) % 3;
+        const glm::vec3& a = t.p[k];
+        const glm::vec3& b = t.p[j];
+        float dx = b.x - a.x, dy = b.y - a.y;
+        int steps = std::max(1, int(std::ceil(std::max(std::fabs(dx), std::fabs(dy)))));
+        for (int s = 0; s <= steps; ++s) {
+            float f = float(s) / steps;
+            int x = int(std::floor(a.x + dx * f));
+            int y = int(std::floor(a.y + dy * f));
+            if (x < x0 || x > x1 || y < y0 || y > y1) continue;
+            float qa = (1.0f - f) * t.invW[k], qb = f * t.invW[j];
+            glm::vec4 color = (qa * t.color[k] + qb * t.color[j]) / (qa + qb);
+            writePixel(x, y, a.z + (b.z - a.z) * f, color);
+        }
+    }
+}
+
+void software_backend_t::rasterizeTile(int tile) {
+    int tx = tile % tilesX, ty = tile / tilesX;
+    int x0 = tx * TILE_SIZE, y0 = ty * TILE_SIZE;
+    int x1 = std::min(x0 + TILE_SIZE, width) - 1;
+    int y1 = std::min(y0 + TILE_SIZE, height) - 1;
+
+    uint32_t clearPacked = packColor(clear);
+    for (int y = y0; y <= y1; ++y) {
+        std::fill(colorBuffer.begin() + size_t(y) * width + x0, colorBuffer.begin() + size_t(y) * width + x1 + 1, clearPacked);
+        std::fill(depthBuffer.begin() + size_t(y) * width + x0, depthBuffer.begin() + size_t(y) * width + x1 + 1, 1.0f);
+    }
+
+    // Worker bins cover consecutive triangle ranges, so this keeps submission order
+    for (const auto& workerBins : bins) {
+        for (uint32_t i : workerBins[tile]) {
+            const setup_t& s = setups[i];
+            int bx0 = std::max(x0, s.minX), by0 = std::max(y0, s.minY);
+            int bx1 = std::min(x1, s.maxX), by1 = std::min(y1, s.maxY);
+            if (Wireframe) drawEdges(s, bx0, by0, bx1, by1);
+            else fillTriangle(s, bx0, by0, bx1, by1);
+        }
+    }
+}
+
+void software_backend_t::endFrame() {
+    setups.resize(triangles.size());
+    size_t perWorker = (triangles.size() + workerCount - 1) / workerCount;
+    runWorkers(workerCount, [&](unsigned int w) {
+        size_t first = std::min(triangles.size(), w * perWorker);
+        size_t last = std::min(triangles.size(), first + perWorker);
+        setupAndBin(first, last, bins[w]);
+    });
+
+    std::atomic<int> nextTile{ 0 };
+    int tileCount = tilesX * tilesY;
+    runWorkers(workerCount, [&](unsigned int) {
+        for (int tile = nextTile++; tile < tileCount; tile = nextTile++) rasterizeTile(tile);
+    });
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - frameStart).count();
+    renderStats.triangles = triangles.size();
+    renderStats.frameMs = seconds * 1000.0;
+    renderStats.trianglesPerSecond = seconds > 0.0 ? triangles.size() / seconds : 0.0;
+}
+
+bool software_backend_t::saveFrame(const std::string& filename) {
+    image_t img(width, height);
+    for (size_t p = 0; p < colorBuffer.size(); ++p) {
+        img.rgb[p * 3 + 0] = uint8_t(colorBuffer[p] & 0xff);
+        img.rgb[p * 3 + 1] = uint8_t((colorBuffer[p] >> 8) & 0xff);
+        img.rgb[p * 3 + 2] = uint8_t((colorBuffer[p] >> 16) & 0xff);
+    }
+    return writePPM(filename, img);
+}
+
+void benchmarkSoftwareRaster(unsigned int maxWorkers, int frames) {
+    if (maxWorkers == 0) maxWorkers = std::max(1u, std::thread::hardware_concurrency());
+    std::unique_ptr<render_backend_t> previous = std::move(renderBackend);
+
+    std::cout << "Software rasterizer benchmark (" << frames << " frames per run)" << std::endl;
+    for (unsigned int workers = 1; workers <= maxWorkers; workers *= 2) {
+        renderBackend = std::make_unique<software_backend_t>(800, 600, workers);
+        double triangles = 0.0, seconds = 0.0;
+        for (int f = 0; f < frames; ++f) {
+            renderBackend->beginFrame(glm::vec4(0.2f, 0.3f, 0.3f, 1.0f));
+            renderScene();
+            renderBackend->endFrame();
+            triangles += double(renderStats.triangles);
+            seconds += renderStats.frameMs / 1000.0;
+        }
+        std::cout << "  workers " << workers << ": "
+                  << (seconds > 0.0 ? triangles / seconds / 1.0e6 : 0.0) << " Mtri/s, "
+                  << seconds * 1000.0 / frames << " ms/frame" << std::endl;
+    }
+    renderBackend = std::move(previous);
+}
@@ -0,0 +1,81 @@
+#ifndef SOFT_RASTER_H
+#define SOFT_RASTER_H
+
+#include <glm/glm.hpp>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "renderer.h"
+#include "clustered_lights.h"
+
+// Vertex after the transform/lighting stage, still in clip space
+struct sw_vertex_t {
+    glm::vec4 clip;
+    glm::vec4 color;
+};
+
+struct sw_triangle_t {
+    sw_vertex_t v[3];
+};
+
+// CPU backend for machines without GL.
+// drawShape() transforms and lights vertices (SSE when available) and queues triangles,
+// endFrame() bins them into TILE_SIZE tiles and rasterizes the tiles on `workers` threads.
+class software_backend_t : public render_backend_t {
+public:
+    static const int TILE_SIZE = 32;
+
+    software_backend_t(int w, int h, unsigned int workers = 0);
+
+    const char* name() const override { return "Software"; }
+    void beginFrame(const glm::vec4& clearColor) override;
+    void setCamera(const glm::mat4& view, const glm::mat4& projection, const std::vector<light_t>& lights) override;
+    void drawShape(shape_t& shape, const glm::mat4& model, const glm::mat4& MVP) override;
+    void endFrame() override;
+    bool saveFrame(const std::string& filename) override;
+
+    unsigned int getWorkerCount() const { return workerCount; }
+
+private:
+    // Screen-space triangle ready for rasterization
+    struct setup_t {
+        glm::vec3 p[3];      // x, y in pixels, z in [0,1]
+        float invW[3];
+        glm::vec4 color[3];
+        int minX, minY, maxX, maxY;
+    };
+
+    int width, height;
+    int tilesX, tilesY;
+    unsigned int workerCount;
+    glm::vec4 clear{ 0.0f };
+    glm::vec3 viewPos{ 0.0f };
+    std::vector<light_t> pointLights;  // the frame's lights, copied in setCamera()
+    std::chrono::steady_clock::time_point frameStart;
+
+    // Per-draw scratch, kept to avoid reallocating every shape
+    std::vector<glm::vec4> clipScratch, worldScratch, normalScratch, litScratch;
+
+    std::vector<sw_triangle_t> triangles;
+    std::vector<setup_t> setups;
+    std::vector<uint32_t> colorBuffer; // packed RGBA8
+    std::vector<float> depthBuffer;
+    // bins[worker][tile] = indices into setups, in submission order
+    std::vector<std::vector<std::vector<uint32_t>>> bins;
+
+    void clipAndQueue(const sw_vertex_t& a, const sw_vertex_t& b, const sw_vertex_t& c);
+    void setupAndBin(size_t first, size_t last, std::vector<std::vector<uint32_t>>& workerBins);
+    void rasterizeTile(int tile);
+    void fillTriangle(const setup_t& t, int x0, int y0, int x1, int y1);
+    void drawEdges(const setup_t& t, int x0, int y0, int x1, int y1);
+    void writePixel(int x, int y, float z, const glm::vec4& color);
+};
+
+// Transforms n points by m; uses SSE when compiled for it
+void transformPoints(const glm::mat4& m, const glm::vec4* in, glm::vec4* out, size_t n);
+
+// Renders the current scene repeatedly with 1, 2, 4, ... maxWorkers threads and prints triangles/s
+void benchmarkSoftwareRaster(unsigned int maxWorkers, int frames);
+
+#endif
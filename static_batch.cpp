@@ -0,0 +1,116 @@
+#include "static_batch.h"
+#include "HIERARCHIAL.h"
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+// Appends one shape, transformed by `local` (the path from the frozen node down to it)
+void appendShape(static_batch_t& batch, shape_t& shape, const glm::mat4& local) {
+    shape.ensureGeometry();
+    size_t n = shape.vertices.size();
+    if (n == 0) return;
+
+    // Normals are left unnormalized: the shaders normalize after applying the frozen node's
+    // normal matrix, which then gives the same result as drawing the shape on its own
+    glm::mat4 normalMatrix = glm::mat4(glm::mat3(glm::transpose(glm::inverse(local))));
+    glm::vec4 fallbackColor = shape.colors.empty() ? glm::vec4(1.0f) : shape.colors[0];
+    unsigned int base = static_cast<unsigned int>(batch.vertices.size());
+    for (size_t i = 0; i < n; ++i) {
+        batch.vertices.push_back(local * shape.vertices[i]);
+        glm::vec4 normal = shape.normals.size() == n ? shape.normals[i] : glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
+        normal.w = 0.0f;
+        batch.normals.push_back(normalMatrix * normal);
+        batch.colors.push_back(i < shape.colors.size() ? shape.colors[i] : fallbackColor);
+    }
+    for (unsigned int index : shape.indices) batch.indices.push_back(base + index);
+}
+
+void bakeNode(static_batch_t& batch, model_node_t& node, const glm::mat4& local,
+    const std::unordered_set<int>& dynamicIds) {
+    if (node.shape) {
+        appendShape(batch, *node.shape, local);
+        batch.nodeIds.push_back(node.id);
+    }
+    for (const auto& child : node.children) {
+        if (dynamicIds.count(child->id)) continue;
+        bakeNode(batch, *child, local * child->getTransform(), dynamicIds);
+    }
+}
+
+} // namespace
+
+void static_batch_t::updateBounds() {
+    boundsMin = glm::vec3(0.0f);
+    boundsMax = glm::vec3(0.0f);
+    if (vertices.empty()) return;
+    boundsMin = boundsMax = glm::vec3(vertices[0]);
+    for (const glm::vec4& v : vertices) {
+        boundsMin = glm::min(boundsMin, glm::vec3(v));
+        boundsMax = glm::max(boundsMax, glm::vec3(v));
+    }
+}
+
+std::shared_ptr<static_batch_t> bakeSubtree(model_node_t& root, const std::unordered_set<int>& dynamicIds) {
+    auto batch = std::make_shared<static_batch_t>();
+    bakeNode(*batch, root, glm::mat4(1.0f), dynamicIds);
+    if (batch->indices.empty()) return nullptr;
+    batch->updateBounds();
+    return batch;
+}
+
+void saveBatch(std::ostream& out, int nodeId, const static_batch_t& batch) {
+    out << "BATCH " << nodeId << " " << batch.vertices.size() << " " << batch.indices.size() << "\n";
+    out << "BATCH_NODES";
+    for (int id : batch.nodeIds) out << " " << id;
+    out << "\n";
+    for (size_t i = 0; i < batch.vertices.size(); ++i) {
+        const glm::vec4& p = batch.vertices[i];
+        const glm::vec4& n = batch.normals[i];
+        const glm::vec4& c = batch.colors[i];
+        out << "BV " << p.x << " " << p.y << " " << p.z << " " << n.x << " " << n.y << " " << n.z
+            << " " << c.r << " " << c.g << " " << c.b << " " << c.a << "\n";
+    }
+    for (size_t i = 0; i + 2 < batch.indices.size(); i += 3)
+        out << "BI " << batch.indices[i] << " " << batch.indices[i + 1] << " " << batch.indices[i + 2] << "\n";
+}
+
+std::shared_ptr<static_batch_t> loadBatch(std::istream& header, std::istream& file, int& nodeId) {
+    size_t vertexCount = 0, indexCount = 0;
+    if (!(header >> nodeId >> vertexCount >> indexCount) || indexCount % 3 != 0) return nullptr;
+
+    auto batch = std::make_shared<static_batch_t>();
+    batch->vertices.reserve(vertexCount);
+    batch->normals.reserve(vertexCount);
+    batch->colors.reserve(vertexCount);
+    batch->indices.reserve(indexCount);
+    std::string line, token;
+    if (!std::getline(file, line)) return nullptr;
+    std::istringstream nodes(line);
+    nodes >> token;
+    if (token != "BATCH_NODES") return nullptr;
+    for (int id; nodes >> id;) batch->nodeIds.push_back(id);
+
+    while (batch->vertices.size() < vertexCount || batch->indices.size() < indexCount) {
+        if (!std::getline(file, line)) return nullptr;
+        std::istringstream ls(line);
+        ls >> token;
+        if (token == "BV" && batch->vertices.size() < vertexCount) {
+            glm::vec4 p(1.0f), n(0.0f), c(1.0f);
+            ls >> p.x >> p.y >> p.z >> n.x >> n.y >> n.z >> c.r >> c.g >> c.b >> c.a;
+            batch->vertices.push_back(p);
+            batch->normals.push_back(n);
+            batch->colors.push_back(c);
+        }
+        else if (token == "BI" && batch->indices.size() < indexCount) {
+            unsigned int a, b, c;
+            if (!(ls >> a >> b >> c) || a >= vertexCount || b >= vertexCount || c >= vertexCount) return nullptr;
+            batch->indices.push_back(a);
+            batch->indices.push_back(b);
+            batch->indices.push_back(c);
+        }
+        else return nullptr;
+    }
+    batch->updateBounds();
+    return batch;
+}
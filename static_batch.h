@@ -0,0 +1,42 @@
+#ifndef STATIC_BATCH_H
+#define STATIC_BATCH_H
+
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "shape.h"
+
+struct model_node_t;
+
+// Merged geometry of a frozen subtree: every baked node's vertices transformed into the
+// frozen node's local space, with their colors as vertex colors, so the whole subtree is
+// one draw. The frozen node's own transform is not baked in and can still be edited.
+class static_batch_t : public shape_t {
+public:
+    std::vector<int> nodeIds;  // nodes whose shapes are baked in
+
+    static_batch_t() : shape_t(1) { shapetype = MESH_SHAPE; }
+
+    // The geometry is the data itself; there is nothing to regenerate
+    void generateGeometry() override {}
+    // Bounds of the merged vertices in the frozen node's space, from updateBounds()
+    void localBounds(glm::vec3& lo, glm::vec3& hi) const override { lo = boundsMin; hi = boundsMax; }
+    void updateBounds();
+
+private:
+    glm::vec3 boundsMin{ 0.0f }, boundsMax{ 0.0f };
+};
+
+// Bakes the shapes of `root` and its descendants, leaving out the nodes in `dynamicIds`
+// together with everything below them. Returns nullptr if nothing could be baked.
+std::shared_ptr<static_batch_t> bakeSubtree(model_node_t& root, const std::unordered_set<int>& dynamicIds);
+
+// .mod serialization: BATCH nodeId vertexCount indexCount, BATCH_NODES ids..., then one
+// BV (position, normal, color) line per vertex and one BI line per triangle
+void saveBatch(std::ostream& out, int nodeId, const static_batch_t& batch);
+// Reads the lines after a BATCH header (already consumed into `header`); nullptr if malformed
+std::shared_ptr<static_batch_t> loadBatch(std::istream& header, std::istream& file, int& nodeId);
+
+#endif
@@ -0,0 +1,170 @@
+#include "tessellation.h"
+#include "shape.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <unordered_map>
+
+namespace {
+
+void icosahedron(geometry_vector_t<glm::vec4>& vertices, geometry_vector_t<unsigned int>& indices) {
+    const float t = (1.0f + std::sqrt(5.0f)) * 0.5f;
+    const glm::vec3 corners[12] = {
+        { -1, t, 0 }, { 1, t, 0 }, { -1, -t, 0 }, { 1, -t, 0 },
+        { 0, -1, t }, { 0, 1, t }, { 0, -1, -t }, { 0, 1, -t },
+        { t, 0, -1 }, { t, 0, 1 }, { -t, 0, -1 }, { -t, 0, 1 } };
+    vertices.clear();
+    for (const auto& c : corners) vertices.push_back(glm::vec4(glm::normalize(c), 1.0f));
+    indices = {
+        0, 11, 5, 0, 5, 1, 0, 1, 7, 0, 7, 10, 0, 10, 11,
+        1, 5, 9, 5, 11, 4, 11, 10, 2, 10, 7, 6, 7, 1, 8,
+        3, 9, 4, 3, 4, 2, 3, 2, 6, 3, 6, 8, 3, 8, 9,
+        4, 9, 5, 2, 4, 11, 6, 2, 10, 8, 6, 7, 9, 8, 1 };
+}
+
+// Splits every triangle in four, pushing the new edge midpoints out onto the unit sphere.
+// Midpoints are shared between the two triangles of an edge.
+void subdivide(geometry_vector_t<glm::vec4>& vertices, geometry_vector_t<unsigned int>& indices) {
+    std::unordered_map<uint64_t, unsigned int> midpoints;
+    midpoints.reserve(indices.size());
+    auto midpoint = [&](unsigned int a, unsigned int b) {
+        uint64_t key = (uint64_t(std::min(a, b)) << 32) | std::max(a, b);
+        auto it = midpoints.find(key);
+        if (it != midpoints.end()) return it->second;
+        glm::vec4 p(glm::normalize(glm::vec3(vertices[a] + vertices[b])), 1.0f);
+        unsigned int index = static_cast<unsigned int>(vertices.size());
+        vertices.push_back(p);
+        midpoints.emplace(key, index);
+        return index;
+    };
+
+    geometry_vector_t<unsigned int> out;
+    out.reserve(indices.size() * 4);
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        unsigned int a = indices[i], b = indices[i + 1], c = indices[i + 2];
+        unsigned int ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+        out.insert(out.end(), { a, ab, ca, b, bc, ab, c, ca, bc, ab, bc, ca });
+    }
+    indices.swap(out);
+}
+
+// Point of triangle abc nearest the origin (Ericson, Real-Time Collision Detection 5.1.5)
+glm::vec3 closestToOrigin(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    glm::vec3 ab = b - a, ac = c - a;
+    float d1 = glm::dot(ab, -a), d2 = glm::dot(ac, -a);
+    if (d1 <= 0.0f && d2 <= 0.0f) return a;
+    float d3 = glm::dot(ab, -b), d4 = glm::dot(ac, -b);
+    if (d3 >= 0.0f && d4 <= d3) return b;
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) return a + ab * (d1 / (d1 - d3));
+    float d5 = glm::dot(ab, -c), d6 = glm::dot(ac, -c);
+    if (d6 >= 0.0f && d5 <= d6) return c;
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) return a + ac * (d2 / (d2 - d6));
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+        return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+    float denom = 1.0f / (va + vb + vc);
+    return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+// Measured error of each subdivision level, from one face of the icosahedron (they are all alike)
+const std::vector<float>& icosphereErrors() {
+    static const std::vector<float> errors = [] {
+        geometry_vector_t<glm::vec4> vertices;
+        geometry_vector_t<unsigned int> indices;
+        icosahedron(vertices, indices);
+        indices.resize(3);
+        std::vector<float> table;
+        for (unsigned int n = 0; n <= MAX_ICOSPHERE_SUBDIVISIONS; ++n) {
+            if (n > 0) subdivide(vertices, indices);
+            table.push_back(measureSphereError(vertices, indices));
+        }
+        return table;
+    }();
+    return errors;
+}
+
+} // namespace
+
+unsigned int circleSegmentsForError(float error) {
+    // A chord spanning angle a sags 1 - cos(a / 2) below the unit circle
+    float c = glm::clamp(1.0f - error, -1.0f, 1.0f);
+    float segments = std::ceil(glm::pi<float>() / std::acos(c));
+    return static_cast<unsigned int>(glm::clamp(segments, 3.0f, float(MAX_CIRCLE_SEGMENTS)));
+}
+
+unsigned int icosphereSubdivisionsForError(float error) {
+    const std::vector<float>& errors = icosphereErrors();
+    for (unsigned int n = 0; n < errors.size(); ++n)
+        if (errors[n] <= error) return n;
+    return MAX_ICOSPHERE_SUBDIVISIONS;
+}
+
+void generateIcosphere(unsigned int subdivisions, geometry_vector_t<glm::vec4>& vertices,
+    geometry_vector_t<glm::vec4>& normals, geometry_vector_t<unsigned int>& indices) {
+    subdivisions = std::min(subdivisions, MAX_ICOSPHERE_SUBDIVISIONS);
+    icosahedron(vertices, indices);
+    // Euler: V = 10 * 4^n + 2
+    vertices.reserve((size_t(10) << (2 * subdivisions)) + 2);
+    for (unsigned int n = 0; n < subdivisions; ++n) subdivide(vertices, indices);
+    normals.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i) normals[i] = glm::vec4(glm::vec3(vertices[i]), 0.0f);
+}
+
+float measureSphereError(const geometry_vector_t<glm::vec4>& vertices, const geometry_vector_t<unsigned int>& indices) {
+    float worst = 0.0f;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        glm::vec3 a(vertices[indices[i]]), b(vertices[indices[i + 1]]), c(vertices[indices[i + 2]]);
+        if (glm::length(glm::cross(b - a, c - a)) < 1e-9f) continue;
+        worst = std::max(worst, 1.0f - glm::length(closestToOrigin(a, b, c)));
+    }
+    return worst;
+}
+
+void benchmarkSphereTessellation() {
+    std::cout << "Sphere tessellation: triangles for the same measured error" << std::endl;
+    for (unsigned int level = 1; level <= 4; ++level) {
+        sphere_t uv(level);
+        uv.generateProcedural();
+        size_t degenerate = 0;
+        for (size_t i = 0; i + 2 < uv.indices.size(); i += 3) {
+            glm::vec3 a(uv.vertices[uv.indices[i]]), b(uv.vertices[uv.indices[i + 1]]), c(uv.vertices[uv.indices[i + 2]]);
+            if (glm::length(glm::cross(b - a, c - a)) < 1e-9f) ++degenerate;
+        }
+        std::cout << "  UV level " << level << ": " << uv.indices.size() / 3 << " triangles ("
+                  << degenerate << " degenerate), " << uv.vertices.size() << " vertices, error "
+                  << measureSphereError(uv.vertices, uv.indices) << std::endl;
+    }
+
+    // Smallest square UV grid reaching each icosphere's error; the grid is what sphere_t
+    // levels use, with 10 * level stacks and slices
+    sphere_t uv(1);
+    for (unsigned int n = 1; n <= 6; ++n) {
+        geometry_vector_t<glm::vec4> vertices, normals;
+        geometry_vector_t<unsigned int> indices;
+        generateIcosphere(n, vertices, normals, indices);
+        float error = measureSphereError(vertices, indices);
+
+        unsigned int lo = 3, hi = 512;
+        while (lo < hi) {
+            unsigned int mid = (lo + hi) / 2;
+            uv.generateGrid(mid, mid);
+            if (measureSphereError(uv.vertices, uv.indices) <= error) hi = mid;
+            else lo = mid + 1;
+        }
+        size_t uvTriangles = size_t(2) * lo * lo;
+        std::cout << "  error " << error << ": icosphere " << n << " " << indices.size() / 3 << " triangles, "
+                  << vertices.size() << " vertices | UV " << lo << "x" << lo << " " << uvTriangles
+                  << " triangles, " << size_t(lo + 1) * (lo + 1) << " vertices ("
+                  << double(uvTriangles) / double(indices.size() / 3) << "x)" << std::endl;
+    }
+
+    std::cout << "Error-bounded generators" << std::endl;
+    for (float error : { 0.01f, 0.001f, 0.0001f, 0.00001f }) {
+        unsigned int n = icosphereSubdivisionsForError(error);
+        std::cout << "  max error " << error << ": icosphere " << n << " (" << (size_t(20) << (2 * n))
+                  << " triangles), " << circleSegmentsForError(error) << " cylinder/cone segments" << std::endl;
+    }
+}
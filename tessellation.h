@@ -0,0 +1,32 @@
+#ifndef TESSELLATION_H
+#define TESSELLATION_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "memory_stats.h"
+
+// Error-bounded tessellation for shape_t::setMaxError(). The error is the largest distance
+// allowed between the flat facets and the true surface, in object space where every
+// primitive spans [-1, 1]; 0.01 is half a percent of the shape's size.
+
+const unsigned int MAX_ICOSPHERE_SUBDIVISIONS = 8;  // 1.3M triangles
+const unsigned int MAX_CIRCLE_SEGMENTS = 4096;
+
+// Segments a unit circle needs for its chords to stay within `error` (cylinder and cone rims)
+unsigned int circleSegmentsForError(float error);
+// Fewest icosahedron subdivisions whose projection onto the unit sphere stays within `error`
+unsigned int icosphereSubdivisionsForError(float error);
+
+// Unit icosphere with 20 * 4^subdivisions triangles; vertices are shared, so there is no seam,
+// and every triangle is close to equilateral. Normals are the positions.
+void generateIcosphere(unsigned int subdivisions, geometry_vector_t<glm::vec4>& vertices,
+    geometry_vector_t<glm::vec4>& normals, geometry_vector_t<unsigned int>& indices);
+
+// How far inside the unit sphere any point of the triangles lies; degenerate ones are skipped
+float measureSphereError(const geometry_vector_t<glm::vec4>& vertices, const geometry_vector_t<unsigned int>& indices);
+
+// Prints, for each UV sphere level, its measured error and the triangles an icosphere needs
+// to stay within the same error
+void benchmarkSphereTessellation();
+
+#endif
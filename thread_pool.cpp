@@ -0,0 +1,105 @@
+#include "thread_pool.h"
+#include <algorithm>
+
+thread_pool_t::thread_pool_t(unsigned int threads) {
+    threadCount = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned int t = 0; t < threadCount; ++t) queues.push_back(std::make_unique<task_queue_t>());
+    for (unsigned int t = 1; t < threadCount; ++t) workers.emplace_back(&thread_pool_t::workerLoop, this, t);
+}
+
+thread_pool_t::~thread_pool_t() {
+    {
+        std::lock_guard<std::mutex> lock(wakeLock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& w : workers) w.join();
+}
+
+bool thread_pool_t::popOrSteal(unsigned int self, range_task_t& task) {
+    {
+        task_queue_t& own = *queues[self];
+        std::lock_guard<std::mutex> lock(own.lock);
+        if (!own.tasks.empty()) {
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (unsigned int i = 1; i < threadCount; ++i) {
+        task_queue_t& victim = *queues[(self + i) % threadCount];
+        std::lock_guard<std::mutex> lock(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void thread_pool_t::runTasks(unsigned int self) {
+    range_task_t task;
+    while (popOrSteal(self, task)) {
+        (*job)(task.first, task.last);
+        pending.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+void thread_pool_t::workerLoop(unsigned int self) {
+    unsigned long long seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(wakeLock);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+        runTasks(self);
+    }
+}
+
+unsigned int thread_pool_t::parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& fn) {
+    if (count == 0) return 1;
+    grain = std::max<size_t>(grain, 1);
+    if (threadCount == 1 || count <= grain) {
+        fn(0, count);
+        return 1;
+    }
+
+    // Another thread has the workers, a background load's LOD build say; waiting for it would
+    // stall the frame, so the caller does the work alone
+    std::unique_lock<std::mutex> call(callLock, std::try_to_lock);
+    if (!call.owns_lock()) {
+        fn(0, count);
+        return 1;
+    }
+    // A few chunks per thread so that stealing can even out uneven work
+    size_t chunks = std::min(count / grain, size_t(threadCount) * 4);
+    size_t per = (count + chunks - 1) / chunks;
+    chunks = (count + per - 1) / per;
+
+    job = &fn;
+    pending.store(chunks, std::memory_order_relaxed);
+    // Neighbouring chunks go to the same thread, which keeps its reads contiguous
+    for (size_t c = 0; c < chunks; ++c) {
+        task_queue_t& q = *queues[c * threadCount / chunks];
+        std::lock_guard<std::mutex> lock(q.lock);
+        q.tasks.push_front({ c * per, std::min(count, (c + 1) * per) });
+    }
+    {
+        std::lock_guard<std::mutex> lock(wakeLock);
+        ++generation;
+    }
+    wake.notify_all();
+
+    runTasks(0);
+    while (pending.load(std::memory_order_acquire) != 0) std::this_thread::yield();
+    job = nullptr;
+    return unsigned(std::min<size_t>(threadCount, chunks));
+}
+
+thread_pool_t& sharedThreadPool() {
+    static thread_pool_t pool;
+    return pool;
+}
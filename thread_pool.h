@@ -0,0 +1,61 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads with one task deque each. parallelFor() deals chunks out to
+// the deques; a thread pops its own deque from the back and, once that is empty, steals
+// from the front of the others. The calling thread works as thread 0.
+class thread_pool_t {
+public:
+    explicit thread_pool_t(unsigned int threads = 0); // 0 = all cores, counting the caller
+    ~thread_pool_t();
+
+    thread_pool_t(const thread_pool_t&) = delete;
+    thread_pool_t& operator=(const thread_pool_t&) = delete;
+
+    unsigned int getThreadCount() const { return threadCount; }
+
+    // Runs fn(first, last) over [0, count) in chunks of at least `grain` items and returns
+    // when all of them are done. Runs inline when one chunk would cover everything, or when
+    // another thread's parallelFor() is using the pool. Returns how many threads the work was
+    // dealt out to, 1 when it ran inline.
+    unsigned int parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& fn);
+
+private:
+    struct range_task_t { size_t first, last; };
+    struct task_queue_t {
+        std::mutex lock;
+        std::deque<range_task_t> tasks;
+    };
+
+    unsigned int threadCount;
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<task_queue_t>> queues; // [0] belongs to the caller
+
+    std::mutex callLock;  // held by the parallelFor() using the workers
+    std::mutex wakeLock;
+    std::condition_variable wake;
+    unsigned long long generation = 0;
+    bool stopping = false;
+
+    const std::function<void(size_t, size_t)>* job = nullptr;
+    std::atomic<size_t> pending{ 0 };
+
+    bool popOrSteal(unsigned int self, range_task_t& task);
+    void runTasks(unsigned int self);
+    void workerLoop(unsigned int self);
+};
+
+// Pool shared by per-frame work (world transforms); created on first use with all cores
+thread_pool_t& sharedThreadPool();
+
+#endif
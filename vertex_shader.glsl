@@ -1,12 +1,187 @@
 #version 330 core
-layout(location = 0) in vec3 aPos;
+
+#ifdef VERTEX_PULLING
+// No vertex buffers: the primitive is rebuilt from gl_VertexID with the same
+// vertex order and index topology as generateGeometry() in shape.h
+uniform int shapeType;    // ShapeType: 0 sphere, 1 cone, 2 box, 3 cylinder
+uniform int level;        // tessellation level, 1..4
+uniform vec4 objectColor;
+
+const float PI = 3.14159265358979;
+
+const vec3 boxCorners[8] = vec3[8](
+    vec3(-1, -1, -1), vec3(1, -1, -1), vec3(1, 1, -1), vec3(-1, 1, -1),
+    vec3(-1, -1,  1), vec3(1, -1,  1), vec3(1, 1,  1), vec3(-1, 1,  1));
+// back, front, left, right, top, bottom
+const ivec4 boxFaces[6] = ivec4[6](
+    ivec4(0, 1, 2, 3), ivec4(5, 4, 7, 6), ivec4(4, 0, 3, 7),
+    ivec4(1, 5, 6, 2), ivec4(3, 2, 6, 7), ivec4(4, 5, 1, 0));
+
+// Index buffer entry `corner` of triangle `tri`
+int pulledIndex(int tri, int corner) {
+    if (shapeType == 0) {
+        int slices = 10 * level;
+        int quad = tri / 2;
+        int first = (quad / slices) * (slices + 1) + quad % slices;
+        int second = first + slices + 1;
+        if (tri % 2 == 0) return corner == 0 ? first : (corner == 1 ? second : first + 1);
+        return corner == 0 ? second : (corner == 1 ? second + 1 : first + 1);
+    }
+    if (shapeType == 1) {
+        int slices = 20 * level;
+        int group = tri / slices, i = tri % slices;
+        if (group == 0) return corner == 0 ? 0 : i + corner;
+        if (group == 1) return corner == 0 ? 0 : 1 + i + corner;
+        return corner == 0 ? 1 : (corner == 1 ? 3 + i : 2 + i);
+    }
+    if (shapeType == 2) {
+        int n = level;
+        int face = tri / (2 * n * n), quad = (tri % (2 * n * n)) / 2;
+        int start = face * (n + 1) * (n + 1);
+        int row1 = (quad / n) * (n + 1) + quad % n + start;
+        int row2 = row1 + n + 1;
+        if (tri % 2 == 0) return corner == 0 ? row1 : (corner == 1 ? row2 : row1 + 1);
+        return corner == 0 ? row2 : (corner == 1 ? row2 + 1 : row1 + 1);
+    }
+    int slices = 20 * level;
+    int topCenter = 2 * (slices + 1);
+    if (tri < 2 * slices) { // side: two triangles per slice
+        int curr = (tri / 2) * 2, next = ((tri / 2 + 1) % slices) * 2;
+        if (tri % 2 == 0) return corner == 0 ? curr : (corner == 1 ? curr + 1 : next);
+        return corner == 0 ? curr + 1 : (corner == 1 ? next + 1 : next);
+    }
+    int cap = tri - 2 * slices, i = cap % slices;
+    int curr = i * 2, next = ((i + 1) % slices) * 2;
+    if (cap < slices) return corner == 0 ? topCenter : (corner == 1 ? curr : next);
+    return corner == 0 ? topCenter + 1 : (corner == 1 ? next + 1 : curr + 1);
+}
+
+// Vertex buffer entry `index`
+vec3 pulledPosition(int index) {
+    if (shapeType == 0) {
+        int slices = 10 * level, stacks = 10 * level;
+        float phi = PI * float(index / (slices + 1)) / float(stacks);
+        float theta = 2.0 * PI * float(index % (slices + 1)) / float(slices);
+        return vec3(sin(phi) * cos(theta), cos(phi), sin(phi) * sin(theta));
+    }
+    if (shapeType == 1) {
+        if (index < 2) return vec3(0.0, index == 0 ? 1.0 : -1.0, 0.0);
+        float theta = 2.0 * PI * float(index - 2) / float(20 * level);
+        return vec3(cos(theta), -1.0, sin(theta));
+    }
+    if (shapeType == 2) {
+        int n = level, perFace = (n + 1) * (n + 1);
+        ivec4 f = boxFaces[index / perFace];
+        float u = float((index % perFace) / (n + 1)) / float(n);
+        float v = float(index % (n + 1)) / float(n);
+        return (1.0 - u) * (1.0 - v) * boxCorners[f.x] + u * (1.0 - v) * boxCorners[f.y]
+             + u * v * boxCorners[f.z] + (1.0 - u) * v * boxCorners[f.w];
+    }
+    int slices = 20 * level;
+    if (index >= 2 * (slices + 1)) return vec3(0.0, index == 2 * (slices + 1) ? 1.0 : -1.0, 0.0);
+    float theta = 2.0 * PI * float(index / 2) / float(slices);
+    return vec3(cos(theta), index % 2 == 0 ? 1.0 : -1.0, sin(theta));
+}
+#else
+layout(location = 0) in vec4 aPos;
 layout(location = 1) in vec4 aColor;
+layout(location = 2) in vec3 aNormal;
+#endif
 
-out vec4 vColor;
+#ifdef DRAW_RECORDS
+// Per-draw data the draw list workers wrote, laid out as draw_record_t in render_queue.h:
+// MVP, model, normal matrix columns, color
+uniform samplerBuffer drawRecords;
+uniform int drawRecord;   // first texel of this draw's record
+#else
 uniform mat4 MVP;
+#endif
+
+#ifdef LIGHTING
+#ifndef DRAW_RECORDS
+uniform mat4 model;
+#endif
+uniform vec3 lightPos;
+uniform vec3 lightColor;
+uniform vec3 viewPos;
+uniform float ambientStrength;
+uniform float diffuseStrength;
+uniform float specularStrength;
+uniform float shininess;
+#endif
+
+out vec4 fragColor;
+#ifdef CLUSTERED_LIGHTS
+// Inputs for the per-fragment point-light loop in fragment_shader.glsl
+out vec3 worldPos;
+out vec3 worldNormal;
+out vec4 baseColor;
+out float viewDepth;
+#endif
 
 void main()
 {
-    gl_Position = MVP * vec4(aPos, 1.0);
-    vColor = aColor;
-}
\ No newline at end of file
+#ifdef DRAW_RECORDS
+    mat4 MVP = mat4(texelFetch(drawRecords, drawRecord), texelFetch(drawRecords, drawRecord + 1),
+                    texelFetch(drawRecords, drawRecord + 2), texelFetch(drawRecords, drawRecord + 3));
+#ifdef LIGHTING
+    mat4 model = mat4(texelFetch(drawRecords, drawRecord + 4), texelFetch(drawRecords, drawRecord + 5),
+                      texelFetch(drawRecords, drawRecord + 6), texelFetch(drawRecords, drawRecord + 7));
+    mat3 normalMatrix = mat3(texelFetch(drawRecords, drawRecord + 8).xyz, texelFetch(drawRecords, drawRecord + 9).xyz,
+                             texelFetch(drawRecords, drawRecord + 10).xyz);
+#endif
+#elif defined(LIGHTING)
+    mat3 normalMatrix = mat3(transpose(inverse(model)));
+#endif
+
+#ifdef VERTEX_PULLING
+    int tri = gl_VertexID / 3;
+    vec3 p0 = pulledPosition(pulledIndex(tri, 0));
+    vec3 p1 = pulledPosition(pulledIndex(tri, 1));
+    vec3 p2 = pulledPosition(pulledIndex(tri, 2));
+    int corner = gl_VertexID % 3;
+    vec4 position = vec4(corner == 0 ? p0 : (corner == 1 ? p1 : p2), 1.0);
+#ifdef DRAW_RECORDS
+    vec4 color = texelFetch(drawRecords, drawRecord + 11);
+#else
+    vec4 color = objectColor;
+#endif
+
+    // Spheres are smooth; everything else gets the face normal, pointed away from the centre
+    vec3 normal = position.xyz;
+    if (shapeType != 0) {
+        vec3 face = cross(p1 - p0, p2 - p0);
+        normal = dot(face, face) > 1e-12 ? face : vec3(0.0, 1.0, 0.0);
+        if (dot(normal, p0 + p1 + p2) < 0.0) normal = -normal;
+    }
+#else
+    vec4 position = aPos;
+    vec4 color = aColor;
+    vec3 normal = aNormal;
+#endif
+
+    gl_Position = MVP * position;
+
+#ifdef LIGHTING
+    vec3 fragPos = vec3(model * position);
+    normal = normalize(normalMatrix * normal);
+    vec3 ambient = ambientStrength * lightColor;
+    vec3 lightDir = normalize(lightPos - fragPos);
+    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 diffuse = diffuseStrength * diff * lightColor;
+    vec3 viewDir = normalize(viewPos - fragPos);
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+    vec3 specular = specularStrength * spec * lightColor;
+
+    fragColor = vec4((ambient + diffuse + specular) * vec3(color), color.a);
+#ifdef CLUSTERED_LIGHTS
+    worldPos = fragPos;
+    worldNormal = normal;
+    baseColor = color;
+    viewDepth = gl_Position.w; // = -z in view space for a perspective projection
+#endif
+#else
+    fragColor = color;
+#endif
+}